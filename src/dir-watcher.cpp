@@ -0,0 +1,123 @@
+/*
+ * Part of WCM Commander
+ * https://github.com/corporateshark/WCMCommander
+ * wcm@linderdaum.com
+ */
+
+#include "dir-watcher.h"
+
+#if defined( __linux__ )
+#	include <errno.h>
+#	include <fcntl.h>
+#	include <sys/inotify.h>
+#	include <unistd.h>
+#endif
+
+DirWatcher::DirWatcher()
+	: m_Fd( -1 )
+	, m_Wd( -1 )
+{
+}
+
+DirWatcher::~DirWatcher()
+{
+#if defined( __linux__ )
+	if ( m_Fd >= 0 ) { close( m_Fd ); }
+#endif
+}
+
+#if defined( __linux__ )
+
+bool DirWatcher::Watch( const char* sysPath )
+{
+	Stop();
+
+	if ( m_Fd < 0 )
+	{
+		m_Fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+
+		if ( m_Fd < 0 ) { return false; }
+	}
+
+	const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+	                      IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+	m_Wd = inotify_add_watch( m_Fd, sysPath, mask );
+
+	return m_Wd >= 0;
+}
+
+void DirWatcher::Stop()
+{
+	if ( m_Fd < 0 ) { return; }
+
+	if ( m_Wd >= 0 )
+	{
+		inotify_rm_watch( m_Fd, m_Wd );
+		m_Wd = -1;
+	}
+
+	// drop events queued for the previous folder
+	char buf[4096];
+
+	while ( read( m_Fd, buf, sizeof( buf ) ) > 0 ) {}
+}
+
+bool DirWatcher::ReadChanges( std::vector<std::string>* names )
+{
+	if ( !IsActive() ) { return true; }
+
+	bool ok = true;
+	char buf[16384] __attribute__( ( aligned( __alignof__( struct inotify_event ) ) ) );
+
+	while ( true )
+	{
+		ssize_t n = read( m_Fd, buf, sizeof( buf ) );
+
+		if ( n < 0 && errno == EINTR ) { continue; }
+
+		if ( n <= 0 ) { break; }
+
+		for ( char* p = buf; p < buf + n; )
+		{
+			const struct inotify_event* ev = ( const struct inotify_event* )p;
+			p += sizeof( struct inotify_event ) + ev->len;
+
+			if ( ev->mask & IN_Q_OVERFLOW )
+			{
+				ok = false;
+				continue;
+			}
+
+			if ( ev->wd != m_Wd ) { continue; }
+
+			if ( ev->mask & ( IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_UNMOUNT ) )
+			{
+				ok = false;
+				continue;
+			}
+
+			if ( ev->len > 0 && ev->name[0] ) { names->push_back( ev->name ); }
+		}
+	}
+
+	return ok;
+}
+
+#else
+
+bool DirWatcher::Watch( const char* sysPath )
+{
+	return false;
+}
+
+void DirWatcher::Stop()
+{
+}
+
+bool DirWatcher::ReadChanges( std::vector<std::string>* names )
+{
+	return true;
+}
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * Part of WCM Commander
+ * https://github.com/corporateshark/WCMCommander
+ * wcm@linderdaum.com
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/// Watches a single local folder for changes of its entries (inotify on Linux, not supported elsewhere).
+/// Events are read without blocking from the UI thread, so no extra thread is needed.
+class DirWatcher
+{
+public:
+	DirWatcher();
+	~DirWatcher();
+
+	/// starts watching the folder given in the system charset, returns false if watching is not supported
+	bool Watch( const char* sysPath );
+	void Stop();
+	bool IsActive() const { return m_Fd >= 0 && m_Wd >= 0; }
+
+	/// Appends names (system charset) of entries that were created, deleted, renamed or modified since the last call.
+	/// Returns false if the events were lost or the folder itself went away and the whole folder has to be reread.
+	bool ReadChanges( std::vector<std::string>* names );
+
+private:
+	int m_Fd;
+	int m_Wd;
+
+	DirWatcher( const DirWatcher& ) = delete;
+	DirWatcher& operator = ( const DirWatcher& ) = delete;
+};
@@ -8,6 +8,12 @@
 #include "string-util.h"
 #include "ltext.h"
 
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
 class OperDirCalcData: public OperData
 {
 public:
@@ -38,6 +44,93 @@ public:
 
 OperDirCalcData::~OperDirCalcData() {}
 
+/// Per-directory totals remembered between calculations.
+/// A directory is identified by (dev, ino) and the entry is only valid while its mtime is unchanged.
+/// Only direct children are stored, so a modified directory invalidates itself alone and its untouched subtrees are still served from the cache.
+struct DirSizeCacheEntry
+{
+	time_t mtime;
+	int64_t fileCount;
+	int64_t folderCount;
+	int64_t sumSize;
+	std::vector<FSString> subDirs;
+
+	DirSizeCacheEntry(): mtime( 0 ), fileCount( 0 ), folderCount( 0 ), sumSize( 0 ) {}
+};
+
+struct DirSizeKey
+{
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+
+	DirSizeKey(): dev( 0 ), ino( 0 ), mtime( 0 ) {}
+};
+
+static bool GetDirSizeKey( const FSStat& st, DirSizeKey* key )
+{
+#ifdef _WIN32
+	// FSSys on Windows does not fill dev/ino
+	return false;
+#else
+
+	if ( !st.dev && !st.ino ) { return false; }
+
+	key->dev = st.dev;
+	key->ino = st.ino;
+	key->mtime = st.m_LastWriteTime;
+	return true;
+#endif
+}
+
+class DirSizeCache
+{
+	enum { MAX_ENTRIES = 1000000 };
+
+	struct KeyHash
+	{
+		size_t operator()( const std::pair<dev_t, ino_t>& k ) const
+		{
+			return std::hash<uint64_t>()( ( uint64_t )k.second ) ^ ( std::hash<uint64_t>()( ( uint64_t )k.first ) << 1 );
+		}
+	};
+
+	Mutex mutex;
+	std::unordered_map<std::pair<dev_t, ino_t>, DirSizeCacheEntry, KeyHash> hash;
+public:
+	DirSizeCache() {}
+
+	bool Get( const DirSizeKey& key, DirSizeCacheEntry* entry )
+	{
+		MutexLock lock( &mutex );
+		auto i = hash.find( std::make_pair( key.dev, key.ino ) );
+
+		if ( i == hash.end() ) { return false; }
+
+		if ( i->second.mtime != key.mtime )
+		{
+			hash.erase( i );
+			return false;
+		}
+
+		*entry = i->second;
+		return true;
+	}
+
+	void Put( const DirSizeKey& key, const DirSizeCacheEntry& entry )
+	{
+		MutexLock lock( &mutex );
+
+		if ( hash.size() >= MAX_ENTRIES ) { hash.clear(); }
+
+		DirSizeCacheEntry& e = hash[std::make_pair( key.dev, key.ino )];
+		e = entry;
+		e.mtime = key.mtime;
+	}
+};
+
+static DirSizeCache dirSizeCache;
+
 class OperDirCalcThread: public OperFileThread
 {
 public:
@@ -45,107 +138,400 @@ public:
 		: OperFileThread( opName, par, n ) {}
 	void Calc();
 	virtual ~OperDirCalcThread();
-private:
-	int64_t CalcDir( FS* fs, FSPath path );
 };
 
+struct DirCalcTask
+{
+	FSPath path;
+	int root; // index into DirCalcWalker::rootSize
+	bool isRoot;
+	bool hasKey;
+	DirSizeKey key;
+
+	DirCalcTask(): root( 0 ), isRoot( false ), hasKey( false ) {}
+};
 
-int64_t OperDirCalcThread::CalcDir( FS* fs, FSPath path )
+/// Walks directory trees with several threads.
+/// Every worker owns a deque of pending directories: it takes work from the back of its own deque and steals from the front of the others,
+/// so large subtrees are split between idle workers while each worker keeps descending depth-first.
+/// The calling thread (the operation thread) is worker 0 and is the only one that sends progress signals to the dialog.
+class DirCalcWalker
 {
-	if ( Info()->Stopped() ) { return -1; }
+	struct Queue
+	{
+		Mutex mutex;
+		std::deque<DirCalcTask> tasks;
+	};
 
+	OperDirCalcThread* thread;
+	FS* fs;
+	bool useCache;
+	time_t scanStart;
+
+	std::vector<std::unique_ptr<Queue>> queues;
+
+	Mutex stateMutex; // {
+	Cond cond;
+	int queued;
+	int pending;
+	bool stop;
+	bool mainIdle;
+	bool progress;
+	cexception* error;
+	// } (stateMutex)
+
+	void Push( int worker, DirCalcTask& task );
+	bool Pop( int worker, DirCalcTask* task );
+	void TaskDone( int worker );
+	void Stop();
+	void Process( int worker, DirCalcTask& task );
+	bool UpdateData( const FSPath* path, int64_t fileCount, int64_t folderCount, int64_t sumSize, bool badDir );
+	static void* WorkerFunc( void* arg );
+public:
+	std::vector<std::atomic<int64_t>> rootSize;
+	std::vector<char> rootBad;
+
+	DirCalcWalker( OperDirCalcThread* t, FS* f, int rootCount );
+	void AddRoot( int root, FSPath& path );
+	bool Run(); // false if stopped
+	void Work( int worker );
+	~DirCalcWalker();
+};
+
+struct DirCalcWorkerArg
+{
+	DirCalcWalker* walker;
+	int worker;
+};
+
+DirCalcWalker::DirCalcWalker( OperDirCalcThread* t, FS* f, int rootCount )
+	: thread( t ), fs( f ), useCache( f->Type() == FS::SYSTEM ), scanStart( time( 0 ) ),
+	  queued( 0 ), pending( 0 ), stop( false ), mainIdle( false ), progress( false ), error( 0 ),
+	  rootSize( rootCount ), rootBad( rootCount, 0 )
+{
+	int workers = 1;
+
+	// the other file systems share one connection and cannot be walked in parallel
+	if ( f->Type() == FS::SYSTEM )
 	{
-		//lock
-		MutexLock lock( Node().GetMutex() );
+		workers = ( int )std::thread::hardware_concurrency();
 
-		if ( !Node().Data() ) { return -1; }
+		if ( workers < 1 ) { workers = 1; }
 
-		OperDirCalcData* data = ( OperDirCalcData* )Node().Data();
-		MutexLock l1( &data->resMutex );
-		data->currentPath = path;
+		if ( workers > 8 ) { workers = 8; }
 	}
 
-	Node().SendSignal( 10 );
+	for ( int i = 0; i < workers; i++ ) { queues.push_back( std::unique_ptr<Queue>( new Queue ) ); }
+
+	for ( int i = 0; i < rootCount; i++ ) { rootSize[i] = 0; }
+}
+
+DirCalcWalker::~DirCalcWalker()
+{
+	if ( error ) { error->destroy(); }
+}
 
-	FSList list;
-	int err;
+void DirCalcWalker::AddRoot( int root, FSPath& path )
+{
+	DirCalcTask task;
+	task.path = path;
+	task.root = root;
+	task.isRoot = true;
 
-	if ( fs->ReadDir( &list, path, &err, Info() ) )
+	if ( useCache )
 	{
-		MutexLock lock( Node().GetMutex() );
+		FSStat st;
+		int err;
 
-		if ( !Node().Data() ) { return -1; }
+		if ( !fs->Stat( path, &st, &err, thread->Info() ) )
+		{
+			task.hasKey = GetDirSizeKey( st, &task.key );
+		}
+	}
 
-		MutexLock l1( &( ( OperDirCalcData* )Node().Data() )->resMutex );
-		( ( OperDirCalcData* )Node().Data() )->badDirs++;
-		return -1;
-	};
+	Push( 0, task );
+}
 
-	int count = list.Count();
+void DirCalcWalker::Push( int worker, DirCalcTask& task )
+{
+	{
+		Queue* q = queues[worker].get();
+		MutexLock lock( &q->mutex );
+		q->tasks.push_back( DirCalcTask() );
+		std::swap( q->tasks.back(), task );
+	}
 
-	std::vector<FSNode*> p = list.GetArray();
+	MutexLock lock( &stateMutex );
+	queued++;
+	pending++;
+	cond.Signal();
+}
 
-	//list.SortByName(p.ptr(), count, true, false);
+bool DirCalcWalker::Pop( int worker, DirCalcTask* task )
+{
+	int n = ( int )queues.size();
 
-	int lastPathPos = path.Count();
+	for ( int i = 0; i < n; i++ )
+	{
+		Queue* q = queues[( worker + i ) % n].get();
+		MutexLock lock( &q->mutex );
 
-	FSPath filePath = path;
+		if ( q->tasks.empty() ) { continue; }
 
-	int64_t fileCount = 0;
+		if ( i == 0 )
+		{
+			std::swap( *task, q->tasks.back() );
+			q->tasks.pop_back();
+		}
+		else
+		{
+			std::swap( *task, q->tasks.front() );
+			q->tasks.pop_front();
+		}
 
-	int64_t folderCount = 0;
+		lock.Unlock();
+
+		MutexLock l1( &stateMutex );
+		queued--;
+		return true;
+	}
+
+	return false;
+}
+
+void DirCalcWalker::TaskDone( int worker )
+{
+	MutexLock lock( &stateMutex );
+	pending--;
+
+	if ( worker > 0 ) { progress = true; }
+
+	if ( pending <= 0 || ( progress && mainIdle ) ) { cond.Broadcast(); }
+}
+
+void DirCalcWalker::Stop()
+{
+	MutexLock lock( &stateMutex );
+	stop = true;
+	cond.Broadcast();
+}
+
+bool DirCalcWalker::UpdateData( const FSPath* path, int64_t fileCount, int64_t folderCount, int64_t sumSize, bool badDir )
+{
+	MutexLock lock( thread->Node().GetMutex() );
+
+	if ( !thread->Node().Data() ) { return false; }
+
+	OperDirCalcData* data = ( OperDirCalcData* )thread->Node().Data();
+	MutexLock l1( &data->resMutex );
+
+	if ( path ) { data->currentPath = *path; }
+
+	if ( badDir ) { data->badDirs++; }
 
-	int64_t sumSize = 0;
+	data->fileCount += fileCount;
+	data->folderCount += folderCount;
+	data->sumSize += sumSize;
+	return true;
+}
+
+void DirCalcWalker::Process( int worker, DirCalcTask& task )
+{
+	if ( thread->Info()->Stopped() || !UpdateData( &task.path, 0, 0, 0, false ) )
+	{
+		Stop();
+		return;
+	}
 
-	int i;
+	if ( worker == 0 ) { thread->Node().SendSignal( 10 ); }
 
-	for ( i = 0; i < count; i++ )
+	int lastPathPos = task.path.Count();
+	std::vector<DirCalcTask> subTasks;
+	DirSizeCacheEntry entry;
+
+	if ( task.hasKey && dirSizeCache.Get( task.key, &entry ) )
 	{
-		if ( p[i]->IsDir() )
+		// the directory itself is unchanged; only its subdirectories have to be looked at
+		for ( const FSString& name : entry.subDirs )
 		{
-			folderCount++;
-			continue;
-		};
+			DirCalcTask sub;
+			sub.path = task.path;
+			sub.path.SetItemStr( lastPathPos, name );
+			sub.root = task.root;
 
-		fileCount++;
+			FSStat st;
+			int err;
 
-		if ( p[i]->IsReg() && !p[i]->IsLnk() )
-		{
-			sumSize += p[i]->Size();
+			if ( fs->Stat( sub.path, &st, &err, thread->Info() ) || !st.IsDir() || !st.link.IsEmpty() )
+			{
+				continue;
+			}
+
+			sub.hasKey = GetDirSizeKey( st, &sub.key );
+			subTasks.push_back( sub );
 		}
 	}
-
+	else
 	{
-		//lock
-		MutexLock lock( Node().GetMutex() );
+		FSList list;
+		int err;
+		int ret = fs->ReadDir( &list, task.path, &err, thread->Info() );
+
+		if ( ret == -2 )
+		{
+			Stop();
+			return;
+		}
+
+		if ( ret )
+		{
+			if ( task.isRoot ) { rootBad[task.root] = 1; }
+
+			UpdateData( 0, 0, 0, 0, true );
+			return;
+		}
+
+		std::vector<FSNode*> p = list.GetArray();
+
+		for ( FSNode* node : p )
+		{
+			if ( node->IsDir() )
+			{
+				entry.folderCount++;
+
+				if ( !node->extType && node->st.link.IsEmpty() )
+				{
+					DirCalcTask sub;
+					sub.path = task.path;
+					sub.path.SetItemStr( lastPathPos, node->Name() );
+					sub.root = task.root;
+					sub.hasKey = useCache && GetDirSizeKey( node->st, &sub.key );
+					subTasks.push_back( sub );
+
+					if ( task.hasKey ) { entry.subDirs.push_back( FSString( node->Name() ) ); }
+				}
+
+				continue;
+			}
+
+			entry.fileCount++;
+
+			if ( node->IsReg() && !node->IsLnk() )
+			{
+				entry.sumSize += node->Size();
+			}
+		}
 
-		if ( !Node().Data() ) { return -1; }
+		// a directory modified within the last second may change again without a visible mtime change
+		if ( task.hasKey && task.key.mtime < scanStart - 1 )
+		{
+			dirSizeCache.Put( task.key, entry );
+		}
+	}
 
-		OperDirCalcData* data = ( OperDirCalcData* )Node().Data();
-		MutexLock l1( &data->resMutex );
+	rootSize[task.root] += entry.sumSize;
 
-		data->fileCount += fileCount;
-		data->folderCount += folderCount;
-		data->sumSize += sumSize;
+	if ( !UpdateData( 0, entry.fileCount, entry.folderCount, entry.sumSize, false ) )
+	{
+		Stop();
+		return;
 	}
 
-	Node().SendSignal( 20 );
+	for ( DirCalcTask& sub : subTasks ) { Push( worker, sub ); }
+}
 
-	for ( i = 0; i < count; i++ )
+void DirCalcWalker::Work( int worker )
+{
+	while ( true )
 	{
-		if ( p[i]->IsDir() && !p[i]->extType && p[i]->st.link.IsEmpty() )
+		DirCalcTask task;
+
+		if ( Pop( worker, &task ) )
 		{
-			if ( Info()->Stopped() )
+			try
+			{
+				Process( worker, task );
+			}
+			catch ( cexception* ex )
 			{
-				return -1;
+				MutexLock lock( &stateMutex );
+
+				if ( error ) { ex->destroy(); }
+				else { error = ex; }
+
+				stop = true;
+				cond.Broadcast();
 			}
 
-			path.SetItemStr( lastPathPos, p[i]->Name() );
-			sumSize += CalcDir( fs, path );
+			TaskDone( worker );
+
+			if ( worker == 0 ) { thread->Node().SendSignal( 20 ); }
+
+			continue;
 		}
+
+		MutexLock lock( &stateMutex );
+
+		if ( stop || pending <= 0 ) { break; }
+
+		if ( queued > 0 ) { continue; }
+
+		if ( worker == 0 && progress )
+		{
+			progress = false;
+			lock.Unlock();
+			thread->Node().SendSignal( 20 );
+			continue;
+		}
+
+		if ( worker == 0 ) { mainIdle = true; }
+
+		cond.Wait( &stateMutex );
+
+		if ( worker == 0 ) { mainIdle = false; }
 	}
+}
 
-	return sumSize;
+void* DirCalcWalker::WorkerFunc( void* arg )
+{
+	DirCalcWorkerArg* a = ( DirCalcWorkerArg* )arg;
+	a->walker->Work( a->worker );
+	return 0;
+}
+
+bool DirCalcWalker::Run()
+{
+	int count = ( int )queues.size();
+	std::vector<DirCalcWorkerArg> args( count );
+	std::vector<thread_t> threads;
+
+	for ( int i = 1; i < count; i++ )
+	{
+		args[i].walker = this;
+		args[i].worker = i;
+		thread_t th;
+
+		if ( thread_create( &th, WorkerFunc, &args[i] ) ) { break; }
+
+		threads.push_back( th );
+	}
+
+	Work( 0 );
+
+	for ( thread_t th : threads )
+	{
+		void* ret;
+		thread_join( th, &ret );
+	}
+
+	if ( error )
+	{
+		cexception* ex = error;
+		error = 0;
+		throw ex;
+	}
+
+	return !stop;
 }
 
 void OperDirCalcThread::Calc()
@@ -169,25 +555,45 @@ void OperDirCalcThread::Calc()
 	//	dbg_printf("%s\n", node->name.GetUtf8());
 	if (list->Count() == 0)
 	{ // then calculate current dir size
-		CalcDir(fs.Ptr(), path);
+		DirCalcWalker walker( this, fs.Ptr(), 1 );
+		walker.AddRoot( 0, path );
+		walker.Run();
 	}
 	else
 	{ // list is not empty: calculate size of objects in the list
 		int cnt = path.Count();
+		std::vector<FSNode*> dirs;
 
 		for (FSNode* node = list->First(); node; node = node->next)
 		{
-			path.SetItemStr(cnt, node->Name()); //-V595
+			if ( node->IsDir() && !node->st.IsLnk() )
+			{
+				dirs.push_back( node );
+			}
+		}
+
+		DirCalcWalker walker( this, fs.Ptr(), ( int )dirs.size() );
+
+		for ( size_t i = 0; i < dirs.size(); i++ )
+		{
+			path.SetItemStr( cnt, dirs[i]->Name() );
+			walker.AddRoot( ( int )i, path );
+		}
+
+		bool done = walker.Run();
+
+		lock.Lock();
 
+		if ( !Node().Data() ) { return; }
+
+		MutexLock l1( &CalcData->resMutex );
+
+		for ( FSNode* node = list->First(); node; node = node->next )
+		{
 			bool IsDir = node->IsDir() && !node->st.IsLnk();
 
 			if ( IsDir )
 			{
-				int64_t Size = CalcDir( fs.Ptr(), path);
-
-				if (Size >=0 && node && node->originNode ) { // установим размер директории после подсчёта
-					node->originNode->st.SetDirSize(Size);
-				}
 				CalcData->folderCount++;
 			}
 			else
@@ -196,6 +602,16 @@ void OperDirCalcThread::Calc()
 				CalcData->sumSize += node->st.size;
 			}
 		}
+
+		if ( !done ) { return; }
+
+		for ( size_t i = 0; i < dirs.size(); i++ )
+		{
+			if ( !walker.rootBad[i] && dirs[i]->originNode ) // установим размер директории после подсчёта
+			{
+				dirs[i]->originNode->st.SetDirSize( walker.rootSize[i] );
+			}
+		}
 	}
 }
 
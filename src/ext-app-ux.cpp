@@ -335,9 +335,7 @@ static std::vector<unicode_t> GetFileExtLC( const unicode_t* uri )
 	if ( !ext || !*ext ) { return std::vector<unicode_t>(); }
 
 	std::vector<unicode_t> a = new_unicode_str( ext + 1 ); //пропустить точку
-	unicode_t* s = a.data();
-
-	for ( ; *s; s++ ) { *s = UnicodeLC( *s ); }
+	UnicodeLC( a.data() );
 
 	return a;
 }
@@ -472,12 +470,9 @@ int MimeGlobs::GetMimeList( const unicode_t* fileName, ccollect<int>& list )
 		if ( fn ) { fn++; }
 		else { fn = fileName; }
 
-		std::vector<unicode_t> str( unicode_strlen( fn ) + 1 );
-		unicode_t* s = str.data();
-
-		while ( *fn ) { *( s++ ) = UnicodeLC( *( fn++ ) ); }
-
-		*s = 0;
+		int len = unicode_strlen( fn );
+		std::vector<unicode_t> str( fn, fn + len + 1 );
+		UnicodeLC( str.data(), len );
 
 		for ( MaskNode* p = maskList; p; p = p->next )
 			if ( p->mask.data() && accmask( str.data(), p->mask.data() ) )
@@ -9,6 +9,11 @@
 #endif
 
 #include <time.h>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include "fileopers.h"
 #include "smblogon.h"
 #include "ftplogon.h"
@@ -358,11 +363,15 @@ public:
 	volatile int64_t infoBytesTotalAll; // общее количество байт для обработки (копирования). Используется при копировании для вывода общего индикатора прогресса
 	volatile int64_t infoFilesAll; // общее количество файлов для копирования
 
+	volatile bool verifyChanged;
+	volatile int64_t infoVerified; // files compared with the source after the copy
+	volatile int64_t infoVerifyFailed;
+
 	OperCFData( NCDialogParent* p )
 		:  OperData( p ), executed( false ),
 		   pathChanged( false ), infoCount( 0 ), progressChanged( false ),
 		   infoSize( 0 ), infoProgress( 0 ), infoMs( 0 ), infoBytes( 0 ), infoBytesTotal( 0 ),
-		   infoBytesTotalAll(0), infoFilesAll(0) {}
+		   infoBytesTotalAll(0), infoFilesAll(0), verifyChanged( false ), infoVerified( 0 ), infoVerifyFailed( 0 ) {}
 
 	void Clear()
 	{
@@ -377,1114 +386,2657 @@ public:
 		progressChanged = false;
 		infoSize = 0;
 		infoProgress = 0;
+		verifyChanged = false;
+		infoVerified = 0;
+		infoVerifyFailed = 0;
 	}
 	virtual ~OperCFData();
 };
 
 OperCFData::~OperCFData() {}
 
-class OperCFThread: public OperFileThread
+/////////////////////////////////////////////////////////////// copy verification
+
+/// xxHash64 of the data going through a copy, taken in blocks of any size
+class CopyHash
 {
-	volatile bool commitAll;
-	volatile bool skipNonRegular;
-	enum { BSIZE = 1024 * 512, STARTSIZE = 1024 * 64 };
-	char* _buffer;
+	enum : uint64_t
+	{
+		P1 = 11400714785074694791ULL,
+		P2 = 14029467366897019727ULL,
+		P3 = 1609587929392839161ULL,
+		P4 = 9650029242287828579ULL,
+		P5 = 2870177450012600261ULL
+	};
+
+	uint64_t v[4];
+	uint64_t total;
+	unsigned char mem[32];
+	int memSize;
+
+	static uint64_t Rotl( uint64_t x, int r ) { return ( x << r ) | ( x >> ( 64 - r ) ); }
+	static uint64_t Round( uint64_t acc, uint64_t input ) { return Rotl( acc + input * P2, 31 ) * P1; }
+	static uint64_t Merge( uint64_t acc, uint64_t val ) { return ( acc ^ Round( 0, val ) ) * P1 + P4; }
+	// the same host reads the source and the destination, so the byte order does not matter
+	static uint64_t Read64( const unsigned char* p ) { uint64_t x; memcpy( &x, p, 8 ); return x; }
+	static uint32_t Read32( const unsigned char* p ) { uint32_t x; memcpy( &x, p, 4 ); return x; }
+	void Stripe( const unsigned char* p ) { for ( int i = 0; i < 4; i++ ) { v[i] = Round( v[i], Read64( p + i * 8 ) ); } }
 public:
-	OperCFThread( const char* opName, NCDialogParent* par, OperThreadNode* n )
-		:  OperFileThread( opName, par, n ),
-		   commitAll( false ), skipNonRegular( false ), _buffer( 0 )
+	CopyHash(): total( 0 ), memSize( 0 )
 	{
-		_buffer = new char[BSIZE];
+		v[0] = P1 + P2;
+		v[1] = P2;
+		v[2] = 0;
+		v[3] = 0 - P1;
 	}
 
-	void CreateDirectory( FS* fs, FSPath& srcPath, FSPath& destPath, bool processMultipleFolders ); //throws
+	void Update( const void* data, size_t size );
+	uint64_t Digest() const;
+};
 
-	bool Unlink ( FS* fs, FSPath& path, bool* skipAll = 0 );
-	bool RmDir  ( FS* fs, FSPath& path, bool* skipAll = 0 );
-	bool DeleteFile   ( FS* fs, FSPath& path );
-	bool DeleteDir ( FS* fs, FSPath& path );
-	bool DeleteList   ( FS* fs, FSPath& _path, FSList& list );
+void CopyHash::Update( const void* data, size_t size )
+{
+	const unsigned char* p = ( const unsigned char* )data;
+	const unsigned char* end = p + size;
 
-	//from и to - эффект cptr !!!
-	bool SendCopyNextFileInfo( FSString from, FSString to );
+	total += size;
 
-	bool SendProgressInfo( int64_t size, int64_t progress, int64_t bytes );
+	if ( memSize + size < 32 )
+	{
+		memcpy( mem + memSize, p, size );
+		memSize += int( size );
+		return;
+	}
 
-	bool CopyLink( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& path, bool move );
-	// XXX CopyFile/MoveFile are #define'd in winbase.h
-	bool CopyFile( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath, bool move );
-	bool CopyDir( FS* srcFs, FSPath& __srcPath, FSNode* srcNode, FS* destFs, FSPath& __destPath, bool move );
-	bool CopyNode( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath, bool move );
-	bool Copy( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath, cstrhash<bool, unicode_t>& resList );
+	if ( memSize )
+	{
+		memcpy( mem + memSize, p, 32 - memSize );
+		p += 32 - memSize;
+		memSize = 0;
+		Stripe( mem );
+	}
 
-	int MoveFile( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath );
-	int MoveDir( FS* srcFs, FSPath& __srcPath, FSNode* srcNode, FS* destFs, FSPath& __destPath );
-	bool MoveNode( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath );
-	bool Move( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath );
+	for ( ; p + 32 <= end; p += 32 ) { Stripe( p ); }
 
-	virtual ~OperCFThread();
-};
+	memSize = int( end - p );
+	memcpy( mem, p, memSize );
+}
 
-OperCFThread::~OperCFThread()
+uint64_t CopyHash::Digest() const
 {
-	if ( _buffer )
+	uint64_t h;
+
+	if ( total >= 32 )
 	{
-		delete [] _buffer;
+		h = Rotl( v[0], 1 ) + Rotl( v[1], 7 ) + Rotl( v[2], 12 ) + Rotl( v[3], 18 );
+
+		for ( int i = 0; i < 4; i++ ) { h = Merge( h, v[i] ); }
 	}
+	else
+	{
+		h = P5;
+	}
+
+	h += total;
+
+	const unsigned char* p = mem;
+	const unsigned char* end = mem + memSize;
+
+	for ( ; p + 8 <= end; p += 8 ) { h = Rotl( h ^ Round( 0, Read64( p ) ), 27 ) * P1 + P4; }
+
+	if ( p + 4 <= end ) { h = Rotl( h ^ ( Read32( p ) * P1 ), 23 ) * P2 + P3; p += 4; }
+
+	for ( ; p < end; p++ ) { h = Rotl( h ^ ( *p * P5 ), 11 ) * P1; }
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
 }
 
-void OperCFThread::CreateDirectory( FS* fs, FSPath& srcPath, FSPath& destPath, bool processMultipleFolders )
+// the hash of a part of a copied file, as it was written
+struct CopyCheck
 {
-	if ( processMultipleFolders )
-	{
-		const int DirIndex = srcPath.GetFirstUnmatchedItem( destPath );
-		FSPath Path;
+	int64_t offset;
+	int64_t size;
+	uint64_t hash;
+};
 
-		for ( int i = 0; i < destPath.Count(); i++ )
-		{
-			// get next dir
-			Path.PushStr( *destPath.GetItem( i ) );
-			
-			int ret_err;
+/////////////////////////////////////////////////////////////// synchronization
 
-			// try to create dir
-			if ( i >= DirIndex && fs->MkDir( Path, 0777, &ret_err, Info() ) )
-			{
-				// skip "already exists" error
-				if ( !fs->IsEEXIST( ret_err ) )
-				{
-					throw_msg( "%s", fs->StrError( ret_err ).GetUtf8() );
-				}
-			}
-		}
-	}
-	else
+// reads 'size' bytes unless the file ends first, the FS may return less in one call
+static int ReadFull( FS* fs, int fd, char* buf, int size, int* err, FSCInfo* info )
+{
+	int done = 0;
+
+	while ( done < size )
 	{
-		int ret_err;
+		int n = fs->Read( fd, buf + done, size - done, err, info );
 
-		if ( fs->MkDir( destPath, 0777, &ret_err, Info() ) )
-		{
-			throw_msg( "%s", fs->StrError( ret_err ).GetUtf8() );
-		}
+		if ( n < 0 ) { return n; }
+
+		if ( !n ) { break; }
+
+		done += n;
 	}
+
+	return done;
 }
 
-class SimpleCFThreadWin: public NCDialog
+// FAT keeps the times with 2 seconds steps
+static bool SameTime( FSTime a, FSTime b )
 {
-public:
-	OperCFData threadData;
+	time_t x = a;
+	time_t y = b;
+	return x - y <= 2 && y - x <= 2;
+}
 
-	SimpleCFThreadWin( NCDialogParent* parent, const char* name )
-		:  NCDialog( ::createDialogAsChild, 0, parent, utf8_to_unicode( name ).data(), bListCancel ), threadData( parent ) {}
-	virtual void OperThreadStopped();
-	virtual ~SimpleCFThreadWin();
+// a file of the same size on both sides, compared before the copy starts
+struct SyncCompare
+{
+	int index; // in the list being copied
+	FSPath srcPath;
+	FSPath destPath;
+	int same; // 1 - the same content, 0 - differs or can't be read, -2 - stopped
 };
 
-void SimpleCFThreadWin::OperThreadStopped()
+struct SyncCompareRun
 {
-	if ( !threadData.errorString.IsEmpty() )
+	FS* srcFs;
+	FS* destFs;
+	FSCInfo* info;
+	std::vector<SyncCompare>* list;
+	std::atomic<size_t> next;
+};
+
+static int SameContent( FS* srcFs, FSPath& srcPath, FS* destFs, FSPath& destPath, char* buf, int size, FSCInfo* info )
+{
+	int ret = 0;
+	int a = srcFs->OpenRead( srcPath, FS::SHARE_READ, 0, info );
+	int b = a < 0 ? -1 : destFs->OpenRead( destPath, FS::SHARE_READ, 0, info );
+
+	if ( a == -2 || b == -2 ) { ret = -2; }
+
+	while ( a >= 0 && b >= 0 )
 	{
-		NCMessageBox( ( NCDialogParent* )Parent(), _LT( "Create directory" ), threadData.errorString.GetUtf8(), true );
-		EndModal( 0 );
-		return;
-	}
+		if ( info && info->IsStopped() ) { ret = -2; break; }
 
-	EndModal( 100 );
-}
+		int n = ReadFull( srcFs, a, buf, size, 0, info );
+		int m = n < 0 ? n : ReadFull( destFs, b, buf + size, size, 0, info );
 
-SimpleCFThreadWin::~SimpleCFThreadWin() {}
+		if ( n == -2 || m == -2 ) { ret = -2; break; }
 
+		if ( n < 0 || m != n || memcmp( buf, buf + size, n ) ) { break; }
 
-///////////////////////////////////////////////////////   MkDir
+		if ( !n ) { ret = 1; break; }
+	}
 
-void MkDirThreadFunc( OperThreadNode* node )
+	if ( a >= 0 ) { srcFs->Close( a, 0, info ); }
+
+	if ( b >= 0 ) { destFs->Close( b, 0, info ); }
+
+	return ret;
+}
+
+static void* SyncCompareFunc( void* arg )
 {
-	try
+	SyncCompareRun* run = ( SyncCompareRun* )arg;
+	const int size = 1024 * 256;
+	std::vector<char> buf( size * 2 );
+
+	for ( size_t i; ( i = run->next++ ) < run->list->size(); )
 	{
-		MutexLock lock( node->GetMutex() );
+		SyncCompare& c = ( *run->list )[i];
+		c.same = SameContent( run->srcFs, c.srcPath, run->destFs, c.destPath, buf.data(), size, run->info );
+	}
 
-		if ( !node->Data() ) { return; }
+	return 0;
+}
 
-		OperCFData* data = ( ( OperCFData* )node->Data() );
-		OperCFThread thread( "create directory", data->Parent(), node );
+/////////////////////////////////////////////////////////////// parallel copy
 
-		clPtr<FS> fs = data->srcFs;
-		FSPath srcPath = data->srcPath;
-		FSPath destPath = data->destPath;
-		bool processMultipleFolders = data->processMultipleFolders;
+// a file copied by CopyScheduler workers, it is opened and finished by the copy thread
+struct CopyTransfer
+{
+	enum STATUS { OK = 0, READ_ERROR, WRITE_ERROR, SHORT_WRITE, STOPPED };
 
-		lock.Unlock();//!!!
+	FS* srcFs;
+	FSPath srcPath;
+	FS* destFs;
+	FSPath destPath;
+	FSStat st;
+	int in;  // read by the first segment, the others open the file again
+	int out;
+	bool move; // the source is removed once the copy is complete
+	bool verify; // segments hash what they write into 'checks'
+	Mutex outMutex; // segments share 'out', Seek and Write go together
+
+	// guarded by CopyScheduler::mutex
+	int streams; // connections held until the transfer is taken finished, 'in' and one per further segment
+	int segmentsLeft;
+	int64_t done;
+	STATUS status; // of the first failed segment
+	int err;
+	std::vector<CopyCheck> checks;
+
+	CopyTransfer(): srcFs( 0 ), destFs( 0 ), in( -1 ), out( -1 ), move( false ), verify( false ), streams( 0 ), segmentsLeft( 0 ), done( 0 ), status( OK ), err( 0 ) {}
+};
 
-		try
-		{
-			thread.CreateDirectory( fs.Ptr(), srcPath, destPath, processMultipleFolders );
-		}
-		catch ( cexception* ex )
-		{
-			lock.Lock(); //!!!
+struct CopySegment
+{
+	CopyTransfer* t;
+	int64_t offset;
+	int64_t size; // -1 - up to the end of the file, 'out' is written as is without Seek
+};
 
-			if ( !node->NBStopped() ) //обязательно надо проверить, иначе 'data' может быть неактуальной
-			{
-				data->errorString = ex->message();
-			}
+class CopyScheduler
+{
+public:
+	enum { BSIZE = 1024 * 512, SEGMENT_MIN = 1024 * 1024 * 16 };
+
+	CopyScheduler( FSCInfo* info, int workers );
+	~CopyScheduler(); //cancels and joins the workers, transfers still in flight are not deleted
+
+	/// splits a file into 'segments' parts read over separate connections (1 - read it sequentially),
+	/// no more than the connections left free by the other transfers
+	void Add( CopyTransfer* t, int segments );
+	/// transfers added and not taken by TakeFinished() yet
+	int Active();
+	/// connections held by the active transfers, never more than 'workers' but for a file added with none free
+	int Streams();
+	CopyTransfer* TakeFinished();
+	/// waits until a worker makes progress or finishes a transfer
+	void WaitChange();
+	/// of the active transfers, bytes - copied since the previous call
+	void GetProgress( int64_t* size, int64_t* done, int64_t* bytes );
+	/// drops queued segments and makes running ones stop after the current block
+	void Cancel();
+
+private:
+	FSCInfo* info;
+	Mutex mutex;
+	Cond workCond;
+	Cond doneCond;
+	std::deque<CopySegment> queue;
+	std::vector<CopyTransfer*> finished;
+	std::vector<thread_t> threads;
+	int maxStreams;
+	int active;
+	int streams;
+	int64_t activeSize;
+	int64_t activeDone;
+	int64_t bytes;
+	bool changed;
+	bool cancel;
+	bool quit;
+
+	void Finish( CopyTransfer* t ); //with mutex locked
+	void Run( CopySegment& seg, char* buf );
+	void Work();
+	static void* WorkerFunc( void* arg );
+
+	CopyScheduler( const CopyScheduler& );
+	void operator = ( const CopyScheduler& );
+};
 
-			ex->destroy();
-		}
+CopyScheduler::CopyScheduler( FSCInfo* i, int workers )
+	: info( i ), maxStreams( workers ), active( 0 ), streams( 0 ), activeSize( 0 ), activeDone( 0 ), bytes( 0 ), changed( false ), cancel( false ), quit( false )
+{
+	for ( int n = 0; n < workers; n++ )
+	{
+		thread_t th;
+
+		if ( thread_create( &th, WorkerFunc, this ) ) { break; }
+
+		threads.push_back( th );
 	}
-	catch ( cexception* ex )
+
+	if ( threads.empty() ) { throw_msg( "can't start copy threads" ); }
+}
+
+CopyScheduler::~CopyScheduler()
+{
 	{
-		fprintf( stderr, "ERR!!! Error exception in MkDirThreadFunc - '%s'\n", ex->message() );
-		ex->destroy();
+		MutexLock lock( &mutex );
+		quit = true;
+		cancel = true;
+		workCond.Broadcast();
 	}
-	catch ( ... )
+
+	for ( thread_t th : threads )
 	{
-		fprintf( stderr, "ERR!!! Unhandled exception in MkDirThreadFunc\n" );
+		void* ret;
+		thread_join( th, &ret );
 	}
 }
 
-bool MkDir( clPtr<FS> f, FSPath& srcPath, FSPath& destPath, bool processMultipleFolders, NCDialogParent* parent )
+void CopyScheduler::Add( CopyTransfer* t, int segments )
 {
-	SimpleCFThreadWin dlg( parent, _LT( "Create directory" ) );
-	dlg.threadData.Clear();
-	dlg.threadData.srcFs = f;
-	dlg.threadData.srcPath = srcPath;
-	dlg.threadData.destPath = destPath;
-	dlg.threadData.processMultipleFolders = processMultipleFolders;
-	dlg.RunNewThread( "Create directory", MkDirThreadFunc, &dlg.threadData ); //может быть исключение
-	dlg.Enable();
-	dlg.Show();
-	dlg.DoModal();
-	dlg.StopThread();
-	return dlg.threadData.errorString.IsEmpty();
-}
+	MutexLock lock( &mutex );
 
+	// 'in' is already open, so the file gets at least the one connection
+	int freeStreams = maxStreams - streams;
 
-///////////////////////////////////////////////////// DELETE
+	if ( segments > freeStreams ) { segments = freeStreams; }
 
-//возвращает true если можно продолжать процесс
+	if ( segments < 1 ) { segments = 1; }
 
-bool OperCFThread::Unlink( FS* fs, FSPath& path, bool* skipAll )
-{
-	int ret_err;
+	active++;
+	streams += segments;
+	t->streams = segments;
+	activeSize += t->st.size;
 
-	while ( fs->Delete( path, &ret_err, Info() ) )
+	if ( segments <= 1 )
 	{
-		if ( skipAll && *skipAll ) { return true; }
-
-		switch ( RedMessage( _LT( "Can`t delete file:\n" ), fs->Uri( path ).GetUtf8(), skipAll ? bRetrySkipSkipallCancel : bRetrySkipCancel,
-		                     fs->StrError( ret_err ).GetUtf8() ) )
-		{
-			case CMD_SKIPALL:
-				if ( skipAll ) { *skipAll = true; } //no break
-
-			case CMD_SKIP:
-				return true;
+		CopySegment seg = { t, 0, -1 };
+		t->segmentsLeft = 1;
+		queue.push_back( seg );
+	}
+	else
+	{
+		int64_t part = ( t->st.size + segments - 1 ) / segments;
 
-			case CMD_RETRY:
-				continue;
+		t->segmentsLeft = segments;
 
-			default:
-				return false;
+		for ( int i = 0; i < segments; i++ )
+		{
+			CopySegment seg = { t, part * i, i + 1 < segments ? part : t->st.size - part * i };
+			queue.push_back( seg );
 		}
 	}
 
-	return true;
+	workCond.Broadcast();
 }
 
-bool OperCFThread::RmDir( FS* fs, FSPath& path, bool* skipAll )
+int CopyScheduler::Active()
 {
-	int ret_err;
+	MutexLock lock( &mutex );
+	return active;
+}
 
-	while ( fs->RmDir( path, &ret_err, Info() ) )
-	{
-		if ( skipAll && *skipAll ) { return true; }
+int CopyScheduler::Streams()
+{
+	MutexLock lock( &mutex );
+	return streams;
+}
 
-		switch ( RedMessage( _LT( "Can`t delete directory:\n" ) , fs->Uri( path ).GetUtf8(), skipAll ? bRetrySkipSkipallCancel : bRetrySkipCancel,
-		                     fs->StrError( ret_err ).GetUtf8() ) )
-		{
-			case CMD_SKIPALL:
-				if ( skipAll ) { *skipAll = true; } //no break
+CopyTransfer* CopyScheduler::TakeFinished()
+{
+	MutexLock lock( &mutex );
 
-			case CMD_SKIP:
-				return true;
+	if ( finished.empty() ) { return 0; }
 
-			case CMD_RETRY:
-				continue;
+	CopyTransfer* t = finished.back();
+	finished.pop_back();
 
-			default:
-				return false;
-		}
-	}
+	active--;
+	streams -= t->streams;
+	activeSize -= t->st.size;
+	activeDone -= t->done;
 
-	return true;
+	return t;
 }
 
-bool OperCFThread::DeleteFile( FS* fs, FSPath& path ) //return true if not concelled
+void CopyScheduler::WaitChange()
 {
-	if ( Info()->Stopped() ) { return false; }
-
-	if ( !commitAll )
-	{
-		switch ( RedMessage( _LT( "Do you want to delete file?\n" ), fs->Uri( path ).GetUtf8(), bDeleteAllSkipCancel ) )
-		{
-			case CMD_SKIP:
-				return true;
+	MutexLock lock( &mutex );
 
-			case CMD_ALL:
-				commitAll = true;
-				break;
+	while ( !changed && finished.empty() ) { doneCond.Wait( &mutex ); }
 
-			case CMD_OK:
-				break;
+	changed = false;
+}
 
-			default:
-				return false;
-		}
-	}
+void CopyScheduler::GetProgress( int64_t* size, int64_t* done, int64_t* b )
+{
+	MutexLock lock( &mutex );
 
-	return Unlink( fs, path ); //skip all???
+	*size = activeSize;
+	*done = activeDone;
+	*b = bytes;
+	bytes = 0;
 }
 
-bool OperCFThread::DeleteDir( FS* fs, FSPath& path )
+void CopyScheduler::Cancel()
 {
-	if ( Info()->Stopped() ) { return false; }
+	MutexLock lock( &mutex );
 
-	FSList list;
+	cancel = true;
 
-	while ( true )
+	for ( CopySegment& seg : queue )
 	{
-		int ret_err;
-		int ret = fs->ReadDir( &list, path, &ret_err, Info() );
+		seg.t->status = CopyTransfer::STOPPED;
 
-		if ( ret == -2 ) { return false; }
+		if ( --seg.t->segmentsLeft == 0 ) { Finish( seg.t ); }
+	}
 
-		if ( !ret ) { break; }
-
-		switch ( RedMessage( _LT( "Can`t open directory:\n" ), fs->Uri( path ).GetUtf8(), bRetrySkipCancel, fs->StrError( ret_err ).GetUtf8() ) )
-		{
-			case CMD_SKIP:
-				return true;
-
-			case CMD_RETRY:
-				continue;
-
-			default:
-				return false;
-		}
-	}
-
-	return DeleteList( fs, path, list );
+	queue.clear();
 }
 
-bool OperCFThread::DeleteList( FS* fs, FSPath& _path, FSList& list )
+void CopyScheduler::Finish( CopyTransfer* t )
 {
-	if ( Info()->Stopped() ) { return false; }
+	finished.push_back( t );
+	changed = true;
+	doneCond.Signal();
+}
 
-	FSPath path = _path;
-	int cnt = path.Count();
+void CopyScheduler::Run( CopySegment& seg, char* buf )
+{
+	CopyTransfer* t = seg.t;
+	CopyTransfer::STATUS status = CopyTransfer::OK;
+	int err = 0;
+	int in = seg.offset ? -1 : t->in;
 
-	for ( FSNode* node = list.First(); node; node = node->next )
+	if ( in < 0 )
 	{
-		if ( node->extType ) { continue; }
+		in = t->srcFs->OpenRead( t->srcPath, FS::SHARE_READ, &err, info );
 
-		path.SetItemStr( cnt, node->Name() );
-
-		if ( node->IsDir() && !node->st.IsLnk() )
+		if ( in < 0 || t->srcFs->Seek( in, FSEEK_BEGIN, seg.offset, 0, &err, info ) )
 		{
-			if ( !DeleteDir( fs, path ) ) { return false; }
-
-			if ( !RmDir( fs, path ) ) { return false; }
-
-			continue;
+			status = CopyTransfer::READ_ERROR;
 		}
-
-		if ( !DeleteFile( fs, path ) ) { return false; }
 	}
 
-	return true;
-}
+	int64_t pos = seg.offset;
+	int64_t left = seg.size;
+	bool complete = false;
+	CopyHash hash;
 
-
-void DeleteThreadFunc( OperThreadNode* node )
-{
-	try
+	while ( status == CopyTransfer::OK && left )
 	{
-		MutexLock lock( node->GetMutex() );
-
-		if ( !node->Data() ) { return; }
-
-		OperCFData* data = ( ( OperCFData* )node->Data() );
-		OperCFThread thread( "Delete", data->Parent(), node );
+		{
+			MutexLock lock( &mutex );
 
-		clPtr<FS> fs = data->srcFs;
-		FSPath path = data->srcPath;
-		clPtr<FSList> list = data->srcList;
+			if ( cancel || t->status != CopyTransfer::OK ) { break; }
+		}
 
-		lock.Unlock();//!!!
+		int size = ( left > 0 && left < BSIZE ) ? int( left ) : BSIZE;
+		int n = t->srcFs->Read( in, buf, size, &err, info );
 
-		try
+		if ( n < 0 )
 		{
-			if ( list.ptr() )
-			{
-				thread.DeleteList( fs.Ptr(), path, *( list.ptr() ) );
-			}
+			status = ( n == -2 ) ? CopyTransfer::STOPPED : CopyTransfer::READ_ERROR;
+			break;
 		}
-		catch ( cexception* ex )
+
+		if ( !n ) { complete = true; break; }
+
 		{
-			lock.Lock(); //!!!
+			MutexLock lock( &t->outMutex );
 
-			if ( !node->NBStopped() ) //обязательно надо проверить, иначе 'data' может быть неактуальной
+			int r = ( seg.size >= 0 ) ? t->destFs->Seek( t->out, FSEEK_BEGIN, pos, 0, &err, info ) : 0;
+
+			if ( !r )
 			{
-				data->errorString = ex->message();
+				r = t->destFs->Write( t->out, buf, n, &err, info );
+
+				if ( r >= 0 && r != n ) { status = CopyTransfer::SHORT_WRITE; }
 			}
 
-			ex->destroy();
+			if ( r < 0 ) { status = ( r == -2 ) ? CopyTransfer::STOPPED : CopyTransfer::WRITE_ERROR; }
 		}
+
+		if ( status != CopyTransfer::OK ) { break; }
+
+		if ( t->verify ) { hash.Update( buf, n ); }
+
+		pos += n;
+
+		if ( left > 0 ) { left -= n; }
+
+		MutexLock lock( &mutex );
+		t->done += n;
+		activeDone += n;
+		bytes += n;
+		changed = true;
+		doneCond.Signal();
 	}
-	catch ( cexception* ex )
+
+	if ( in >= 0 && in != t->in ) { t->srcFs->Close( in, 0, info ); }
+
+	MutexLock lock( &mutex );
+
+	if ( status != CopyTransfer::OK && t->status == CopyTransfer::OK )
 	{
-		fprintf( stderr, "ERR!!! Error exception in DeleteThreadFunc - '%s'\n", ex->message() );
-		ex->destroy();
+		t->status = status;
+		t->err = err;
 	}
-	catch ( ... )
+	else if ( !complete && left && t->status == CopyTransfer::OK )
 	{
-		fprintf( stderr, "ERR!!! Unhandled exception in DeleteThreadFunc\n" );
+		t->status = CopyTransfer::STOPPED; //cancelled
+	}
+	else if ( t->verify )
+	{
+		CopyCheck check = { seg.offset, pos - seg.offset, hash.Digest() };
+		t->checks.push_back( check );
 	}
-}
 
-bool DeleteList( clPtr<FS> f, FSPath& p, clPtr<FSList> list, NCDialogParent* parent )
-{
-	SimpleCFThreadWin dlg( parent, _LT( "Delete" ) );
-	dlg.threadData.Clear();
-	dlg.threadData.srcFs = f;
-	dlg.threadData.srcPath = p;
-	dlg.threadData.srcList = list;
-	dlg.RunNewThread( "Delete", DeleteThreadFunc, &dlg.threadData ); //может быть исключение
-	dlg.Enable();
-	dlg.Show();
-	dlg.DoModal();
-	dlg.StopThread();
-	return dlg.threadData.errorString.IsEmpty();
+	if ( --t->segmentsLeft == 0 ) { Finish( t ); }
 }
 
-/////////////////////////////////////////////////////////////// Copy
-
-bool OperCFThread::SendCopyNextFileInfo( FSString from, FSString to )
+void CopyScheduler::Work()
 {
-	MutexLock lock( Node().GetMutex() );
+	std::vector<char> buf( BSIZE );
 
-	if ( Node().NBStopped() ) { return false; }
+	MutexLock lock( &mutex );
 
-	OperCFData* data = ( ( OperCFData* )Node().Data() );
+	while ( !quit )
+	{
+		if ( queue.empty() )
+		{
+			workCond.Wait( &mutex );
+			continue;
+		}
 
-	if ( !data ) { return false; }
+		CopySegment seg = queue.front();
+		queue.pop_front();
 
-	data->infoCount++;
-	data->infoSrcUri = from;
-	data->infoDstUri = to;
-	data->pathChanged = true;
+		lock.Unlock();
+		Run( seg, buf.data() );
+		lock.Lock();
+	}
+}
 
-	if ( !WinThreadSignal( INFO_NEXTFILE ) ) { return false; }
+void* CopyScheduler::WorkerFunc( void* arg )
+{
+	( ( CopyScheduler* )arg )->Work();
+	return 0;
+}
 
-	data->infoProgress = 0;
+/////////////////////////////////////////////////////////////// move pipeline
 
-	return true;
-}
+// a source of a move whose copy is complete, or a directory left empty by the move
+struct MoveRemoval
+{
+	FS* fs;
+	FSPath path;
+	bool dir;
+	int err;
+};
 
-namespace wal
+/// Removes the sources of a move on its own thread while the next files are copied.
+/// The removals are done in the order they were added, so a directory goes after its content.
+class MoveRemover
 {
-	extern unsigned GetTickMiliseconds();
+public:
+	enum { MAX_QUEUED = 64 };
+
+	MoveRemover( FSCInfo* info );
+	~MoveRemover(); //finishes the queued removals, the copies of those files are complete
+
+	/// waits while MAX_QUEUED removals are ahead, so the sources don't fall far behind the copy
+	void Add( FS* fs, FSPath& path, bool dir );
+	/// a removal that failed, the caller deletes it. 0 if none so far
+	MoveRemoval* TakeFailed();
+	/// waits until all added removals are done
+	void Wait();
+
+private:
+	FSCInfo* info;
+	Mutex mutex;
+	Cond workCond;
+	Cond doneCond;
+	std::deque<MoveRemoval*> queue;
+	std::vector<MoveRemoval*> failed;
+	thread_t thread;
+	bool busy;
+	bool quit;
+
+	void Work();
+	static void* WorkerFunc( void* arg );
+
+	MoveRemover( const MoveRemover& );
+	void operator = ( const MoveRemover& );
 };
 
-bool OperCFThread::SendProgressInfo( int64_t size, int64_t progress, int64_t bytes )
+MoveRemover::MoveRemover( FSCInfo* i )
+	: info( i ), busy( false ), quit( false )
 {
-	MutexLock lock( Node().GetMutex() );
+	if ( thread_create( &thread, WorkerFunc, this ) ) { throw_msg( "can't start move thread" ); }
+}
 
-	if ( Node().NBStopped() ) { return false; }
+MoveRemover::~MoveRemover()
+{
+	{
+		MutexLock lock( &mutex );
+		quit = true;
+		workCond.Broadcast();
+	}
 
-	OperCFData* data = ( ( OperCFData* )Node().Data() );
+	void* ret;
+	thread_join( thread, &ret );
 
-	if ( !data ) { return false; }
+	for ( MoveRemoval* r : failed ) { delete r; }
+}
 
-	data->infoSize = size;
-	data->infoProgress = progress;
-	data->infoBytes += bytes;
-	data->infoBytesTotal += bytes;
-	data->infoMs = GetTickMiliseconds();
-	data->progressChanged = true;
+void MoveRemover::Add( FS* fs, FSPath& path, bool dir )
+{
+	MoveRemoval* r = new MoveRemoval();
+	r->fs = fs;
+	r->path = path;
+	r->dir = dir;
+	r->err = 0;
 
-	if ( !WinThreadSignal( INFO_NEXTFILE ) ) { return false; }
+	MutexLock lock( &mutex );
 
-	return true;
+	while ( queue.size() >= MAX_QUEUED ) { doneCond.Wait( &mutex ); }
+
+	queue.push_back( r );
+	workCond.Signal();
 }
 
-OperFileNameWin::OperFileNameWin( Win* parent, int ccount )
-	: Win( Win::WT_CHILD, 0, parent, 0 )
-	, _ccount( ccount )
+MoveRemoval* MoveRemover::TakeFailed()
 {
-	wal::GC gc( this );
-	cpoint size = GetStaticTextExtent( gc, ABCString, GetFont() );
-	size.x = size.x / ABCStringLen * ccount;
+	MutexLock lock( &mutex );
 
-	if ( size.x > 500 ) { size.x = 550; }
+	if ( failed.empty() ) { return 0; }
 
-	SetLSize( LSize( size ) );
+	MoveRemoval* r = failed.front();
+	failed.erase( failed.begin() );
+	return r;
 }
 
-void OperFileNameWin::SetText( const unicode_t* s )
+void MoveRemover::Wait()
 {
-	text = new_unicode_str( s );
-	Invalidate();
+	MutexLock lock( &mutex );
+
+	while ( busy || !queue.empty() ) { doneCond.Wait( &mutex ); }
 }
 
-void OperFileNameWin::Paint( wal::GC& gc, const crect& paintRect )
+void MoveRemover::Work()
 {
-	crect rect = ClientRect();
-	gc.SetFillColor( UiGetColor( uiBackground, 0, 0, 0xFFFFFF ) );
-	gc.FillRect( rect );
-	gc.SetTextColor( UiGetColor( uiColor, 0, 0, 0 ) );
-	gc.Set( GetFont() );
-
-	unicode_t* p = text.data();
+	MutexLock lock( &mutex );
 
-	if ( p )
+	while ( true )
 	{
-		int l = unicode_strlen( p );
-
-		if ( l > _ccount )
+		if ( queue.empty() )
 		{
-			p += l - _ccount;
-		}
+			if ( quit ) { break; }
 
-		DrawStaticText( gc, 0, 0, p );
-	}
-}
+			workCond.Wait( &mutex );
+			continue;
+		}
 
-OperFileNameWin::~OperFileNameWin() {};
+		MoveRemoval* r = queue.front();
+		queue.pop_front();
+		busy = true;
 
+		lock.Unlock();
+		int ret = r->dir ? r->fs->RmDir( r->path, &r->err, info ) : r->fs->Delete( r->path, &r->err, info );
+		lock.Lock();
 
-class NCNumberWin: public Win
-{
-	int64_t _num;
-public:
-	NCNumberWin( Win* parent, int width = 10 )
-		:  Win( Win::WT_CHILD, 0, parent, 0 ), _num( 0 )
-	{
-		wal::GC gc( this );
-		cpoint size = GetStaticTextExtent( gc, ABCString, GetFont() );
-		size.x = size.x / ABCStringLen * width;
-		SetLSize( LSize( size ) );
-	}
+		busy = false;
 
-	void SetNumber( int64_t n )
-	{
-		if ( _num == n ) { return; }
+		// a stopped removal is not reported, the source stays as a copy would leave it
+		if ( ret == -1 ) { failed.push_back( r ); }
+		else { delete r; }
 
-		_num = n;
-		Invalidate();
+		doneCond.Broadcast();
 	}
+}
 
-	void Paint( wal::GC& gc, const crect& paintRect );
-	virtual ~NCNumberWin();
-};
+void* MoveRemover::WorkerFunc( void* arg )
+{
+	( ( MoveRemover* )arg )->Work();
+	return 0;
+}
 
-void NCNumberWin::Paint( wal::GC& gc, const crect& paintRect )
+class OperCFThread: public OperFileThread
 {
-	crect rect = ClientRect();
-	gc.SetFillColor( UiGetColor( uiBackground, 0, 0, 0xFFFFFF ) );
-	gc.FillRect( rect );
-	gc.SetTextColor( UiGetColor( uiColor, 0, 0, 0 ) );
-	gc.Set( GetFont() );
+	volatile bool commitAll;
+	volatile bool skipNonRegular;
+	bool verify; // set when the operation starts, see clWcmConfig::systemVerifyCopy
+	bool skipUnchanged; // clWcmConfig::systemCopySkipUnchanged
+	bool compareContent; // clWcmConfig::systemCopyCompareContent
+	int64_t dropBehindSize; // clWcmConfig::systemCopyNoCacheSize in bytes, 0 - never
+	enum { BSIZE = 1024 * 512, STARTSIZE = 1024 * 64 };
+	char* _buffer;
+	CopyScheduler* copyScheduler; // created by the first file copied from an FS with several read streams
+	MoveRemover* moveRemover; // created by the first source of a move removed in the background
+	std::vector<MoveRemoval>* removeAfterFlush; // set while moving into a destination keeping the changes until Flush()
+
+	bool StartTransfer( FS* srcFs, FSPath& srcPath, FSNode* srcNode, int in, FS* destFs, FSPath& destPath, int out, bool move );
+	bool FinishTransfer( CopyTransfer* t ); //return false if cancelled
+
+	/*
+	   reads the copy back and compares it with the hashes taken while writing it
+	   0 - the same
+	   1 - differs or can't be read, skipped by the user
+	   -1 - stop
+	*/
+	int VerifyCopy( FS* fs, FSPath& path, std::vector<CopyCheck>& checks );
+
+	// what is done with a file copied into an existing directory
+	enum SYNC { SYNC_COPY = 0, SYNC_SKIP, SYNC_DELTA };
+	enum { DELTA_MIN = 1024 * 1024 * 4 }; // smaller files are written whole
+
+	/// decides for each node of 'list' going into the existing directory 'destDir' (empty 'plan' - copy all)
+	bool PlanSync( FS* srcFs, FSPath& srcDir, FSList* list, FS* destFs, FSPath& destDir, bool move, std::vector<char>& plan ); //false if stopped
+
+	/*
+	   rewrites the blocks of the destination that differ from the source, both are of the same size
+	   0 - ok
+	   1 - can't be updated in place, copy the whole file
+	   2 - failed, skipped by the user
+	   -1 - stop
+	*/
+	int CopyDelta( FS* srcFs, FSPath& srcPath, FSNode* srcNode, int in, FS* destFs, FSPath& destPath );
+	void CancelTransfers();
+
+	/// removes the source of a move whose copy is complete, in the background if 'fs' can be used by two threads at once
+	bool RemoveSource( FS* fs, FSPath& path, bool dir ); //return false if cancelled
+	/// asks about the background removals that failed, 'wait' - for all of them to be done first
+	bool CheckRemoved( bool wait ); //return false if cancelled
+
+	/// writes the files of FS::Extract() under the destination directory
+	class ExtractSink: public FSExtractSink
+	{
+		OperCFThread* thread;
+		FS* srcFs;
+		FSPath srcDir;
+		FS* destFs;
+		FSPath destDir;
+
+		// the file being written
+		FSPath srcPath;
+		FSPath destPath;
+		FSStat st;
+		int out;
+		int64_t doneBytes;
 
-	unicode_t c[32];
-	unicode_t buf[32];
-	unicode_t* s = buf;
+		std::vector<std::pair<FSPath, FSStat> > dirs;
 
-	int64_t n = _num;
-	bool minus = n < 0;
+		void SetPaths( FSPath& path );
+		int Drop( bool stop ); // closes and removes the file being written, -2 if 'stop' else 1
+	public:
+		ExtractSink( OperCFThread* t, FS* sFs, FSPath& sDir, FS* dFs, FSPath& dDir )
+			: thread( t ), srcFs( sFs ), srcDir( sDir ), destFs( dFs ), destDir( dDir ), out( -1 ), doneBytes( 0 ) {}
 
-	if ( minus ) { n = -n; }
+		virtual int Begin( FSPath& path, const FSStat& st ) override;
+		virtual int Data( void* buf, int size ) override;
+		virtual int End() override;
+		virtual int Fail( int err ) override;
 
-	int i = 0;
+		/// drops a file left unfinished by a stop and sets the times of the created directories
+		void Finish();
+	};
 
-	for ( ; n > 0; i++, n /= 10 ) { c[i] = char( n % 10 ) + '0'; }
+	/*
+	   0 - ok
+	   1 - need copy
+	   -1 - stop
+	*/
+	int ExtractList( FS* srcFs, FSPath& srcDir, FSList* list, FS* destFs, FSPath& destDir );
+
+	/// asks about the entries FS::DeleteDirContent() could not remove
+	class DeleteSink: public FSDeleteSink
+	{
+		OperCFThread* thread;
+		FS* fs;
+		bool skipAll;
+	public:
+		bool skipped; // something was left, so the directory stays too
+		DeleteSink( OperCFThread* t, FS* f ): thread( t ), fs( f ), skipAll( false ), skipped( false ) {}
+		virtual int Fail( FSPath& path, bool dir, int err ) override;
+	};
+public:
+	OperCFThread( const char* opName, NCDialogParent* par, OperThreadNode* n )
+		:  OperFileThread( opName, par, n ),
+		   commitAll( false ), skipNonRegular( false ), verify( g_WcmConfig.systemVerifyCopy ),
+		   skipUnchanged( g_WcmConfig.systemCopySkipUnchanged ), compareContent( g_WcmConfig.systemCopyCompareContent ),
+		   dropBehindSize( int64_t( g_WcmConfig.systemCopyNoCacheSize > 0 ? g_WcmConfig.systemCopyNoCacheSize : 0 ) * 1024 * 1024 ), _buffer( 0 ), copyScheduler( 0 ), moveRemover( 0 ), removeAfterFlush( 0 )
+	{
+		_buffer = new char[BSIZE];
+	}
 
-	if ( minus ) { *s = '-'; s++; }
+	void CreateDirectory( FS* fs, FSPath& srcPath, FSPath& destPath, bool processMultipleFolders ); //throws
 
-	if ( i == 0 ) {*s = '0'; s++; };
+	bool Unlink ( FS* fs, FSPath& path, bool* skipAll = 0 );
+	bool RmDir  ( FS* fs, FSPath& path, bool* skipAll = 0 );
+	bool DeleteFile   ( FS* fs, FSPath& path );
+	bool DeleteDir ( FS* fs, FSPath& path, bool* kept = 0 ); // 'kept' is set if the content was not removed all
+	bool DeleteList   ( FS* fs, FSPath& _path, FSList& list );
 
-	for ( i--; i >= 0; i-- ) { *( s++ ) = c[i]; }
+	//from и to - эффект cptr !!!
+	bool SendCopyNextFileInfo( FSString from, FSString to );
 
-	*s = 0;
+	bool SendProgressInfo( int64_t size, int64_t progress, int64_t bytes );
 
-	gc.TextOut( 0, 0, buf );
-}
+	void SendVerifyInfo( bool ok );
 
-NCNumberWin::~NCNumberWin() {}
+	/// a file left as it is at the destination counts as copied in the total progress
+	void SendSkipInfo( int64_t size );
 
+	/// finishes parallel transfers until they hold no more than 'maxStreams' connections, false if cancelled
+	bool WaitTransfers( int maxStreams );
 
-class NCProgressWin: public Win
-{
-	int64_t _from, _to;
-	int64_t _num;
-	int64_t _lastWidth, _lastPos;
-public:
-	NCProgressWin( Win* parent )
-		:  Win( Win::WT_CHILD, 0, parent, 0 ), _from( 0 ), _to( 0 ), _num( 0 ), _lastWidth( 0 ), _lastPos( 0 )
+	bool CopyLink( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& path, bool move );
+	// XXX CopyFile/MoveFile are #define'd in winbase.h
+	bool CopyFile( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath, bool move, bool delta = false );
+	bool CopyDir( FS* srcFs, FSPath& __srcPath, FSNode* srcNode, FS* destFs, FSPath& __destPath, bool move );
+	bool CopyNode( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath, bool move, int sync = SYNC_COPY );
+	bool CopyList( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath, cstrhash<bool, unicode_t>& resList, bool move = false );
+	bool Copy( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath, cstrhash<bool, unicode_t>& resList );
 
+	/// writes out the changes 'fs' keeps until Flush() (see FS::IsWriteDeferred()), drops them if 'ok' is false
+	bool FlushChanges( FS* fs, FSPath& path, bool ok );
+
+	int MoveFile( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath );
+	int MoveDir( FS* srcFs, FSPath& __srcPath, FSNode* srcNode, FS* destFs, FSPath& __destPath );
+	bool MoveNode( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath );
+	bool MoveList( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath );
+	bool Move( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath );
+
+	virtual ~OperCFThread();
+};
+
+OperCFThread::~OperCFThread()
+{
+	if ( copyScheduler )
+	{
+		CancelTransfers();
+		delete copyScheduler;
+	}
+
+	if ( moveRemover )
+	{
+		delete moveRemover;
+	}
+
+	if ( _buffer )
+	{
+		delete [] _buffer;
+	}
+}
+
+void OperCFThread::CreateDirectory( FS* fs, FSPath& srcPath, FSPath& destPath, bool processMultipleFolders )
+{
+	if ( processMultipleFolders )
+	{
+		const int DirIndex = srcPath.GetFirstUnmatchedItem( destPath );
+		FSPath Path;
+
+		for ( int i = 0; i < destPath.Count(); i++ )
+		{
+			// get next dir
+			Path.PushStr( *destPath.GetItem( i ) );
+			
+			int ret_err;
+
+			// try to create dir
+			if ( i >= DirIndex && fs->MkDir( Path, 0777, &ret_err, Info() ) )
+			{
+				// skip "already exists" error
+				if ( !fs->IsEEXIST( ret_err ) )
+				{
+					throw_msg( "%s", fs->StrError( ret_err ).GetUtf8() );
+				}
+			}
+		}
+	}
+	else
+	{
+		int ret_err;
+
+		if ( fs->MkDir( destPath, 0777, &ret_err, Info() ) )
+		{
+			throw_msg( "%s", fs->StrError( ret_err ).GetUtf8() );
+		}
+	}
+
+	int ret_err;
+
+	if ( fs->IsWriteDeferred() && fs->Flush( &ret_err, Info() ) )
+	{
+		throw_msg( "%s", fs->StrError( ret_err ).GetUtf8() );
+	}
+}
+
+class SimpleCFThreadWin: public NCDialog
+{
+public:
+	OperCFData threadData;
+
+	SimpleCFThreadWin( NCDialogParent* parent, const char* name )
+		:  NCDialog( ::createDialogAsChild, 0, parent, utf8_to_unicode( name ).data(), bListCancel ), threadData( parent ) {}
+	virtual void OperThreadStopped();
+	virtual ~SimpleCFThreadWin();
+};
+
+void SimpleCFThreadWin::OperThreadStopped()
+{
+	if ( !threadData.errorString.IsEmpty() )
+	{
+		NCMessageBox( ( NCDialogParent* )Parent(), _LT( "Create directory" ), threadData.errorString.GetUtf8(), true );
+		EndModal( 0 );
+		return;
+	}
+
+	EndModal( 100 );
+}
+
+SimpleCFThreadWin::~SimpleCFThreadWin() {}
+
+
+///////////////////////////////////////////////////////   MkDir
+
+void MkDirThreadFunc( OperThreadNode* node )
+{
+	try
+	{
+		MutexLock lock( node->GetMutex() );
+
+		if ( !node->Data() ) { return; }
+
+		OperCFData* data = ( ( OperCFData* )node->Data() );
+		OperCFThread thread( "create directory", data->Parent(), node );
+
+		clPtr<FS> fs = data->srcFs;
+		FSPath srcPath = data->srcPath;
+		FSPath destPath = data->destPath;
+		bool processMultipleFolders = data->processMultipleFolders;
+
+		lock.Unlock();//!!!
+
+		try
+		{
+			thread.CreateDirectory( fs.Ptr(), srcPath, destPath, processMultipleFolders );
+		}
+		catch ( cexception* ex )
+		{
+			fs->Rollback();
+
+			lock.Lock(); //!!!
+
+			if ( !node->NBStopped() ) //обязательно надо проверить, иначе 'data' может быть неактуальной
+			{
+				data->errorString = ex->message();
+			}
+
+			ex->destroy();
+		}
+	}
+	catch ( cexception* ex )
+	{
+		fprintf( stderr, "ERR!!! Error exception in MkDirThreadFunc - '%s'\n", ex->message() );
+		ex->destroy();
+	}
+	catch ( ... )
+	{
+		fprintf( stderr, "ERR!!! Unhandled exception in MkDirThreadFunc\n" );
+	}
+}
+
+bool MkDir( clPtr<FS> f, FSPath& srcPath, FSPath& destPath, bool processMultipleFolders, NCDialogParent* parent )
+{
+	SimpleCFThreadWin dlg( parent, _LT( "Create directory" ) );
+	dlg.threadData.Clear();
+	dlg.threadData.srcFs = f;
+	dlg.threadData.srcPath = srcPath;
+	dlg.threadData.destPath = destPath;
+	dlg.threadData.processMultipleFolders = processMultipleFolders;
+	dlg.RunNewThread( "Create directory", MkDirThreadFunc, &dlg.threadData ); //может быть исключение
+	dlg.Enable();
+	dlg.Show();
+	dlg.DoModal();
+	dlg.StopThread();
+	return dlg.threadData.errorString.IsEmpty();
+}
+
+
+///////////////////////////////////////////////////// DELETE
+
+//возвращает true если можно продолжать процесс
+
+bool OperCFThread::Unlink( FS* fs, FSPath& path, bool* skipAll )
+{
+	int ret_err;
+
+	while ( fs->Delete( path, &ret_err, Info() ) )
+	{
+		if ( skipAll && *skipAll ) { return true; }
+
+		switch ( RedMessage( _LT( "Can`t delete file:\n" ), fs->Uri( path ).GetUtf8(), skipAll ? bRetrySkipSkipallCancel : bRetrySkipCancel,
+		                     fs->StrError( ret_err ).GetUtf8() ) )
+		{
+			case CMD_SKIPALL:
+				if ( skipAll ) { *skipAll = true; } //no break
+
+			case CMD_SKIP:
+				return true;
+
+			case CMD_RETRY:
+				continue;
+
+			default:
+				return false;
+		}
+	}
+
+	return true;
+}
+
+bool OperCFThread::RmDir( FS* fs, FSPath& path, bool* skipAll )
+{
+	int ret_err;
+
+	while ( fs->RmDir( path, &ret_err, Info() ) )
+	{
+		if ( skipAll && *skipAll ) { return true; }
+
+		switch ( RedMessage( _LT( "Can`t delete directory:\n" ) , fs->Uri( path ).GetUtf8(), skipAll ? bRetrySkipSkipallCancel : bRetrySkipCancel,
+		                     fs->StrError( ret_err ).GetUtf8() ) )
+		{
+			case CMD_SKIPALL:
+				if ( skipAll ) { *skipAll = true; } //no break
+
+			case CMD_SKIP:
+				return true;
+
+			case CMD_RETRY:
+				continue;
+
+			default:
+				return false;
+		}
+	}
+
+	return true;
+}
+
+bool OperCFThread::DeleteFile( FS* fs, FSPath& path ) //return true if not concelled
+{
+	if ( Info()->Stopped() ) { return false; }
+
+	if ( !commitAll )
+	{
+		switch ( RedMessage( _LT( "Do you want to delete file?\n" ), fs->Uri( path ).GetUtf8(), bDeleteAllSkipCancel ) )
+		{
+			case CMD_SKIP:
+				return true;
+
+			case CMD_ALL:
+				commitAll = true;
+				break;
+
+			case CMD_OK:
+				break;
+
+			default:
+				return false;
+		}
+	}
+
+	return Unlink( fs, path ); //skip all???
+}
+
+int OperCFThread::DeleteSink::Fail( FSPath& path, bool dir, int err )
+{
+	if ( skipAll ) { skipped = true; return 0; }
+
+	switch ( thread->RedMessage( dir ? _LT( "Can`t delete directory:\n" ) : _LT( "Can`t delete file:\n" ), fs->Uri( path ).GetUtf8(),
+	                             bRetrySkipSkipallCancel, fs->StrError( err ).GetUtf8() ) )
+	{
+		case CMD_SKIPALL:
+			skipAll = true;
+			skipped = true;
+			return 0;
+
+		case CMD_SKIP:
+			skipped = true;
+			return 0;
+
+		case CMD_RETRY:
+			return 1;
+
+		default:
+			return -2;
+	}
+}
+
+bool OperCFThread::DeleteDir( FS* fs, FSPath& path, bool* kept )
+{
+	if ( Info()->Stopped() ) { return false; }
+
+	// once there are no questions to ask about each file the FS may take the whole tree at once
+	if ( commitAll )
+	{
+		DeleteSink sink( this, fs );
+		int ret_err;
+		int ret = fs->DeleteDirContent( path, &sink, &ret_err, Info() );
+
+		if ( ret == -2 ) { return false; }
+
+		if ( !ret )
+		{
+			if ( kept ) { *kept = sink.skipped; }
+
+			return true;
+		}
+
+		// not supported, or the directory can't be read: go node by node and report it there
+	}
+
+	FSList list;
+
+	while ( true )
+	{
+		int ret_err;
+		int ret = fs->ReadDir( &list, path, &ret_err, Info() );
+
+		if ( ret == -2 ) { return false; }
+
+		if ( !ret ) { break; }
+
+		switch ( RedMessage( _LT( "Can`t open directory:\n" ), fs->Uri( path ).GetUtf8(), bRetrySkipCancel, fs->StrError( ret_err ).GetUtf8() ) )
+		{
+			case CMD_SKIP:
+				return true;
+
+			case CMD_RETRY:
+				continue;
+
+			default:
+				return false;
+		}
+	}
+
+	return DeleteList( fs, path, list );
+}
+
+bool OperCFThread::DeleteList( FS* fs, FSPath& _path, FSList& list )
+{
+	if ( Info()->Stopped() ) { return false; }
+
+	FSPath path = _path;
+	int cnt = path.Count();
+
+	for ( FSNode* node = list.First(); node; node = node->next )
+	{
+		if ( node->extType ) { continue; }
+
+		path.SetItemStr( cnt, node->Name() );
+
+		if ( node->IsDir() && !node->st.IsLnk() )
+		{
+			bool kept = false;
+
+			if ( !DeleteDir( fs, path, &kept ) ) { return false; }
+
+			if ( !kept && !RmDir( fs, path ) ) { return false; }
+
+			continue;
+		}
+
+		if ( !DeleteFile( fs, path ) ) { return false; }
+	}
+
+	return true;
+}
+
+
+void DeleteThreadFunc( OperThreadNode* node )
+{
+	try
+	{
+		MutexLock lock( node->GetMutex() );
+
+		if ( !node->Data() ) { return; }
+
+		OperCFData* data = ( ( OperCFData* )node->Data() );
+		OperCFThread thread( "Delete", data->Parent(), node );
+
+		clPtr<FS> fs = data->srcFs;
+		FSPath path = data->srcPath;
+		clPtr<FSList> list = data->srcList;
+
+		lock.Unlock();//!!!
+
+		try
+		{
+			if ( list.ptr() )
+			{
+				thread.FlushChanges( fs.Ptr(), path, thread.DeleteList( fs.Ptr(), path, *( list.ptr() ) ) );
+			}
+		}
+		catch ( cexception* ex )
+		{
+			lock.Lock(); //!!!
+
+			if ( !node->NBStopped() ) //обязательно надо проверить, иначе 'data' может быть неактуальной
+			{
+				data->errorString = ex->message();
+			}
+
+			ex->destroy();
+		}
+	}
+	catch ( cexception* ex )
+	{
+		fprintf( stderr, "ERR!!! Error exception in DeleteThreadFunc - '%s'\n", ex->message() );
+		ex->destroy();
+	}
+	catch ( ... )
+	{
+		fprintf( stderr, "ERR!!! Unhandled exception in DeleteThreadFunc\n" );
+	}
+}
+
+bool DeleteList( clPtr<FS> f, FSPath& p, clPtr<FSList> list, NCDialogParent* parent )
+{
+	SimpleCFThreadWin dlg( parent, _LT( "Delete" ) );
+	dlg.threadData.Clear();
+	dlg.threadData.srcFs = f;
+	dlg.threadData.srcPath = p;
+	dlg.threadData.srcList = list;
+	dlg.RunNewThread( "Delete", DeleteThreadFunc, &dlg.threadData ); //может быть исключение
+	dlg.Enable();
+	dlg.Show();
+	dlg.DoModal();
+	dlg.StopThread();
+	return dlg.threadData.errorString.IsEmpty();
+}
+
+/////////////////////////////////////////////////////////////// Copy
+
+bool OperCFThread::SendCopyNextFileInfo( FSString from, FSString to )
+{
+	MutexLock lock( Node().GetMutex() );
+
+	if ( Node().NBStopped() ) { return false; }
+
+	OperCFData* data = ( ( OperCFData* )Node().Data() );
+
+	if ( !data ) { return false; }
+
+	data->infoCount++;
+	data->infoSrcUri = from;
+	data->infoDstUri = to;
+	data->pathChanged = true;
+
+	if ( !WinThreadSignal( INFO_NEXTFILE ) ) { return false; }
+
+	data->infoProgress = 0;
+
+	return true;
+}
+
+namespace wal
+{
+	extern unsigned GetTickMiliseconds();
+};
+
+bool OperCFThread::SendProgressInfo( int64_t size, int64_t progress, int64_t bytes )
+{
+	MutexLock lock( Node().GetMutex() );
+
+	if ( Node().NBStopped() ) { return false; }
+
+	OperCFData* data = ( ( OperCFData* )Node().Data() );
+
+	if ( !data ) { return false; }
+
+	data->infoSize = size;
+	data->infoProgress = progress;
+	data->infoBytes += bytes;
+	data->infoBytesTotal += bytes;
+	data->infoMs = GetTickMiliseconds();
+	data->progressChanged = true;
+
+	if ( !WinThreadSignal( INFO_NEXTFILE ) ) { return false; }
+
+	return true;
+}
+
+void OperCFThread::SendSkipInfo( int64_t size )
+{
+	MutexLock lock( Node().GetMutex() );
+
+	if ( Node().NBStopped() ) { return; }
+
+	OperCFData* data = ( ( OperCFData* )Node().Data() );
+
+	if ( !data ) { return; }
+
+	data->infoBytesTotal += size;
+	data->progressChanged = true;
+
+	WinThreadSignal( INFO_NEXTFILE );
+}
+
+void OperCFThread::SendVerifyInfo( bool ok )
+{
+	MutexLock lock( Node().GetMutex() );
+
+	if ( Node().NBStopped() ) { return; }
+
+	OperCFData* data = ( ( OperCFData* )Node().Data() );
+
+	if ( !data ) { return; }
+
+	if ( ok ) { data->infoVerified++; }
+	else { data->infoVerifyFailed++; }
+
+	data->verifyChanged = true;
+
+	WinThreadSignal( INFO_NEXTFILE );
+}
+
+OperFileNameWin::OperFileNameWin( Win* parent, int ccount )
+	: Win( Win::WT_CHILD, 0, parent, 0 )
+	, _ccount( ccount )
+{
+	wal::GC gc( this );
+	cpoint size = GetStaticTextExtent( gc, ABCString, GetFont() );
+	size.x = size.x / ABCStringLen * ccount;
+
+	if ( size.x > 500 ) { size.x = 550; }
+
+	SetLSize( LSize( size ) );
+}
+
+void OperFileNameWin::SetText( const unicode_t* s )
+{
+	text = new_unicode_str( s );
+	Invalidate();
+}
+
+void OperFileNameWin::Paint( wal::GC& gc, const crect& paintRect )
+{
+	crect rect = ClientRect();
+	gc.SetFillColor( UiGetColor( uiBackground, 0, 0, 0xFFFFFF ) );
+	gc.FillRect( rect );
+	gc.SetTextColor( UiGetColor( uiColor, 0, 0, 0 ) );
+	gc.Set( GetFont() );
+
+	unicode_t* p = text.data();
+
+	if ( p )
+	{
+		int l = unicode_strlen( p );
+
+		if ( l > _ccount )
+		{
+			p += l - _ccount;
+		}
+
+		DrawStaticText( gc, 0, 0, p );
+	}
+}
+
+OperFileNameWin::~OperFileNameWin() {};
+
+
+class NCNumberWin: public Win
+{
+	int64_t _num;
+public:
+	NCNumberWin( Win* parent, int width = 10 )
+		:  Win( Win::WT_CHILD, 0, parent, 0 ), _num( 0 )
+	{
+		wal::GC gc( this );
+		cpoint size = GetStaticTextExtent( gc, ABCString, GetFont() );
+		size.x = size.x / ABCStringLen * width;
+		SetLSize( LSize( size ) );
+	}
+
+	void SetNumber( int64_t n )
+	{
+		if ( _num == n ) { return; }
+
+		_num = n;
+		Invalidate();
+	}
+
+	void Paint( wal::GC& gc, const crect& paintRect );
+	virtual ~NCNumberWin();
+};
+
+void NCNumberWin::Paint( wal::GC& gc, const crect& paintRect )
+{
+	crect rect = ClientRect();
+	gc.SetFillColor( UiGetColor( uiBackground, 0, 0, 0xFFFFFF ) );
+	gc.FillRect( rect );
+	gc.SetTextColor( UiGetColor( uiColor, 0, 0, 0 ) );
+	gc.Set( GetFont() );
+
+	unicode_t c[32];
+	unicode_t buf[32];
+	unicode_t* s = buf;
+
+	int64_t n = _num;
+	bool minus = n < 0;
+
+	if ( minus ) { n = -n; }
+
+	int i = 0;
+
+	for ( ; n > 0; i++, n /= 10 ) { c[i] = char( n % 10 ) + '0'; }
+
+	if ( minus ) { *s = '-'; s++; }
+
+	if ( i == 0 ) {*s = '0'; s++; };
+
+	for ( i--; i >= 0; i-- ) { *( s++ ) = c[i]; }
+
+	*s = 0;
+
+	gc.TextOut( 0, 0, buf );
+}
+
+NCNumberWin::~NCNumberWin() {}
+
+
+class NCProgressWin: public Win
+{
+	int64_t _from, _to;
+	int64_t _num;
+	int64_t _lastWidth, _lastPos;
+public:
+	NCProgressWin( Win* parent )
+		:  Win( Win::WT_CHILD, 0, parent, 0 ), _from( 0 ), _to( 0 ), _num( 0 ), _lastWidth( 0 ), _lastPos( 0 )
+
+	{
+		cpoint size;
+		size.x = 10;
+		size.y = 16;
+		LSize ls( size );
+		ls.x.maximal = 1000;
+		SetLSize( ls );
+	}
+
+	void SetData( int64_t from, int64_t to, int64_t num )
+	{
+		if ( _from == from && _to == to && _num == num ) { return; }
+
+		bool diapazonChanged = _from != from || _to != to;
+
+		_from = from;
+		_to = to;
+		_num = num;
+
+		if ( _num < _from || _to <= _from ) { return; }
+
+		int64_t size = _to - _from;
+		int64_t n = ( _lastWidth * _num ) / size;
+
+		if ( diapazonChanged || _lastPos != n )
+		{
+			Invalidate();
+		}
+	}
+
+	virtual void Paint( wal::GC& gc, const crect& paintRect );
+	virtual ~NCProgressWin();
+};
+
+
+inline unsigned MidAB( int a, int b, int i, int n )
+{
+	return n > 1 ? a + ( ( b - a ) * i ) / ( n - 1 ) : a;
+}
+
+static void FillHorisont( wal::GC& gc, crect rect, unsigned a, unsigned b )
+{
+	if ( rect.IsEmpty() ) { return; }
+
+	unsigned ar = a & 0xFF,    ag = ( a >> 8 ) & 0xFF, ab = ( a >> 16 ) & 0xFF,
+	         br = b & 0xFF, bg = ( b >> 8 ) & 0xFF, bb = ( b >> 16 ) & 0xFF;
+
+	int h = rect.Height();
+	int x1 = rect.left, x2 = rect.right;
+
+	if ( h <= 0 || x1 >= x2 ) { return; }
+
+	for ( int i = 0; i < h; i++ )
+	{
+		unsigned color = ( MidAB( ar, br, i, h ) & 0xFF ) + ( ( MidAB( ag, bg, i, h ) & 0xFF ) << 8 ) + ( ( MidAB( ab, bb, i, h ) & 0xFF ) << 16 );
+		gc.SetLine( color );
+		gc.MoveTo( x1, rect.top + i );
+		gc.LineTo( x2, rect.top + i );
+	}
+
+}
+
+void NCProgressWin::Paint( wal::GC& gc, const crect& paintRect )
+{
+	crect rect = ClientRect();
+	int w = rect.Width();
+
+	Draw3DButtonW2( gc, rect, 0x808080, false );
+	rect.Dec();
+	rect.Dec();
+	w -= 2;
+
+	if ( !( _num < _from || _to <= _from || w <= 0 ) )
+	{
+		int64_t size = _to - _from;
+		int n = int( ( w * _num ) / size );
+
+		crect r = rect;
+		r.right = n;
+
+		unsigned color = 0xA00000;
+		unsigned bColor = ColorTone( color, -80 ), aColor = ColorTone( color, +80 );
+		FillHorisont( gc, r, aColor, bColor );
+
+		_lastWidth = w;
+		_lastPos = n;
+		rect.left += n;
+	}
+
+	unsigned color = 0xB0B0B0;
+	unsigned bColor = ColorTone( color, +50 ), aColor = ColorTone( color, -50 );
+	FillHorisont( gc, rect, aColor, bColor );
+
+}
+
+NCProgressWin::~NCProgressWin() {}
+
+
+class CopyDialog: public SimpleCFThreadWin
+{
+	Layout _layout;
+	StaticLine _text1;
+	StaticLine _text2;
+	StaticLine _text3;
+	OperFileNameWin _from, _to;
+	StaticLine _countWin;
+	NCProgressWin _progressWin;
+	StaticLine _text4; // заголовок перед счётчиком общего размера
+	StaticLine _countSize;  // счётчик общего размера
+	NCProgressWin _progressWinTotal;
+	StaticLine _speedStr;
+	StaticLine _verifyStr;
+	enum
+	{
+		SPEED_NODE_COUNT = 10
+	};
+	struct SpeedNode
+	{
+		unsigned deltaMs;
+		int64_t bytes;
+		SpeedNode(): deltaMs( 0 ), bytes( 0 ) {}
+	} _speedList[SPEED_NODE_COUNT];
+
+	unsigned _lastMs;
+
+public:
+	CopyDialog( NCDialogParent* parent, bool move = false )
+		:  SimpleCFThreadWin( parent, move ? _LT( "Move" ) : _LT( "Copy" ) ),
+		   _layout( 9, 2 ),
+		   _text1( 0, this, utf8_to_unicode( move ? _LT( "Moving the file" ) : _LT( "Copying the file" ) ).data() ),
+		   _text2( 0, this, utf8_to_unicode( _LT( "to" ) ).data() ),
+		   _text3( 0, this, utf8_to_unicode( _LT( "Files processed" ) ).data() ),
+		   _from( this ),
+		   _to( this ),
+		   _countWin( 0, this, utf8_to_unicode( "0 / 0" ).data() ),
+		   _progressWin( this ),
+		   _text4( 0, this, utf8_to_unicode( _LT( "Total progress" ) ).data() ),
+		   _countSize( 0, this, utf8_to_unicode( "0 / 0" ).data() ),
+		   _progressWinTotal( this ),
+		   _speedStr( uiValue, this, 0, 0, StaticLine::LEFT, 10 ),
+		   _verifyStr( 0, this, 0 ),
+		   _lastMs( GetTickMiliseconds() )
+	{
+		_layout.AddWin( &_text1, 0, 0, 0, 1 );
+		_layout.AddWin( &_from, 1, 0, 1, 1 );
+		_layout.AddWin( &_text2, 2, 0, 2, 1 );
+		_layout.AddWin( &_to, 3, 0, 3, 1 );
+		_layout.AddWin( &_progressWin, 4, 0, 4, 1 );
+		_layout.AddWin( &_text4, 5, 0 );
+		_layout.AddWin( &_countSize, 5, 1 );
+		_layout.AddWin( &_progressWinTotal, 6, 0, 6, 1 );
+		_layout.AddWin( &_text3, 7, 0 );
+		_layout.AddWin( &_countWin, 7, 1 );
+		_layout.AddWin( &_speedStr, 8, 0 );
+		_layout.AddWin( &_verifyStr, 8, 1 );
+		_text1.Show();
+		_text1.Enable();
+		_text2.Show();
+		_text2.Enable();
+		_text3.Show();
+		_text3.Enable();
+		_from.Show();
+		_from.Enable();
+		_to.Show();
+		_to.Enable();
+		_countWin.Show();
+		_countWin.Enable();
+		_progressWin.Show();
+		_progressWin.Enable();
+		_text4.Show();
+		_text4.Enable();
+		_countSize.Show();
+		_countSize.Enable();
+		if ( g_WcmConfig.systemTotalProgressIndicator ) { // общий индикатор копирования
+			_progressWinTotal.Show();
+			_progressWinTotal.Enable();
+		}
+		_speedStr.Show();
+		_speedStr.Enable();
+		if ( g_WcmConfig.systemVerifyCopy ) {
+			_verifyStr.Show();
+			_verifyStr.Enable();
+		}
+		AddLayout( &_layout );
+		SetTimer( 1, 1000 );
+		SetPosition();
+	}
+
+	virtual void OperThreadSignal( int info );
+	virtual void EventTimer( int tid );
+	virtual ~CopyDialog();
+};
+
+#define GIG (int64_t(1024)*1024*1024)
+#define MEG (int64_t(1024)*1024)
+#define KIL (int64_t(1024))
+
+static std::string GetSmallPrintableSpeedStr( int64_t Speed )
+{
+	if ( Speed >= GIG )
+	{
+		return ToString( double(Speed)/double(GIG), 1 ) + " Gb/s";
+	}
+	else if ( Speed >= MEG )
+	{
+		return ToString( double(Speed) / double(MEG), 1 ) + " Mb/s";
+	}
+	else if ( Speed >= KIL )
+	{
+		return ToString( double(Speed) / double(KIL), 1 ) + " Kb/s";
+	}
+
+	return ToString( Speed ) + " Bytes/s";
+}
+
+void CopyDialog::EventTimer( int tid )
+{
+	if ( tid == 1 )
+	{
+		unsigned ms = 0;
+		int64_t bytes = 0;
+
+		{
+			MutexLock lock( &threadData.infoMutex );
+			ms = threadData.infoMs;
+			bytes = threadData.infoBytes;
+			threadData.infoBytes = 0;
+			lock.Unlock();
+		}
+
+		//shift
+		int i;
+
+		for ( i = SPEED_NODE_COUNT - 1; i > 0; i-- )
+		{
+			_speedList[i] = _speedList[i - 1];
+		}
+
+		_speedList[0].bytes = bytes;
+
+		if ( bytes > 0 )
+		{
+			unsigned n = ms - _lastMs;
+			_speedList[0].deltaMs = n > 1000000 ? 0 : n;
+			_lastMs = ms;
+		}
+		else
+		{
+			_speedList[0].deltaMs = 0;
+		}
+
+		int64_t sumBytes = 0;
+		int64_t sumMs = 0;
+
+		for ( i = 0; i < SPEED_NODE_COUNT; i++ )
+		{
+			sumMs += _speedList[i].deltaMs;
+			sumBytes += _speedList[i].bytes;
+		}
+
+		int64_t speed = 0;
+
+		if ( sumMs > 0 && sumBytes > 0 )
+		{
+			speed = ( sumBytes * 1000 ) / sumMs;
+		}
+
+		_speedStr.SetText( utf8str_to_unicode( GetSmallPrintableSpeedStr( speed ) ).data() );
+
+		return;
+	}
+}
+
+void CopyDialog::OperThreadSignal( int info )
+{
+	if ( info == INFO_NEXTFILE )
 	{
-		cpoint size;
-		size.x = 10;
-		size.y = 16;
-		LSize ls( size );
-		ls.x.maximal = 1000;
-		SetLSize( ls );
+		MutexLock lock( &threadData.infoMutex );
+
+		if ( threadData.pathChanged )
+		{
+			_from.SetText( threadData.infoSrcUri.GetUnicode() );
+			_to.SetText( threadData.infoDstUri.GetUnicode() );
+			if ( g_WcmConfig.systemTotalProgressIndicator ) { // Если нужен общий индикатор -- то отображаем счетчик " / всего файлов"
+				_countWin.SetText(utf8str_to_unicode(ToStringGrouped(threadData.infoCount) + " / " + ToStringGrouped(threadData.infoFilesAll)).data());
+			} else {
+				_countWin.SetText(utf8str_to_unicode(ToStringGrouped(threadData.infoCount)).data());
+			}
+			threadData.pathChanged = false;
+		}
+
+		if ( threadData.progressChanged )
+		{
+			_progressWin.SetData( 0, threadData.infoSize, threadData.infoProgress );
+			if ( g_WcmConfig.systemTotalProgressIndicator ) { // Если нужен общий индикатор -- то отображаем счетчик " / всего байт и общий индикатор"
+				_progressWinTotal.SetData( 0, threadData.infoBytesTotalAll, threadData.infoBytesTotal );  // отображаем общий индикатор копирования
+				_countSize.SetText(utf8str_to_unicode(ToStringGrouped(threadData.infoBytesTotal) + " / " + ToStringGrouped(threadData.infoBytesTotalAll)).data()); // текстовый счётчик объёма
+			} else {
+				_countSize.SetText(utf8str_to_unicode(ToStringGrouped(threadData.infoBytesTotal)).data()); // текстовый счётчик объёма
+			}
+			threadData.progressChanged = false;
+		}
+
+		if ( threadData.verifyChanged )
+		{
+			std::string s = std::string( _LT( "Verified" ) ) + ": " + ToStringGrouped( threadData.infoVerified );
+
+			if ( threadData.infoVerifyFailed > 0 )
+			{
+				s += std::string( ", " ) + _LT( "failed" ) + ": " + ToStringGrouped( threadData.infoVerifyFailed );
+			}
+
+			_verifyStr.SetText( utf8str_to_unicode( s ).data() );
+			threadData.verifyChanged = false;
+		}
+	}
+}
+
+CopyDialog::~CopyDialog() {}
+
+static bool IsSameFile( FS* srcFs, FSPath& srcPath, FSStat* srcStat, FS* destFs, FSPath& destPath )
+{
+	if ( srcFs->Type() != destFs->Type() ) { return false; }
+
+#ifndef _WIN32
+
+	if ( destFs->Type() == FS::SYSTEM )
+	{
+		FSStat st;
+		return ( !destFs->Stat( destPath, &st, 0, 0 ) && srcStat->dev == st.dev && srcStat->ino == st.ino );
+	}
+
+#endif
+
+	FSString s = destFs->Uri( destPath );
+	return !srcFs->Uri( srcPath ).Cmp( s );
+}
+
+bool OperCFThread::CopyLink( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath, bool move )
+{
+	ASSERT( srcNode->st.IsLnk() );
+
+	if ( IsSameFile( srcFs, srcPath, &( srcNode->st ), destFs, destPath ) )
+	{
+		RedMessage( _LT( "Can't copy link to itself:\n" ) , srcFs->Uri( srcPath ).GetUtf8() );
+		return false;
+	}
+
+	int ret_err;
+
+	while ( destFs->Symlink( destPath, srcNode->st.link, &ret_err, Info() ) && !skipNonRegular )
+		switch ( RedMessage( _LT( "Can't create symbolic link:\n" ), destFs->Uri( destPath ).GetUtf8(), "to\n",
+		                     srcNode->st.link.GetUtf8(),  bSkipSkipallCancel, destFs->StrError( ret_err ).GetUtf8() ) )
+		{
+			case CMD_CANCEL:
+				return false;
+
+			case CMD_SKIPALL:
+				skipNonRegular = true;
+
+			case CMD_SKIP:
+				return true;
+		}
+
+	return !move || RemoveSource( srcFs, srcPath, false );
+}
+
+
+//#define BUFSIZE (1024*512) //(1024*64)
+
+//inline FSString Err(FS *fs, int err){ return fs->StrError(err); }
+
+bool OperCFThread::CopyFile( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath, bool move, bool delta )
+{
+	if ( !srcNode->st.IsReg() && !skipNonRegular )
+		switch ( RedMessage( _LT( "Can't copy the links or special file:\n" ), srcFs->Uri( srcPath ).GetUtf8(), bSkipSkipallCancel ) )
+		{
+			case CMD_SKIPALL:
+				skipNonRegular = true; // no break
+
+			case CMD_SKIP:
+				return true;
+
+			default:
+				return false;
+		}
+
+	if ( IsSameFile( srcFs, srcPath, &( srcNode->st ), destFs, destPath ) )
+	{
+		RedMessage( _LT( "Can't copy file to itself:\n" ) , srcFs->Uri( srcPath ).GetUtf8() );
+		return false;
+	}
+
+	SendCopyNextFileInfo( srcFs->Uri( srcPath ), destFs->Uri( destPath ) );
+	SendProgressInfo( srcNode->st.size, 0, 0 );
+
+	bool stopped = false;
+
+	int ret_err;
+
+	int in = -1;
+
+	if (destFs->Type() == FS::TYPES::TMP)
+	{
+		// copy and move to tmpfs work the same way. Should we yell on move op instead?
+		FSTmp* destTmpFS = static_cast<FSTmp*>(destFs);
+		if (!destTmpFS->BaseIsEqual(srcFs))
+		{
+			RedMessage(_LT("Temporary panel can store only files from the same file system:\n"));
+			return false;
+		}
+		if (srcFs->Type() == FS::TMP && srcNode->IsReg())
+		{
+			FSString srcFullFSString(srcNode->name.GetUnicode());
+			FSPath srcFullFSPath(srcFullFSString);
+			//srcFullFSPath.dbg_printf("OperCFThread::CopyFile srcFullFSPath=");
+			//destPath.dbg_printf("OperCFThread::CopyFile destPath=");
+			FSPath destDir(destPath);
+			destDir.Pop();
+			return destTmpFS->AddNode(srcFullFSPath, destDir);
+		}
+		else
+			return destTmpFS->AddNode(srcPath, srcNode, destPath);
+	}
+
+	// large files are passed through without pushing everything else out of the cache
+	const int dropBehind = dropBehindSize > 0 && srcNode->st.size >= dropBehindSize ? FS::DROP_BEHIND : 0;
+
+	// a destination keeping the changes until Flush() takes the files one at a time
+	const int streams = destFs->IsWriteDeferred() ? 1 : srcFs->ReadStreams();
+	// nor is such a file there to read back before Flush()
+	const bool check = verify && !destFs->IsWriteDeferred();
+
+	if ( streams > 1 )
+	{
+		if ( !copyScheduler ) { copyScheduler = new CopyScheduler( Info(), streams ); }
+
+		// one connection is left for 'in', the whole operation never reads over more than 'streams'
+		if ( !WaitTransfers( streams - 1 ) ) { return false; }
+	}
+
+	while ( true )
+	{
+		in = srcFs->OpenRead( srcPath, FS::SHARE_READ | dropBehind, &ret_err, Info() );
+
+		if ( in == -2 ) { return false; }
+
+		if ( in >= 0 ) { break; }
+
+		switch ( RedMessage( _LT( "Can't open file:\n" ) , srcFs->Uri( srcPath ).GetUtf8(), bRetrySkipCancel, srcFs->StrError( ret_err ).GetUtf8() ) )
+		{
+			case CMD_CANCEL:
+				return false;
+
+			case CMD_SKIP:
+				return true;
+		}
+	}
+
+	bool overwrite = commitAll;
+
+	if ( delta )
+	{
+		if ( !overwrite )
+			switch ( RedMessage( _LT( "Overwrite file?\n" ) , destFs->Uri( destPath ).GetUtf8(), bOkAllNoCancel ) )
+			{
+				case CMD_ALL:
+					commitAll = true;
+					overwrite = true;
+					break;
+
+				case CMD_OK:
+					overwrite = true;
+					break;
+
+				case CMD_NO:
+					srcFs->Close( in, 0, Info() );
+					return true;
+
+				default:
+					srcFs->Close( in, 0, Info() );
+					return false;
+			}
+
+		int r = CopyDelta( srcFs, srcPath, srcNode, in, destFs, destPath );
+
+		if ( r != 1 )
+		{
+			srcFs->Close( in, 0, Info() );
+
+			if ( r < 0 ) { return false; }
+
+			return r == 2 || !move || RemoveSource( srcFs, srcPath, false );
+		}
+
+		// read again from the start for the whole copy
+		srcFs->Close( in, 0, Info() );
+		in = srcFs->OpenRead( srcPath, FS::SHARE_READ | dropBehind, &ret_err, Info() );
+
+		if ( in < 0 )
+		{
+			return in != -2 && RedMessage( _LT( "Can't open file:\n" ) , srcFs->Uri( srcPath ).GetUtf8(), bSkipCancel, srcFs->StrError( ret_err ).GetUtf8() ) == CMD_SKIP;
+		}
+	}
+
+	int out =  -1;
+
+	out = destFs->OpenCreate( destPath, overwrite, srcNode->st.mode, dropBehind, &ret_err, Info() );
+
+	if ( out < 0 && destFs->IsEEXIST( ret_err ) )
+		switch ( RedMessage( _LT( "Overwrite file?\n" ) , destFs->Uri( destPath ).GetUtf8(), bOkAllNoCancel ) )
+		{
+			case CMD_ALL:
+				commitAll = true; //no break
+
+			case CMD_OK:
+				out = destFs->OpenCreate( destPath, true, srcNode->st.mode, dropBehind, &ret_err, Info() );
+				break;
+
+			case CMD_NO:
+				srcFs->Close( in, 0, Info() );
+				return true;
+
+			default:
+				srcFs->Close( in, 0, Info() );
+				return false;
+		}
+
+	if ( out < 0 )
+	{
+		srcFs->Close( in, 0, Info() );
+		return RedMessage( _LT( "Can't create file:\n" ), destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) == CMD_SKIP;
 	}
 
-	void SetData( int64_t from, int64_t to, int64_t num )
+	if ( streams > 1 )
 	{
-		if ( _from == from && _to == to && _num == num ) { return; }
+		return StartTransfer( srcFs, srcPath, srcNode, in, destFs, destPath, out, move );
+	}
 
-		bool diapazonChanged = _from != from || _to != to;
+	int  bytes;
+	//char    buf[BUFSIZE];
+	int64_t doneBytes = 0;
 
-		_from = from;
-		_to = to;
-		_num = num;
+	int blockSize = STARTSIZE;
+	CopyHash hash;
+	// each run of data is hashed on its own, the holes are neither hashed nor read back
+	std::vector<CopyCheck> checks;
+	int64_t checkStart = 0;
 
-		if ( _num < _from || _to <= _from ) { return; }
+	// holes of a sparse source are not read, the destination gets them by seeking over;
+	// a file without holes has its space reserved at once, so it is not fragmented
+	int64_t dataStart = 0;
+	int64_t holeStart = 0;
+	bool sparse = false;
 
-		int64_t size = _to - _from;
-		int64_t n = ( _lastWidth * _num ) / size;
+	if ( destFs->Flags() & FS::HAVE_SPARSE )
+	{
+		int r = srcFs->FindData( in, 0, &dataStart, &holeStart, 0, Info() );
+		sparse = r == 1 || ( !r && ( dataStart > 0 || holeStart < srcNode->st.size ) );
+	}
 
-		if ( diapazonChanged || _lastPos != n )
+	if ( !sparse ) { destFs->Allocate( out, srcNode->st.size, 0, Info() ); }
+
+	while ( true )
+	{
+		if ( Info()->Stopped() )
 		{
-			Invalidate();
+			stopped = true;
+			goto err;
 		}
-	}
 
-	virtual void Paint( wal::GC& gc, const crect& paintRect );
-	virtual ~NCProgressWin();
-};
+		if ( sparse && doneBytes == holeStart )
+		{
+			int r = srcFs->FindData( in, doneBytes, &dataStart, &holeStart, &ret_err, Info() );
 
+			if ( r == 2 ) { sparse = false; }
 
-inline unsigned MidAB( int a, int b, int i, int n )
-{
-	return n > 1 ? a + ( ( b - a ) * i ) / ( n - 1 ) : a;
-}
+			if ( r < 0 )
+			{
+				if ( r == -2 ||
+				     RedMessage( _LT( "Can't read the file:\n" ), srcFs->Uri( srcPath ).GetUtf8(), bSkipCancel, srcFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP )
+				{
+					stopped = true;
+				}
 
-static void FillHorisont( wal::GC& gc, crect rect, unsigned a, unsigned b )
-{
-	if ( rect.IsEmpty() ) { return; }
+				goto err;
+			}
+		}
 
-	unsigned ar = a & 0xFF,    ag = ( a >> 8 ) & 0xFF, ab = ( a >> 16 ) & 0xFF,
-	         br = b & 0xFF, bg = ( b >> 8 ) & 0xFF, bb = ( b >> 16 ) & 0xFF;
+		if ( sparse && doneBytes < dataStart )
+		{
+			int r = srcFs->Seek( in, FSEEK_BEGIN, dataStart, 0, &ret_err, Info() );
 
-	int h = rect.Height();
-	int x1 = rect.left, x2 = rect.right;
+			if ( r )
+			{
+				if ( r == -2 ||
+				     RedMessage( _LT( "Can't read the file:\n" ), srcFs->Uri( srcPath ).GetUtf8(), bSkipCancel, srcFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP )
+				{
+					stopped = true;
+				}
 
-	if ( h <= 0 || x1 >= x2 ) { return; }
+				goto err;
+			}
 
-	for ( int i = 0; i < h; i++ )
-	{
-		unsigned color = ( MidAB( ar, br, i, h ) & 0xFF ) + ( ( MidAB( ag, bg, i, h ) & 0xFF ) << 8 ) + ( ( MidAB( ab, bb, i, h ) & 0xFF ) << 16 );
-		gc.SetLine( color );
-		gc.MoveTo( x1, rect.top + i );
-		gc.LineTo( x2, rect.top + i );
-	}
+			r = destFs->Seek( out, FSEEK_BEGIN, dataStart, 0, &ret_err, Info() );
 
-}
+			if ( r )
+			{
+				if ( r == -2 || RedMessage( _LT( "Can't write the file:\n" ), destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP )
+				{
+					stopped = true;
+				}
 
-void NCProgressWin::Paint( wal::GC& gc, const crect& paintRect )
-{
-	crect rect = ClientRect();
-	int w = rect.Width();
+				goto err;
+			}
 
-	Draw3DButtonW2( gc, rect, 0x808080, false );
-	rect.Dec();
-	rect.Dec();
-	w -= 2;
+			if ( check && doneBytes > checkStart )
+			{
+				CopyCheck c = { checkStart, doneBytes - checkStart, hash.Digest() };
+				checks.push_back( c );
+				hash = CopyHash();
+			}
 
-	if ( !( _num < _from || _to <= _from || w <= 0 ) )
-	{
-		int64_t size = _to - _from;
-		int n = int( ( w * _num ) / size );
+			checkStart = dataStart;
 
-		crect r = rect;
-		r.right = n;
+			SendProgressInfo( srcNode->st.size, dataStart, dataStart - doneBytes );
+			doneBytes = dataStart;
+		}
 
-		unsigned color = 0xA00000;
-		unsigned bColor = ColorTone( color, -80 ), aColor = ColorTone( color, +80 );
-		FillHorisont( gc, r, aColor, bColor );
+		int size = blockSize;
 
-		_lastWidth = w;
-		_lastPos = n;
-		rect.left += n;
-	}
+		if ( sparse && holeStart - doneBytes < size ) { size = int( holeStart - doneBytes ); }
 
-	unsigned color = 0xB0B0B0;
-	unsigned bColor = ColorTone( color, +50 ), aColor = ColorTone( color, -50 );
-	FillHorisont( gc, rect, aColor, bColor );
+		time_t timeStart = time( 0 );
 
-}
+		if ( ( bytes = size > 0 ? srcFs->Read( in, _buffer, size, &ret_err, Info() ) : 0 ) < 0 )
+		{
+			if ( bytes == -2 ||
+			     RedMessage( _LT( "Can't read the file:\n" ), srcFs->Uri( srcPath ).GetUtf8(), bSkipCancel, srcFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP )
+			{
+				stopped = true;
+			}
 
-NCProgressWin::~NCProgressWin() {}
+			goto err;
+		}
 
+		if ( !bytes ) { break; }
 
-class CopyDialog: public SimpleCFThreadWin
-{
-	Layout _layout;
-	StaticLine _text1;
-	StaticLine _text2;
-	StaticLine _text3;
-	OperFileNameWin _from, _to;
-	StaticLine _countWin;
-	NCProgressWin _progressWin;
-	StaticLine _text4; // заголовок перед счётчиком общего размера
-	StaticLine _countSize;  // счётчик общего размера
-	NCProgressWin _progressWinTotal;
-	StaticLine _speedStr;
-	enum
-	{
-		SPEED_NODE_COUNT = 10
-	};
-	struct SpeedNode
-	{
-		unsigned deltaMs;
-		int64_t bytes;
-		SpeedNode(): deltaMs( 0 ), bytes( 0 ) {}
-	} _speedList[SPEED_NODE_COUNT];
+		int b;
 
-	unsigned _lastMs;
+		if ( ( b = destFs->Write( out, _buffer, bytes, &ret_err, Info() ) ) < 0 )
+		{
+			if ( b == -2 || RedMessage( _LT( "Can't write the file:\n" ), destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP )
+			{
+				stopped = true;
+			}
 
-public:
-	CopyDialog( NCDialogParent* parent, bool move = false )
-		:  SimpleCFThreadWin( parent, move ? _LT( "Move" ) : _LT( "Copy" ) ),
-		   _layout( 9, 2 ),
-		   _text1( 0, this, utf8_to_unicode( move ? _LT( "Moving the file" ) : _LT( "Copying the file" ) ).data() ),
-		   _text2( 0, this, utf8_to_unicode( _LT( "to" ) ).data() ),
-		   _text3( 0, this, utf8_to_unicode( _LT( "Files processed" ) ).data() ),
-		   _from( this ),
-		   _to( this ),
-		   _countWin( 0, this, utf8_to_unicode( "0 / 0" ).data() ),
-		   _progressWin( this ),
-		   _text4( 0, this, utf8_to_unicode( _LT( "Total progress" ) ).data() ),
-		   _countSize( 0, this, utf8_to_unicode( "0 / 0" ).data() ),
-		   _progressWinTotal( this ),
-		   _speedStr( uiValue, this, 0, 0, StaticLine::LEFT, 10 ),
-		   _lastMs( GetTickMiliseconds() )
-	{
-		_layout.AddWin( &_text1, 0, 0, 0, 1 );
-		_layout.AddWin( &_from, 1, 0, 1, 1 );
-		_layout.AddWin( &_text2, 2, 0, 2, 1 );
-		_layout.AddWin( &_to, 3, 0, 3, 1 );
-		_layout.AddWin( &_progressWin, 4, 0, 4, 1 );
-		_layout.AddWin( &_text4, 5, 0 );
-		_layout.AddWin( &_countSize, 5, 1 );
-		_layout.AddWin( &_progressWinTotal, 6, 0, 6, 1 );
-		_layout.AddWin( &_text3, 7, 0 );
-		_layout.AddWin( &_countWin, 7, 1 );
-		_layout.AddWin( &_speedStr, 8, 0 );
-		_text1.Show();
-		_text1.Enable();
-		_text2.Show();
-		_text2.Enable();
-		_text3.Show();
-		_text3.Enable();
-		_from.Show();
-		_from.Enable();
-		_to.Show();
-		_to.Enable();
-		_countWin.Show();
-		_countWin.Enable();
-		_progressWin.Show();
-		_progressWin.Enable();
-		_text4.Show();
-		_text4.Enable();
-		_countSize.Show();
-		_countSize.Enable();
-		if ( g_WcmConfig.systemTotalProgressIndicator ) { // общий индикатор копирования
-			_progressWinTotal.Show();
-			_progressWinTotal.Enable();
+			goto err;
 		}
-		_speedStr.Show();
-		_speedStr.Enable();
-		AddLayout( &_layout );
-		SetTimer( 1, 1000 );
-		SetPosition();
-	}
 
-	virtual void OperThreadSignal( int info );
-	virtual void EventTimer( int tid );
-	virtual ~CopyDialog();
-};
 
-#define GIG (int64_t(1024)*1024*1024)
-#define MEG (int64_t(1024)*1024)
-#define KIL (int64_t(1024))
+		if ( b != bytes )
+		{
+			if ( RedMessage( "May be disk full \n(writed bytes != readed bytes)\nwhen write:\n", destFs->Uri( destPath ).GetUtf8(), bSkipCancel ) != CMD_SKIP )
+			{
+				stopped = true;
+			}
 
-static std::string GetSmallPrintableSpeedStr( int64_t Speed )
-{
-	if ( Speed >= GIG )
-	{
-		return ToString( double(Speed)/double(GIG), 1 ) + " Gb/s";
-	}
-	else if ( Speed >= MEG )
-	{
-		return ToString( double(Speed) / double(MEG), 1 ) + " Mb/s";
-	}
-	else if ( Speed >= KIL )
-	{
-		return ToString( double(Speed) / double(KIL), 1 ) + " Kb/s";
-	}
+			goto err;
+		}
 
-	return ToString( Speed ) + " Bytes/s";
-}
+		if ( check ) { hash.Update( _buffer, bytes ); }
 
-void CopyDialog::EventTimer( int tid )
-{
-	if ( tid == 1 )
+		time_t timeStop = time( 0 );
+
+		if ( timeStart == timeStop && blockSize < BSIZE )
+		{
+			blockSize = blockSize * 2;
+
+			if ( blockSize > BSIZE ) { blockSize = BSIZE; }
+		}
+
+		doneBytes += bytes;
+		SendProgressInfo( srcNode->st.size, doneBytes, bytes );
+	}
+
+	// a hole at the end is not written
+	if ( sparse )
 	{
-		unsigned ms = 0;
-		int64_t bytes = 0;
+		int r = destFs->SetSize( out, doneBytes, &ret_err, Info() );
 
+		if ( r < 0 )
 		{
-			MutexLock lock( &threadData.infoMutex );
-			ms = threadData.infoMs;
-			bytes = threadData.infoBytes;
-			threadData.infoBytes = 0;
-			lock.Unlock();
+			if ( r == -2 || RedMessage( _LT( "Can't write the file:\n" ), destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP )
+			{
+				stopped = true;
+			}
+
+			goto err;
 		}
+	}
 
-		//shift
-		int i;
+	srcFs->Close( in, 0, Info() );
+	in = -1;
 
-		for ( i = SPEED_NODE_COUNT - 1; i > 0; i-- )
-		{
-			_speedList[i] = _speedList[i - 1];
-		}
+	SendProgressInfo( srcNode->st.size, srcNode->st.size, 0 );
 
-		_speedList[0].bytes = bytes;
+	{
+		int r = destFs->Close( out, &ret_err, Info() );
 
-		if ( bytes > 0 )
+		if ( r )
 		{
-			unsigned n = ms - _lastMs;
-			_speedList[0].deltaMs = n > 1000000 ? 0 : n;
-			_lastMs = ms;
+			if ( r == -2 || RedMessage( "Can't close the file:\n", destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP )
+			{
+				stopped = true;
+			}
+
+			goto err;
 		}
 		else
 		{
-			_speedList[0].deltaMs = 0;
+			out = -1;
 		}
+	}
 
-		int64_t sumBytes = 0;
-		int64_t sumMs = 0;
-
-		for ( i = 0; i < SPEED_NODE_COUNT; i++ )
+	if ( check )
+	{
+		if ( doneBytes > checkStart || checks.empty() )
 		{
-			sumMs += _speedList[i].deltaMs;
-			sumBytes += _speedList[i].bytes;
+			CopyCheck c = { checkStart, doneBytes - checkStart, hash.Digest() };
+			checks.push_back( c );
 		}
 
-		int64_t speed = 0;
+		int v = VerifyCopy( destFs, destPath, checks );
 
-		if ( sumMs > 0 && sumBytes > 0 )
+		if ( v )
 		{
-			speed = ( sumBytes * 1000 ) / sumMs;
+			stopped = v < 0;
+			goto err;
 		}
+	}
 
-		_speedStr.SetText( utf8str_to_unicode( GetSmallPrintableSpeedStr( speed ) ).data() );
+	destFs->SetFileTime( destPath, srcNode->st.m_CreationTime, srcNode->st.m_LastWriteTime, srcNode->st.m_LastWriteTime, 0, Info() );
 
-		return;
-	}
+	return !move || RemoveSource( srcFs, srcPath, false );
+
+err:
+
+	if ( in >= 0 ) { srcFs->Close( in, 0, Info() ); }
+
+	if ( out >= 0 ) { destFs->Close( out, 0, Info() ); }
+
+	Unlink( destFs, destPath );
+
+	return !stopped;
 }
 
-void CopyDialog::OperThreadSignal( int info )
+int OperCFThread::VerifyCopy( FS* fs, FSPath& path, std::vector<CopyCheck>& checks )
 {
-	if ( info == INFO_NEXTFILE )
+	int ret_err = 0;
+	int r = 0; // 1 - differs, -1 - read error, -2 - stopped
+	int in = fs->OpenRead( path, FS::NO_CACHE, &ret_err, Info() );
+
+	if ( in < 0 ) { r = in; }
+
+	for ( size_t i = 0; !r && i < checks.size(); i++ )
 	{
-		MutexLock lock( &threadData.infoMutex );
+		CopyCheck& c = checks[i];
+		CopyHash hash;
 
-		if ( threadData.pathChanged )
-		{
-			_from.SetText( threadData.infoSrcUri.GetUnicode() );
-			_to.SetText( threadData.infoDstUri.GetUnicode() );
-			if ( g_WcmConfig.systemTotalProgressIndicator ) { // Если нужен общий индикатор -- то отображаем счетчик " / всего файлов"
-				_countWin.SetText(utf8str_to_unicode(ToStringGrouped(threadData.infoCount) + " / " + ToStringGrouped(threadData.infoFilesAll)).data());
-			} else {
-				_countWin.SetText(utf8str_to_unicode(ToStringGrouped(threadData.infoCount)).data());
-			}
-			threadData.pathChanged = false;
-		}
+		if ( c.offset && fs->Seek( in, FSEEK_BEGIN, c.offset, 0, &ret_err, Info() ) ) { r = -1; break; }
 
-		if ( threadData.progressChanged )
+		for ( int64_t left = c.size; left > 0; )
 		{
-			_progressWin.SetData( 0, threadData.infoSize, threadData.infoProgress );
-			if ( g_WcmConfig.systemTotalProgressIndicator ) { // Если нужен общий индикатор -- то отображаем счетчик " / всего байт и общий индикатор"
-				_progressWinTotal.SetData( 0, threadData.infoBytesTotalAll, threadData.infoBytesTotal );  // отображаем общий индикатор копирования
-				_countSize.SetText(utf8str_to_unicode(ToStringGrouped(threadData.infoBytesTotal) + " / " + ToStringGrouped(threadData.infoBytesTotalAll)).data()); // текстовый счётчик объёма
-			} else {
-				_countSize.SetText(utf8str_to_unicode(ToStringGrouped(threadData.infoBytesTotal)).data()); // текстовый счётчик объёма
-			}
-			threadData.progressChanged = false;
+			if ( Info()->Stopped() ) { r = -2; break; }
+
+			int n = fs->Read( in, _buffer, left < BSIZE ? int( left ) : BSIZE, &ret_err, Info() );
+
+			if ( n < 0 ) { r = n; break; }
+
+			if ( !n ) { r = 1; break; } // shorter than it was written
+
+			hash.Update( _buffer, n );
+			left -= n;
 		}
+
+		if ( !r && hash.Digest() != c.hash ) { r = 1; }
 	}
-}
 
-CopyDialog::~CopyDialog() {}
+	if ( in >= 0 ) { fs->Close( in, 0, Info() ); }
 
-static bool IsSameFile( FS* srcFs, FSPath& srcPath, FSStat* srcStat, FS* destFs, FSPath& destPath )
-{
-	if ( srcFs->Type() != destFs->Type() ) { return false; }
+	if ( r == -2 ) { return -1; }
 
-#ifndef _WIN32
+	SendVerifyInfo( !r );
 
-	if ( destFs->Type() == FS::SYSTEM )
-	{
-		FSStat st;
-		return ( !destFs->Stat( destPath, &st, 0, 0 ) && srcStat->dev == st.dev && srcStat->ino == st.ino );
-	}
+	if ( !r ) { return 0; }
 
-#endif
+	int cmd = ( r > 0 ) ?
+	          RedMessage( _LT( "The copy differs from the source:\n" ), fs->Uri( path ).GetUtf8(), bSkipCancel ) :
+	          RedMessage( _LT( "Can't verify the file:\n" ), fs->Uri( path ).GetUtf8(), bSkipCancel, fs->StrError( ret_err ).GetUtf8() );
 
-	FSString s = destFs->Uri( destPath );
-	return !srcFs->Uri( srcPath ).Cmp( s );
+	return cmd == CMD_SKIP ? 1 : -1;
 }
 
-bool OperCFThread::CopyLink( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath, bool move )
+int OperCFThread::CopyDelta( FS* srcFs, FSPath& srcPath, FSNode* srcNode, int in, FS* destFs, FSPath& destPath )
 {
-	ASSERT( srcNode->st.IsLnk() );
+	int ret_err;
+	int old = destFs->OpenRead( destPath, FS::SHARE_READ, &ret_err, Info() );
 
-	if ( IsSameFile( srcFs, srcPath, &( srcNode->st ), destFs, destPath ) )
+	if ( old == -2 ) { return -1; }
+
+	if ( old < 0 ) { return 1; }
+
+	int out = destFs->OpenCreate( destPath, true, srcNode->st.mode, FS::UPDATE, &ret_err, Info() );
+
+	if ( out < 0 )
 	{
-		RedMessage( _LT( "Can't copy link to itself:\n" ) , srcFs->Uri( srcPath ).GetUtf8() );
-		return false;
+		destFs->Close( old, 0, Info() );
+		return out == -2 ? -1 : 1;
 	}
 
-	int ret_err;
+	// the source block goes to the first half of the buffer, the old one to the second
+	const int size = BSIZE / 2;
+	int64_t pos = 0;
+	int ret = 0;
+	CopyHash hash;
 
-	while ( destFs->Symlink( destPath, srcNode->st.link, &ret_err, Info() ) && !skipNonRegular )
-		switch ( RedMessage( _LT( "Can't create symbolic link:\n" ), destFs->Uri( destPath ).GetUtf8(), "to\n",
-		                     srcNode->st.link.GetUtf8(),  bSkipSkipallCancel, destFs->StrError( ret_err ).GetUtf8() ) )
-		{
-			case CMD_CANCEL:
-				return false;
+	while ( true )
+	{
+		if ( Info()->Stopped() ) { ret = -1; break; }
 
-			case CMD_SKIPALL:
-				skipNonRegular = true;
+		int n = ReadFull( srcFs, in, _buffer, size, &ret_err, Info() );
 
-			case CMD_SKIP:
-				return true;
+		if ( n < 0 )
+		{
+			ret = ( n == -2 || RedMessage( _LT( "Can't read the file:\n" ), srcFs->Uri( srcPath ).GetUtf8(), bSkipCancel, srcFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP ) ? -1 : 2;
+			break;
 		}
 
-	return !move || Unlink( srcFs, srcPath );
-}
-
+		if ( !n ) { break; }
 
-//#define BUFSIZE (1024*512) //(1024*64)
+		int m = ReadFull( destFs, old, _buffer + size, n, &ret_err, Info() );
 
-//inline FSString Err(FS *fs, int err){ return fs->StrError(err); }
+		if ( m == -2 ) { ret = -1; break; }
 
-bool OperCFThread::CopyFile( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath, bool move )
-{
-	if ( !srcNode->st.IsReg() && !skipNonRegular )
-		switch ( RedMessage( _LT( "Can't copy the links or special file:\n" ), srcFs->Uri( srcPath ).GetUtf8(), bSkipSkipallCancel ) )
+		if ( m != n || memcmp( _buffer, _buffer + size, n ) )
 		{
-			case CMD_SKIPALL:
-				skipNonRegular = true; // no break
+			int w = destFs->Seek( out, FSEEK_BEGIN, pos, 0, &ret_err, Info() );
 
-			case CMD_SKIP:
-				return true;
+			if ( !w ) { w = destFs->Write( out, _buffer, n, &ret_err, Info() ); }
 
-			default:
-				return false;
+			if ( w < 0 || w != n )
+			{
+				ret = ( w == -2 || RedMessage( _LT( "Can't write the file:\n" ), destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP ) ? -1 : 2;
+				break;
+			}
 		}
 
-	if ( IsSameFile( srcFs, srcPath, &( srcNode->st ), destFs, destPath ) )
+		if ( verify ) { hash.Update( _buffer, n ); }
+
+		pos += n;
+		SendProgressInfo( srcNode->st.size, pos, n );
+	}
+
+	// the source changed its size since it was listed, the rest of the old file would stay
+	if ( !ret && pos != srcNode->st.size ) { ret = 1; }
+
+	destFs->Close( old, 0, Info() );
+
+	if ( destFs->Close( out, &ret_err, Info() ) && !ret )
 	{
-		RedMessage( _LT( "Can't copy file to itself:\n" ) , srcFs->Uri( srcPath ).GetUtf8() );
-		return false;
+		ret = RedMessage( "Can't close the file:\n", destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP ? -1 : 2;
 	}
 
-	SendCopyNextFileInfo( srcFs->Uri( srcPath ), destFs->Uri( destPath ) );
-	SendProgressInfo( srcNode->st.size, 0, 0 );
+	if ( !ret && verify )
+	{
+		std::vector<CopyCheck> checks( 1 );
+		checks[0].offset = 0;
+		checks[0].size = pos;
+		checks[0].hash = hash.Digest();
 
-	bool stopped = false;
+		int v = VerifyCopy( destFs, destPath, checks );
+
+		if ( v ) { ret = v < 0 ? -1 : 2; }
+	}
 
+	// a file left half updated is kept rather than losing the blocks not rewritten yet,
+	// it has the time of the update, so the next sync takes it again
+
+	if ( !ret ) { destFs->SetFileTime( destPath, srcNode->st.m_CreationTime, srcNode->st.m_LastWriteTime, srcNode->st.m_LastWriteTime, 0, Info() ); }
+
+	return ret;
+}
+
+bool OperCFThread::PlanSync( FS* srcFs, FSPath& srcDir, FSList* list, FS* destFs, FSPath& destDir, bool move, std::vector<char>& plan )
+{
+	plan.clear();
+
+	if ( !skipUnchanged || destFs->Type() == FS::TMP ) { return true; }
+
+	// one listing of the destination instead of a Stat of each file
+	FSList destList;
 	int ret_err;
+	int r = destFs->ReadDir( &destList, destDir, &ret_err, Info() );
 
-	int in = -1;
+	if ( r == -2 ) { return false; }
 
-	if (destFs->Type() == FS::TYPES::TMP)
+	if ( r ) { return true; } // the copy reports it
+
+	std::unordered_map<std::string, FSNode*> dest;
+
+	for ( FSNode* p = destList.First(); p; p = p->next )
 	{
-		// copy and move to tmpfs work the same way. Should we yell on move op instead?
-		FSTmp* destTmpFS = static_cast<FSTmp*>(destFs);
-		if (!destTmpFS->BaseIsEqual(srcFs))
-		{
-			RedMessage(_LT("Temporary panel can store only files from the same file system:\n"));
-			return false;
-		}
-		if (srcFs->Type() == FS::TMP && srcNode->IsReg())
+		const char* name = p->name.GetUtf8();
+
+		if ( name ) { dest[name] = p; }
+	}
+
+	plan.assign( list->Count(), SYNC_COPY );
+
+	std::vector<SyncCompare> compare;
+	int n = 0;
+
+	for ( FSNode* node = list->First(); node; node = node->next, n++ )
+	{
+		if ( !node->IsReg() ) { continue; }
+
+		auto it = dest.find( node->name.GetUtf8() );
+
+		if ( it == dest.end() || !it->second->IsReg() || it->second->st.size != node->st.size ) { continue; }
+
+		// a changed file of the same size is likely changed in a few places
+		int changed = ( node->st.size >= DELTA_MIN && destFs->Type() == FS::SYSTEM ) ? SYNC_DELTA : SYNC_COPY;
+
+		// a skipped file of a move loses its source, the size and time alone do not make it the same
+		if ( !compareContent && !move )
 		{
-			FSString srcFullFSString(srcNode->name.GetUnicode());
-			FSPath srcFullFSPath(srcFullFSString);
-			//srcFullFSPath.dbg_printf("OperCFThread::CopyFile srcFullFSPath=");
-			//destPath.dbg_printf("OperCFThread::CopyFile destPath=");
-			FSPath destDir(destPath);
-			destDir.Pop();
-			return destTmpFS->AddNode(srcFullFSPath, destDir);
+			plan[n] = SameTime( node->st.m_LastWriteTime, it->second->st.m_LastWriteTime ) ? SYNC_SKIP : changed;
+			continue;
 		}
-		else
-			return destTmpFS->AddNode(srcPath, srcNode, destPath);
+
+		plan[n] = changed;
+
+		SyncCompare c;
+		c.index = n;
+		c.srcPath = srcDir;
+		c.srcPath.PushStr( node->Name() );
+		c.destPath = destDir;
+		c.destPath.PushStr( node->Name() );
+		c.same = 0;
+		compare.push_back( c );
 	}
 
-	while ( true )
-	{
-		in = srcFs->OpenRead( srcPath, FS::SHARE_READ, &ret_err, Info() );
+	if ( compare.empty() ) { return true; }
 
-		if ( in == -2 ) { return false; }
+	SyncCompareRun run;
+	run.srcFs = srcFs;
+	run.destFs = destFs;
+	run.info = Info();
+	run.list = &compare;
+	run.next = 0;
 
-		if ( in >= 0 ) { break; }
+	// the other file systems share one connection, the files are compared here one by one
+	std::vector<thread_t> threads;
 
-		switch ( RedMessage( _LT( "Can't open file:\n" ) , srcFs->Uri( srcPath ).GetUtf8(), bRetrySkipCancel, srcFs->StrError( ret_err ).GetUtf8() ) )
+	if ( srcFs->Type() == FS::SYSTEM && destFs->Type() == FS::SYSTEM )
+	{
+		int workers = ( int )std::thread::hardware_concurrency();
+
+		if ( workers > 8 ) { workers = 8; }
+
+		for ( int i = 1; i < workers && i < ( int )compare.size(); i++ )
 		{
-			case CMD_CANCEL:
-				return false;
+			thread_t th;
 
-			case CMD_SKIP:
-				return true;
+			if ( !thread_create( &th, SyncCompareFunc, &run ) ) { threads.push_back( th ); }
 		}
 	}
 
-	int out =  -1;
+	SyncCompareFunc( &run );
 
-	out = destFs->OpenCreate( destPath, false | commitAll, srcNode->st.mode, 0, &ret_err, Info() );
+	for ( thread_t th : threads )
+	{
+		void* ret;
+		thread_join( th, &ret );
+	}
 
-	if ( out < 0 && destFs->IsEEXIST( ret_err ) )
-		switch ( RedMessage( _LT( "Overwrite file?\n" ) , destFs->Uri( destPath ).GetUtf8(), bOkAllNoCancel ) )
-		{
-			case CMD_ALL:
-				commitAll = true; //no break
+	for ( SyncCompare& c : compare )
+	{
+		if ( c.same == -2 ) { return false; }
 
-			case CMD_OK:
-				out = destFs->OpenCreate( destPath, true, srcNode->st.mode, 0, &ret_err, Info() );
-				break;
+		if ( c.same > 0 ) { plan[c.index] = SYNC_SKIP; }
+	}
 
-			case CMD_NO:
-				srcFs->Close( in, 0, Info() );
-				return true;
+	return true;
+}
 
-			default:
-				srcFs->Close( in, 0, Info() );
-				return false;
-		}
+bool OperCFThread::StartTransfer( FS* srcFs, FSPath& srcPath, FSNode* srcNode, int in, FS* destFs, FSPath& destPath, int out, bool move )
+{
+	CopyTransfer* t = new CopyTransfer();
+	t->srcFs = srcFs;
+	t->srcPath = srcPath;
+	t->destFs = destFs;
+	t->destPath = destPath;
+	t->st = srcNode->st;
+	t->in = in;
+	t->out = out;
+	t->move = move;
+	t->verify = verify;
 
-	if ( out < 0 )
+	// a large file is read in parts from several offsets at once and written to its place in 'out',
+	// Add() leaves it only the connections the other transfers do not hold
+	int segments = 1;
+
+	if ( ( srcFs->Flags() & FS::HAVE_SEEK ) && ( destFs->Flags() & FS::HAVE_SEEK ) )
 	{
-		srcFs->Close( in, 0, Info() );
-		return RedMessage( _LT( "Can't create file:\n" ), destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) == CMD_SKIP;
+		int64_t n = t->st.size / CopyScheduler::SEGMENT_MIN;
+		int streams = srcFs->ReadStreams();
+		segments = n < streams ? int( n ) : streams;
 	}
 
-	int  bytes;
-	//char    buf[BUFSIZE];
-	int64_t doneBytes = 0;
+	copyScheduler->Add( t, segments );
 
-	int blockSize = STARTSIZE;
+	return true;
+}
 
-	while ( true )
+bool OperCFThread::FinishTransfer( CopyTransfer* t )
+{
+	bool stopped = false;
+	int ret_err;
+
+	t->srcFs->Close( t->in, 0, Info() );
+
+	switch ( t->status )
 	{
-		if ( Info()->Stopped() )
+		case CopyTransfer::OK:
 		{
-			stopped = true;
-			goto err;
-		}
+			int r = t->destFs->Close( t->out, &ret_err, Info() );
+			t->out = -1;
 
-		time_t timeStart = time( 0 );
+			int v = ( !r && t->verify ) ? VerifyCopy( t->destFs, t->destPath, t->checks ) : 0;
+
+			if ( v )
+			{
+				stopped = v < 0;
+				break;
+			}
+
+			if ( !r )
+			{
+				t->destFs->SetFileTime( t->destPath, t->st.m_CreationTime, t->st.m_LastWriteTime, t->st.m_LastWriteTime, 0, Info() );
+				bool ok = !t->move || RemoveSource( t->srcFs, t->srcPath, false );
+				delete t;
+				return ok;
+			}
 
-		if ( ( bytes = srcFs->Read( in, _buffer, blockSize, &ret_err, Info() ) ) < 0 )
-		{
-			if ( bytes == -2 ||
-			     RedMessage( _LT( "Can't read the file:\n" ), srcFs->Uri( srcPath ).GetUtf8(), bSkipCancel, srcFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP )
+			if ( r == -2 || RedMessage( "Can't close the file:\n", t->destFs->Uri( t->destPath ).GetUtf8(), bSkipCancel, t->destFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP )
 			{
 				stopped = true;
 			}
 
-			goto err;
+			break;
 		}
 
-		if ( !bytes ) { break; }
+		case CopyTransfer::READ_ERROR:
+			if ( RedMessage( _LT( "Can't read the file:\n" ), t->srcFs->Uri( t->srcPath ).GetUtf8(), bSkipCancel, t->srcFs->StrError( t->err ).GetUtf8() ) != CMD_SKIP )
+			{
+				stopped = true;
+			}
 
-		int b;
+			break;
 
-		if ( ( b = destFs->Write( out, _buffer, bytes, &ret_err, Info() ) ) < 0 )
-		{
-			if ( b == -2 || RedMessage( _LT( "Can't write the file:\n" ), destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP )
+		case CopyTransfer::WRITE_ERROR:
+			if ( RedMessage( _LT( "Can't write the file:\n" ), t->destFs->Uri( t->destPath ).GetUtf8(), bSkipCancel, t->destFs->StrError( t->err ).GetUtf8() ) != CMD_SKIP )
 			{
 				stopped = true;
 			}
 
-			goto err;
-		}
-
+			break;
 
-		if ( b != bytes )
-		{
-			if ( RedMessage( "May be disk full \n(writed bytes != readed bytes)\nwhen write:\n", destFs->Uri( destPath ).GetUtf8(), bSkipCancel ) != CMD_SKIP )
+		case CopyTransfer::SHORT_WRITE:
+			if ( RedMessage( "May be disk full \n(writed bytes != readed bytes)\nwhen write:\n", t->destFs->Uri( t->destPath ).GetUtf8(), bSkipCancel ) != CMD_SKIP )
 			{
 				stopped = true;
 			}
 
-			goto err;
-		}
-
-		time_t timeStop = time( 0 );
+			break;
 
-		if ( timeStart == timeStop && blockSize < BSIZE )
-		{
-			blockSize = blockSize * 2;
+		default:
+			stopped = true;
+	}
 
-			if ( blockSize > BSIZE ) { blockSize = BSIZE; }
-		}
+	if ( t->out >= 0 ) { t->destFs->Close( t->out, 0, Info() ); }
 
-		doneBytes += bytes;
-		SendProgressInfo( srcNode->st.size, doneBytes, bytes );
-	}
+	Unlink( t->destFs, t->destPath );
+	delete t;
 
-	srcFs->Close( in, 0, Info() );
-	in = -1;
+	return !stopped;
+}
 
-	SendProgressInfo( srcNode->st.size, srcNode->st.size, 0 );
+void OperCFThread::CancelTransfers()
+{
+	copyScheduler->Cancel();
 
+	while ( true )
 	{
-		int r = destFs->Close( out, &ret_err, Info() );
+		CopyTransfer* t;
 
-		if ( r )
+		while ( ( t = copyScheduler->TakeFinished() ) != 0 )
 		{
-			if ( r == -2 || RedMessage( "Can't close the file:\n", destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP )
+			// no questions here, files that were not complete are removed
+			t->srcFs->Close( t->in, 0, Info() );
+
+			if ( t->destFs->Close( t->out, 0, Info() ) || t->status != CopyTransfer::OK )
 			{
-				stopped = true;
+				t->destFs->Delete( t->destPath, 0, Info() );
+			}
+			else
+			{
+				t->destFs->SetFileTime( t->destPath, t->st.m_CreationTime, t->st.m_LastWriteTime, t->st.m_LastWriteTime, 0, Info() );
 			}
 
-			goto err;
+			delete t;
 		}
-		else
+
+		if ( !copyScheduler->Active() ) { break; }
+
+		copyScheduler->WaitChange();
+	}
+}
+
+bool OperCFThread::WaitTransfers( int maxStreams )
+{
+	if ( !copyScheduler ) { return true; }
+
+	while ( true )
+	{
+		CopyTransfer* t;
+
+		while ( ( t = copyScheduler->TakeFinished() ) != 0 )
 		{
-			out = -1;
+			if ( !FinishTransfer( t ) )
+			{
+				CancelTransfers();
+				return false;
+			}
 		}
+
+		if ( copyScheduler->Streams() <= maxStreams ) { return true; }
+
+		copyScheduler->WaitChange();
+
+		int64_t size, done, bytes;
+		copyScheduler->GetProgress( &size, &done, &bytes );
+		SendProgressInfo( size, done, bytes );
 	}
+}
 
-	destFs->SetFileTime( destPath, srcNode->st.m_CreationTime, srcNode->st.m_LastWriteTime, srcNode->st.m_LastWriteTime, 0, Info() );
+bool OperCFThread::RemoveSource( FS* fs, FSPath& path, bool dir )
+{
+	if ( removeAfterFlush )
+	{
+		MoveRemoval r = { fs, path, dir, 0 };
+		removeAfterFlush->push_back( r );
+		return true;
+	}
 
-	return !move || Unlink( srcFs, srcPath );
+	// FSSys, or an FS keeping a pool of connections for several streams
+	bool background = ( fs->Type() == FS::SYSTEM || fs->ReadStreams() > 1 ) && !fs->IsWriteDeferred();
 
-err:
+	if ( !background ) { return dir ? RmDir( fs, path ) : Unlink( fs, path ); }
 
-	if ( in >= 0 ) { srcFs->Close( in, 0, Info() ); }
+	if ( !moveRemover ) { moveRemover = new MoveRemover( Info() ); }
 
-	if ( out >= 0 ) { destFs->Close( out, 0, Info() ); }
+	if ( !CheckRemoved( false ) ) { return false; }
 
-	Unlink( destFs, destPath );
+	moveRemover->Add( fs, path, dir );
+	return true;
+}
 
-	return !stopped;
+bool OperCFThread::CheckRemoved( bool wait )
+{
+	if ( !moveRemover ) { return true; }
+
+	if ( wait ) { moveRemover->Wait(); }
+
+	while ( MoveRemoval* r = moveRemover->TakeFailed() )
+	{
+		int cmd = RedMessage( r->dir ? _LT( "Can`t delete directory:\n" ) : _LT( "Can`t delete file:\n" ), r->fs->Uri( r->path ).GetUtf8(),
+		                      bRetrySkipCancel, r->fs->StrError( r->err ).GetUtf8() );
+
+		// a retry is done here, so the prompts go on as usual
+		bool ok = cmd == CMD_SKIP || ( cmd == CMD_RETRY && ( r->dir ? RmDir( r->fs, r->path ) : Unlink( r->fs, r->path ) ) );
+
+		delete r;
+
+		if ( !ok ) { return false; }
+	}
+
+	return true;
 }
 
 bool OperCFThread::CopyDir( FS* srcFs, FSPath& __srcPath, FSNode* srcNode, FS* destFs, FSPath& __destPath, bool move )
@@ -1516,8 +3068,12 @@ bool OperCFThread::CopyDir( FS* srcFs, FSPath& __srcPath, FSNode* srcNode, FS* d
 		}
 	}
 
-	while ( destFs->MkDir( __destPath, MkDirMode, &ret_error, Info() ) && !destFs->IsEEXIST( ret_error ) )
+	bool destExists = false;
+
+	while ( destFs->MkDir( __destPath, MkDirMode, &ret_error, Info() ) )
 	{
+		if ( destFs->IsEEXIST( ret_error ) ) { destExists = true; break; }
+
 		switch ( RedMessage( _LT( "Can't create the directory:\n" ), destFs->Uri( __destPath ).GetUtf8(), bRetrySkipCancel, destFs->StrError( ret_error ).GetUtf8() ) )
 		{
 			case CMD_CANCEL:
@@ -1528,26 +3084,31 @@ bool OperCFThread::CopyDir( FS* srcFs, FSPath& __srcPath, FSNode* srcNode, FS* d
 		}
 	}
 
+	std::vector<char> plan;
+
+	if ( destExists && !PlanSync( srcFs, __srcPath, &list, destFs, __destPath, move, plan ) ) { return false; }
 
 	FSPath srcPath = __srcPath;
 	int srcPos = srcPath.Count();
 	FSPath destPath = __destPath;
 	int destPos = destPath.Count();
 
+	int n = 0;
 
-	for ( FSNode* node = list.First(); node; node = node->next )
+	for ( FSNode* node = list.First(); node; node = node->next, n++ )
 	{
 		if ( Info()->Stopped() ) { return false; }
 
 		srcPath.SetItemStr( srcPos, node->Name() );
 		destPath.SetItemStr( destPos, node->Name() );
 
-		if ( !CopyNode( srcFs, srcPath, node, destFs, destPath, move ) ) { return false; }
+		if ( !CopyNode( srcFs, srcPath, node, destFs, destPath, move, plan.empty() ? int( SYNC_COPY ) : plan[n] ) ) { return false; }
 	}
 
 	destFs->SetFileTime( destPath, srcNode->st.m_CreationTime, srcNode->st.m_LastWriteTime, srcNode->st.m_LastWriteTime, 0, Info() );
 
-	return !move || RmDir( srcFs, __srcPath );
+	// the files still copied in parallel are finished first, their sources go before the directory
+	return !move || ( WaitTransfers( 0 ) && RemoveSource( srcFs, __srcPath, true ) );
 }
 
 static void stripPathFromLastItem(FSPath& path)
@@ -1564,7 +3125,7 @@ static void stripPathFromLastItem(FSPath& path)
 	}
 }
 
-bool OperCFThread::CopyNode( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath, bool move )
+bool OperCFThread::CopyNode( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* destFs, FSPath& destPath, bool move, int sync )
 {
 	// XXX blame, blame. In tmp panel name has full path. Strip the path from the last item
 	stripPathFromLastItem(destPath);
@@ -1577,15 +3138,212 @@ bool OperCFThread::CopyNode( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* de
 	{
 		if ( !CopyDir( srcFs, srcPath, srcNode, destFs, destPath, move ) ) { return false; }
 	}
+	else if ( sync == SYNC_SKIP )
+	{
+		SendSkipInfo( srcNode->st.size );
+
+		// the destination has the same content, so a move only removes the source
+		if ( move && !RemoveSource( srcFs, srcPath, false ) ) { return false; }
+	}
 	else
 	{
-		if ( !CopyFile( srcFs, srcPath, srcNode, destFs, destPath, move ) ) { return false; }
+		if ( !CopyFile( srcFs, srcPath, srcNode, destFs, destPath, move, sync == SYNC_DELTA ) ) { return false; }
 	}
 
 	return true;
 }
 
-bool OperCFThread::Copy( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath, cstrhash<bool, unicode_t>& resList )
+void OperCFThread::ExtractSink::SetPaths( FSPath& path )
+{
+	srcPath = srcDir;
+	destPath = destDir;
+
+	for ( int i = 0; i < path.Count(); i++ )
+	{
+		srcPath.PushStr( *path.GetItem( i ) );
+		destPath.PushStr( *path.GetItem( i ) );
+	}
+}
+
+int OperCFThread::ExtractSink::Drop( bool stop )
+{
+	if ( out >= 0 )
+	{
+		destFs->Close( out, 0, thread->Info() );
+		out = -1;
+		thread->Unlink( destFs, destPath );
+	}
+
+	return stop ? -2 : 1;
+}
+
+int OperCFThread::ExtractSink::Begin( FSPath& path, const FSStat& _st )
+{
+	if ( thread->Info()->Stopped() ) { return -2; }
+
+	SetPaths( path );
+	st = _st;
+
+	int ret_err;
+
+	if ( st.IsDir() )
+	{
+		while ( destFs->MkDir( destPath, MkDirMode, &ret_err, thread->Info() ) && !destFs->IsEEXIST( ret_err ) )
+		{
+			switch ( thread->RedMessage( _LT( "Can't create the directory:\n" ), destFs->Uri( destPath ).GetUtf8(), bRetrySkipCancel, destFs->StrError( ret_err ).GetUtf8() ) )
+			{
+				case CMD_CANCEL:
+					return -2;
+
+				case CMD_SKIP:
+					return 1;
+			}
+		}
+
+		dirs.push_back( std::make_pair( destPath, st ) );
+		return 1;
+	}
+
+	if ( !st.IsReg() && !thread->skipNonRegular )
+		switch ( thread->RedMessage( _LT( "Can't copy the links or special file:\n" ), srcFs->Uri( srcPath ).GetUtf8(), bSkipSkipallCancel ) )
+		{
+			case CMD_SKIPALL:
+				thread->skipNonRegular = true;
+				return 1;
+
+			case CMD_SKIP:
+				return 1;
+
+			default:
+				return -2;
+		}
+
+	if ( !st.IsReg() ) { return 1; }
+
+	thread->SendCopyNextFileInfo( srcFs->Uri( srcPath ), destFs->Uri( destPath ) );
+	thread->SendProgressInfo( st.size, 0, 0 );
+
+	out = destFs->OpenCreate( destPath, false | thread->commitAll, st.mode, 0, &ret_err, thread->Info() );
+
+	if ( out < 0 && destFs->IsEEXIST( ret_err ) )
+		switch ( thread->RedMessage( _LT( "Overwrite file?\n" ) , destFs->Uri( destPath ).GetUtf8(), bOkAllNoCancel ) )
+		{
+			case CMD_ALL:
+				thread->commitAll = true;
+				out = destFs->OpenCreate( destPath, true, st.mode, 0, &ret_err, thread->Info() );
+				break;
+
+			case CMD_OK:
+				out = destFs->OpenCreate( destPath, true, st.mode, 0, &ret_err, thread->Info() );
+				break;
+
+			case CMD_NO:
+				return 1;
+
+			default:
+				return -2;
+		}
+
+	if ( out < 0 )
+	{
+		return thread->RedMessage( _LT( "Can't create file:\n" ), destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) == CMD_SKIP ? 1 : -2;
+	}
+
+	doneBytes = 0;
+	return 0;
+}
+
+int OperCFThread::ExtractSink::Data( void* buf, int size )
+{
+	if ( thread->Info()->Stopped() ) { return Drop( true ); }
+
+	int ret_err;
+	int b = destFs->Write( out, buf, size, &ret_err, thread->Info() );
+
+	if ( b < 0 )
+	{
+		return Drop( b == -2 || thread->RedMessage( _LT( "Can't write the file:\n" ), destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP );
+	}
+
+	if ( b != size )
+	{
+		return Drop( thread->RedMessage( "May be disk full \n(writed bytes != readed bytes)\nwhen write:\n", destFs->Uri( destPath ).GetUtf8(), bSkipCancel ) != CMD_SKIP );
+	}
+
+	doneBytes += b;
+	thread->SendProgressInfo( st.size, doneBytes, b );
+	return 0;
+}
+
+int OperCFThread::ExtractSink::End()
+{
+	thread->SendProgressInfo( st.size, st.size, 0 );
+
+	int ret_err;
+	int r = destFs->Close( out, &ret_err, thread->Info() );
+
+	if ( r )
+	{
+		bool stop = r == -2 || thread->RedMessage( "Can't close the file:\n", destFs->Uri( destPath ).GetUtf8(), bSkipCancel, destFs->StrError( ret_err ).GetUtf8() ) != CMD_SKIP;
+		out = -1;
+		thread->Unlink( destFs, destPath );
+		return stop ? -2 : 0;
+	}
+
+	out = -1;
+	destFs->SetFileTime( destPath, st.m_CreationTime, st.m_LastWriteTime, st.m_LastWriteTime, 0, thread->Info() );
+	return 0;
+}
+
+int OperCFThread::ExtractSink::Fail( int err )
+{
+	bool stop = thread->RedMessage( _LT( "Can't read the file:\n" ), srcFs->Uri( srcPath ).GetUtf8(), bSkipCancel, srcFs->StrError( err ).GetUtf8() ) != CMD_SKIP;
+	Drop( stop );
+	return stop ? -2 : 0;
+}
+
+void OperCFThread::ExtractSink::Finish()
+{
+	Drop( true );
+
+	// the files written into the directories have changed their times, deepest first
+	for ( auto it = dirs.rbegin(); it != dirs.rend(); ++it )
+	{
+		destFs->SetFileTime( it->first, it->second.m_CreationTime, it->second.m_LastWriteTime, it->second.m_LastWriteTime, 0, thread->Info() );
+	}
+}
+
+int OperCFThread::ExtractList( FS* srcFs, FSPath& srcDir, FSList* list, FS* destFs, FSPath& destDir )
+{
+	if ( destFs->Type() == FS::TMP ) { return 1; }
+
+	for ( FSNode* node = list->First(); node; node = node->next )
+	{
+		// a selection in the temporary panel has full paths as names
+		if ( node->Name().IsEmpty() || unicode_strchr( node->Name().GetUnicode(), DIR_SPLITTER ) ) { return 1; }
+	}
+
+	ExtractSink sink( this, srcFs, srcDir, destFs, destDir );
+
+	int ret_err;
+	int r = srcFs->Extract( srcDir, list, &sink, &ret_err, Info() );
+
+	sink.Finish();
+
+	if ( r == 1 ) { return 1; }
+
+	if ( r == -2 ) { return -1; }
+
+	if ( r )
+	{
+		RedMessage( _LT( "Can't read:\n" ), srcFs->Uri( srcDir ).GetUtf8(), bOk, srcFs->StrError( ret_err ).GetUtf8() );
+		return -1;
+	}
+
+	return 0;
+}
+
+bool OperCFThread::CopyList( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath, cstrhash<bool, unicode_t>& resList, bool move )
 {
 	if ( list->Count() <= 0 ) { return true; }
 
@@ -1608,6 +3366,24 @@ bool OperCFThread::Copy( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs,
 
 	bool exist = ( res == 0 );
 
+	// a move removes the sources file by file, so it does not go through the one pass extraction
+	if ( exist && st.IsDir() && !move )
+	{
+		// the whole selection goes into the directory, a source able to do it reads it in one pass
+		int r = ExtractList( srcFs, __srcPath, list, destFs, __destPath );
+
+		if ( r < 0 ) { return false; }
+
+		if ( r == 0 )
+		{
+			for ( FSNode* node = list->First(); node; node = node->next )
+			{
+				resList[node->Name().GetUnicode()] = true;
+			}
+
+			return true;
+		}
+	}
 
 	if ( list->Count() > 1 )
 	{
@@ -1624,13 +3400,19 @@ bool OperCFThread::Copy( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs,
 			return false;
 		}
 
-		for ( FSNode* node = list->First(); node; node = node->next )
+		std::vector<char> plan;
+
+		if ( !PlanSync( srcFs, __srcPath, list, destFs, __destPath, move, plan ) ) { return false; }
+
+		int n = 0;
+
+		for ( FSNode* node = list->First(); node; node = node->next, n++ )
 		{
 			if ( Info()->Stopped() ) { return false; }
 			srcPath.SetItemStr( srcPos, node->Name() );
 			destPath.SetItemStr(destPos, node->Name() );
 
-			if ( !CopyNode( srcFs, srcPath, node, destFs, destPath, false ) ) { return false; }
+			if ( !CopyNode( srcFs, srcPath, node, destFs, destPath, move, plan.empty() ? int( SYNC_COPY ) : plan[n] ) ) { return false; }
 
 			resList[node->Name().GetUnicode()] = true;
 		}
@@ -1646,12 +3428,39 @@ bool OperCFThread::Copy( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs,
 
 		srcPath.SetItemStr( srcPos, list->First()->Name() );
 
-		if ( !CopyNode( srcFs, srcPath, list->First(), destFs, destPath, false ) ) { return false; }
+		if ( !CopyNode( srcFs, srcPath, list->First(), destFs, destPath, move ) ) { return false; }
 
 		resList[list->First()->Name().GetUnicode()] = true;
 	};
 
-	return true;
+	return WaitTransfers( 0 );
+}
+
+bool OperCFThread::Copy( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath, cstrhash<bool, unicode_t>& resList )
+{
+	// a stopped copy leaves a destination keeping the changes (an archive) as it was
+	return FlushChanges( destFs, __destPath, CopyList( srcFs, __srcPath, list, destFs, __destPath, resList ) );
+}
+
+bool OperCFThread::FlushChanges( FS* fs, FSPath& path, bool ok )
+{
+	if ( !fs->IsWriteDeferred() ) { return ok; }
+
+	if ( !ok )
+	{
+		fs->Rollback();
+		return false;
+	}
+
+	int ret_err;
+	int r = fs->Flush( &ret_err, Info() );
+
+	if ( r == -1 )
+	{
+		RedMessage( _LT( "Can't write the changes:\n" ), fs->Uri( path ).GetUtf8(), bOk, fs->StrError( ret_err ).GetUtf8() );
+	}
+
+	return r == 0;
 }
 
 void CopyThreadFunc( OperThreadNode* node )
@@ -1930,7 +3739,7 @@ bool OperCFThread::MoveNode( FS* srcFs, FSPath& srcPath, FSNode* srcNode, FS* de
 }
 
 
-bool OperCFThread::Move( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath )
+bool OperCFThread::MoveList( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath )
 {
 	if ( list->Count() <= 0 ) { return true; }
 
@@ -1995,7 +3804,34 @@ bool OperCFThread::Move( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs,
 
 	}
 
-	return true;
+	return WaitTransfers( 0 ) && CheckRemoved( true );
+}
+
+bool OperCFThread::Move( FS* srcFs, FSPath& __srcPath, FSList* list, FS* destFs, FSPath& __destPath )
+{
+	if ( destFs->IsWriteDeferred() )
+	{
+		// only the sources of what was really written are removed, and only after the destination has written it out
+		std::vector<MoveRemoval> removals;
+		cstrhash<bool, unicode_t> resList;
+
+		removeAfterFlush = &removals;
+		bool ok = CopyList( srcFs, __srcPath, list, destFs, __destPath, resList, true );
+		removeAfterFlush = 0;
+
+		if ( !FlushChanges( destFs, __destPath, ok ) ) { return false; }
+
+		bool removed = true;
+
+		for ( size_t i = 0; removed && i < removals.size(); i++ )
+		{
+			removed = RemoveSource( removals[i].fs, removals[i].path, removals[i].dir );
+		}
+
+		return FlushChanges( srcFs, __srcPath, removed && CheckRemoved( true ) );
+	}
+
+	return FlushChanges( srcFs, __srcPath, MoveList( srcFs, __srcPath, list, destFs, __destPath ) );
 }
 
 void MoveThreadFunc( OperThreadNode* node )
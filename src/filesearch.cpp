@@ -348,7 +348,7 @@ void OperSearchThread::Search()
 OperSearchThread::~OperSearchThread() {}
 
 
-class SearchListWin: public VListWin
+class SearchListWin: public VListWin, private VListDataSource
 {
 	std::unordered_map<int, clPtr<SearchDirNode> > m_DirHash;
 	std::vector<SearchItemNode> m_ItemList;
@@ -381,8 +381,13 @@ public:
 		ls.y.minimal = 100;
 
 		SetLSize( ls );
+
+		SetDataSource( this );
 	}
 
+	virtual int GetRowCount() override { return ( int )m_ItemList.size(); }
+	virtual int GetRowWidth( wal::GC& gc, int n ) override;
+
 	void Add( clPtr<ThreadRetStruct> p )
 	{
 		if ( !p.ptr() ) { return; }
@@ -401,21 +406,12 @@ public:
 			}
 		}
 
-		this->SetCount( m_ItemList.size() );
+		DataAppended();
 
 		if ( GetCurrent() < 0 && this->GetCount() > 0 )
 		{
 			SetCurrent( 0 );
 		}
-
-		this->CalcScroll();
-
-		if ( this->GetPageFirstItem() + this->GetPageItemCount() + 1 < ( int )m_ItemList.size() )
-		{
-			return;
-		}
-
-		Invalidate();
 	}
 
 	bool GetCurrentURI( std::vector<unicode_t>* uri )
@@ -614,22 +610,13 @@ void SearchListWin::DrawItem( wal::GC& gc, int n, crect rect )
 			x += PanelWin::folderIcon.Width( ) + FolderIconMargin;
 		}
 
-		int textWidth = x;
-
 		if ( txt )
 		{
 			gc.SetTextColor( textColor );
 			gc.Set( GetFont() );
-			textWidth = gc.GetTextExtents( txt ).x;
 			gc.SetFillColor( bg );
 			gc.TextOutF( rect.left + x, rect.top + 2, txt );
 		}
-
-		if ( this->GetItemWidth() < textWidth )
-		{
-			this->SetItemSize( GetItemHeight(), textWidth );
-		}
-
 	}
 	else
 	{
@@ -638,6 +625,33 @@ void SearchListWin::DrawItem( wal::GC& gc, int n, crect rect )
 	}
 }
 
+int SearchListWin::GetRowWidth( wal::GC& gc, int n )
+{
+	if ( n < 0 || n >= ( int )m_ItemList.size() ) { return -1; }
+
+	const unicode_t* txt = 0;
+	int x = 0;
+
+	if ( m_ItemList[n].fsNode )
+	{
+		txt = m_ItemList[n].fsNode->GetUnicodeName();
+		x = fontW * 10 + 20;
+	}
+	else
+	{
+		auto i = m_DirHash.find( m_ItemList[n].dirId );
+
+		if ( i != m_DirHash.end() && i->second ) { txt = i->second->path.GetUnicode(); }
+
+		x = PanelWin::folderIcon.Width() + 10;
+	}
+
+	if ( !txt ) { return x; }
+
+	gc.Set( GetFont() );
+	return x + gc.GetTextExtents( txt ).x;
+}
+
 SearchListWin::~SearchListWin() {};
 
 class SearchFileThreadWin: public NCDialog
@@ -641,6 +641,8 @@ bool EditWin::Undo()
 		{
 			if ( _shlLine > r->line ) { _shlLine = r->line; }
 
+			DropColIndex( r->line );
+
 			switch ( r->type )
 			{
 
@@ -717,6 +719,8 @@ bool EditWin::Redo()
 		{
 			if ( _shlLine > r->line ) { _shlLine = r->line; }
 
+			DropColIndex( r->line );
+
 			switch ( r->type )
 			{
 
@@ -1720,6 +1724,7 @@ void EditWin::Clear()
 	_path.Clear();
 	_fs = 0;
 	recomendedCursorCol = -1;
+	DropColIndex( 0 );
 }
 
 void EditWin::Save( MemFile& f )
@@ -1735,6 +1740,8 @@ void EditWin::SetChanged( int minLine )
 	_changed = true;
 
 	if ( _shlLine > minLine ) { _shlLine = minLine; }
+
+	DropColIndex( minLine );
 }
 
 void EditWin::RefreshShl( int n )
@@ -1806,15 +1813,28 @@ void EditWin::__RefreshScreenData()
 		{
 
 //TEMP
-			std::vector<char> colId( str.len + 1 );
-			memset( colId.data(), -1, str.len + 1 );
+			std::vector<char> colId;
 
 			if ( _shl )
 			{
+				colId.assign( str.len + 1, -1 );
 				RefreshShl( line );
 				_shl->ScanLine( ( unsigned char* )str.Get(), colId.data(), str.len, str.shlId );
 			}
 
+			// the cursor line scrolled to the right is walked from the nearest indexed point
+			if ( ColIndex* x = colOffset > 0 && line == cursor.line ? GetColIndex( line ) : 0 )
+			{
+				size_t i = std::upper_bound( x->col.begin(), x->col.end(), colOffset ) - x->col.begin();
+
+				if ( i > 0 )
+				{
+					s = begin + x->pos[i - 1];
+					col = x->col[i - 1];
+					tab = charset->IsTab( s, end );
+				}
+			}
+
 			int ce = col;
 
 			while ( s )
@@ -2315,6 +2335,48 @@ void EditWin::EventSize( cevent_size* pEvent )
 }
 
 
+EditWin::ColIndex* EditWin::GetColIndex( int line )
+{
+	EditString& str = text.Get( line );
+
+	if ( str.Len() < COL_INDEX_MIN ) { return 0; }
+
+	ColIndex& x = colIndex;
+
+	if ( x.line == line && x.data == str.Get() && x.len == str.Len() && x.charset == charset && x.tabSize == tabSize ) { return &x; }
+
+	x.line = line;
+	x.data = str.Get();
+	x.len = str.Len();
+	x.charset = charset;
+	x.tabSize = tabSize;
+	x.pos.assign( 1, 0 );
+	x.col.assign( 1, 0 );
+
+	char* begin = str.Get(), *s = begin, *end = begin + str.Len();
+	bool tab = charset->IsTab( s, end );
+	int col = 0;
+
+	while ( s )
+	{
+		col += tab ? tabSize - col % tabSize : 1;
+		char* t = charset->GetNext( s, end );
+
+		if ( !t ) { break; }
+
+		tab = charset->IsTab( t, end );
+		s = t;
+
+		if ( s - begin >= x.pos.back() + COL_INDEX_STEP )
+		{
+			x.pos.push_back( int( s - begin ) );
+			x.col.push_back( col );
+		}
+	}
+
+	return &x;
+}
+
 int EditWin::GetColFromPos( int line, int pos )
 {
 	if ( line < 0 || line >= text.Count() ) { return 0; }
@@ -2322,9 +2384,21 @@ int EditWin::GetColFromPos( int line, int pos )
 	EditString& str = text.Get( line );
 
 	char* s = str.Get(), *end = s + str.Len();
+	int col = 0;
+
+	if ( ColIndex* x = GetColIndex( line ) )
+	{
+		size_t i = std::upper_bound( x->pos.begin(), x->pos.end(), pos ) - x->pos.begin();
+
+		if ( i > 0 )
+		{
+			s += x->pos[i - 1];
+			col = x->col[i - 1];
+			pos -= x->pos[i - 1];
+		}
+	}
 
 	bool tab = charset->IsTab( s, end );
-	int col = 0;
 
 	while ( s )
 	{
@@ -2351,10 +2425,22 @@ int EditWin::GetPosFromCol( int line, int nCol )
 
 	char* s = str.Get(), *end = s + str.Len();
 
-	bool tab = charset->IsTab( s, end );
-
 	int pos = 0, col = 0;
 
+	if ( ColIndex* x = GetColIndex( line ) )
+	{
+		size_t i = std::upper_bound( x->col.begin(), x->col.end(), nCol ) - x->col.begin();
+
+		if ( i > 0 )
+		{
+			s += x->pos[i - 1];
+			pos = x->pos[i - 1];
+			col = x->col[i - 1];
+		}
+	}
+
+	bool tab = charset->IsTab( s, end );
+
 	while ( s )
 	{
 		int step = ( tab ? tabSize - ( col % tabSize ) : 1 );
@@ -2485,8 +2571,7 @@ bool EditWin::Search( const unicode_t* arg, bool sens )
 {
 	std::vector<unicode_t> search = new_unicode_str( arg );
 
-	if ( !sens )
-		for ( unicode_t* u = search.data(); *u; u++ ) { *u = UnicodeLC( *u ); }
+	if ( !sens ) { UnicodeLC( search.data() ); }
 
 	int line =  cursor.line;
 
@@ -2557,8 +2642,7 @@ bool EditWin::Replace( const unicode_t* from, const unicode_t* to, bool sens )
 {
 	std::vector<unicode_t> search = new_unicode_str( from );
 
-	if ( !sens )
-		for ( unicode_t* u = search.data(); *u; u++ ) { *u = UnicodeLC( *u ); }
+	if ( !sens ) { UnicodeLC( search.data() ); }
 
 	ccollect<char> rep;
 	charset_struct* cs = charset;
@@ -572,6 +572,25 @@ class EditWin : public Win
 
 	bool _changed;
 
+	/// columns of a long line at points about COL_INDEX_STEP bytes apart, so the column of a position far into
+	/// the line is counted from the nearest point and not from the beginning of the line on every cursor move
+	enum { COL_INDEX_MIN = 4096, COL_INDEX_STEP = 1024 };
+	struct ColIndex
+	{
+		int line; // -1 - not built
+		const char* data; // of the line, with len, charset and tabSize: what the index was built for
+		int len;
+		charset_struct* charset;
+		int tabSize;
+		std::vector<int> pos; // character boundaries, pos[0] == 0
+		std::vector<int> col; // the column at pos[i]
+		ColIndex(): line( -1 ), data( 0 ), len( 0 ), charset( 0 ), tabSize( 0 ) {}
+	};
+	ColIndex colIndex;
+
+	ColIndex* GetColIndex( int line ); // 0 for a short line
+	void DropColIndex( int minLine ) { if ( colIndex.line >= minLine ) { colIndex.line = -1; } }
+
 	void SetChanged( int minLine );
 	unsigned ColorById( int id );
 	void RefreshShl( int n );
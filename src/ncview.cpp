@@ -13,6 +13,7 @@
 #include "search-tools.h"
 #include "charsetdlg.h"
 #include "ltext.h"
+#include "tcp_sock.h"
 
 #ifdef _WIN32
 #include <time.h>
@@ -785,7 +786,7 @@ public:
 	bool stopped;
 	FSCViewerInfo(): stopped( false ) {}
 	void Reset() { MutexLock lock( &mutex ); stopped = false; }
-	void SetStop() { MutexLock lock( &mutex ); stopped = true; }
+	void SetStop() { { MutexLock lock( &mutex ); stopped = true; } TCPWakeWaiters(); }
 	virtual bool Stopped();
 	virtual ~FSCViewerInfo();
 };
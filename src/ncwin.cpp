@@ -2872,7 +2872,7 @@ bool NCWin::OnKeyDown( Win* w, cevent_key* pEvent, bool pressed )
 				break;
 
 			case FC( VK_R, KM_CTRL ):
-				_panel->Reread();
+				_panel->Refresh();
 				_panel->Invalidate();
 				break;
 				/*
@@ -3521,7 +3521,7 @@ bool NCWin::Command( int id, int subId, Win* win, void* data )
 				return true;
 
 			case ID_REFRESH:
-				_panel->Reread();
+				_panel->Refresh();
 				_panel->Invalidate();
 				return true;
 
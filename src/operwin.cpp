@@ -5,6 +5,7 @@
  */
 
 #include "operwin.h"
+#include "tcp_sock.h"
 
 static Mutex operMutex; //блокировать при изменении operStopList, и при к threadId и tNode  в OperThreadWin !!!
 
@@ -54,6 +55,8 @@ void OperThreadWin::SetStopFlag()
 		MutexLock lockNode( &tNode->mutex );
 		tNode->stopped = true;
 	}
+
+	TCPWakeWaiters(); // sockets of the thread see the stop flag at once
 }
 
 void OperThreadWin::StopThread()
@@ -69,6 +72,7 @@ void OperThreadWin::StopThread()
 	MutexLock lockNode( &tNode->mutex );
 	tNode->stopped = true;
 	tNode->data = 0;
+	TCPWakeWaiters();
 
 	if ( !this->cbExecuted ) //!!!
 	{
@@ -6,6 +6,7 @@
 
 #define __STDC_FORMAT_MACROS
 #include <stdint.h>
+#include <algorithm>
 #if !defined(_MSC_VER) || _MSC_VER >= 1700
 #  include <inttypes.h>
 #endif
@@ -631,14 +632,34 @@ bool PanelWin::Command( int id, int subId, Win* win, void* data )
 
 	if ( n != _first )
 	{
+		int delta = n - _first;
 		_first = n;
 		SetScroll();
-		Invalidate();
+		ScrollItems( delta );
 	}
 
 	return true;
 }
 
+void PanelWin::ScrollItems( int delta )
+{
+	if ( !delta ) { return; }
+
+	if ( delta >= _rows || -delta >= _rows || _rectList.count() < _rows * _cols )
+	{
+		Invalidate();
+		return;
+	}
+
+	// each column is shifted separately, the items moved between columns fall into the exposed rows
+	for ( int c = 0; c < _cols; c++ )
+	{
+		crect r = _rectList[c * _rows];
+		r.bottom = _rectList[c * _rows + _rows - 1].bottom;
+		ScrollClient( r, 0, -delta * _itemHeight );
+	}
+}
+
 bool PanelWin::Broadcast( int id, int subId, Win* win, void* data )
 {
 	if ( id == ID_CHANGED_CONFIG_BROADCAST )
@@ -1196,6 +1217,7 @@ void PanelWin::SetCurrent( int n, bool Shift, LPanelSelectionType* SelectType, b
 	}
 
 	int old = _current;
+	int oldFirst = _first;
 	_current = n;
 
 	bool fullRedraw = false;
@@ -1244,13 +1266,10 @@ void PanelWin::SetCurrent( int n, bool Shift, LPanelSelectionType* SelectType, b
 		_first = _current - _rectList.count() + 1;
 
 		if ( _first < 0 ) { _first = 0; }
-
-		fullRedraw = true;
 	}
 	else if ( _current < _first )
 	{
 		_first = _current;
-		fullRedraw = true;
 	}
 	else
 	{
@@ -1259,8 +1278,6 @@ void PanelWin::SetCurrent( int n, bool Shift, LPanelSelectionType* SelectType, b
 			_first = _list.Count( HideDotsInDir() ) - _rectList.count();
 
 			if ( _first < 0 ) { _first = 0; }
-
-			fullRedraw = true;
 		}
 	}
 
@@ -1272,6 +1289,8 @@ void PanelWin::SetCurrent( int n, bool Shift, LPanelSelectionType* SelectType, b
 		return;
 	}
 
+	ScrollItems( _first - oldFirst );
+
 	wal::GC gc( this );
 	gc.Set( GetFont() );
 	DrawItem( gc, old );
@@ -1708,6 +1727,7 @@ void PanelWin::LoadPath( clPtr<FS> fs, FSPath& paramPath, FSString* current, clP
 	try
 	{
 		StopThread();
+		_watcher.Stop();
 		_inOperState = true;
 		_operType = lType;
 
@@ -1865,6 +1885,7 @@ void PanelWin::OperThreadStopped()
 			SetCurrent( 0 );
 		}
 
+		WatchDir();
 	}
 	catch ( cexception* ex )
 	{
@@ -1901,6 +1922,130 @@ void PanelWin::Reread( bool resetCurrent, const char* newCurrentNameUtf8 )
 	LoadPath( GetFSPtr(), GetPath(), StrPtr, sHash, RESET );
 }
 
+void PanelWin::Refresh()
+{
+	FS* fs = GetFS();
+
+	if ( fs ) { fs->DropCache( GetPath() ); }
+
+	Reread();
+}
+
+void PanelWin::WatchDir()
+{
+	FS* fs = GetFS();
+
+	if ( fs && fs->Type() == FS::SYSTEM && _watcher.Watch( ( const char* )GetPath().GetString( sys_charset_id ) ) )
+	{
+		SetTimer( WATCH_TIMER_ID, WATCH_TIMER_PERIOD );
+	}
+	else
+	{
+		_watcher.Stop();
+		DelTimer( WATCH_TIMER_ID );
+	}
+}
+
+// Applies changes reported by the folder watcher to the list in place.
+// Each changed name is stat'ed once per tick, so a burst of events for one file costs a single update.
+void PanelWin::ApplyDirChanges()
+{
+	std::vector<std::string> names;
+
+	if ( !_watcher.ReadChanges( &names ) )
+	{
+		Reread();
+		return;
+	}
+
+	if ( names.empty() ) { return; }
+
+	std::sort( names.begin(), names.end() );
+	names.erase( std::unique( names.begin(), names.end() ), names.end() );
+
+	if ( names.size() > WATCH_MAX_CHANGES || _list.RemovedCount() > WATCH_MAX_CHANGES )
+	{
+		Reread();
+		return;
+	}
+
+	FS* fs = GetFS();
+
+	if ( !fs ) { return; }
+
+	FSPath path = GetPath();
+	int n = path.Count();
+
+	FSNode* current = GetCurrent();
+	int oldCurrent = _current;
+	int oldIndex = current ? _list.GetIndex( current, HideDotsInDir() ) : -1;
+
+	std::vector<FSNode*> removedNodes;
+
+	for ( const std::string& s : names )
+	{
+		FSString name( sys_charset_id, s.c_str() );
+		path.SetItemStr( n, name );
+
+		FSNode* p = _list.FindByName( name );
+		FSStat st;
+		int err;
+
+		// FSSys::Stat() fills the link from lstat() before it stats the target, so a dangling symlink
+		// is kept and updated as a full reread lists it; an entry goes only when lstat() finds nothing too
+		if ( fs->Stat( path, &st, &err, 0 ) && !st.IsLnk() )
+		{
+			if ( !p || !fs->IsENOENT( err ) ) { continue; }
+
+			if ( p == current ) { current = 0; }
+
+			removedNodes.push_back( p );
+			continue;
+		}
+
+		if ( p )
+		{
+			_list.UpdateNode( p, st );
+		}
+		else
+		{
+			clPtr<FSNode> node = new FSNode();
+			node->name = name;
+			node->st = st;
+			_list.AddNode( node );
+		}
+	}
+
+	_list.RemoveNodes( removedNodes );
+
+	// keep the cursor on the same item and on the same screen row
+	int newIndex = current ? _list.GetIndex( current, HideDotsInDir() ) : -1;
+
+	if ( newIndex >= 0 && oldIndex >= 0 )
+	{
+		_first += newIndex - oldIndex;
+
+		if ( _first < 0 ) { _first = 0; }
+	}
+
+	SetCurrent( newIndex >= 0 ? newIndex : oldCurrent );
+	Invalidate();
+}
+
+void PanelWin::EventTimer( int tid )
+{
+	if ( tid != WATCH_TIMER_ID )
+	{
+		NCDialogParent::EventTimer( tid );
+		return;
+	}
+
+	// a hidden panel leaves the events queued in the kernel and catches up when shown again
+	if ( _inOperState || !IsVisible() ) { return; }
+
+	ApplyDirChanges();
+}
+
 bool PanelWin::EventMouse( cevent_mouse* pEvent )
 {
 //	bool shift = ( pEvent->Mod() & KM_SHIFT ) != 0;
@@ -12,6 +12,7 @@
 #include "operwin.h"
 #include "fileopers.h"
 #include "panel_list.h"
+#include "dir-watcher.h"
 
 #define FC(key, mods) (((key)&0xFFFF) + ((mods)<<16))
 
@@ -219,6 +220,7 @@ private:
 	}
 
 	void SetScroll();
+	void ScrollItems( int delta );
 
 	void Check();
 	void DrawItem( wal::GC& gc,  int n );
@@ -242,6 +244,17 @@ private:
 	FSString _operCurrentStr;
 	int _operCursorLoc;
 
+	// live updates of a local folder without rereading it
+	enum
+	{
+		WATCH_TIMER_ID = 1,
+		WATCH_TIMER_PERIOD = 500,   // ms
+		WATCH_MAX_CHANGES = 4096    // more changed names per tick (or removed nodes kept by _list) make a full reread cheaper
+	};
+	DirWatcher _watcher;
+	void WatchDir();
+	void ApplyDirChanges();
+
 public:
 	PanelWin( Win* parent, int mode );
 	bool IsSelectedPanel();
@@ -281,6 +294,8 @@ public:
 	void LoadPathStringSafe( const char* path );
 
 	void Reread(bool resetCurrent = false, const char* newCurrentNameUtf8 = 0);
+	/// Reread() requested by the user, does not trust cached remote listings
+	void Refresh();
 
 	int GetXMargin() const;
 
@@ -342,6 +357,7 @@ public:
 	virtual void Paint( wal::GC& gc, const crect& paintRect );
 	virtual void EventSize( cevent_size* pEvent );
 	virtual bool EventMouse( cevent_mouse* pEvent );
+	virtual void EventTimer( int tid );
 	virtual bool Command( int id, int subId, Win* win, void* data );
 	virtual bool Broadcast( int id, int subId, Win* win, void* data );
 	virtual void OnChangeStyles();
@@ -158,3 +158,174 @@ void PanelList::InvertSelection()
 		}
 	}
 };
+
+void PanelList::BuildNameIndex()
+{
+	nameIndex.clear();
+
+	if ( data.ptr() )
+	{
+		nameIndex.reserve( data->Count() );
+
+		for ( FSNode* p = data->First(); p; p = p->next )
+		{
+			nameIndex[p->GetUtf8Name()] = p;
+		}
+	}
+
+	nameIndexValid = true;
+}
+
+void PanelList::CountNode( FSNode* p, bool add )
+{
+	if ( !IsListed( p ) )
+	{
+		if ( add ) { hiddenCn.AddOne( p->Size() ); }
+		else { hiddenCn.SubOne( p->Size() ); }
+
+		return;
+	}
+
+	if ( add )
+	{
+		filesCn.AddOne( p->Size() );
+
+		if ( p->IsSelected() ) { selectedCn.AddOne( p->Size() ); }
+
+		if ( !p->IsDir() ) { filesCnNoDirs.AddOne( p->Size() ); }
+	}
+	else
+	{
+		filesCn.SubOne( p->Size() );
+
+		if ( p->IsSelected() ) { selectedCn.SubOne( p->Size() ); }
+
+		if ( !p->IsDir() ) { filesCnNoDirs.SubOne( p->Size() ); }
+	}
+}
+
+int PanelList::InsertPos( FSNode* p )
+{
+	if ( sortMode == SORT_NONE || !listCount ) { return listCount; }
+
+	int i = FSNodeVectorSorter::BSearch( *p, list, EXACT_OR_CLOSEST_SUCCEEDING_NODE, ascSort, caseSensitive, sortMode );
+
+	if ( i < 0 ) { return 0; }
+
+	return i > listCount ? listCount : i;
+}
+
+int PanelList::ListIndex( FSNode* p )
+{
+	if ( !p || !IsListed( p ) ) { return -1; }
+
+	if ( sortMode != SORT_NONE && listCount > 0 )
+	{
+		int i = FSNodeVectorSorter::BSearch( *p, list, EXACT_OR_CLOSEST_SUCCEEDING_NODE, ascSort, caseSensitive, sortMode );
+
+		if ( i < 0 ) { i = 0; }
+
+		// nodes with an equal sort key may lie on both sides of the found one
+		for ( int d = 0; i + d < listCount || i - d - 1 >= 0; d++ )
+		{
+			if ( i + d < listCount && list[i + d] == p ) { return i + d; }
+
+			if ( i - d - 1 >= 0 && list[i - d - 1] == p ) { return i - d - 1; }
+		}
+
+		return -1;
+	}
+
+	for ( int i = 0; i < listCount; i++ )
+	{
+		if ( list[i] == p ) { return i; }
+	}
+
+	return -1;
+}
+
+FSNode* PanelList::FindByName( const FSString& name )
+{
+	if ( !nameIndexValid ) { BuildNameIndex(); }
+
+	auto i = nameIndex.find( name.GetUtf8() );
+	return i != nameIndex.end() ? i->second : 0;
+}
+
+void PanelList::AddNode( clPtr<FSNode> node )
+{
+	if ( !data.ptr() ) { data = new FSList; }
+
+	if ( !nameIndexValid ) { BuildNameIndex(); }
+
+	FSNode* p = node.ptr();
+	data->Append( node );
+	nameIndex[p->GetUtf8Name()] = p;
+
+	CountNode( p, true );
+
+	if ( IsListed( p ) )
+	{
+		list.insert( list.begin() + InsertPos( p ), p );
+		listCount = ( int )list.size();
+	}
+}
+
+void PanelList::UpdateNode( FSNode* p, const FSStat& st )
+{
+	int i = ListIndex( p );
+
+	CountNode( p, false );
+
+	if ( i >= 0 )
+	{
+		list.erase( list.begin() + i );
+		listCount = ( int )list.size();
+	}
+
+	// keep a folder size calculated earlier, the folder itself has not been replaced
+	int64_t dirSize = p->st.size;
+	bool keepDirSize = p->st.IsDir() && p->st.dirCorrectSize && st.IsDir();
+
+	p->st = st;
+
+	if ( keepDirSize ) { p->st.SetDirSize( dirSize ); }
+
+	if ( !IsListed( p ) ) { p->ClearSelected(); }
+
+	CountNode( p, true );
+
+	if ( IsListed( p ) )
+	{
+		int pos = ( sortMode == SORT_NONE && i >= 0 ) ? i : InsertPos( p );
+		list.insert( list.begin() + pos, p );
+		listCount = ( int )list.size();
+	}
+}
+
+void PanelList::RemoveNodes( const std::vector<FSNode*>& nodes )
+{
+	if ( nodes.empty() || !data.ptr() ) { return; }
+
+	std::unordered_set<FSNode*> marked( nodes.begin(), nodes.end() );
+
+	for ( FSNode* p : nodes )
+	{
+		CountNode( p, false );
+
+		if ( nameIndexValid ) { nameIndex.erase( p->GetUtf8Name() ); }
+	}
+
+	// both lists are compacted once, whatever the number of removed nodes
+	int n = 0;
+
+	for ( int i = 0; i < listCount; i++ )
+		if ( !marked.count( list[i] ) ) { list[n++] = list[i]; }
+
+	list.resize( n );
+	listCount = n;
+
+	if ( !removed.ptr() ) { removed = new FSList; }
+
+	data->MoveNodes( marked, removed.ptr() );
+}
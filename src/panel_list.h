@@ -10,6 +10,9 @@
 #include "vfs.h"
 #include "vfs-uri.h"
 
+#include <string>
+#include <unordered_map>
+
 using namespace wal;
 
 enum LPanelSelectionType
@@ -53,9 +56,21 @@ private:
 	bool showHidden;
 	bool caseSensitive;
 
+	// nodes dropped by RemoveNode(), kept alive until the next SetData() because copies made by GetSelectedList() refer to them via originNode
+	clPtr<FSList> removed;
+	// utf8 name -> node of every node in 'data', built on the first incremental update
+	std::unordered_map<std::string, FSNode*> nameIndex;
+	bool nameIndexValid;
+
 	void Sort();
 	void MakeList();
 
+	void BuildNameIndex();
+	bool IsListed( FSNode* p ) const { return showHidden || !p->IsHidden(); }
+	void CountNode( FSNode* p, bool add );
+	int InsertPos( FSNode* p );
+	int ListIndex( FSNode* p );
+
 public:
 
 	PanelList( bool _showHidden, bool _case )
@@ -63,7 +78,8 @@ public:
 		   ascSort( true ),
 		   listCount( 0 ),
 		   showHidden( _showHidden ),
-		   caseSensitive( _case )
+		   caseSensitive( _case ),
+		   nameIndexValid( false )
 	{
 	}
 
@@ -86,6 +102,9 @@ public:
 		try
 		{
 			data = d;
+			removed.clear();
+			nameIndex.clear();
+			nameIndexValid = false;
 			MakeList();
 			Sort();
 		}
@@ -273,6 +292,14 @@ public:
 
 	void ShiftSelection( int n, LPanelSelectionType* selectType, bool RootDir );
 
+	// incremental updates of a watched folder: the sort order is kept by binary insertion, selection flags are not touched
+	FSNode* FindByName( const FSString& name );
+	void AddNode( clPtr<FSNode> node );
+	void UpdateNode( FSNode* p, const FSStat& st );
+	void RemoveNodes( const std::vector<FSNode*>& nodes );
+	int GetIndex( FSNode* p, bool RootDir ) { int i = ListIndex( p ); return i < 0 ? -1 : i + ( RootDir ? 0 : 1 ); }
+	int RemovedCount() const { return removed.ptr() ? removed->Count() : 0; }
+
 
 	void InvertSelection();
 	void Mark( const unicode_t* mask, bool enable );
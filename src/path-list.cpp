@@ -95,13 +95,27 @@ PathListWin::PathListWin(Win* parent, PathList& dataList)
 
     SetLSize(ls);
 
+    SetDataSource(this);
+
     if (m_dataList.GetCount() > 0)
     {
-        SetCount(m_dataList.GetCount());
         SetCurrent(0);
     }
 }
 
+int PathListWin::GetRowWidth(wal::GC& gc, int n)
+{
+    const PathList::Data* curr = m_dataList.GetData(n);
+    if (!curr)
+    {
+        return -1;
+    }
+
+    std::vector<unicode_t> text = GetItemText(curr);
+    gc.Set(GetFont());
+    return 10 + gc.GetTextExtents(text.data()).x;
+}
+
 void PathListWin::Sort()
 {
     const PathList::Data* curr = GetCurrentData();
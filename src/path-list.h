@@ -118,11 +118,15 @@ public:
 };
 
 
-class PathListWin : public VListWin
+class PathListWin : public VListWin, private VListDataSource
 {
 protected:
     PathList&  m_dataList;
 
+private:
+    virtual int GetRowCount() override { return m_dataList.GetCount(); }
+    virtual int GetRowWidth(wal::GC& gc, int n) override;
+
 public:
     PathListWin(Win* parent, PathList& dataList);
 
@@ -171,8 +175,7 @@ protected:
 	virtual std::vector<unicode_t> GetItemText( const PathList::Data* Data ) const;
     virtual void OnItemListChanged()
     {
-        CalcScroll();
-        Invalidate();
+        DataChanged();
     }
 };
 
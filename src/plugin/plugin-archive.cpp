@@ -14,7 +14,12 @@
 #include "string-util.h"
 
 #include <list>
+#include <vector>
+#include <deque>
+#include <unordered_set>
 #include <algorithm>
+#include <thread>
+#include <random>
 
 #include <archive.h>
 #include <archive_entry.h>
@@ -30,11 +35,38 @@ static int g_NextArchFD = 1;
 #ifdef _WIN32
 #  define FSARCH_ERROR_FILE_EXISTS ERROR_FILE_EXISTS
 #  define FSARCH_ERROR_FILE_NOT_FOUND ERROR_FILE_NOT_FOUND
+#  define FSARCH_ERROR_IO ERROR_WRITE_FAULT
+#  define FSARCH_ERROR_NOT_SUPPORTED ERROR_NOT_SUPPORTED
+#  define FSARCH_ERROR_CHANGED ERROR_FILE_INVALID
 #else
 #  define FSARCH_ERROR_FILE_EXISTS EEXIST
 #  define FSARCH_ERROR_FILE_NOT_FOUND ENOENT
+#  define FSARCH_ERROR_IO EIO
+#  define FSARCH_ERROR_NOT_SUPPORTED ENOTSUP
+#  define FSARCH_ERROR_CHANGED ESTALE
 #endif // _WIN32
 
+/// error of the failed C library call in the system codes StrError() takes, errno is not one of them on Windows
+static int CrtError()
+{
+#ifdef _WIN32
+	return _doserrno ? int( _doserrno ) : FSARCH_ERROR_IO;
+#else
+	return errno ? errno : FSARCH_ERROR_IO;
+#endif
+}
+
+/// error of the failed libarchive call, libarchive keeps errno codes
+static int ArchError( struct archive* Arch )
+{
+#ifdef _WIN32
+	return FSARCH_ERROR_IO;
+#else
+	const int Err = archive_errno( Arch );
+	return Err > 0 ? Err : FSARCH_ERROR_IO;
+#endif
+}
+
 
 /// Describes archive entry
 struct FSArchNode
@@ -42,15 +74,16 @@ struct FSArchNode
 	FSString name; // how it appears in panel
 	FSStat fsStat;
 	int64_t entryOffset; // position of entry inside archive
+	int entryIndex; // number of the entry in archive order, -1 for directories without an own entry
 
 	struct FSArchNode* parentDir;
 	std::list<FSArchNode> content; // content of a dir node
 
 	FSArchNode()
-		: entryOffset( 0 ), parentDir( nullptr ) { fsStat.mode |= S_IFDIR; }
+		: entryOffset( 0 ), entryIndex( -1 ), parentDir( nullptr ) { fsStat.mode |= S_IFDIR; }
 
 	FSArchNode( const char* Name, const FSStat& Stat )
-		: name( Name ), fsStat( Stat ),  entryOffset( 0 ), parentDir( nullptr ) {}
+		: name( Name ), fsStat( Stat ),  entryOffset( 0 ), entryIndex( -1 ), parentDir( nullptr ) {}
 
 	FSArchNode* findByFsPath( FSPath& basePath, int basePathLevel = 0 );
 	FSArchNode* findByName( const FSString& name, bool isRecursive = false );
@@ -74,22 +107,212 @@ struct FSArchNode
 };
 
 
+/// Parsed tree of an archive, shared by all FSArch opened on the same unchanged file
+struct FSArchIndex : public iIntrusiveCounter
+{
+	FSArchNode rootDir;
+	std::string uri;
+	int64_t size;
+	time_t mtime;
+	unsigned version; // of the archive when the tree was read, see ArchVersion()
+
+	FSArchIndex() : size( 0 ), mtime( 0 ), version( 0 ) {}
+};
+
+/// Indexes of the recently opened archives, most recently used first
+static Mutex g_ArchIndexMutex;
+static std::list< clPtr<FSArchIndex> > g_ArchIndexCache;
+static const size_t MAX_CACHED_ARCHIVES = 8;
+/// Times each archive was rewritten by FSArch::Commit(), a tree of an older version has the old entry order
+static std::unordered_map<std::string, unsigned> g_ArchVersions;
+
+static unsigned ArchVersion( const std::string& Uri )
+{
+	MutexLock Lock( &g_ArchIndexMutex );
+
+	auto it = g_ArchVersions.find( Uri );
+	return it != g_ArchVersions.end() ? it->second : 0;
+}
+
+/// makes the trees read before stale, returns the version of the rewritten archive
+static unsigned ArchRewritten( const std::string& Uri )
+{
+	MutexLock Lock( &g_ArchIndexMutex );
+
+	return ++g_ArchVersions[Uri];
+}
+
+static clPtr<FSArchIndex> ArchIndexGet( const std::string& Uri, int64_t Size, time_t MTime )
+{
+	MutexLock Lock( &g_ArchIndexMutex );
+
+	for ( auto it = g_ArchIndexCache.begin(); it != g_ArchIndexCache.end(); ++it )
+	{
+		if ( ( *it )->uri != Uri ) { continue; }
+
+		clPtr<FSArchIndex> Index = *it;
+		g_ArchIndexCache.erase( it );
+
+		auto Version = g_ArchVersions.find( Uri );
+
+		if ( Index->size != Size || Index->mtime != MTime || Index->version != ( Version != g_ArchVersions.end() ? Version->second : 0 ) )
+		{
+			// the archive was changed since it was read
+			return nullptr;
+		}
+
+		g_ArchIndexCache.push_front( Index );
+		return Index;
+	}
+
+	return nullptr;
+}
+
+static void ArchIndexPut( clPtr<FSArchIndex> Index )
+{
+	MutexLock Lock( &g_ArchIndexMutex );
+
+	for ( auto it = g_ArchIndexCache.begin(); it != g_ArchIndexCache.end(); ++it )
+	{
+		if ( ( *it )->uri == Index->uri )
+		{
+			g_ArchIndexCache.erase( it );
+			break;
+		}
+	}
+
+	g_ArchIndexCache.push_front( Index );
+
+	while ( g_ArchIndexCache.size() > MAX_CACHED_ARCHIVES )
+	{
+		g_ArchIndexCache.pop_back();
+	}
+}
+
+void ArchClose( struct archive* Arch );
+struct archive* ArchOpen( const char* FileName );
+static clPtr<FSArchIndex> ArchReadIndex( FS* Fs, FSPath& Path, const FSString& Uri );
+
+/// Archive reader positioned between entries.
+/// Reading entries in archive order with one reader decompresses the archive once, for seekable formats (zip, 7z)
+/// the skipped entries are passed by seeking over their data.
+struct FSArchReader
+{
+	struct archive* arch;
+	int nextEntry; // index of the entry the next archive_read_next_header() returns
+	bool stale; // the archive was rewritten while the reader was in use, not to be reused
+
+	FSArchReader() : arch( nullptr ), nextEntry( 0 ), stale( false ) {}
+};
+
+/// File being added to an archive.
+/// The data is spooled to a temporary file until the size needed for the entry header is known
+struct FSArchNewFile
+{
+	FSPath path;
+	FSStat st;
+	std::string spoolName;
+	FILE* spool;
+
+	FSArchNewFile() : spool( nullptr ) {}
+	~FSArchNewFile()
+	{
+		if ( spool )
+		{
+			fclose( spool );
+			remove( spoolName.c_str() );
+		}
+	}
+};
+
+/// Changes of an archive not written out yet.
+/// New files are compressed into a temporary archive by a writer thread while the next ones are copied,
+/// FSArch::Flush() adds the kept entries of the old archive and puts the temporary archive in place of the old one.
+struct FSArchUpdate
+{
+	enum { MAX_QUEUED = 4, BUFFER_SIZE = 1024 * 512 };
+
+	clPtr<FSArchIndex> oldIndex; // restored by FSArch::Rollback()
+	std::string tempSuffix; // the temporary archive is named after the old one
+	std::string tempName;
+	struct archive* arch;
+	bool hasEntries; // there are entries of the old archive to carry over
+	bool keepTemp; // the temporary archive is in place of the old one, or complete and left after a failed replace
+
+	std::unordered_set<int> dropped; // entries of the old archive replaced or deleted
+	std::vector<FSPath> newFiles; // in the order they are written
+	std::vector<FSPath> newDirs;
+
+	int fd; // of the file being added, -1 if none
+	FSArchNewFile* openFile;
+	FSArchNewFile* closedFile; // queued by the next change, SetFileTime() comes after Close()
+	int spoolCount;
+
+	Mutex mutex;
+	Cond cond;
+	std::deque<FSArchNewFile*> queue;
+	FSArchNewFile* writing; // the file of the queue the writer thread has taken
+	bool done; // no more files will be queued
+	volatile bool stop;
+	FSCInfo* info; // of the operation waiting for the writer thread
+	int error; // the first error of the writer thread, -2 if stopped
+	bool threadStarted;
+	thread_t thread;
+
+	FSArchUpdate()
+		: arch( nullptr ), hasEntries( false ), keepTemp( false ), fd( -1 ), openFile( nullptr ), closedFile( nullptr ), spoolCount( 0 ),
+		  writing( nullptr ), done( false ), stop( false ), info( nullptr ), error( 0 ), threadStarted( false ) {}
+	~FSArchUpdate();
+
+	void QueueClosed();
+	/// takes a new file back before the writer thread gets to it, false if it is written already
+	bool DropNew( FSPath& Path );
+	int Finish( FSCInfo* Info );
+	static void* ThreadFunc( void* Arg );
+
+private:
+	int WriteFile( FSArchNewFile* File, char* Buf, FSCInfo* Info );
+	void Run();
+};
+
 class FSArch : public FS
 {
 	//CLASS_COPY_PROTECTION( FSArch );
 private:
-	FSArch( const FSArch& ) : FS( PLUGIN ) {};
+	FSArch( const FSArch& a ) : FS( PLUGIN ), m_Index( a.m_Index ), m_Update( nullptr ) {};
 	FSArch& operator = ( const FSArch& ) { return *this; };
 
-	FSArchNode m_RootDir;
+	clPtr<FSArchIndex> m_Index;
 	FSString m_Uri; // original file Uri
+	clPtr<FS> m_HostFs; // FS the archive file is on
+	FSPath m_HostPath;
+
+	/// Changes not written out yet, nullptr if none
+	FSArchUpdate* m_Update;
 
+	enum { MAX_IDLE_READERS = 4, EXTRACT_BUFFER_SIZE = 1024 * 512 };
+
+	Mutex m_Mutex; // guards the readers
 	/// Stores current open files
-	std::unordered_map<int, struct archive*> m_OpenFiles;
+	std::unordered_map<int, FSArchReader> m_OpenFiles;
+	/// Readers of closed files, kept for the entries that follow
+	std::list<FSArchReader> m_IdleReaders;
+
+	bool TakeReader( int EntryIndex, FSArchReader* Reader );
+	void DropReaders();
+	/// reads the tree again if the archive was rewritten through another FSArch
+	int RefreshIndex( int* err );
+	/// fails if the archive was rewritten or changed on disk since the update began
+	int CheckUnchanged( int* err );
+
+	int BeginUpdate( int* err );
+	int CloseNewFile( int* err );
+	int Commit( int* err, FSCInfo* info );
 
 public:
-	FSArch( const FSArchNode& RootDir, const FSString& Uri ) : FS( PLUGIN ), m_RootDir( RootDir ), m_Uri( Uri ) {}
-	virtual ~FSArch() {}
+	FSArch( clPtr<FSArchIndex> Index, const FSString& Uri, clPtr<FS> HostFs, FSPath& HostPath )
+		: FS( PLUGIN ), m_Index( Index ), m_Uri( Uri ), m_HostFs( HostFs ), m_HostPath( HostPath ), m_Update( nullptr ) {}
+	virtual ~FSArch();
 
 	//
 	// FS interface
@@ -97,7 +320,7 @@ public:
 	virtual bool IsPersistent() override { return false; }
 	virtual bool IsShowDotsInRoot() override { return true; }
 
-	virtual unsigned Flags() override { return HAVE_READ; }
+	virtual unsigned Flags() override { return HAVE_READ | HAVE_WRITE; }
 
 	virtual bool IsEEXIST( int err ) override { return err == FSARCH_ERROR_FILE_EXISTS; }
 
@@ -105,21 +328,24 @@ public:
 
 	virtual bool IsEXDEV( int err ) override { return false; }
 
-	virtual FSString StrError( int err ) override { return FSString( "Operation is not supported" ); }
+	virtual FSString StrError( int err ) override
+	{
+		// all the codes are system ones, 0 is not left by any operation failed here
+		sys_char_t Buf[1024];
+		FSString Ret;
+		Ret.SetSys( sys_error_str( err ? err : FSARCH_ERROR_IO, Buf, sizeof( Buf ) / sizeof( sys_char_t ) ) );
+		return Ret;
+	}
 
 	virtual bool Equal( FS* fs ) override { return fs && fs->Type() == Type(); }
 
 	virtual int OpenRead( FSPath& path, int flags, int* err, FSCInfo* info ) override;
 
-	virtual int OpenCreate( FSPath& path, bool overwrite, int mode, int flags, int* err, FSCInfo* info ) override
-	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
-		return -1;
-	}
+	virtual int OpenCreate( FSPath& path, bool overwrite, int mode, int flags, int* err, FSCInfo* info ) override;
 
 	virtual int Rename( FSPath&  oldpath, FSPath& newpath, int* err, FSCInfo* info ) override
 	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		FS::SetError( err, FSARCH_ERROR_NOT_SUPPORTED );
 		return -1;
 	}
 
@@ -127,60 +353,44 @@ public:
 
 	virtual int Read( int fd, void* buf, int size, int* err, FSCInfo* info ) override;
 
-	virtual int Write( int fd, void* buf, int size, int* err, FSCInfo* info ) override
-	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
-		return -1;
-	}
+	virtual int Write( int fd, void* buf, int size, int* err, FSCInfo* info ) override;
 
 	virtual int Seek( int fd, SEEK_FILE_MODE mode, seek_t pos, seek_t* pRet, int* err, FSCInfo* info ) override
 	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		FS::SetError( err, FSARCH_ERROR_NOT_SUPPORTED );
 		return -1;
 	}
 
-	virtual int MkDir( FSPath& path, int mode, int* err, FSCInfo* info ) override
-	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
-		return -1;
-	}
+	virtual int MkDir( FSPath& path, int mode, int* err, FSCInfo* info ) override;
 
-	virtual int Delete( FSPath& path, int* err, FSCInfo* info ) override
-	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
-		return -1;
-	}
+	virtual int Delete( FSPath& path, int* err, FSCInfo* info ) override;
 
-	virtual int RmDir( FSPath& path, int* err, FSCInfo* info ) override
-	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
-		return -1;
-	}
+	virtual int RmDir( FSPath& path, int* err, FSCInfo* info ) override;
 
-	virtual int SetFileTime( FSPath& path, FSTime cTime, FSTime aTime, FSTime mTime, int* err, FSCInfo* info ) override
-	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
-		return -1;
-	}
+	virtual int SetFileTime( FSPath& path, FSTime cTime, FSTime aTime, FSTime mTime, int* err, FSCInfo* info ) override;
 
 	virtual int ReadDir( FSList* list, FSPath& path, int* err, FSCInfo* info ) override;
 	virtual int Stat( FSPath& path, FSStat* st, int* err, FSCInfo* info ) override;
 	virtual int StatSetAttr( FSPath& path, const FSStat* st, int* err, FSCInfo* info ) override
 	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		FS::SetError( err, FSARCH_ERROR_NOT_SUPPORTED );
 		return -1;
 	}
 
 	virtual int FStat( int fd, FSStat* st, int* err, FSCInfo* info ) override
 	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		FS::SetError( err, FSARCH_ERROR_NOT_SUPPORTED );
 		return -1;
 	}
 
-	virtual int Symlink( FSPath& path, FSString& str, int* err, FSCInfo* info ) override {  return -1;  }
+	virtual int Symlink( FSPath& path, FSString& str, int* err, FSCInfo* info ) override { FS::SetError( err, FSARCH_ERROR_NOT_SUPPORTED ); return -1; }
 	virtual int StatVfs( FSPath& path, FSStatVfs* st, int* err, FSCInfo* info ) override;
+	virtual int Extract( FSPath& dir, FSList* list, FSExtractSink* sink, int* err, FSCInfo* info ) override;
+	virtual bool IsWriteDeferred() override { return true; }
+	virtual int Flush( int* err, FSCInfo* info ) override;
+	virtual void Rollback() override;
 
-	virtual int64_t GetFileSystemFreeSpace( FSPath& path, int* err ) override { return m_RootDir.entryOffset; }
+	virtual int64_t GetFileSystemFreeSpace( FSPath& path, int* err ) override { return m_Index->rootDir.entryOffset; }
 
 	virtual FSString Uri( FSPath& path ) override
 	{
@@ -324,7 +534,9 @@ int FSArch::ReadDir( FSList* list, FSPath& path, int* err, FSCInfo* info )
 {
 	list->Clear();
 
-	FSArchNode* n = m_RootDir.findByFsPath( path );
+	if ( RefreshIndex( err ) ) { return -1; }
+
+	FSArchNode* n = m_Index->rootDir.findByFsPath( path );
 
 	if ( !n || !n->IsDir() )
 	{
@@ -347,7 +559,9 @@ int FSArch::Stat( FSPath& path, FSStat* st, int* err, FSCInfo* info )
 {
 	dbg_printf( "FSArch::Stat " );
 
-	FSArchNode* n = m_RootDir.findByFsPath( path );
+	if ( RefreshIndex( err ) ) { return -1; }
+
+	FSArchNode* n = m_Index->rootDir.findByFsPath( path );
 
 	if ( !n )
 	{
@@ -364,7 +578,7 @@ int FSArch::StatVfs( FSPath& path, FSStatVfs* st, int* err, FSCInfo* info )
 
 	FSStatVfs StatVfs;
 	StatVfs.avail = 0;
-	StatVfs.size = m_RootDir.entryOffset;
+	StatVfs.size = m_Index->rootDir.entryOffset;
 
 	*st = StatVfs;
 	return 0;
@@ -425,16 +639,97 @@ struct archive* ArchOpen( const char* FileName )
 	return nullptr;
 }
 
+FSArch::~FSArch()
+{
+	// changes not flushed by the operation that made them are dropped
+	Rollback();
+
+	for ( auto& it : m_OpenFiles ) { ArchClose( it.second.arch ); }
+
+	for ( FSArchReader& Reader : m_IdleReaders ) { ArchClose( Reader.arch ); }
+}
+
+void FSArch::DropReaders()
+{
+	MutexLock Lock( &m_Mutex );
+
+	for ( FSArchReader& Reader : m_IdleReaders ) { ArchClose( Reader.arch ); }
+
+	m_IdleReaders.clear();
+
+	for ( auto& it : m_OpenFiles ) { it.second.stale = true; }
+}
+
+int FSArch::RefreshIndex( int* err )
+{
+	// with changes pending the tree is a copy of this FSArch
+	if ( m_Update || m_Index->version == ArchVersion( m_Uri.GetUtf8() ) ) { return 0; }
+
+	clPtr<FSArchIndex> Index = ArchReadIndex( m_HostFs.Ptr(), m_HostPath, m_Uri );
+
+	if ( !Index.Ptr() )
+	{
+		FS::SetError( err, FSARCH_ERROR_IO );
+		return -1;
+	}
+
+	// the readers know the old entry order
+	DropReaders();
+	m_Index = Index;
+	return 0;
+}
+
+bool FSArch::TakeReader( int EntryIndex, FSArchReader* Reader )
+{
+	MutexLock Lock( &m_Mutex );
+
+	// the reader closest before the entry, it has the least to skip
+	auto Best = m_IdleReaders.end();
+
+	for ( auto it = m_IdleReaders.begin(); it != m_IdleReaders.end(); ++it )
+	{
+		if ( it->nextEntry <= EntryIndex && ( Best == m_IdleReaders.end() || it->nextEntry > Best->nextEntry ) )
+		{
+			Best = it;
+		}
+	}
+
+	if ( Best == m_IdleReaders.end() ) { return false; }
+
+	*Reader = *Best;
+	m_IdleReaders.erase( Best );
+	return true;
+}
+
 int FSArch::Close( int fd, int* err, FSCInfo* info )
 {
 	dbg_printf( "FSArch::Close\n" );
 
+	if ( m_Update && fd == m_Update->fd )
+	{
+		return CloseNewFile( err );
+	}
+
+	MutexLock Lock( &m_Mutex );
+
 	auto iter = m_OpenFiles.find( fd );
 
-	if ( iter != m_OpenFiles.end() )
+	if ( iter != m_OpenFiles.end() && iter->second.stale )
+	{
+		ArchClose( iter->second.arch );
+		m_OpenFiles.erase( iter );
+	}
+	else if ( iter != m_OpenFiles.end() )
 	{
-		struct archive* Arch = iter->second;
-		ArchClose( Arch );
+		// the rest of the entry is skipped by the next archive_read_next_header()
+		m_IdleReaders.push_front( iter->second );
+		m_OpenFiles.erase( iter );
+
+		if ( m_IdleReaders.size() > MAX_IDLE_READERS )
+		{
+			ArchClose( m_IdleReaders.back().arch );
+			m_IdleReaders.pop_back();
+		}
 	}
 
 	return 0;
@@ -444,49 +739,62 @@ int FSArch::OpenRead( FSPath& path, int flags, int* err, FSCInfo* info )
 {
 	dbg_printf( "FSArch::Open\n" );
 
-	FSArchNode* Node = m_RootDir.findByFsPath( path );
+	if ( RefreshIndex( err ) ) { return -1; }
 
-	if ( Node == nullptr )
+	FSArchNode* Node = m_Index->rootDir.findByFsPath( path );
+
+	if ( Node == nullptr || Node->entryIndex < 0 )
 	{
 		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
 		return -1;
 	}
 
-	struct archive* Arch = ArchOpen( m_Uri.GetUtf8() );
+	FSArchReader Reader;
 
-	if ( Arch == nullptr )
+	if ( !TakeReader( Node->entryIndex, &Reader ) )
 	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
-		return -1;
+		Reader.arch = ArchOpen( m_Uri.GetUtf8() );
+
+		if ( Reader.arch == nullptr )
+		{
+			FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+			return -1;
+		}
 	}
 
-	struct archive_entry* entry = archive_entry_new2( Arch );
-	int Res;
+	struct archive_entry* entry;
+	int Res = ARCHIVE_OK;
 
-	// seek to the entry
-	while ( ( Res = archive_read_next_header2( Arch, entry ) ) == ARCHIVE_OK )
+	// skip to the entry
+	while ( Reader.nextEntry <= Node->entryIndex )
 	{
-		int64_t EntryOffset = archive_read_header_position( Arch );
-
-		if ( EntryOffset == Node->entryOffset )
+		if ( info && info->IsStopped() )
 		{
-			break;
+			ArchClose( Reader.arch );
+			FS::SetError( err, 0 );
+			return -2;
 		}
-	}
 
-	archive_entry_free( entry );
+		Res = archive_read_next_header( Reader.arch, &entry );
 
-	if ( Res != ARCHIVE_OK )
+		if ( Res != ARCHIVE_OK && Res != ARCHIVE_WARN ) { break; }
+
+		Reader.nextEntry++;
+	}
+
+	if ( Res != ARCHIVE_OK && Res != ARCHIVE_WARN )
 	{
-		ArchClose( Arch );
-		
-		dbg_printf( "Couldn't read archive entry: %s\n", archive_error_string( Arch ) );
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		dbg_printf( "Couldn't read archive entry: %s\n", archive_error_string( Reader.arch ) );
+		ArchClose( Reader.arch );
+
+		FS::SetError( err, FSARCH_ERROR_IO );
 		return -1;
 	}
 
+	MutexLock Lock( &m_Mutex );
+
 	const int fd = g_NextArchFD++;
-	m_OpenFiles[ fd ] = Arch;
+	m_OpenFiles[ fd ] = Reader;
 	return fd;
 }
 
@@ -494,117 +802,1067 @@ int FSArch::Read( int fd, void* buf, int size, int* err, FSCInfo* info )
 {
 //	printf( "FSArch::Read\n" );
 
-	auto iter = m_OpenFiles.find( fd );
+	struct archive* Arch;
 
-	if ( iter == m_OpenFiles.end() )
 	{
-		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
-		return -1;
-	}
+		MutexLock Lock( &m_Mutex );
+
+		auto iter = m_OpenFiles.find( fd );
+
+		if ( iter == m_OpenFiles.end() )
+		{
+			FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+			return -1;
+		}
 
-	struct archive* Arch = iter->second;
+		Arch = iter->second.arch;
+	}
 
 	int Res = archive_read_data( Arch, buf, size );
 
 	return Res < 0 ? -1 : Res;
 }
 
-//
-// clArchPlugin
-//
-
-const char* clArchPlugin::GetPluginId() const
+/// File of the selection to extract with its path relative to the selection dir
+struct FSArchExtractItem
 {
-	return g_ArchPluginId;
-}
+	FSArchNode* node;
+	FSPath path;
+};
 
-FSArchNode* ArchGetParentDir( FSArchNode* CurrDir, FSPath& ItemPath, const FSStat& ItemStat )
+/// Directories are passed to the sink right away, files are collected by their entry index
+static int ArchCollectEntries( FSArchNode* Node, FSPath& Path, FSExtractSink* Sink, std::unordered_map<int, FSArchExtractItem>* Items )
 {
-	for ( int i = 0; i < ItemPath.Count() - 1; i++ )
+	if ( !Node->IsDir() )
 	{
-		FSString* Name = ItemPath.GetItem( i );
-
-		if ( i == 0 && ( Name->IsDot() || Name->IsEmpty() ) )
+		if ( Node->entryIndex >= 0 )
 		{
-			// skip root dir
-			continue;
+			FSArchExtractItem& Item = ( *Items )[Node->entryIndex];
+			Item.node = Node;
+			Item.path = Path;
 		}
 
-		FSArchNode* Dir = CurrDir->findByName( *Name );
+		return 0;
+	}
 
-		if ( Dir == nullptr )
-		{
-			FSStat Stat = ItemStat;
-			Stat.mode = S_IFDIR;
-			Stat.size = 0;
-			Dir = CurrDir->Add( FSArchNode( Name->GetUtf8(), Stat ) );
-		}
+	if ( Sink->Begin( Path, Node->fsStat ) == -2 ) { return -2; }
 
-		CurrDir = Dir;
+	for ( FSArchNode& n : Node->content )
+	{
+		Path.PushStr( n.name );
+		const int Res = ArchCollectEntries( &n, Path, Sink, Items );
+		Path.Pop();
+
+		if ( Res == -2 ) { return -2; }
 	}
 
-	return CurrDir;
+	return 0;
 }
 
-clPtr<FS> clArchPlugin::OpenFS( clPtr<FS> Fs, FSPath& Path ) const
+int FSArch::Extract( FSPath& dir, FSList* list, FSExtractSink* sink, int* err, FSCInfo* info )
 {
-	FSString Uri = Fs->Uri( Path );
+	if ( RefreshIndex( err ) ) { return -1; }
 
-	struct archive* Arch = ArchOpen( Uri.GetUtf8() );
+	FSArchNode* Dir = m_Index->rootDir.findByFsPath( dir );
 
-	if ( Arch == nullptr )
+	if ( Dir == nullptr || !Dir->IsDir() )
 	{
-		return nullptr;
+		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		return -1;
 	}
 
-	FSArchNode RootDir;
-	RootDir.fsStat.mode = S_IFDIR;
-
-	FSPath NodePath;
-	struct archive_entry* entry = archive_entry_new2( Arch );
-
-	int Res;
+	std::unordered_map<int, FSArchExtractItem> Items;
 
-	while ( ( Res = archive_read_next_header2( Arch, entry ) ) == ARCHIVE_OK )
+	for ( FSNode* n = list->First(); n; n = n->next )
 	{
-		NodePath.Set( CS_UTF8, archive_entry_pathname( entry ) );
+		FSArchNode* Node = Dir->findByName( n->Name() );
 
-		FSString* ItemName = NodePath.GetItem( NodePath.Count() - 1 );
+		if ( Node == nullptr ) { continue; }
 
-		if ( NodePath.Count() == 1 && ( ItemName->IsDot() || ItemName->IsEmpty() ) )
-		{
-			// skip root dir
-			continue;
-		}
+		FSPath Path;
+		Path.PushStr( Node->name );
 
-		const mode_t Mode = archive_entry_mode( entry );
-		const int64_t Size = archive_entry_size( entry );
-		RootDir.entryOffset += Size;
+		if ( ArchCollectEntries( Node, Path, sink, &Items ) == -2 ) { return -2; }
+	}
 
-		FSStat ItemStat;
-		ItemStat.mode = S_ISREG( Mode ) ? Mode : S_IFDIR;
-		ItemStat.size = Size;
-		ItemStat.m_CreationTime = archive_entry_ctime( entry );
-		ItemStat.m_LastAccessTime = archive_entry_atime( entry );
-		ItemStat.m_LastWriteTime = archive_entry_mtime( entry );
-		ItemStat.m_ChangeTime = ItemStat.m_LastWriteTime;
+	if ( Items.empty() ) { return 0; }
 
-		FSArchNode* Dir = ArchGetParentDir( &RootDir, NodePath, ItemStat );
-		FSArchNode* Item = Dir->Add( FSArchNode( ItemName->GetUtf8(), ItemStat ) );
-		if (Item) {
-			Item->entryOffset = archive_read_header_position( Arch );
-		}
-	}
+	struct archive* Arch = ArchOpen( m_Uri.GetUtf8() );
 
-	if ( Res != ARCHIVE_EOF )
+	if ( Arch == nullptr )
 	{
-		dbg_printf( "Couldn't read archive entry: %s\n", archive_error_string( Arch ) );
+		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		return -1;
 	}
 
-	archive_entry_free( entry );
-	ArchClose( Arch );
+	std::vector<char> Buffer( EXTRACT_BUFFER_SIZE );
+
+	struct archive_entry* entry;
+	int EntryIndex = -1;
+	size_t Left = Items.size();
+	int Ret = 0;
+
+	// one pass over the archive, the data of entries not selected is skipped by the next archive_read_next_header()
+	while ( Left > 0 && Ret == 0 )
+	{
+		if ( info && info->IsStopped() ) { Ret = -2; break; }
+
+		const int Res = archive_read_next_header( Arch, &entry );
+
+		if ( Res != ARCHIVE_OK && Res != ARCHIVE_WARN )
+		{
+			dbg_printf( "Couldn't read archive entry: %s\n", archive_error_string( Arch ) );
+			FS::SetError( err, FSARCH_ERROR_IO );
+			Ret = -1;
+			break;
+		}
+
+		auto it = Items.find( ++EntryIndex );
+
+		if ( it == Items.end() ) { continue; }
+
+		Left--;
+
+		int r = sink->Begin( it->second.path, it->second.node->fsStat );
+
+		while ( r == 0 )
+		{
+			if ( info && info->IsStopped() ) { r = -2; break; }
+
+			const la_ssize_t Bytes = archive_read_data( Arch, Buffer.data(), Buffer.size() );
+
+			if ( Bytes < 0 )
+			{
+				dbg_printf( "Couldn't read archive data: %s\n", archive_error_string( Arch ) );
+				r = sink->Fail( ArchError( Arch ) );
+				break;
+			}
+
+			if ( Bytes == 0 )
+			{
+				r = sink->End();
+				break;
+			}
+
+			r = sink->Data( Buffer.data(), ( int )Bytes );
+		}
+
+		if ( r == -2 ) { Ret = -2; }
+	}
+
+	ArchClose( Arch );
+
+	return Ret;
+}
+
+//
+// Update
+//
+
+
+/// Entry name of a node, without the leading splitter
+static std::string ArchEntryName( FSPath& Path )
+{
+	std::string Name;
+
+	for ( int i = 0; i < Path.Count(); i++ )
+	{
+		const char* Item = Path.GetItem( i )->GetUtf8();
+
+		if ( !Item || !*Item ) { continue; }
+
+		if ( !Name.empty() ) { Name += '/'; }
+
+		Name += Item;
+	}
+
+	return Name;
+}
+
+static void ArchSetEntry( struct archive_entry* Entry, FSPath& Path, FSStat& St )
+{
+	archive_entry_set_pathname( Entry, ArchEntryName( Path ).c_str() );
+	archive_entry_set_filetype( Entry, St.IsDir() ? AE_IFDIR : AE_IFREG );
+	archive_entry_set_perm( Entry, St.mode & 07777 );
+	archive_entry_set_size( Entry, St.IsDir() ? 0 : St.size );
+	archive_entry_set_mtime( Entry, ( time_t )St.m_LastWriteTime, 0 );
+}
+
+/// Copy of a tree with the parent links pointing into the copy
+static void ArchCopyTree( FSArchNode* Dst, const FSArchNode& Src )
+{
+	Dst->name = Src.name;
+	Dst->fsStat = Src.fsStat;
+	Dst->entryOffset = Src.entryOffset;
+	Dst->entryIndex = Src.entryIndex;
+
+	for ( const FSArchNode& n : Src.content )
+	{
+		Dst->content.push_back( FSArchNode() );
+		Dst->content.back().parentDir = Dst;
+		ArchCopyTree( &Dst->content.back(), n );
+	}
+}
+
+/// Nodes having an entry in the archive, by the entry index
+static void ArchCollectIndexed( FSArchNode* Node, std::unordered_map<int, FSArchNode*>* Nodes )
+{
+	if ( Node->entryIndex >= 0 ) { ( *Nodes )[Node->entryIndex] = Node; }
+
+	for ( FSArchNode& n : Node->content ) { ArchCollectIndexed( &n, Nodes ); }
+}
+
+static FSArchNode* ArchFindParent( FSArchNode* Root, FSPath& Path )
+{
+	FSPath ParentPath = Path;
+	ParentPath.Pop();
+
+	FSArchNode* Dir = Root->findByFsPath( ParentPath );
+
+	return Dir && Dir->IsDir() ? Dir : nullptr;
+}
+
+FSArchUpdate::~FSArchUpdate()
+{
+	stop = true;
+	Finish( nullptr );
+
+	delete openFile;
+	delete closedFile;
+
+	if ( arch ) { archive_write_free( arch ); }
+
+	if ( !keepTemp ) { remove( tempName.c_str() ); }
+}
+
+void FSArchUpdate::QueueClosed()
+{
+	if ( !closedFile ) { return; }
+
+	newFiles.push_back( closedFile->path );
+
+	MutexLock Lock( &mutex );
+
+	while ( queue.size() >= MAX_QUEUED && !error )
+	{
+		cond.Wait( &mutex );
+	}
+
+	queue.push_back( closedFile );
+	closedFile = nullptr;
+	cond.Broadcast();
+}
+
+bool FSArchUpdate::DropNew( FSPath& Path )
+{
+	if ( closedFile && closedFile->path.Equals( &Path ) )
+	{
+		delete closedFile;
+		closedFile = nullptr;
+		return true;
+	}
+
+	MutexLock Lock( &mutex );
+
+	for ( auto it = queue.begin(); it != queue.end(); ++it )
+	{
+		if ( *it == writing || !( *it )->path.Equals( &Path ) ) { continue; }
+
+		delete *it;
+		queue.erase( it );
+		cond.Broadcast();
+
+		// Commit() counts the entry indexes over the files written
+		for ( size_t i = newFiles.size(); i-- > 0; )
+		{
+			if ( newFiles[i].Equals( &Path ) )
+			{
+				newFiles.erase( newFiles.begin() + i );
+				break;
+			}
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+int FSArchUpdate::Finish( FSCInfo* Info )
+{
+	if ( threadStarted )
+	{
+		{
+			MutexLock Lock( &mutex );
+			done = true;
+			info = Info;
+			cond.Broadcast();
+		}
+
+		thread_join( thread, nullptr );
+		threadStarted = false;
+	}
+
+	return error;
+}
+
+int FSArchUpdate::WriteFile( FSArchNewFile* File, char* Buf, FSCInfo* Info )
+{
+	struct archive_entry* Entry = archive_entry_new();
+	ArchSetEntry( Entry, File->path, File->st );
+
+	int Res = 0;
+
+	if ( archive_write_header( arch, Entry ) < ARCHIVE_WARN )
+	{
+		Res = ArchError( arch );
+	}
+	else
+	{
+		rewind( File->spool );
+
+		size_t Bytes;
+
+		while ( !Res && ( Bytes = fread( Buf, 1, BUFFER_SIZE, File->spool ) ) > 0 )
+		{
+			if ( stop || ( Info && Info->IsStopped() ) ) { Res = -2; }
+			else if ( archive_write_data( arch, Buf, Bytes ) < 0 ) { Res = ArchError( arch ); }
+		}
+
+		if ( !Res && ferror( File->spool ) ) { Res = FSARCH_ERROR_IO; }
+	}
+
+	archive_entry_free( Entry );
+	return Res;
+}
+
+void FSArchUpdate::Run()
+{
+	std::vector<char> Buf( BUFFER_SIZE );
+
+	MutexLock Lock( &mutex );
+
+	while ( true )
+	{
+		if ( queue.empty() )
+		{
+			if ( done ) { break; }
+
+			cond.Wait( &mutex );
+			continue;
+		}
+
+		FSArchNewFile* File = queue.front();
+		writing = File;
+		const bool Skip = error != 0 || stop;
+		FSCInfo* Info = info;
+
+		Lock.Unlock();
+
+		const int Res = Skip ? 0 : WriteFile( File, Buf.data(), Info );
+		delete File;
+
+		Lock.Lock();
+
+		queue.pop_front();
+		writing = nullptr;
+
+		if ( Res && !error ) { error = Res; }
+
+		cond.Broadcast();
+	}
+}
+
+void* FSArchUpdate::ThreadFunc( void* Arg )
+{
+	( ( FSArchUpdate* )Arg )->Run();
+	return nullptr;
+}
+
+/// creates an empty file named Base + *Suffix no one else uses, as mkstemp() does, returns an error code
+static int ArchCreateTemp( const std::string& Base, std::string* Suffix )
+{
+	std::random_device Random;
+
+	for ( int i = 0; i < 100; i++ )
+	{
+		char Buf[32];
+		snprintf( Buf, sizeof( Buf ), ".wcm-%08x.tmp", unsigned( Random() ) );
+
+		FILE* File = fopen( ( Base + Buf ).c_str(), "wx" );
+
+		if ( File )
+		{
+			fclose( File );
+			*Suffix = Buf;
+			return 0;
+		}
+
+		if ( errno != EEXIST ) { return CrtError(); }
+	}
+
+	return FSARCH_ERROR_FILE_EXISTS;
+}
+
+int FSArch::BeginUpdate( int* err )
+{
+	if ( m_Update ) { return 0; }
+
+	if ( RefreshIndex( err ) ) { return -1; }
+
+	std::string Suffix;
+	const int TempRes = ArchCreateTemp( m_Uri.GetUtf8(), &Suffix );
+
+	if ( TempRes )
+	{
+		FS::SetError( err, TempRes );
+		return -1;
+	}
+
+	FSArchUpdate* Update = new FSArchUpdate();
+	Update->tempSuffix = Suffix;
+	Update->tempName = std::string( m_Uri.GetUtf8() ) + Suffix;
+	Update->arch = archive_write_new();
+
+	int Res = ARCHIVE_FATAL;
+
+	struct archive* Reader = ArchOpen( m_Uri.GetUtf8() );
+	struct archive_entry* Entry;
+	const int HeaderRes = Reader ? archive_read_next_header( Reader, &Entry ) : ARCHIVE_FATAL;
+
+	if ( HeaderRes == ARCHIVE_OK || HeaderRes == ARCHIVE_WARN )
+	{
+		// the same format through the same filters
+		Update->hasEntries = true;
+		Res = archive_write_set_format( Update->arch, archive_format( Reader ) );
+
+		for ( int i = 0; Res == ARCHIVE_OK && i < archive_filter_count( Reader ) - 1; i++ )
+		{
+			Res = archive_write_add_filter( Update->arch, archive_filter_code( Reader, i ) );
+		}
+	}
+	else if ( HeaderRes == ARCHIVE_EOF )
+	{
+		// an empty file becomes an archive of the kind its name tells (.zip, .7z, .tar.zst, ...)
+		Res = archive_write_set_format_filter_by_ext( Update->arch, m_Uri.GetUtf8() );
+	}
+
+	ArchClose( Reader );
+
+	if ( Res != ARCHIVE_OK )
+	{
+		dbg_printf( "Couldn't set up archive writer: %s\n", archive_error_string( Update->arch ) );
+		delete Update;
+		// libarchive can't write this format
+		FS::SetError( err, FSARCH_ERROR_NOT_SUPPORTED );
+		return -1;
+	}
+
+	// compressors able to (xz, zstd) run on all cores, the others ignore the option
+	const unsigned Threads = std::thread::hardware_concurrency();
+
+	if ( Threads > 1 )
+	{
+		archive_write_set_filter_option( Update->arch, nullptr, "threads", std::to_string( Threads ).c_str() );
+	}
+
+	if ( archive_write_open_filename( Update->arch, Update->tempName.c_str() ) != ARCHIVE_OK )
+	{
+		FS::SetError( err, ArchError( Update->arch ) );
+		delete Update;
+		return -1;
+	}
+
+	if ( thread_create( &Update->thread, FSArchUpdate::ThreadFunc, Update ) )
+	{
+		FS::SetError( err, FSARCH_ERROR_IO );
+		delete Update;
+		return -1;
+	}
+
+	Update->threadStarted = true;
+
+	// the tree is shared with the other FSArch on this archive, changes go to a copy
+	Update->oldIndex = m_Index;
+	m_Index = new FSArchIndex();
+	ArchCopyTree( &m_Index->rootDir, Update->oldIndex->rootDir );
+
+	m_Update = Update;
+	return 0;
+}
+
+int FSArch::OpenCreate( FSPath& path, bool overwrite, int mode, int flags, int* err, FSCInfo* info )
+{
+	if ( BeginUpdate( err ) ) { return -1; }
+
+	if ( m_Update->openFile )
+	{
+		// files are added one at a time
+		FS::SetError( err, FSARCH_ERROR_NOT_SUPPORTED );
+		return -1;
+	}
+
+	FSArchNode* Node = m_Index->rootDir.findByFsPath( path );
+
+	if ( Node && ( Node->IsDir() || !overwrite ) )
+	{
+		FS::SetError( err, FSARCH_ERROR_FILE_EXISTS );
+		return -1;
+	}
+
+	// a file added by this update is replaced, not written twice
+	if ( Node && Node->entryIndex < 0 && !m_Update->DropNew( path ) )
+	{
+		// already passed to the writer
+		FS::SetError( err, FSARCH_ERROR_NOT_SUPPORTED );
+		return -1;
+	}
+
+	m_Update->QueueClosed();
+
+	FSArchNode* Dir = Node ? Node->parentDir : ArchFindParent( &m_Index->rootDir, path );
+
+	if ( Dir == nullptr )
+	{
+		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		return -1;
+	}
+
+	FSArchNewFile* File = new FSArchNewFile();
+	File->path = path;
+	File->st.mode = S_IFREG | ( mode & 0777 );
+	File->st.m_LastWriteTime = time( nullptr );
+	File->st.m_CreationTime = File->st.m_LastWriteTime;
+	File->st.m_LastAccessTime = File->st.m_LastWriteTime;
+	File->st.m_ChangeTime = File->st.m_LastWriteTime;
+	File->spoolName = m_Update->tempName + "-" + std::to_string( m_Update->spoolCount++ );
+	File->spool = fopen( File->spoolName.c_str(), "w+b" );
+
+	if ( !File->spool )
+	{
+		FS::SetError( err, CrtError() );
+		delete File;
+		return -1;
+	}
+
+	if ( Node )
+	{
+		// the old entry is not carried over
+		if ( Node->entryIndex >= 0 )
+		{
+			m_Update->dropped.insert( Node->entryIndex );
+			Node->entryIndex = -1;
+		}
+
+		m_Index->rootDir.entryOffset -= Node->fsStat.size;
+		Node->fsStat = File->st;
+	}
+	else
+	{
+		Dir->Add( FSArchNode( path.GetItem( path.Count() - 1 )->GetUtf8(), File->st ) );
+	}
+
+	m_Update->openFile = File;
+	m_Update->fd = g_NextArchFD++;
+	return m_Update->fd;
+}
+
+int FSArch::Write( int fd, void* buf, int size, int* err, FSCInfo* info )
+{
+	if ( !m_Update || fd != m_Update->fd )
+	{
+		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		return -1;
+	}
+
+	FSArchNewFile* File = m_Update->openFile;
+
+	if ( fwrite( buf, 1, size, File->spool ) != ( size_t )size )
+	{
+		FS::SetError( err, CrtError() );
+		return -1;
+	}
+
+	File->st.size += size;
+	return size;
+}
+
+int FSArch::CloseNewFile( int* err )
+{
+	FSArchNewFile* File = m_Update->openFile;
+	m_Update->openFile = nullptr;
+	m_Update->fd = -1;
+
+	// a file failed to close stays until Delete() drops it
+	m_Update->closedFile = File;
+
+	if ( fflush( File->spool ) )
+	{
+		FS::SetError( err, CrtError() );
+		return -1;
+	}
+
+	FSArchNode* Node = m_Index->rootDir.findByFsPath( File->path );
+
+	if ( Node )
+	{
+		Node->fsStat = File->st;
+		m_Index->rootDir.entryOffset += File->st.size;
+	}
+
+	return 0;
+}
+
+int FSArch::SetFileTime( FSPath& path, FSTime cTime, FSTime aTime, FSTime mTime, int* err, FSCInfo* info )
+{
+	FSArchNode* Node = m_Index->rootDir.findByFsPath( path );
+
+	if ( Node == nullptr )
+	{
+		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		return -1;
+	}
+
+	// entries already in the archive are carried over as they are
+	if ( !m_Update || Node->entryIndex >= 0 ) { return 0; }
+
+	Node->fsStat.m_CreationTime = cTime;
+	Node->fsStat.m_LastAccessTime = aTime;
+	Node->fsStat.m_LastWriteTime = mTime;
+
+	FSArchNewFile* File = m_Update->closedFile;
+
+	if ( File && File->path.Equals( &path ) )
+	{
+		File->st.m_CreationTime = cTime;
+		File->st.m_LastAccessTime = aTime;
+		File->st.m_LastWriteTime = mTime;
+	}
+
+	return 0;
+}
+
+int FSArch::MkDir( FSPath& path, int mode, int* err, FSCInfo* info )
+{
+	if ( BeginUpdate( err ) ) { return -1; }
+
+	if ( m_Index->rootDir.findByFsPath( path ) )
+	{
+		FS::SetError( err, FSARCH_ERROR_FILE_EXISTS );
+		return -1;
+	}
+
+	FSArchNode* Dir = ArchFindParent( &m_Index->rootDir, path );
+
+	if ( Dir == nullptr )
+	{
+		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		return -1;
+	}
+
+	FSStat St;
+	St.mode = S_IFDIR | ( mode & 0777 );
+	St.m_LastWriteTime = time( nullptr );
+	St.m_CreationTime = St.m_LastWriteTime;
+	St.m_LastAccessTime = St.m_LastWriteTime;
+	St.m_ChangeTime = St.m_LastWriteTime;
+
+	Dir->Add( FSArchNode( path.GetItem( path.Count() - 1 )->GetUtf8(), St ) );
+	m_Update->newDirs.push_back( path );
+	return 0;
+}
+
+int FSArch::Delete( FSPath& path, int* err, FSCInfo* info )
+{
+	if ( BeginUpdate( err ) ) { return -1; }
+
+	FSArchNode* Node = m_Index->rootDir.findByFsPath( path );
+
+	if ( Node == nullptr || Node->IsDir() || Node->parentDir == nullptr )
+	{
+		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		return -1;
+	}
+
+	if ( Node->entryIndex >= 0 )
+	{
+		m_Update->dropped.insert( Node->entryIndex );
+	}
+	else if ( !m_Update->DropNew( path ) )
+	{
+		// already passed to the writer
+		FS::SetError( err, FSARCH_ERROR_NOT_SUPPORTED );
+		return -1;
+	}
+
+	m_Index->rootDir.entryOffset -= Node->fsStat.size;
+
+	const FSString Name = Node->name;
+	Node->parentDir->Remove( Name, false );
+	return 0;
+}
+
+int FSArch::RmDir( FSPath& path, int* err, FSCInfo* info )
+{
+	if ( BeginUpdate( err ) ) { return -1; }
+
+	FSArchNode* Node = m_Index->rootDir.findByFsPath( path );
+
+	if ( Node == nullptr || !Node->IsDir() || Node->parentDir == nullptr || !Node->content.empty() )
+	{
+		FS::SetError( err, FSARCH_ERROR_FILE_NOT_FOUND );
+		return -1;
+	}
+
+	if ( Node->entryIndex >= 0 )
+	{
+		m_Update->dropped.insert( Node->entryIndex );
+	}
+
+	std::vector<FSPath>& Dirs = m_Update->newDirs;
+
+	for ( size_t i = 0; i < Dirs.size(); i++ )
+	{
+		if ( Dirs[i].Equals( &path ) )
+		{
+			Dirs.erase( Dirs.begin() + i );
+			break;
+		}
+	}
+
+	const FSString Name = Node->name;
+	Node->parentDir->Remove( Name, false );
+	return 0;
+}
+
+int FSArch::Commit( int* err, FSCInfo* info )
+{
+	FSArchUpdate* Update = m_Update;
+
+	if ( Update->openFile )
+	{
+		FS::SetError( err, FSARCH_ERROR_NOT_SUPPORTED );
+		return -1;
+	}
+
+	Update->QueueClosed();
+
+	int Ret = Update->Finish( info );
+
+	// the dropped entries are counted in the order of the archive the update began on
+	if ( CheckUnchanged( err ) ) { return -1; }
+
+	// the entries of the old archive left in the tree, before the new files get their indexes
+	std::unordered_map<int, FSArchNode*> Kept;
+	ArchCollectIndexed( &m_Index->rootDir, &Kept );
+
+	int EntryIndex = 0;
+
+	for ( FSPath& Path : Update->newFiles )
+	{
+		FSArchNode* Node = m_Index->rootDir.findByFsPath( Path );
+
+		if ( Node ) { Node->entryIndex = EntryIndex; }
+
+		EntryIndex++;
+	}
+
+	if ( !Ret && Update->hasEntries )
+	{
+		struct archive* Reader = ArchOpen( m_Uri.GetUtf8() );
+
+		if ( Reader == nullptr )
+		{
+			Ret = FSARCH_ERROR_IO;
+		}
+		else
+		{
+			std::vector<char> Buffer( EXTRACT_BUFFER_SIZE );
+			struct archive_entry* Entry;
+			int Res;
+
+			// libarchive has no raw copy of an entry, the kept ones are decompressed and compressed again
+			for ( int i = 0; ( Res = archive_read_next_header( Reader, &Entry ) ) == ARCHIVE_OK || Res == ARCHIVE_WARN; i++ )
+			{
+				if ( info && info->IsStopped() ) { Ret = -2; break; }
+
+				if ( Update->dropped.count( i ) ) { continue; }
+
+				auto it = Kept.find( i );
+
+				if ( it != Kept.end() ) { it->second->entryIndex = EntryIndex; }
+
+				EntryIndex++;
+
+				if ( archive_write_header( Update->arch, Entry ) < ARCHIVE_WARN )
+				{
+					Ret = ArchError( Update->arch );
+					break;
+				}
+
+				la_ssize_t Bytes;
+
+				while ( ( Bytes = archive_read_data( Reader, Buffer.data(), Buffer.size() ) ) > 0 )
+				{
+					if ( archive_write_data( Update->arch, Buffer.data(), Bytes ) < 0 )
+					{
+						Ret = ArchError( Update->arch );
+						break;
+					}
+				}
+
+				if ( Ret ) { break; }
+
+				if ( Bytes < 0 )
+				{
+					Ret = ArchError( Reader );
+					break;
+				}
+			}
+
+			if ( !Ret && Res != ARCHIVE_EOF ) { Ret = ArchError( Reader ); }
+
+			ArchClose( Reader );
+		}
+	}
+
+	for ( size_t i = 0; !Ret && i < Update->newDirs.size(); i++ )
+	{
+		FSArchNode* Node = m_Index->rootDir.findByFsPath( Update->newDirs[i] );
+
+		if ( Node == nullptr || !Node->IsDir() ) { continue; }
+
+		struct archive_entry* Entry = archive_entry_new();
+		ArchSetEntry( Entry, Update->newDirs[i], Node->fsStat );
+
+		if ( archive_write_header( Update->arch, Entry ) < ARCHIVE_WARN )
+		{
+			Ret = ArchError( Update->arch );
+		}
+
+		archive_entry_free( Entry );
+		Node->entryIndex = EntryIndex++;
+	}
+
+	if ( !Ret && archive_write_close( Update->arch ) != ARCHIVE_OK )
+	{
+		Ret = ArchError( Update->arch );
+	}
+
+	if ( Ret )
+	{
+		FS::SetError( err, Ret == -2 ? 0 : Ret );
+		return Ret == -2 ? -2 : -1;
+	}
+
+	FSString* Name = m_HostPath.GetItem( m_HostPath.Count() - 1 );
+	FSPath TempPath = m_HostPath;
+	TempPath.SetItemStr( TempPath.Count() - 1, FSString( ( std::string( Name->GetUtf8() ) + Update->tempSuffix ).c_str() ) );
+
+	// nor is a change made while the entries were carried over lost
+	if ( CheckUnchanged( err ) ) { return -1; }
+
+	// the readers know the old entry order
+	DropReaders();
+
+	// the old archive is replaced in one step, it stays as it was if that fails
+	Update->keepTemp = true;
+
+	if ( m_HostFs->Rename( TempPath, m_HostPath, err, info ) ) { return -1; }
+
+	// the other FSArch on this archive read their trees again
+	m_Index->version = ArchRewritten( m_Uri.GetUtf8() );
+
+	FSStat St;
+
+	if ( m_HostFs->Stat( m_HostPath, &St, nullptr, nullptr ) == 0 )
+	{
+		m_Index->uri = m_Uri.GetUtf8();
+		m_Index->size = St.size;
+		m_Index->mtime = ( time_t )St.m_LastWriteTime;
+		ArchIndexPut( m_Index );
+	}
+
+	delete Update;
+	m_Update = nullptr;
+	return 0;
+}
+
+int FSArch::CheckUnchanged( int* err )
+{
+	const FSArchIndex* Old = m_Update->oldIndex.Ptr();
+	bool Changed = Old->version != ArchVersion( m_Uri.GetUtf8() );
+
+	// a tree read without the archive stat has nothing to compare
+	if ( !Changed && !Old->uri.empty() )
+	{
+		FSStat St;
+		Changed = m_HostFs->Stat( m_HostPath, &St, nullptr, nullptr ) != 0 ||
+		          St.size != Old->size || ( time_t )St.m_LastWriteTime != Old->mtime;
+	}
+
+	if ( Changed )
+	{
+		FS::SetError( err, FSARCH_ERROR_CHANGED );
+		return -1;
+	}
+
+	return 0;
+}
+
+int FSArch::Flush( int* err, FSCInfo* info )
+{
+	if ( !m_Update ) { return 0; }
+
+	const int Res = Commit( err, info );
+
+	// the old archive is left as it was
+	if ( Res ) { Rollback(); }
+
+	return Res;
+}
+
+void FSArch::Rollback()
+{
+	if ( !m_Update ) { return; }
+
+	m_Index = m_Update->oldIndex;
+
+	delete m_Update;
+	m_Update = nullptr;
+}
+
+//
+// clArchPlugin
+//
+
+const char* clArchPlugin::GetPluginId() const
+{
+	return g_ArchPluginId;
+}
+
+FSArchNode* ArchGetParentDir( FSArchNode* CurrDir, FSPath& ItemPath, const FSStat& ItemStat )
+{
+	for ( int i = 0; i < ItemPath.Count() - 1; i++ )
+	{
+		FSString* Name = ItemPath.GetItem( i );
+
+		if ( i == 0 && ( Name->IsDot() || Name->IsEmpty() ) )
+		{
+			// skip root dir
+			continue;
+		}
+
+		FSArchNode* Dir = CurrDir->findByName( *Name );
+
+		if ( Dir == nullptr )
+		{
+			FSStat Stat = ItemStat;
+			Stat.mode = S_IFDIR;
+			Stat.size = 0;
+			Dir = CurrDir->Add( FSArchNode( Name->GetUtf8(), Stat ) );
+		}
+
+		CurrDir = Dir;
+	}
+
+	return CurrDir;
+}
+
+/// the tree of the archive, from the cache if the file is unchanged since it was read, nullptr if it can't be opened
+static clPtr<FSArchIndex> ArchReadIndex( FS* Fs, FSPath& Path, const FSString& Uri )
+{
+	// taken first, a rewrite during the reading makes the tree stale
+	const unsigned Version = ArchVersion( Uri.GetUtf8() );
+
+	FSStat ArchStat;
+	const bool HaveStat = Fs->Stat( Path, &ArchStat, nullptr, nullptr ) == 0;
+
+	if ( HaveStat )
+	{
+		clPtr<FSArchIndex> Index = ArchIndexGet( Uri.GetUtf8(), ArchStat.size, ( time_t )ArchStat.m_LastWriteTime );
+
+		if ( Index.Ptr() ) { return Index; }
+	}
+
+	struct archive* Arch = ArchOpen( Uri.GetUtf8() );
+
+	if ( Arch == nullptr )
+	{
+		return nullptr;
+	}
+
+	clPtr<FSArchIndex> Index = new FSArchIndex();
+	Index->version = Version;
+	FSArchNode& RootDir = Index->rootDir;
+	RootDir.fsStat.mode = S_IFDIR;
+
+	FSPath NodePath;
+	int EntryIndex = -1;
+	struct archive_entry* entry = archive_entry_new2( Arch );
+
+	int Res;
+
+	while ( ( Res = archive_read_next_header2( Arch, entry ) ) == ARCHIVE_OK )
+	{
+		EntryIndex++;
+		NodePath.Set( CS_UTF8, archive_entry_pathname( entry ) );
+
+		FSString* ItemName = NodePath.GetItem( NodePath.Count() - 1 );
+
+		if ( NodePath.Count() == 1 && ( ItemName->IsDot() || ItemName->IsEmpty() ) )
+		{
+			// skip root dir
+			continue;
+		}
+
+		const mode_t Mode = archive_entry_mode( entry );
+		const int64_t Size = archive_entry_size( entry );
+		RootDir.entryOffset += Size;
+
+		FSStat ItemStat;
+		ItemStat.mode = S_ISREG( Mode ) ? Mode : S_IFDIR;
+		ItemStat.size = Size;
+		ItemStat.m_CreationTime = archive_entry_ctime( entry );
+		ItemStat.m_LastAccessTime = archive_entry_atime( entry );
+		ItemStat.m_LastWriteTime = archive_entry_mtime( entry );
+		ItemStat.m_ChangeTime = ItemStat.m_LastWriteTime;
+
+		FSArchNode* Dir = ArchGetParentDir( &RootDir, NodePath, ItemStat );
+		FSArchNode* Item = Dir->Add( FSArchNode( ItemName->GetUtf8(), ItemStat ) );
+		if (Item) {
+			Item->entryOffset = archive_read_header_position( Arch );
+			Item->entryIndex = EntryIndex;
+		}
+	}
+
+	if ( Res != ARCHIVE_EOF )
+	{
+		dbg_printf( "Couldn't read archive entry: %s\n", archive_error_string( Arch ) );
+	}
+
+	archive_entry_free( entry );
+	ArchClose( Arch );
+
+	if ( HaveStat )
+	{
+		Index->uri = Uri.GetUtf8();
+		Index->size = ArchStat.size;
+		Index->mtime = ( time_t )ArchStat.m_LastWriteTime;
+		ArchIndexPut( Index );
+	}
+
+	return Index;
+}
+
+clPtr<FS> clArchPlugin::OpenFS( clPtr<FS> Fs, FSPath& Path ) const
+{
+	FSString Uri = Fs->Uri( Path );
+	clPtr<FSArchIndex> Index = ArchReadIndex( Fs.Ptr(), Path, Uri );
+
+	if ( !Index.Ptr() ) { return nullptr; }
 
-	return new FSArch( RootDir, Uri );
+	return new FSArch( Index, Uri, Fs, Path );
 }
 
 #endif //LIBARCHIVE_EXIST
@@ -31,6 +31,20 @@ namespace wal
 		fontW = ( ts.x / ABCStringLen );
 		fontH = ts.y + 2;
 		this->SetItemSize( fontH + 1, GetItemWidth() ); //+1 for border if current
+		this->SetDataSource( this );
+	}
+
+	int TextList::GetRowWidth( GC& gc, int n )
+	{
+		if ( n < 0 || n >= ( int )list.size() ) { return -1; }
+
+		if ( list[n].pixelWidth < 0 )
+		{
+			gc.Set( GetFont() );
+			list[n].pixelWidth = gc.GetTextExtents( list[n].str.data() ).x;
+		}
+
+		return list[n].pixelWidth;
 	}
 
 	void TextList::DrawItem( GC& gc, int n, crect rect )
@@ -94,35 +108,8 @@ namespace wal
 		if ( !valid )
 		{
 			valid = true;
-			GC gc( this );
-			gc.Set( GetFont() );
-			int X = 0;
-
-			for ( int i = 0; i < (int)list.size(); i++ )
-			{
-				if ( list[i].pixelWidth < 0 )
-				{
-					list[i].pixelWidth = gc.GetTextExtents( list[i].str.data() ).x;
-				}
-
-				if ( list[i].pixelWidth > X )
-				{
-					X = list[i].pixelWidth;
-				}
-			}
-
-			if ( GetCount() != (int)list.size() )
-			{
-				SetCount( (int)list.size() );
-			}
-
-			if ( X != this->GetItemWidth() )
-			{
-				SetItemSize( GetItemHeight(), X );
-			}
-
-			CalcScroll();
-			Invalidate();
+			// the widths are measured lazily by VListWin::Paint for the visible rows only
+			DataChanged();
 		}
 	}
 
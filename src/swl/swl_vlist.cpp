@@ -11,6 +11,8 @@ namespace wal
 	int uiClassVListWin = GetUiID( "VListWin" );
 	int VListWin::UiGetClassId() { return uiClassVListWin; }
 
+	VListDataSource::~VListDataSource() {}
+
 
 	VListWin::VListWin( WTYPE wt, unsigned hints, int nId, Win* parent, SelectType st, BorderType bt, crect* rect )
 		: Win( wt, hints, parent, rect, nId ),
@@ -18,6 +20,8 @@ namespace wal
 		  borderType( bt ),
 		  itemHeight( 1 ),
 		  itemWidth( 1 ),
+		  dataSource( 0 ),
+		  widthCap( DEFAULT_WIDTH_CAP ),
 		  xOffset( 0 ),
 		  count( 0 ),
 		  first( 0 ),
@@ -95,10 +99,72 @@ namespace wal
 
 		if ( first != n )
 		{
+			int delta = n - first;
 			first = n;
 			CalcScroll();
+			ScrollItems( delta );
+		}
+	}
+
+	void VListWin::ScrollItems( int delta )
+	{
+		if ( delta >= pageSize || -delta >= pageSize )
+		{
 			Invalidate();
+			return;
 		}
+
+		ScrollClient( listRect, 0, -delta * itemHeight );
+	}
+
+	void VListWin::SetDataSource( VListDataSource* ds )
+	{
+		dataSource = ds;
+		DataChanged();
+	}
+
+	void VListWin::DataChanged()
+	{
+		count = dataSource ? dataSource->GetRowCount() : count;
+		itemWidth = 1;
+		xOffset = 0;
+
+		if ( current >= count ) { current = count - 1; }
+
+		if ( first + pageSize > count ) { first = count - pageSize; }
+
+		if ( first < 0 ) { first = 0; }
+
+		CalcScroll();
+		Invalidate();
+	}
+
+	void VListWin::DataAppended()
+	{
+		int oldCount = count;
+		count = dataSource ? dataSource->GetRowCount() : count;
+
+		if ( count == oldCount ) { return; }
+
+		CalcScroll();
+
+		for ( int i = oldCount; i < count && i <= first + pageSize; i++ )
+		{
+			InvalidateItem( i );
+		}
+	}
+
+	void VListWin::InvalidateItem( int n )
+	{
+		if ( n < first || n > first + pageSize ) { return; }
+
+		crect r = listRect;
+		r.top += ( n - first ) * itemHeight;
+		r.bottom = r.top + itemHeight;
+
+		if ( r.bottom > listRect.bottom ) { r.bottom = listRect.bottom; }
+
+		Invalidate( r );
 	}
 
 	void VListWin::MoveXOffset( int n )
@@ -170,20 +236,26 @@ namespace wal
 	{
 		crect rect = ClientRect();
 
-		switch ( borderType )
+		// the border is outside of listRect, so a repaint of some rows after scrolling skips it
+		bool onlyList = listRect.Intersect( paintRect ) == paintRect;
+
+		if ( !onlyList )
 		{
-			case SINGLE_BORDER:
-				DrawBorder( gc, rect, InFocus() ? 0x00C000 : borderColor );
-				break;
+			switch ( borderType )
+			{
+				case SINGLE_BORDER:
+					DrawBorder( gc, rect, InFocus() ? 0x00C000 : borderColor );
+					break;
 
-			case BORDER_3D:
-				Draw3DButtonW2( gc, rect, bgColor, false );
+				case BORDER_3D:
+					Draw3DButtonW2( gc, rect, bgColor, false );
 
-			default:
-				;
+				default:
+					;
+			}
 		}
 
-		if ( !scrollRect.IsEmpty() )
+		if ( !scrollRect.IsEmpty() && scrollRect.Cross( paintRect ) )
 		{
 			gc.SetFillColor( 0xD0D0D0 );
 			gc.FillRect( scrollRect ); //CCC
@@ -195,18 +267,40 @@ namespace wal
 			crect r = this->listRect;
 			int bottom = r.bottom;
 			r.bottom = r.top + itemHeight;
+			int width = itemWidth;
 
 			for ( int i = 0; i < n; i++ )
 			{
-				gc.SetClipRgn( &r );
-				crect r1( r );
-				r1.left -= xOffset;
-				this->DrawItem( gc, i + first, r1 );
+				if ( r.Cross( paintRect ) )
+				{
+					crect clip = r.Intersect( paintRect );
+					gc.SetClipRgn( &clip );
+					crect r1( r );
+					r1.left -= xOffset;
+					this->DrawItem( gc, i + first, r1 );
+
+					if ( dataSource && i + first < count )
+					{
+						int w = dataSource->GetRowWidth( gc, i + first );
+
+						if ( w > width ) { width = w < widthCap ? w : widthCap; }
+					}
+				}
+
 				r.top += itemHeight;
 				r.bottom += itemHeight;
 
 				if ( r.bottom > bottom ) { r.bottom = bottom; }
 			}
+
+			gc.SetClipRgn();
+
+			// only the scroll range changes, the drawn rows stay valid
+			if ( width != itemWidth )
+			{
+				itemWidth = width;
+				CalcScroll();
+			}
 		}
 		else
 		{
@@ -366,7 +460,6 @@ namespace wal
 					return false;
 			}
 
-			Invalidate();
 			return true;
 		}
 
@@ -411,17 +504,24 @@ namespace wal
 			if ( f < 0 ) { f = 0; }
 		}
 
-		bool redraw = ( f != first || n != current );
+		int delta = f - first;
 		first = f;
 
+		int old = current;
 		bool curChanged = ( n != current );
 
 		current = n;
 
-		if ( redraw )
+		if ( delta )
 		{
 			CalcScroll();
-			Invalidate();
+			ScrollItems( delta );
+		}
+
+		if ( curChanged )
+		{
+			InvalidateItem( old );
+			InvalidateItem( current );
 		}
 
 		if ( curChanged )
@@ -416,11 +416,26 @@ namespace wal
 	};
 
 
+	/*
+	   Source of rows for VListWin.
+	   The list asks it only about the rows it actually draws, so a consumer
+	   with a huge number of items does not have to measure them up front.
+	*/
+	class VListDataSource
+	{
+	public:
+		virtual int GetRowCount() = 0;
+		// pixel width of the row, called only for the drawn rows; -1 if unknown
+		virtual int GetRowWidth( GC& gc, int n ) { return -1; }
+		virtual ~VListDataSource();
+	};
+
 	class VListWin: public Win
 	{
 	public:
 		enum SelectType { NO_SELECT = 0, SINGLE_SELECT, MULTIPLE_SELECT };
 		enum BorderType { NO_BORDER = 0, SINGLE_BORDER, BORDER_3D};
+		enum { DEFAULT_WIDTH_CAP = 10000 };
 	private:
 		SelectType selectType;
 		BorderType borderType;
@@ -428,6 +443,9 @@ namespace wal
 		int itemHeight;
 		int itemWidth;
 
+		VListDataSource* dataSource;
+		int widthCap; //the horizontal scroll range grows up to this while rows get measured
+
 		int xOffset;
 		int count;
 		int first;
@@ -450,6 +468,10 @@ namespace wal
 
 		IntList selectList;
 
+		// moves the visible rows by delta items, blitting the rows which stay on screen
+		void ScrollItems( int delta );
+		void InvalidateItem( int n );
+
 	protected:
 		void SetCount( int );
 		void SetItemSize( int h, int w );
@@ -462,6 +484,13 @@ namespace wal
 		int GetItemWidth() { return itemWidth; }
 
 		void SetCurrent( int );
+
+		void SetDataSource( VListDataSource* ds );
+		void SetWidthCap( int w ) { widthCap = w; }
+		// the rows are replaced, the measured width is dropped
+		void DataChanged();
+		// new rows were added to the end: O(1), repaints only the appended rows that are visible
+		void DataAppended();
 	public:
 		VListWin( WTYPE t, unsigned hints, int nId, Win* _parent, SelectType st, BorderType bt, crect* rect );
 		virtual void DrawItem( GC& gc, int n, crect rect );
@@ -502,12 +531,15 @@ namespace wal
 		TLNode( const unicode_t* s, int i = 0, void* p = 0 ) : pixelWidth( -1 ), str( new_unicode_str( s ) ), intData( i ), ptrData( p ) {}
 	};
 
-	class TextList: public VListWin
+	class TextList: public VListWin, private VListDataSource
 	{
 		std::vector<TLNode> list;
 		bool valid;
 		int fontH;
 		int fontW;
+
+		virtual int GetRowCount() override { return ( int )list.size(); }
+		virtual int GetRowWidth( GC& gc, int n ) override;
 	public:
 		TextList( WTYPE t, unsigned hints, int nId, Win* _parent, SelectType st, BorderType bt, crect* rect );
 		virtual void DrawItem( GC& gc, int n, crect rect );
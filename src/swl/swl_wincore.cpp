@@ -199,6 +199,82 @@ namespace wal
 	}
 
 
+////////////////////////////////////////////////// DamageRegion
+
+	static inline int64_t RectArea( const crect& r )
+	{
+		return r.IsEmpty() ? 0 : int64_t( r.Width() ) * r.Height();
+	}
+
+	crect DamageRegion::Bounds() const
+	{
+		if ( !count ) { return crect(); }
+
+		crect r = rects[0];
+
+		for ( int i = 1; i < count; i++ ) { r = r.Union( rects[i] ); }
+
+		return r;
+	}
+
+	void DamageRegion::Add( const crect& r )
+	{
+		if ( r.IsEmpty() ) { return; }
+
+		for ( int i = 0; i < count; i++ )
+		{
+			crect u = rects[i].Union( r );
+
+			// merge if the bounding rect does not add too much extra area
+			if ( RectArea( u ) * 2 <= ( RectArea( rects[i] ) + RectArea( r ) ) * 3 )
+			{
+				rects[i] = rects[--count];
+				Add( u );
+				return;
+			}
+		}
+
+		if ( count < MAX_RECTS )
+		{
+			rects[count++] = r;
+			return;
+		}
+
+		crect b = Bounds().Union( r );
+		rects[0] = b;
+		count = 1;
+	}
+
+	void DamageRegion::Scroll( const crect& clip, int dx, int dy )
+	{
+		crect list[MAX_RECTS];
+		int n = count;
+
+		for ( int i = 0; i < n; i++ ) { list[i] = rects[i]; }
+
+		count = 0;
+
+		for ( int i = 0; i < n; i++ )
+		{
+			crect r = list[i];
+
+			if ( !r.Cross( clip ) )
+			{
+				Add( r );
+				continue;
+			}
+
+			crect moved = r.Intersect( clip );
+
+			// the part outside of the clip rect stays where it was
+			if ( moved != r ) { Add( r ); }
+
+			moved.Offset( dx, dy );
+			Add( moved.Intersect( clip ) );
+		}
+	}
+
+
 ////////////////////////////////////////////////// Win
 
 
@@ -95,6 +95,47 @@ namespace wal
 			         right < a.right ? right : a.right, bottom < a.bottom ? bottom : a.bottom );
 			return !b.IsEmpty();
 		}
+
+		crect Intersect( const crect& a ) const
+		{
+			return crect( left > a.left ? left : a.left, top > a.top ? top : a.top,
+			              right < a.right ? right : a.right, bottom < a.bottom ? bottom : a.bottom );
+		}
+
+		crect Union( const crect& a ) const
+		{
+			return crect( left < a.left ? left : a.left, top < a.top ? top : a.top,
+			              right > a.right ? right : a.right, bottom > a.bottom ? bottom : a.bottom );
+		}
+
+		void Offset( int dx, int dy ) { left += dx; right += dx; top += dy; bottom += dy; }
+	};
+
+	/*
+	   Damaged area of a window which has to be repainted.
+	   Kept as a few rectangles so that e.g. a scrolled list repaints only the
+	   newly exposed rows instead of the bounding box of all changes.
+	*/
+	class DamageRegion
+	{
+	public:
+		enum { MAX_RECTS = 4 };
+	private:
+		crect rects[MAX_RECTS];
+		int count;
+	public:
+		DamageRegion(): count( 0 ) {}
+
+		bool IsEmpty() const { return count == 0; }
+		int Count() const { return count; }
+		const crect& Get( int n ) const { return rects[n]; }
+		crect Bounds() const;
+
+		void Clear() { count = 0; }
+		void Add( const crect& r );
+
+		// moves the damaged parts lying inside the clip rect together with the pixels being scrolled
+		void Scroll( const crect& clip, int dx, int dy );
 	};
 
 }; //namespace wal
@@ -811,6 +852,9 @@ namespace wal
 		void FillRectXor( crect r );
 		void SetClipRgn( crect* r = 0 );
 
+		// shifts pixels inside the rect by (dx, dy), the uncovered part keeps old content
+		void ScrollRect( const crect& r, int dx, int dy );
+
 		void DrawIcon( int x, int y, cicon* ico );
 		void DrawIconF( int x, int y, cicon* ico );
 
@@ -1019,7 +1063,7 @@ namespace wal
 
 
 		crect position; // in parent coordinates
-		crect exposeRect;
+		DamageRegion exposeRgn;
 		void AddExposeRect( crect r );
 		SHOW_TYPE showType;
 
@@ -1110,6 +1154,13 @@ namespace wal
 		void OnTop();
 		bool IsCaptured() { return captured; }
 		void Invalidate();
+		void Invalidate( const crect& r );
+
+		/*
+		   scrolls the client area inside the rect by (dx, dy) with a screen-to-screen copy
+		   and invalidates only the uncovered strips, so Paint gets called just for them
+		*/
+		void ScrollClient( const crect& r, int dx, int dy );
 		virtual void SetFocus();
 
 		void SetName( const unicode_t* name );
@@ -789,6 +789,21 @@ namespace wal
 		::InvalidateRect( handle, &r, FALSE );
 	}
 
+	void Win::Invalidate( const crect& r )
+	{
+		RECT rect = {r.left, r.top, r.right, r.bottom};
+		::InvalidateRect( handle, &rect, FALSE );
+	}
+
+	void Win::ScrollClient( const crect& r, int dx, int dy )
+	{
+		if ( r.IsEmpty() || ( !dx && !dy ) ) { return; }
+
+		// the system keeps the update region and invalidates the uncovered parts itself
+		RECT rect = {r.left, r.top, r.right, r.bottom};
+		::ScrollWindowEx( handle, dx, dy, &rect, &rect, NULL, NULL, SW_INVALIDATE );
+	}
+
 	void Win::Maximize()
 	{
 		
@@ -1114,6 +1129,12 @@ namespace wal
 		::SelectClipRgn( handle, rgn.handle );
 	}
 
+	void GC::ScrollRect( const crect& r, int dx, int dy )
+	{
+		RECT rect = {r.left, r.top, r.right, r.bottom};
+		::ScrollDC( handle, dx, dy, &rect, &rect, NULL, NULL );
+	}
+
 	void GC::DrawIcon( int x, int y, cicon* ico )
 	{
 		if ( ico ) { ico->Draw( *this, x, y ); }
@@ -4,6 +4,11 @@
 
 
 #include <X11/Xutil.h>
+#ifdef USEXSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
 
 #include "swl.h"
 #include "swl_wincore_internal.h"
@@ -384,6 +389,118 @@ namespace wal
 	}
 
 
+#ifdef USEXSHM
+	/*
+	   MIT-SHM transport for IntXImage::Put on a local X server.
+	   Pixels are copied into one shared segment used as a ring buffer and the server
+	   reads them from there instead of receiving them through the socket.
+	   XSync is needed only when the ring wraps around, so a series of small puts
+	   (glyphs, icons, toolbar) costs no round trips.
+	*/
+	static XShmSegmentInfo shmStageInfo;
+	static bool shmStageOk = false;
+	static size_t shmStagePos = 0;
+	enum { SHM_STAGE_SIZE = 4 * 1024 * 1024 };
+
+	static bool shmAttachFailed = false;
+
+	static int ShmAttachErrorHandler( Display* d, XErrorEvent* e )
+	{
+		shmAttachFailed = true;
+		return 0;
+	}
+
+	static bool IsLocalDisplay( Display* d )
+	{
+		const char* name = DisplayString( d );
+
+		if ( !name ) { return false; }
+
+		// ":0", "unix:0" and launchd sockets are local, "host:10.0" (ssh -X) is not
+		return name[0] == ':' || name[0] == '/' || !strncmp( name, "unix:", 5 );
+	}
+
+	static void XShmStageInit()
+	{
+		shmStageOk = false;
+
+		if ( getenv( "WCM_NO_XSHM" ) ) { return; }
+
+		if ( !IsLocalDisplay( display ) || !XShmQueryExtension( display ) ) { return; }
+
+		shmStageInfo.shmid = shmget( IPC_PRIVATE, SHM_STAGE_SIZE, IPC_CREAT | 0600 );
+
+		if ( shmStageInfo.shmid < 0 ) { return; }
+
+		shmStageInfo.shmaddr = ( char* )shmat( shmStageInfo.shmid, 0, 0 );
+		shmStageInfo.readOnly = False;
+
+		if ( shmStageInfo.shmaddr == ( char* ) - 1 )
+		{
+			shmctl( shmStageInfo.shmid, IPC_RMID, 0 );
+			return;
+		}
+
+		// the server may still refuse to attach (e.g. another ipc namespace), check it synchronously
+		shmAttachFailed = false;
+		XErrorHandler prev = XSetErrorHandler( ShmAttachErrorHandler );
+		Status st = XShmAttach( display, &shmStageInfo );
+		XSync( display, False );
+		XSetErrorHandler( prev );
+
+		// the segment is destroyed automatically after both sides detach
+		shmctl( shmStageInfo.shmid, IPC_RMID, 0 );
+
+		if ( !st || shmAttachFailed )
+		{
+			shmdt( shmStageInfo.shmaddr );
+			return;
+		}
+
+		shmStagePos = 0;
+		shmStageOk = true;
+	}
+
+	/*
+	   copies the rect of a 32 bit ZPixmap image into the shared segment
+	   and fills shmIm so that the rect starts at (0,0) in it
+	*/
+	static bool XShmStage( XImage* src, int src_x, int src_y, int w, int h, XImage* shmIm )
+	{
+		if ( !shmStageOk || src->format != ZPixmap || src->bits_per_pixel != 32 ) { return false; }
+
+		size_t lineSize = size_t( w ) * 4;
+		size_t size = ( lineSize * h + 15 ) & ~size_t( 15 );
+
+		if ( size > SHM_STAGE_SIZE ) { return false; }
+
+		if ( shmStagePos + size > SHM_STAGE_SIZE )
+		{
+			// wait until the server has read everything before reusing the ring
+			XSync( display, False );
+			shmStagePos = 0;
+		}
+
+		char* dst = shmStageInfo.shmaddr + shmStagePos;
+		shmStagePos += size;
+
+		const char* s = src->data + src_y * src->bytes_per_line + src_x * 4;
+
+		for ( int y = 0; y < h; y++, s += src->bytes_per_line )
+		{
+			memcpy( dst + y * lineSize, s, lineSize );
+		}
+
+		*shmIm = *src;
+		shmIm->width = w;
+		shmIm->height = h;
+		shmIm->bytes_per_line = int( lineSize );
+		shmIm->data = dst;
+		shmIm->obdata = ( char* )&shmStageInfo;
+		return true;
+	}
+#endif
+
 	void AppInit()
 	{
 		TimeInit();
@@ -470,6 +587,11 @@ namespace wal
 		}
 
 		XSetErrorHandler( ErrorHandler );
+
+#ifdef USEXSHM
+		XShmStageInit();
+#endif
+
 		//Atoms
 		atom_WM_DELETE_WINDOW = XInternAtom( display, "WM_DELETE_WINDOW", True );
 		atom_WM_PROTOCOLS = XInternAtom( display, "WM_PROTOCOLS", True );
@@ -484,11 +606,17 @@ namespace wal
 	{
 		if ( !w ) { return; }
 
-		if ( !w->exposeRect.IsEmpty() )
+		if ( !w->exposeRgn.IsEmpty() )
 		{
+			DamageRegion rgn = w->exposeRgn;
+			w->exposeRgn.Clear();
+
 			GC gc( w );
-			w->Paint( gc, w->exposeRect );
-			w->exposeRect.Zero();
+
+			for ( int i = 0; i < rgn.Count(); i++ )
+			{
+				w->Paint( gc, rgn.Get( i ) );
+			}
 		}
 	}
 
@@ -1245,7 +1373,22 @@ static const char* getEventName(int id)
 			break; //12
 
 			case GraphicsExpose:
-				break; //13
+			{
+				// parts of a ScrollClient() source area that were obscured and could not be copied
+				Win* w = GetWinByID( event->xgraphicsexpose.drawable );
+
+				if ( !w ) { break; }
+
+				crect r( event->xgraphicsexpose.x, event->xgraphicsexpose.y,
+				         event->xgraphicsexpose.x + event->xgraphicsexpose.width, event->xgraphicsexpose.y + event->xgraphicsexpose.height );
+				w->AddExposeRect( r );
+
+				if ( !event->xgraphicsexpose.count )
+				{
+					AddRepaint( w );
+				}
+			}
+			break; //13
 
 			case NoExpose:
 				break; //14
@@ -2295,6 +2438,20 @@ Nah:
 		}
 	}
 
+	void GC::ScrollRect( const crect& r, int dx, int dy )
+	{
+		int w = r.Width() - abs( dx );
+		int h = r.Height() - abs( dy );
+
+		if ( w <= 0 || h <= 0 ) { return; }
+
+		int x = dx < 0 ? r.left - dx : r.left;
+		int y = dy < 0 ? r.top - dy : r.top;
+
+		// GraphicsExpose events for the obscured source parts are handled in DoEvents()
+		XCopyArea( display, winId, winId, gc, x, y, w, h, x + dx, y + dy );
+	}
+
 	void GC::DrawIcon( int x, int y, cicon* ico )
 	{
 		if ( ico ) { ico->Draw( *this, x, y ); }
@@ -2480,8 +2637,7 @@ Nah:
 		layout( 0 ),
 		uiNameId( uiNId ),
 
-		reparent( 0 ),
-		exposeRect( 0, 0, 0, 0 )
+		reparent( 0 )
 	{
 		crect r = ( rect ? *rect : crect( 0, 0, 1, 1 ) );
 
@@ -2842,25 +2998,46 @@ stopped:
 
 	void Win::AddExposeRect( crect r )
 	{
-		if ( exposeRect.IsEmpty() )
+		exposeRgn.Add( r );
+	}
+
+	void Win::Invalidate()
+	{
+		AddExposeRect( ClientRect() );
+		AddRepaint( this );
+	}
+
+	void Win::Invalidate( const crect& r )
+	{
+		AddExposeRect( r.Intersect( ClientRect() ) );
+		AddRepaint( this );
+	}
+
+	void Win::ScrollClient( const crect& r, int dx, int dy )
+	{
+		if ( r.IsEmpty() || ( !dx && !dy ) ) { return; }
+
+		if ( !IsVisible() || abs( dx ) >= r.Width() || abs( dy ) >= r.Height() )
 		{
-			exposeRect = r;
+			Invalidate( r );
+			return;
 		}
-		else
+
+		exposeRgn.Scroll( r, dx, dy );
+
 		{
-			if ( r.left < exposeRect.left ) { exposeRect.left = r.left; }
+			GC gc( this );
+			gc.ScrollRect( r, dx, dy );
+		}
 
-			if ( r.top < exposeRect.top ) { exposeRect.top = r.top; }
+		if ( dy > 0 ) { AddExposeRect( crect( r.left, r.top, r.right, r.top + dy ) ); }
 
-			if ( r.right > exposeRect.right ) { exposeRect.right = r.right; }
+		if ( dy < 0 ) { AddExposeRect( crect( r.left, r.bottom + dy, r.right, r.bottom ) ); }
 
-			if ( r.bottom > exposeRect.bottom ) { exposeRect.bottom = r.bottom; }
-		}
-	}
+		if ( dx > 0 ) { AddExposeRect( crect( r.left, r.top, r.left + dx, r.bottom ) ); }
+
+		if ( dx < 0 ) { AddExposeRect( crect( r.right + dx, r.top, r.right, r.bottom ) ); }
 
-	void Win::Invalidate()
-	{
-		AddExposeRect( ClientRect() );
 		AddRepaint( this );
 	}
 
@@ -3632,6 +3809,20 @@ haveMask:
 		}
 	}
 
+	static inline void PutImage( wal::GC& gc, XImage* im, int src_x, int src_y, int dest_x, int dest_y, int w, int h )
+	{
+#ifdef USEXSHM
+
+		if ( im->obdata )
+		{
+			XShmPutImage( display, gc.GetXDrawable(), gc.XHandle(), im, src_x, src_y, dest_x, dest_y, w, h, False );
+			return;
+		}
+
+#endif
+		XPutImage( display, gc.GetXDrawable(), gc.XHandle(), im, src_x, src_y, dest_x, dest_y, w, h );
+	}
+
 	void IntXImage::Put( wal::GC& gc, int src_x, int src_y, int dest_x, int dest_y, int w, int h )
 	{
 		if ( !data.data() ) { return; }
@@ -3652,6 +3843,21 @@ haveMask:
 
 		if ( w <= 0 || h <= 0 ) { return; }
 
+		XImage* pIm = &im;
+		int shift_x = 0;
+		int shift_y = 0;
+
+#ifdef USEXSHM
+		XImage shmIm;
+
+		if ( XShmStage( &im, src_x, src_y, w, h, &shmIm ) )
+		{
+			pIm = &shmIm;
+			shift_x = src_x;
+			shift_y = src_y;
+		}
+#endif
+
 		if ( mask.data() )
 		{
 
@@ -3679,8 +3885,10 @@ haveMask:
 						else
 						{
 							if ( !r.IsEmpty() )
-								XPutImage( display, gc.GetXDrawable(), gc.XHandle(), &im, r.left, r.top,
-								           dest_x + r.left, dest_y + r.top, r.Width(), r.Height() );
+							{
+								PutImage( gc, pIm, r.left - shift_x, r.top - shift_y,
+								          dest_x + r.left, dest_y + r.top, r.Width(), r.Height() );
+							}
 
 							r.Set( x1, y, x, y + 1 );
 						}
@@ -3689,14 +3897,15 @@ haveMask:
 			}
 
 			if ( !r.IsEmpty() )
-				XPutImage( display, gc.GetXDrawable(), gc.XHandle(), &im, r.left, r.top,
-				           dest_x + r.left, dest_y + r.top, r.Width(), r.Height() );
-
+			{
+				PutImage( gc, pIm, r.left - shift_x, r.top - shift_y,
+				          dest_x + r.left, dest_y + r.top, r.Width(), r.Height() );
+			}
 
 		}
 		else
 		{
-			XPutImage( display, gc.GetXDrawable(), gc.XHandle(), &im, src_x, src_y, dest_x, dest_y, w, h );
+			PutImage( gc, pIm, src_x - shift_x, src_y - shift_y, dest_x, dest_y, w, h );
 		}
 	}
 
@@ -102,3 +102,162 @@ bool GetHostIp( const char* utf8, unsigned* pIp, int* err )
 }
 
 #endif
+
+
+#ifdef _WIN32
+
+int TCPWaker::Fd() { return -1; }
+void TCPWaker::Wake() {}
+void TCPWaker::Drain() {}
+TCPWaker::~TCPWaker() {}
+
+void TCPWakeWaiters() {}
+
+#else
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+
+#if defined( __linux__ )
+#  include <sys/eventfd.h>
+#endif
+
+int TCPWaker::Fd()
+{
+	if ( rfd >= 0 ) { return rfd; }
+
+#if defined( __linux__ )
+	rfd = wfd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+#else
+	int p[2];
+
+	if ( !pipe( p ) )
+	{
+		for ( int i = 0; i < 2; i++ )
+		{
+			fcntl( p[i], F_SETFL, fcntl( p[i], F_GETFL ) | O_NONBLOCK );
+			fcntl( p[i], F_SETFD, FD_CLOEXEC );
+		}
+
+		rfd = p[0];
+		wfd = p[1];
+	}
+
+#endif
+	return rfd;
+}
+
+void TCPWaker::Wake()
+{
+	if ( wfd < 0 ) { return; }
+
+#if defined( __linux__ )
+	uint64_t v = 1;
+#else
+	char v = 1;
+#endif
+	ssize_t r = write( wfd, &v, sizeof( v ) );
+	( void )r; // a full pipe is already readable
+}
+
+void TCPWaker::Drain()
+{
+	if ( rfd < 0 ) { return; }
+
+	char buf[64];
+
+	while ( read( rfd, buf, sizeof( buf ) ) > 0 ) {}
+}
+
+TCPWaker::~TCPWaker()
+{
+	if ( rfd >= 0 ) { close( rfd ); }
+
+	if ( wfd >= 0 && wfd != rfd ) { close( wfd ); }
+}
+
+static Mutex waitersMutex;
+static std::vector<TCPWaker*> waiters;
+
+void TCPWakeWaiters()
+{
+	MutexLock lock( &waitersMutex );
+
+	for ( TCPWaker* w : waiters ) { w->Wake(); }
+}
+
+struct TCPWaitRegistration
+{
+	TCPWaker* waker;
+
+	TCPWaitRegistration( TCPWaker* w ): waker( w )
+	{
+		if ( !waker ) { return; }
+
+		MutexLock lock( &waitersMutex );
+		waiters.push_back( waker );
+	}
+
+	~TCPWaitRegistration()
+	{
+		if ( !waker ) { return; }
+
+		MutexLock lock( &waitersMutex );
+		waiters.erase( std::find( waiters.begin(), waiters.end(), waker ) );
+	}
+};
+
+#endif
+
+void TCPWait( TCPSock& sock, bool write, int timeoutSec, CheckStopFunc stopFunc, void* stopParam, TCPWaker* waker )
+{
+	if ( stopFunc && stopFunc( stopParam ) ) { throw int( -2 ); }
+
+#ifdef _WIN32
+
+	for ( int t = timeoutSec; t > 0; t-- )
+	{
+		if ( write ? sock.SelectWrite( 1 ) : sock.SelectRead( 1 ) ) { return; }
+
+		if ( stopFunc && stopFunc( stopParam ) ) { throw int( -2 ); }
+	}
+
+#else
+
+	int wakeFd = ( stopFunc && waker ) ? waker->Fd() : -1;
+	TCPWaitRegistration registration( wakeFd >= 0 ? waker : 0 );
+
+	struct pollfd p[2];
+	p[0].fd = sock.Id();
+	p[0].events = write ? POLLOUT : POLLIN;
+	p[1].fd = wakeFd;
+	p[1].events = POLLIN;
+
+	// the one second slices still check stopFunc for stop flags set without TCPWakeWaiters()
+	for ( int t = timeoutSec; t > 0; )
+	{
+		p[0].revents = p[1].revents = 0;
+
+		int n = poll( p, wakeFd >= 0 ? 2 : 1, 1000 );
+
+		if ( n < 0 )
+		{
+			if ( errno == EINTR ) { continue; }
+
+			throw int( errno );
+		}
+
+		if ( p[0].revents ) { return; }
+
+		if ( p[1].revents ) { waker->Drain(); }
+		else { t--; }
+
+		if ( stopFunc && stopFunc( stopParam ) ) { throw int( -2 ); }
+	}
+
+#endif
+
+	throw int( -3 );
+}
@@ -19,6 +19,7 @@
 #  include <arpa/inet.h>
 #  include <netinet/tcp.h>
 #  include <netinet/in.h>
+#  include <poll.h>
 #endif
 
 using namespace wal;
@@ -102,6 +103,7 @@ public:
 			throw int( SysErr() );
 		}
 	}
+	void SetRecvBuffer( int bytes ) { if ( setsockopt( sock, SOL_SOCKET, SO_RCVBUF, ( const char* )&bytes, sizeof( bytes ) ) ) { throw int( SysErr() ); } }
 	void GetSockName( Sin& s )      { int l = sizeof( Sin ); if ( getsockname( sock, s.SockAddr(), &l ) ) { throw int( SysErr() ); } }
 	int GetSoError()        { int ret; int l = sizeof( ret ); if ( getsockopt( sock, SOL_SOCKET, SO_ERROR, ( char* )&ret, &l ) ) { throw int( SysErr() ); } return ret; }
 
@@ -131,36 +133,33 @@ class TCPSock
 {
 protected:
 	int sock;
-	bool __Select( bool sRead, int timeoutSec = -1 ) //ret false on timeout
+	int __Poll( short events, int timeoutSec ) //ret 0 on timeout
 	{
-		fd_set fs;
-		FD_ZERO( &fs );
-		FD_SET( sock, &fs );
-		struct timeval tv;
+		struct pollfd p;
+		p.fd = sock;
+		p.events = events;
+		p.revents = 0;
 
-		if ( timeoutSec >= 0 ) { tv.tv_sec = timeoutSec; tv.tv_usec = 0; }
+		while ( true )
+		{
+			int n = poll( &p, 1, timeoutSec >= 0 ? timeoutSec * 1000 : -1 );
 
-		int n = select( sock + 1, ( sRead ) ? &fs : 0, ( sRead ) ? 0 : &fs, 0, timeoutSec >= 0 ? &tv : 0 );
+			if ( n < 0 && errno == EINTR ) { continue; }
 
-		if ( n < 0 ) { throw int( errno ); }
+			if ( n < 0 ) { throw int( errno ); }
 
-		return n != 0 ;
+			return n;
+		}
 	}
 
-	int __Select2( bool r, bool w, int timeoutSec = -1 ) //ret false on timeout
+	bool __Select( bool sRead, int timeoutSec = -1 ) //ret false on timeout
 	{
-		fd_set fs;
-		FD_ZERO( &fs );
-		FD_SET( sock, &fs );
-		struct timeval tv;
-
-		if ( timeoutSec >= 0 ) { tv.tv_sec = timeoutSec; tv.tv_usec = 0; }
-
-		int n = select( sock + 1, r ? &fs : 0, w ? &fs : 0, 0, timeoutSec >= 0 ? &tv : 0 );
-
-		if ( n < 0 ) { throw int( errno ); }
+		return __Poll( sRead ? POLLIN : POLLOUT, timeoutSec ) != 0;
+	}
 
-		return n;
+	int __Select2( bool r, bool w, int timeoutSec = -1 ) //ret false on timeout
+	{
+		return __Poll( ( r ? POLLIN : 0 ) | ( w ? POLLOUT : 0 ), timeoutSec );
 	}
 
 public:
@@ -194,6 +193,7 @@ public:
 	int Read( void* buf, int size )    { int bytes = read( sock, buf, size ); if ( bytes < 0 ) { throw int( errno ); } return bytes; }
 	int Write( void* buf, int size )      { int bytes = write( sock, buf, size ); if ( bytes <= 0 ) { throw int( errno ); } return bytes; }
 	void SetNoDelay( bool yes = true ) { int n = yes ? 1 : 0; if ( setsockopt( sock, IPPROTO_TCP, TCP_NODELAY, &n, sizeof( n ) ) ) { throw int( errno ); } }
+	void SetRecvBuffer( int bytes ) { if ( setsockopt( sock, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof( bytes ) ) ) { throw int( errno ); } }
 	void GetSockName( Sin& s )      { socklen_t l = sizeof( Sin ); if ( getsockname( sock, s.SockAddr(), &l ) ) { throw int( errno ); } }
 	int GetSoError()        { int ret; socklen_t l = sizeof( ret ); if ( getsockopt( sock, SOL_SOCKET, SO_ERROR, &ret, &l ) ) { throw int( errno ); } return ret; }
 
@@ -231,8 +231,10 @@ struct InBuf
 	std::vector<char> data;
 	int pos, count;
 	InBuf( int bufSize = 1024 * 16 ): size( bufSize ), data( bufSize ), pos( 1 ), count( 1 ) {}
-	int Pop( char* s, int n ) { if ( n > count - pos ) { n = count - pos; } if ( n < 0 ) { return 0; } memcpy( s, data.data() + pos, n ); pos += n; return n; }
+	int Available() const { return count > pos ? count - pos : 0; }
+	int Pop( char* s, int n ) { if ( n > count - pos ) { n = count - pos; } if ( n <= 0 ) { return 0; } memcpy( s, data.data() + pos, n ); pos += n; return n; }
 	void Clear() { pos = 1; count = 1; }
+	void Resize( int bufSize ) { size = bufSize; data.resize( bufSize ); Clear(); }
 };
 
 struct OutBuf
@@ -244,6 +246,7 @@ struct OutBuf
 	OutBuf( int bufSize = 1024 * 16 ): size( bufSize ), data( bufSize ), count( 0 ) {}
 	int Push( const char* s, int n ) { if ( n > Space() ) { n = Space(); } if ( !n ) { return 0; } memcpy( data.data() + count, s, n ); count += n; return n; }
 	void Clear() { count = 0; }
+	void Resize( int bufSize ) { size = bufSize; data.resize( bufSize ); Clear(); }
 };
 
 typedef bool ( *CheckStopFunc )( void* param );
@@ -253,6 +256,25 @@ typedef bool ( *CheckStopFunc )( void* param );
 #define TIMEOUT_WRITE (16)
 #define TIMEOUT_ACCEPT (16)
 
+/// Lets a socket waiting for data notice a stop request at once instead of on its next one second check.
+/// Sockets register their waker while they wait, TCPWakeWaiters() pokes all of them (eventfd on Linux, a pipe on other unixes).
+class TCPWaker
+{
+	int rfd, wfd;
+public:
+	TCPWaker(): rfd( -1 ), wfd( -1 ) {}
+	int Fd(); //-1 if there is no way to wake (Windows)
+	void Wake();
+	void Drain();
+	~TCPWaker();
+};
+
+/// call after setting a stop flag that is checked by a CheckStopFunc
+void TCPWakeWaiters();
+
+/// waits until 'sock' can be read or written, throws -2 when stopFunc says so and -3 after timeoutSec seconds without it
+void TCPWait( TCPSock& sock, bool write, int timeoutSec, CheckStopFunc stopFunc, void* stopParam, TCPWaker* waker );
+
 class TCPSyncBufProto
 {
 	TCPSock sock;
@@ -263,44 +285,32 @@ class TCPSyncBufProto
 	CheckStopFunc stopFunc;
 	void* stopParam;
 
-	bool Eof() { return inBuf.count == 0; }
+	int timeout;    // seconds without any progress before the operation fails with -3
+	int recvBuffer; // SO_RCVBUF in bytes, 0 - system default
+	bool noDelay;   // TCP_NODELAY, for request-reply protocols
+	TCPWaker waker;
 
-	void SelectRead()
-	{
-		for ( int t = TIMEOUT_READ; t > 0; t-- )
-		{
-			if ( sock.SelectRead( 1 ) ) { return; }
+	bool Eof() { return inBuf.count == 0; }
 
-			if ( stopFunc && stopFunc( stopParam ) ) { throw int( -2 ); }
-		}
+	void SelectRead() { TCPWait( sock, false, timeout, stopFunc, stopParam, &waker ); }
+	void SelectWrite() { TCPWait( sock, true, timeout, stopFunc, stopParam, &waker ); }
 
-		throw int( -3 );
-	}
-
-	void SelectWrite()
+	void WriteData( const char* s, int size )
 	{
-		for ( int t = TIMEOUT_WRITE; t > 0; t-- )
+		while ( size > 0 )
 		{
-			if ( sock.SelectWrite( 1 ) ) { return; }
-
-			if ( stopFunc && stopFunc( stopParam ) ) { throw int( -2 ); }
+			SelectWrite();
+			int n = sock.Write( ( void* )s, size );
+			s += n;
+			size -= n;
 		}
-
-		throw int( -3 );
 	}
 
 	void WriteBuf()
 	{
 		if ( outBuf.count <= 0 ) { return; }
 
-		int pos = 0;
-
-		while ( pos < outBuf.count )
-		{
-			SelectWrite();
-			pos += sock.Write( outBuf.data.data() + pos, outBuf.count - pos );
-		}
-
+		WriteData( outBuf.data.data(), outBuf.count );
 		outBuf.count = 0;
 	}
 
@@ -314,8 +324,22 @@ class TCPSyncBufProto
 		inBuf.count = bytes;
 		inBuf.pos = 0;
 	}
+
+	void SetOptions()
+	{
+		if ( recvBuffer > 0 ) { sock.SetRecvBuffer( recvBuffer ); }
+
+		if ( noDelay ) { sock.SetNoDelay(); }
+	}
 public:
-	TCPSyncBufProto(): stopFunc( 0 ), stopParam( 0 ) {}
+	TCPSyncBufProto(): stopFunc( 0 ), stopParam( 0 ), timeout( TIMEOUT_READ ), recvBuffer( 0 ), noDelay( false ) {}
+
+	/// sizes of the read and write buffers, takes effect at once, so call it while not connected
+	void SetBufferSize( int bytes ) { if ( bytes < 1024 ) { bytes = 1024; } inBuf.Resize( bytes ); outBuf.Resize( bytes ); }
+	/// applied to the socket by the next Connect() or Accept()
+	void SetSockOptions( int recvBufferBytes, bool tcpNoDelay ) { recvBuffer = recvBufferBytes; noDelay = tcpNoDelay; }
+	void SetTimeout( int seconds ) { timeout = seconds > 0 ? seconds : TIMEOUT_READ; }
+	int Timeout() const { return timeout; }
 
 	void GetSockName( Sin& s ) { sock.GetSockName( s ); }
 
@@ -327,6 +351,7 @@ public:
 		{
 			sock.Bind();
 			sock.SetNonBlock();
+			SetOptions();
 
 			try { sock.Connect( ip, port ); }
 			catch ( int e )
@@ -353,6 +378,17 @@ public:
 		}
 	}
 
+	/// waits for a connection on a listening socket and takes it over
+	void Accept( TCPSock& listener )
+	{
+		TCPWait( listener, false, timeout, stopFunc, stopParam, &waker );
+
+		Sin sin;
+		listener.Accept( sock, sin );
+		sock.SetNonBlock();
+		SetOptions();
+	}
+
 	int GetC() { ReadBuf(); return Eof() ? int( EOF ) : int( inBuf.data[inBuf.pos++] ) & 0xFF; }
 
 	TCPSock& Sock() { return sock; }
@@ -360,49 +396,62 @@ public:
 	char* ReadLine( char* buf, int size )
 	{
 		size--;
-		int n = 0;
 		char* s = buf;
-		dbg_printf( "\n" );
+		bool skip = false; // the line is longer than the buffer, the rest of it is dropped
 
-		for ( ; size > 0; s++, size--, n++ )
+		while ( true )
 		{
-			int c = GetC();
-
-			if ( c >= 32 ) { dbg_printf( "%c", c ); }
+			ReadBuf();
 
-			if ( c == '\n' )
+			if ( Eof() )
 			{
 				*s = 0;
-				return buf;
+				return ( s > buf || skip ) ? buf : 0;
 			}
-			else if ( c == EOF )
+
+			const char* p = inBuf.data.data() + inBuf.pos;
+			int n = inBuf.Available();
+			const char* nl = ( const char* )memchr( p, '\n', n );
+			int len = nl ? int( nl - p ) : n;
+
+			if ( !skip )
 			{
-				*s = 0;
-				return n > 0 ? buf : 0;
-			}
+				int c = len < size ? len : size;
+				memcpy( s, p, c );
+				s += c;
+				size -= c;
 
-			*s = c;
-		}
+				if ( !size && ( len > c || !nl ) ) { skip = true; }
+			}
 
-		while ( true )
-		{
-			int c = GetC();
+			inBuf.pos += nl ? len + 1 : len;
 
-			if ( c == '\n' || c == EOF ) { break; }
+			if ( nl ) { break; }
 		}
 
+		*s = 0;
+		dbg_printf( "\n%s", buf );
+
 		return buf;
 	}
 
 	void Flush() { WriteBuf(); }
 	void Close( bool aborted = false ) { if ( !aborted ) { Flush(); sock.Shutdown(); };  sock.Close( aborted ); inBuf.Clear(); outBuf.Clear(); }
 	void PutC( unicode_t c ) { if ( !outBuf.Space() ) { WriteBuf(); } outBuf.data[outBuf.count++] = char( c & 0xFF ); }
-	void WriteStr( const char* s ) { for ( ; *s; s++ ) { PutC( *s ); } }
+	void WriteStr( const char* s ) { Write( s, int( strlen( s ) ) ); }
 	void WriteStr( const char* s1, const char* s2 ) { WriteStr( s1 ); WriteStr( s2 ); }
 	void WriteStr( const char* s1, const char* s2, const char* s3 ) { WriteStr( s1 ); WriteStr( s2 ); WriteStr( s3 ); }
 
 	void Write( const char* s, int size )
 	{
+		// a block as large as the buffer goes to the socket without copying
+		if ( size >= outBuf.size )
+		{
+			WriteBuf();
+			WriteData( s, size );
+			return;
+		}
+
 		while ( size > 0 )
 		{
 			int n = outBuf.Push( s, size );
@@ -426,7 +475,19 @@ public:
 			{
 				if ( Eof() ) { break; }
 
-				ReadBuf();
+				if ( size >= inBuf.size )
+				{
+					// the buffer is empty and the caller wants more than it holds, read straight into the caller's memory
+					WriteBuf();
+					SelectRead();
+					n = sock.Read( s, size );
+
+					if ( !n ) { inBuf.count = inBuf.pos = 0; break; } //eof
+				}
+				else
+				{
+					ReadBuf();
+				}
 			}
 
 			size -= n;
@@ -6,6 +6,14 @@
 
 #include "unicode_lc.h"
 
+#include <string.h>
+#include <vector>
+
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#  include <emmintrin.h>
+#  define LC_SSE2
+#endif
+
 static unsigned short tab1024[1024] =
 {
 	0x0000, 0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007, 0x0008, 0x0009, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E, 0x000F,
@@ -81,6 +89,60 @@ struct UStruct
 	unsigned short b;
 };
 
+/*
+   the tables here are built once into a two-level table over all the planes:
+   the high bits of a character choose a block of 256 deltas to add to it,
+   all the blocks without case pairs share the first block of zeros
+*/
+class UnicodeCaseTable
+{
+public:
+	UnicodeCaseTable( const unsigned short* tab, const UStruct* pairs, int count, unsigned supplFirst, unsigned supplLast, int supplDelta );
+
+	wal::unicode_t Get( wal::unicode_t ch ) const
+	{
+		unsigned c = ( unsigned )ch;
+		return c < LIMIT ? wal::unicode_t( c + deltas[( blocks[c >> 8] << 8 ) | ( c & 0xFF )] ) : ch;
+	}
+
+private:
+	enum { LIMIT = 0x110000 };
+
+	unsigned short blocks[LIMIT >> 8];
+	std::vector<int> deltas;
+
+	void Set( unsigned c, unsigned to );
+};
+
+UnicodeCaseTable::UnicodeCaseTable( const unsigned short* tab, const UStruct* pairs, int count, unsigned supplFirst, unsigned supplLast, int supplDelta )
+	: deltas( 0x100, 0 )
+{
+	memset( blocks, 0, sizeof( blocks ) );
+
+	for ( unsigned c = 0; c < 1024; c++ ) { Set( c, tab[c] ); }
+
+	// the first 1024 characters are taken from 'tab' only
+	for ( int i = 0; i < count; i++ )
+		if ( pairs[i].a >= 1024 ) { Set( pairs[i].a, pairs[i].b ); }
+
+	for ( unsigned c = supplFirst; c <= supplLast; c++ ) { Set( c, c + supplDelta ); }
+}
+
+void UnicodeCaseTable::Set( unsigned c, unsigned to )
+{
+	if ( c == to ) { return; }
+
+	unsigned short& b = blocks[c >> 8];
+
+	if ( !b )
+	{
+		b = ( unsigned short )( deltas.size() >> 8 );
+		deltas.resize( deltas.size() + 0x100, 0 );
+	}
+
+	deltas[( b << 8 ) | ( c & 0xFF )] = int( to ) - int( c );
+}
+
 static UStruct uData[690] =
 {
 	{ 0x0400, 0x0450 }, { 0x0401, 0x0451 }, { 0x0402, 0x0452 }, { 0x0403, 0x0453 }, { 0x0404, 0x0454 }, { 0x0405, 0x0455 }, { 0x0406, 0x0456 },
@@ -185,26 +247,61 @@ static UStruct uData[690] =
 };
 
 
+static const UnicodeCaseTable& LCTable()
+{
+	static UnicodeCaseTable t( tab1024, uData, sizeof( uData ) / sizeof( uData[0] ), 0x10400, 0x10427, 40 );
+	return t;
+}
+
 wal::unicode_t UnicodeLC( wal::unicode_t ch )
 {
-	if ( ch < 1024 ) { return tab1024[ch]; }
+	unsigned c = ( unsigned )ch;
+
+	if ( c < 0x80 ) { return c - 'A' <= 'Z' - 'A' ? wal::unicode_t( c + 'a' - 'A' ) : ch; }
 
-	if ( ch <= 0xFFFF )
+	return LCTable().Get( ch );
+}
+
+void UnicodeLC( wal::unicode_t* s, int len )
+{
+	if ( !s ) { return; }
+
+	if ( len < 0 )
 	{
-		int L = 0, R = 690;
+		len = 0;
+
+		while ( s[len] ) { len++; }
+	}
 
-		while ( L < R )
+	const UnicodeCaseTable& t = LCTable();
+	int i = 0;
+
+#if defined( LC_SSE2 ) && !defined( _WIN32 )
+	// 4 characters at once while they are ASCII (unicode_t is 32 bit outside of Windows)
+	const __m128i notAscii = _mm_set1_epi32( ~0x7F );
+	const __m128i beforeA = _mm_set1_epi32( 'A' - 1 );
+	const __m128i afterZ = _mm_set1_epi32( 'Z' + 1 );
+	const __m128i diff = _mm_set1_epi32( 'a' - 'A' );
+	const __m128i zero = _mm_setzero_si128();
+
+	for ( ; i + 4 <= len; i += 4 )
+	{
+		__m128i v = _mm_loadu_si128( ( const __m128i* )( s + i ) );
+
+		if ( _mm_movemask_epi8( _mm_cmpeq_epi32( _mm_and_si128( v, notAscii ), zero ) ) != 0xFFFF )
 		{
-			int i = ( L + R ) / 2;
+			for ( int k = i; k < i + 4; k++ ) { s[k] = t.Get( s[k] ); }
 
-			if ( ch <= uData[i].a ) { R = i; }
-			else { L = i + 1; }
+			continue;
 		}
 
-		return uData[R].a == ch ? uData[R].b : ch;
+		__m128i upper = _mm_and_si128( _mm_cmpgt_epi32( v, beforeA ), _mm_cmplt_epi32( v, afterZ ) );
+		_mm_storeu_si128( ( __m128i* )( s + i ), _mm_add_epi32( v, _mm_and_si128( upper, diff ) ) );
 	}
 
-	return ch >= 0x10400 && ch <= 0x10427 ? ch + 40 : ch;
+#endif
+
+	for ( ; i < len; i++ ) { s[i] = t.Get( s[i] ); }
 }
 
 //косячные таблицы
@@ -379,24 +476,17 @@ static UStruct uDataUC[679] =
 	{ 0xFF55, 0xFF35 }, { 0xFF56, 0xFF36 }, { 0xFF57, 0xFF37 }, { 0xFF58, 0xFF38 }, { 0xFF59, 0xFF39 }, { 0xFF5A, 0xFF3A },
 };
 
-wal::unicode_t UnicodeUC( wal::unicode_t ch )
+static const UnicodeCaseTable& UCTable()
 {
-	if ( ch < 1024 ) { return tab1024UC[ch]; }
-
-	if ( ch <= 0xFFFF )
-	{
-		int L = 0, R = 679;
-
-		while ( L < R )
-		{
-			int i = ( L + R ) / 2;
+	static UnicodeCaseTable t( tab1024UC, uDataUC, sizeof( uDataUC ) / sizeof( uDataUC[0] ), 0x10400 + 40, 0x10427 + 40, -40 );
+	return t;
+}
 
-			if ( ch <= uDataUC[i].a ) { R = i; }
-			else { L = i + 1; }
-		}
+wal::unicode_t UnicodeUC( wal::unicode_t ch )
+{
+	unsigned c = ( unsigned )ch;
 
-		return uDataUC[R].a == ch ? uDataUC[R].b : ch;
-	}
+	if ( c < 0x80 ) { return c - 'a' <= 'z' - 'a' ? wal::unicode_t( c - ( 'a' - 'A' ) ) : ch; }
 
-	return ch >= 0x10400 + 40 && ch <= 0x10427 + 40 ? ch - 40 : ch;
+	return UCTable().Get( ch );
 }
@@ -11,6 +11,9 @@
 /// convert a single UCS-2 character to lowercase
 wal::unicode_t UnicodeLC( wal::unicode_t ch );
 
+/// convert 'len' characters of 's' to lowercase in place, up to the terminating 0 if 'len' < 0
+void UnicodeLC( wal::unicode_t* s, int len = -1 );
+
 /// convert a single UCS-2 character to uppercase
 wal::unicode_t UnicodeUC( wal::unicode_t ch );
 
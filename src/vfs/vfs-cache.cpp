@@ -0,0 +1,266 @@
+/*
+ * Part of WCM Commander
+ * https://github.com/corporateshark/WCMCommander
+ * wcm@linderdaum.com
+ */
+
+#include "vfs-cache.h"
+
+#include <iterator>
+
+struct FSDirCacheRefresh
+{
+	FSDirCache* cache;
+	clPtr<FS> fs; // keeps the owner (and so the cache) alive while the directory is reread
+	FSPath path;
+};
+
+FSDirCache::FSDirCache( FS* o, ReadFunc r )
+	: owner( o ), read( r ), nodeCount( 0 ), generation( 0 )
+{
+}
+
+std::string FSDirCache::Key( FSPath& path, std::string* parent, std::string* name )
+{
+	std::string key;
+
+	if ( parent ) { parent->clear(); }
+
+	if ( name ) { name->clear(); }
+
+	for ( int i = 0; i < path.Count(); i++ )
+	{
+		const char* s = path.GetItem( i )->GetUtf8();
+
+		// the root of an absolute path and a trailing splitter are empty items
+		if ( !s || !*s ) { continue; }
+
+		if ( parent ) { *parent = key; }
+
+		if ( name ) { *name = s; }
+
+		key += '/';
+		key += s;
+	}
+
+	return key;
+}
+
+FSDirCache::Entry* FSDirCache::Find( const std::string& key, bool allowStale, bool* stale )
+{
+	auto it = entries.find( key );
+
+	if ( it == entries.end() ) { return 0; }
+
+	int ttl = g_WcmConfig.remoteCacheTtl;
+	time_t age = time( 0 ) - it->second.tim;
+
+	*stale = false;
+
+	if ( ttl > 0 && age >= 0 && age <= ttl * STALE_FACTOR )
+	{
+		if ( age > ttl )
+		{
+			if ( !g_WcmConfig.remoteCacheStale ) { Drop( it ); return 0; }
+
+			if ( !allowStale ) { return 0; }
+
+			*stale = true;
+		}
+
+		lru.splice( lru.begin(), lru, it->second.lru );
+		return &it->second;
+	}
+
+	Drop( it );
+	return 0;
+}
+
+void FSDirCache::Drop( std::unordered_map<std::string, Entry>::iterator it )
+{
+	nodeCount -= it->second.list->Count();
+	lru.erase( it->second.lru );
+	entries.erase( it );
+}
+
+FSDirCache::LOOKUP FSDirCache::GetList( FSPath& path, FSList* list )
+{
+	std::string key = Key( path );
+
+	MutexLock lock( &mutex );
+
+	bool stale = false;
+	Entry* e = Find( key, true, &stale );
+
+	if ( !e ) { return MISS; }
+
+	if ( list ) { list->CopyFrom( *e->list.ptr() ); }
+
+	if ( !stale ) { return FRESH; }
+
+	StartRefresh( path, e );
+	return STALE;
+}
+
+int FSDirCache::GetStat( FSPath& path, FSStat* st )
+{
+	std::string dir;
+	std::string name;
+	Key( path, &dir, &name );
+
+	if ( name.empty() ) { return 1; }
+
+	MutexLock lock( &mutex );
+
+	bool stale = false;
+	Entry* e = Find( dir, false, &stale );
+
+	if ( !e ) { return 1; }
+
+	auto n = e->names.find( name );
+
+	if ( n == e->names.end() ) { return -1; }
+
+	if ( st ) { *st = n->second->st; }
+
+	return 0;
+}
+
+unsigned FSDirCache::Generation()
+{
+	MutexLock lock( &mutex );
+	return generation;
+}
+
+void FSDirCache::PutList( FSPath& path, FSList& list, unsigned gen )
+{
+	if ( g_WcmConfig.remoteCacheTtl <= 0 || list.Count() > MAX_NODES ) { return; }
+
+	std::string key = Key( path );
+
+	clPtr<FSList> copy = new FSList();
+	copy->CopyFrom( list );
+
+	MutexLock lock( &mutex );
+
+	if ( gen != generation ) { return; }
+
+	auto it = entries.find( key );
+
+	if ( it != entries.end() ) { Drop( it ); }
+
+	lru.push_front( key );
+
+	Entry& e = entries[key];
+	e.tim = time( 0 );
+	e.list = copy;
+	e.lru = lru.begin();
+
+	for ( FSNode* p = copy->First(); p; p = p->next )
+	{
+		const char* s = p->name.GetUtf8();
+
+		if ( s ) { e.names[s] = p; }
+	}
+
+	nodeCount += copy->Count();
+
+	int maxDirs = g_WcmConfig.remoteCacheDirs;
+
+	if ( maxDirs < 1 ) { maxDirs = 1; }
+
+	while ( entries.size() > 1 && ( ( int )entries.size() > maxDirs || nodeCount > MAX_NODES ) )
+	{
+		Drop( entries.find( lru.back() ) );
+	}
+}
+
+void FSDirCache::Invalidate( FSPath& path )
+{
+	std::string dir;
+	std::string key = Key( path, &dir );
+	std::string prefix = key + "/";
+
+	MutexLock lock( &mutex );
+
+	generation++;
+
+	for ( auto it = entries.begin(); it != entries.end(); )
+	{
+		auto next = std::next( it );
+
+		if ( it->first == dir || it->first == key || !it->first.compare( 0, prefix.size(), prefix ) )
+		{
+			Drop( it );
+		}
+
+		it = next;
+	}
+}
+
+void FSDirCache::Clear()
+{
+	MutexLock lock( &mutex );
+
+	generation++;
+	entries.clear();
+	lru.clear();
+	nodeCount = 0;
+}
+
+void FSDirCache::StartRefresh( FSPath& path, Entry* e )
+{
+	if ( e->refreshing ) { return; }
+
+	FSDirCacheRefresh* arg = new FSDirCacheRefresh;
+	arg->cache = this;
+	arg->fs = owner;
+	arg->path = path;
+
+	e->refreshing = true;
+
+	thread_t th;
+
+	if ( thread_create( &th, RefreshThreadFunc, arg, true ) )
+	{
+		e->refreshing = false;
+		delete arg;
+	}
+}
+
+void* FSDirCache::RefreshThreadFunc( void* p )
+{
+	FSDirCacheRefresh* arg = ( FSDirCacheRefresh* )p;
+	FSDirCache* cache = arg->cache;
+
+	FSList list;
+	int err = 0;
+	int ret = -1;
+	unsigned gen = cache->Generation();
+
+	try
+	{
+		ret = cache->read( arg->fs.ptr(), &list, arg->path, &err, 0 );
+	}
+	catch ( cexception* ex )
+	{
+		ex->destroy();
+	}
+
+	if ( !ret )
+	{
+		cache->PutList( arg->path, list, gen );
+	}
+	else
+	{
+		// the directory may be gone, let the next visit go to the server and report it
+		std::string key = Key( arg->path );
+		MutexLock lock( &cache->mutex );
+		auto it = cache->entries.find( key );
+
+		if ( it != cache->entries.end() ) { cache->Drop( it ); }
+	}
+
+	delete arg; // may destroy the owner FS together with the cache
+	return 0;
+}
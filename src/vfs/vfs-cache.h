@@ -0,0 +1,72 @@
+/*
+ * Part of WCM Commander
+ * https://github.com/corporateshark/WCMCommander
+ * wcm@linderdaum.com
+ */
+
+#pragma once
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "vfs.h"
+
+/// Directory listings of a remote FS kept for a while, so walking back and forth in a remote tree
+/// does not go to the server every time. Stat of a file is answered from the listing of its directory.
+/// Lifetime and limits are taken from the network settings (see wcm-config.h).
+class FSDirCache
+{
+public:
+	/// reads a directory from the server bypassing the cache, info is 0 when called for a background refresh
+	typedef int ( *ReadFunc )( FS* fs, FSList* list, FSPath& path, int* err, FSCInfo* info );
+
+	enum LOOKUP { MISS = 0, FRESH, STALE };
+
+	FSDirCache( FS* owner, ReadFunc read );
+
+	/// copies the cached listing of 'path' into 'list', a STALE one is returned too and reread in the background
+	LOOKUP GetList( FSPath& path, FSList* list );
+
+	/// 0 - ok, 1 - no fresh listing of the parent directory, -1 - not in the parent listing
+	int GetStat( FSPath& path, FSStat* st );
+
+	/// take before reading from the server and pass to PutList(), a listing read across Invalidate() is dropped
+	unsigned Generation();
+	void PutList( FSPath& path, FSList& list, unsigned generation );
+
+	/// 'path' was changed through the owner FS: forgets the listing of its directory and the listings of 'path' and below
+	void Invalidate( FSPath& path );
+	void Clear();
+
+private:
+	enum CONSTS { STALE_FACTOR = 10, MAX_NODES = 200000 };
+
+	struct Entry
+	{
+		time_t tim;
+		clPtr<FSList> list;
+		std::unordered_map<std::string, FSNode*> names;
+		std::list<std::string>::iterator lru;
+		bool refreshing;
+		Entry(): tim( 0 ), refreshing( false ) {}
+	};
+
+	Mutex mutex;
+	FS* owner;
+	ReadFunc read;
+	std::unordered_map<std::string, Entry> entries;
+	std::list<std::string> lru; // most recently used first
+	int nodeCount;
+	unsigned generation;
+
+	static std::string Key( FSPath& path, std::string* parent = 0, std::string* name = 0 );
+
+	Entry* Find( const std::string& key, bool allowStale, bool* stale ); //with mutex locked
+	void Drop( std::unordered_map<std::string, Entry>::iterator it ); //with mutex locked
+	void StartRefresh( FSPath& path, Entry* e ); //with mutex locked
+	static void* RefreshThreadFunc( void* arg );
+
+	FSDirCache( const FSDirCache& );
+	void operator = ( const FSDirCache& );
+};
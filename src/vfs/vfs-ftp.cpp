@@ -182,6 +182,10 @@ void FTPNode::OpenData( const char* cmd )
 	{
 		s.Create();
 		s.SetNonBlock();
+
+		// accepted sockets inherit it, the window is negotiated before accept() returns
+		if ( g_WcmConfig.tcpReceiveBuffer > 0 ) { s.SetRecvBuffer( g_WcmConfig.tcpReceiveBuffer * 1024 ); }
+
 		s.Bind();
 		Sin ctrlSin, sSin;
 		ctrl.GetSockName( ctrlSin );
@@ -201,23 +205,27 @@ void FTPNode::OpenData( const char* cmd )
 	{
 		s.Listen();
 
-		if ( !s.SelectRead( TIMEOUT_ACCEPT ) ) { throw int( -3 ); } //!!! надо посекундный цикл
-
-		Sin sin;
-		s.Accept( data.Sock(), sin );
+		data.Accept( s );
 	}
 
 	CheckFtpRet( ReadCode() );
 }
 
 
-FTPNode::FTPNode(): _passive( false ) {}
+FTPNode::FTPNode(): _passive( false ), _mlst( false ) {}
 
 void FTPNode::Connect( unsigned ip, int port, const char* user, const char* password, bool passive )
 {
 	ctrl.Close( true );
 	data.Close( true );
 	_passive = passive;
+
+	ctrl.SetTimeout( g_WcmConfig.tcpTimeout );
+	ctrl.SetSockOptions( 0, g_WcmConfig.tcpNoDelay );
+	data.SetTimeout( g_WcmConfig.tcpTimeout );
+	data.SetBufferSize( g_WcmConfig.tcpBufferSize * 1024 );
+	data.SetSockOptions( g_WcmConfig.tcpReceiveBuffer * 1024, false );
+
 	ctrl.Connect( ip, port );
 	int rc = ReadCode();
 	CheckFtpRet( rc );
@@ -233,6 +241,59 @@ void FTPNode::Connect( unsigned ip, int port, const char* user, const char* pass
 	CheckFtpRet( rc );
 	ctrl.WriteStr( "TYPE I\r\n" );
 	CheckFtpRet( ReadCode() );
+	Feat();
+}
+
+static bool StartsWithNoCase( const char* s, const char* prefix )
+{
+	for ( ; *prefix; s++, prefix++ )
+	{
+		if ( toupper( ( unsigned char )*s ) != toupper( ( unsigned char )*prefix ) ) { return false; }
+	}
+
+	return true;
+}
+
+void FTPNode::Feat()
+{
+	_mlst = false;
+
+	ctrl.WriteStr( "FEAT\r\n" );
+
+	const char* last = nullptr;
+	char buf[0x100];
+	const char* s = ctrl.ReadLine( buf, sizeof( buf ) );
+	int r = GETINT( s, &last );
+
+	if ( !s ) { throw int( EFTP_BADPROTO ); }
+
+	if ( *last != '-' ) { return; } //500 - no FEAT, or no features at all
+
+	for ( int i = 0; ; i++ )
+	{
+		s = ctrl.ReadLine( buf, sizeof( buf ) );
+
+		if ( !s || i >= 1000 ) { throw int( EFTP_BADPROTO ); }
+
+		// features are listed one per line, indented by a space
+		if ( *s == ' ' )
+		{
+			if ( StartsWithNoCase( s + 1, "MLST" ) ) { _mlst = true; }
+
+			continue;
+		}
+
+		int r2 = GETINT( s, &last );
+
+		if ( r2 == r && *last != '-' ) { break; }
+	}
+
+	if ( _mlst )
+	{
+		// ask for the facts we use, servers that do not know OPTS MLST send them anyway
+		ctrl.WriteStr( "OPTS MLST type;size;modify;UNIX.mode;UNIX.owner;UNIX.group;\r\n" );
+		ReadCode();
+	}
 }
 
 void FTPNode::Noop()
@@ -241,30 +302,94 @@ void FTPNode::Noop()
 	CheckFtpRet( ReadCode() );
 }
 
-void FTPNode::Ls( ccollect<std::string >& list )
+void FTPNode::Ls( bool mlsd, FtpLineFunc f, void* param )
 {
-	OpenData( "LIST\r\n" );
-	list.clear();
+	OpenData( mlsd ? "MLSD\r\n" : "LIST\r\n" );
 	char buf[4096];
 
 	while ( data.ReadLine( buf, sizeof( buf ) ) )
 	{
-		list.append( std::string( buf ) );
+		f( buf, param );
 	}
 
 	data.Close();
 	CheckFtpRet( ReadCode() ); //250
 }
 
+bool FTPNode::Mlst( const char* path, char* buf, int size )
+{
+	ctrl.WriteStr( "MLST ", path, "\r\n" );
+
+	const char* last = nullptr;
+	char line[4096];
+	const char* s = ctrl.ReadLine( line, sizeof( line ) );
+	int r = GETINT( s, &last );
+
+	if ( !s ) { throw int( EFTP_BADPROTO ); }
+
+	if ( *last != '-' )
+	{
+		if ( r == 550 ) { return false; }
+
+		CheckFtpRet( r );
+		throw int( EFTP_BADPROTO ); //no facts line
+	}
+
+	bool found = false;
+
+	for ( int i = 0; ; i++ )
+	{
+		s = ctrl.ReadLine( line, sizeof( line ) );
+
+		if ( !s || i >= 1000 ) { throw int( EFTP_BADPROTO ); }
+
+		// 250-Listing path
+		//  type=file;size=1024;modify=20150101120000; /path
+		// 250 End
+		if ( *s == ' ' )
+		{
+			if ( !found )
+			{
+				int n = strlen( s + 1 );
+
+				if ( n >= size ) { n = size - 1; }
+
+				memcpy( buf, s + 1, n );
+				buf[n] = 0;
+				found = true;
+			}
+
+			continue;
+		}
+
+		int r2 = GETINT( s, &last );
+
+		if ( r2 == r && *last != '-' ) { break; }
+	}
+
+	CheckFtpRet( r );
+	return found;
+}
+
 void FTPNode::Cwd( const char* path )
 {
 	ctrl.WriteStr( "CWD ", path, "\r\n" );
 	CheckFtpRet( ReadCode() );
 }
 
-void FTPNode::OpenRead( const char* fileName )
+void FTPNode::OpenRead( const char* fileName, seek_t offset )
 {
 	char buf[4096];
+
+	if ( offset > 0 )
+	{
+		Lsnprintf( buf, sizeof( buf ) - 1, "REST %" PRId64 "\r\n", int64_t( offset ) );
+		ctrl.WriteStr( buf );
+		int r = ReadCode();
+
+		if ( r != 350 ) { throw int( r >= 500 ? EFTP_NOTSUPPORTED : -r ); }
+	}
+
 	Lsnprintf( buf, sizeof( buf ) - 1, "RETR %s\r\n", fileName );
 	OpenData( buf );
 }
@@ -312,6 +437,12 @@ void FTPNode::CloseData()
 	CheckFtpRet( ReadCode() );
 }
 
+int FTPNode::FinishData()
+{
+	data.Close( true );
+	return ReadCode();
+}
+
 
 FTPNode::~FTPNode() {}
 
@@ -379,29 +510,14 @@ int FSFtp::GetFreeNode( int* err, FSCInfo* info )
 		}
 	}
 
+	p->reading = p->dataOpen = p->readDone = false;
+	p->readPos = 0;
+
 	if ( !p->pFtpNode.ptr() )
 	{
 		try
 		{
-			p->pFtpNode = new FTPNode();
-
-			CStopSetter stopSetter( p->pFtpNode.ptr(), info );
-
-			unsigned ip; // = inet_addr(unicode_to_utf8(_param.server.Data()).ptr());
-			int e;
-
-			if ( !GetHostIp( _param.server.c_str(), &ip, &e ) )
-			{
-				throw int( e );
-			}
-
-			FSString User = FSString( _param.user.c_str() );
-			FSString Pass = FSString( _param.pass.c_str() );
-
-			const char* UserStr = _param.anonymous ? "anonymous" : (char*)User.Get( _param.charset );
-			const char* PassStr = _param.anonymous ? "anonymous@" : (char*)Pass.Get( _param.charset );
-
-			p->pFtpNode->Connect( ntohl( ip ), _param.port, UserStr, PassStr, _param.passive );
+			ConnectNode( p, info );
 		}
 		catch ( int e )
 		{
@@ -420,14 +536,72 @@ int FSFtp::GetFreeNode( int* err, FSCInfo* info )
 	return n;
 }
 
+void FSFtp::ConnectNode( Node* p, FSCInfo* info )
+{
+	p->pFtpNode = new FTPNode();
+
+	CStopSetter stopSetter( p->pFtpNode.ptr(), info );
+
+	unsigned ip; // = inet_addr(unicode_to_utf8(_param.server.Data()).ptr());
+	int e;
+
+	if ( !GetHostIp( _param.server.c_str(), &ip, &e ) )
+	{
+		throw int( e );
+	}
+
+	FSString User = FSString( _param.user.c_str() );
+	FSString Pass = FSString( _param.pass.c_str() );
+
+	const char* UserStr = _param.anonymous ? "anonymous" : (char*)User.Get( _param.charset );
+	const char* PassStr = _param.anonymous ? "anonymous@" : (char*)Pass.Get( _param.charset );
+
+	p->pFtpNode->Connect( ntohl( ip ), _param.port, UserStr, PassStr, _param.passive );
+}
+
+FSFtp::Node* FSFtp::GetReadNode( int fd, int* err )
+{
+	if ( fd < 0 || fd >= NODES_COUNT )
+	{
+		if ( err ) { *err = EFTP_INVALID_PARAMETER; }
+
+		return 0;
+	}
+
+	Node* p = nodes + fd;
+
+	MutexLock lock( &mutex );
+
+	if ( !p->busy || !p->reading )
+	{
+		if ( err ) { *err = EFTP_INVALID_PARAMETER; }
+
+		return 0;
+	}
+
+	return p;
+}
+
 FSFtp::FSFtp( FSFtpParam* param )
-	:  FS( FTP ), statCache( const_cast<int*>( &_param.charset ) )
+	:  FS( FTP ), dirCache( this, ReadDirFunc )
 {
 	_param = *param;
 	_infoParam = *param;
 }
 
-unsigned FSFtp::Flags() { return HAVE_READ; } // | HAVE_WRITE; }
+unsigned FSFtp::Flags() { return HAVE_READ | HAVE_SEEK; } // | HAVE_WRITE; }
+
+int FSFtp::ReadStreams()
+{
+	// every stream takes a node, leave the rest for listings and Stat
+	int n = g_WcmConfig.ftpConnections;
+
+	if ( n < 1 ) { n = 1; }
+
+	if ( n > MAX_STREAMS ) { n = MAX_STREAMS; }
+
+	return n;
+}
 
 
 bool FSFtp::IsEEXIST( int err ) { return err == EFTP_EXIST; }
@@ -602,6 +776,9 @@ int FSFtp::OpenRead  ( FSPath& path, int flags, int* err, FSCInfo* info )
 		CStopSetter stopSetter( p->pFtpNode.ptr(), info );
 
 		p->pFtpNode->OpenRead( ( char* )path.GetString( _param.charset, '/' ) );
+		p->readPath = path;
+		p->reading = true;
+		p->dataOpen = true;
 	}
 	catch ( int e )
 	{
@@ -644,6 +821,8 @@ int FSFtp::OpenCreate   ( FSPath& path, bool overwrite, int mode, int flags, int
 		CStopSetter stopSetter( p->pFtpNode.ptr(), info );
 
 		p->pFtpNode->OpenWrite( ( char* )path.GetString( _param.charset, '/' ) );
+		dirCache.Invalidate( path );
+		p->writePath = path;
 	}
 	catch ( int e )
 	{
@@ -686,7 +865,22 @@ int FSFtp::Close  ( int fd, int* err, FSCInfo* info )
 	{
 		CStopSetter stopSetter( p->pFtpNode.ptr(), info );
 
-		p->pFtpNode->CloseData();
+		if ( !p->reading )
+		{
+			p->pFtpNode->CloseData();
+		}
+		else if ( p->dataOpen && p->pFtpNode.ptr() )
+		{
+			// closed before the end of the file, the server answers 426 for the dropped transfer
+			p->dataOpen = false;
+			p->pFtpNode->FinishData();
+		}
+
+		if ( p->writePath.Count() > 0 )
+		{
+			dirCache.Invalidate( p->writePath );
+			p->writePath.Clear();
+		}
 
 		{
 			MutexLock lock( &mutex );
@@ -696,6 +890,8 @@ int FSFtp::Close  ( int fd, int* err, FSCInfo* info )
 	}
 	catch ( int e )
 	{
+		p->writePath.Clear();
+
 		MutexLock lock( &mutex );
 		p->busy = false;
 
@@ -708,6 +904,12 @@ int FSFtp::Close  ( int fd, int* err, FSCInfo* info )
 }
 
 
+// errors after which the same download is worth continuing from where it stopped
+static bool IsTransferBroken( int e )
+{
+	return e > 0 /* errno */ || e == -3 /* timeout */ || e == -421 || e == -425 || e == -426 || e == -450 || e == -451;
+}
+
 int FSFtp::Read   ( int fd, void* buf, int size, int* err, FSCInfo* info )
 {
 	if ( fd < 0 || fd >= NODES_COUNT )
@@ -722,7 +924,7 @@ int FSFtp::Read   ( int fd, void* buf, int size, int* err, FSCInfo* info )
 	{
 		MutexLock lock( &mutex );
 
-		if ( !p->busy )
+		if ( !p->busy || !p->reading )
 		{
 			if ( err ) { *err = EFTP_INVALID_PARAMETER; }
 
@@ -732,28 +934,55 @@ int FSFtp::Read   ( int fd, void* buf, int size, int* err, FSCInfo* info )
 		lock.Unlock();
 	}
 
-	try
+	for ( int attempt = 0; ; attempt++ )
 	{
-		CStopSetter stopSetter( p->pFtpNode.ptr(), info );
+		try
+		{
+			if ( !p->dataOpen && p->readDone ) { return 0; }
 
-		int n = p->pFtpNode->ReadData( buf, size );
+			if ( !p->pFtpNode.ptr() ) { ConnectNode( p, info ); }
 
-		{
-			// надо сделать проверку нет ли выполнения чего-либо уже с этим файлом
+			CStopSetter stopSetter( p->pFtpNode.ptr(), info );
+
+			if ( !p->dataOpen )
+			{
+				p->pFtpNode->OpenRead( ( char* )p->readPath.GetString( _param.charset, '/' ), p->readPos );
+				p->dataOpen = true;
+			}
+
+			int n = p->pFtpNode->ReadData( buf, size );
+
+			if ( n > 0 )
+			{
+				p->readPos += n;
+				return n;
+			}
+
+			// the data connection is closed at the end of the file and when the transfer breaks, the reply tells which
+			p->dataOpen = false;
+			CheckFtpRet( p->pFtpNode->FinishData() );
+			p->readDone = true;
+
+			return 0;
 		}
+		catch ( int e )
+		{
+			//busy fd здесь освобождать нельзя
+			// the reply of the broken transfer is not read, so the connection is dropped rather than left to the next command
+			p->dataOpen = false;
+			p->pFtpNode = 0;
 
-		return n;
+			if ( e != -2 && attempt < MAX_RESUME && IsTransferBroken( e ) )
+			{
+				// reconnect and continue with REST from readPos
+				continue;
+			}
 
-	}
-	catch ( int e )
-	{
-		//busy fd здесь освобождать нельзя
-		if ( err ) { *err = e; }
+			if ( err ) { *err = e; }
 
-		return ( e == -2 ) ? -2 : -1;
+			return ( e == -2 ) ? -2 : -1;
+		}
 	}
-
-	return 0;
 }
 
 int FSFtp::Write  ( int fd, void* buf, int size, int* err, FSCInfo* info )
@@ -805,6 +1034,97 @@ int FSFtp::Write  ( int fd, void* buf, int size, int* err, FSCInfo* info )
 
 }
 
+int FSFtp::Seek( int fd, SEEK_FILE_MODE mode, seek_t pos, seek_t* pRet,  int* err, FSCInfo* info )
+{
+	Node* p = GetReadNode( fd, err );
+
+	if ( !p ) { return -1; }
+
+	seek_t target = pos;
+
+	if ( mode == FSEEK_POS )
+	{
+		target += p->readPos;
+	}
+	else if ( mode == FSEEK_END )
+	{
+		FSStat st;
+		int ret = Stat( p->readPath, &st, err, info );
+
+		if ( ret ) { return ret; }
+
+		target += st.size;
+	}
+
+	if ( target < 0 )
+	{
+		if ( err ) { *err = EFTP_INVALID_PARAMETER; }
+
+		return -1;
+	}
+
+	// a short jump forward is cheaper to read through than to restart the transfer
+	if ( p->dataOpen && target > p->readPos && target - p->readPos <= SEEK_SKIP_SIZE )
+	{
+		char buf[0x4000];
+
+		while ( p->readPos < target )
+		{
+			int n = target - p->readPos < seek_t( sizeof( buf ) ) ? int( target - p->readPos ) : int( sizeof( buf ) );
+			n = Read( fd, buf, n, err, info );
+
+			if ( n < 0 ) { return n; }
+
+			if ( !n ) { break; } //past the end of the file
+		}
+	}
+
+	if ( p->readDone && target >= p->readPos ) { p->readPos = target; } //stays at the end, Read returns 0
+
+	if ( target != p->readPos )
+	{
+		if ( p->dataOpen )
+		{
+			p->dataOpen = false;
+
+			try
+			{
+				CStopSetter stopSetter( p->pFtpNode.ptr(), info );
+				p->pFtpNode->FinishData();
+			}
+			catch ( int e )
+			{
+				if ( e == -2 )
+				{
+					if ( err ) { *err = e; }
+
+					return -2;
+				}
+
+				p->pFtpNode = 0; // the next Read reconnects
+			}
+		}
+
+		// RETR is reopened with REST on the next Read
+		p->readPos = target;
+		p->readDone = false;
+	}
+
+	if ( pRet ) { *pRet = p->readPos; }
+
+	return 0;
+}
+
+int FSFtp::FStat( int fd, FSStat* st, int* err, FSCInfo* info )
+{
+	Node* p = GetReadNode( fd, err );
+
+	if ( !p ) { return -1; }
+
+	// the control connection of the file is busy with the transfer, the parent listing or MLST goes through another node
+	return Stat( p->readPath, st, err, info );
+}
+
 int FSFtp::Rename ( FSPath&  oldpath, FSPath& newpath, int* err,  FSCInfo* info )
 {
 	int nodeId = GetFreeNode( err, info );
@@ -819,6 +1139,8 @@ int FSFtp::Rename ( FSPath&  oldpath, FSPath& newpath, int* err,  FSCInfo* info
 
 		p->pFtpNode->Cwd( "/" );
 		p->pFtpNode->Rename( ( char* )oldpath.GetString( _param.charset, '/' ), ( char* )newpath.GetString( _param.charset, '/' ) );
+		dirCache.Invalidate( oldpath );
+		dirCache.Invalidate( newpath );
 
 	}
 	catch ( int e )
@@ -865,6 +1187,7 @@ int FSFtp::MkDir  ( FSPath& path, int mode, int* err,  FSCInfo* info )
 		CStopSetter stopSetter( p->pFtpNode.ptr(), info );
 
 		p->pFtpNode->MkDir( ( char* )path.GetString( _param.charset, '/' ) );
+		dirCache.Invalidate( path );
 
 	}
 	catch ( int e )
@@ -895,7 +1218,7 @@ int FSFtp::Delete( FSPath& path, int* err, FSCInfo* info )
 	{
 		CStopSetter stopSetter( p->pFtpNode.ptr(), info );
 		p->pFtpNode->Delete( ( char* )path.GetString( _param.charset, '/' ) );
-		statCache.Del( path );
+		dirCache.Invalidate( path );
 
 	}
 	catch ( int e )
@@ -930,7 +1253,7 @@ int FSFtp::RmDir  ( FSPath& path, int* err, FSCInfo* info )
 		par.Pop();
 		p->pFtpNode->Cwd( ( char* )par.GetString( _param.charset, '/' ) ); //можно и в корень /
 		p->pFtpNode->RmDir( ( char* )path.GetString( _param.charset, '/' ) );
-		statCache.Del( path );
+		dirCache.Invalidate( path );
 	}
 	catch ( int e )
 	{
@@ -1106,7 +1429,34 @@ static int StringToMode( const char* s )
 }
 
 
-static time_t GetFtpFTime( const char* p1, const char* p2, const char* p3 )
+static int GetCurrentTmYear()
+{
+	time_t tim = time( 0 );
+	int y = 0;
+
+#if _MSC_VER > 1700
+	struct tm st;
+
+	if ( localtime_s( &st, &tim ) == 0 ) { y = st.tm_year; }
+
+#elif defined( _WIN32 )
+	struct tm* st = localtime( &tim );
+
+	if ( st ) { y = st->tm_year; }
+
+#else
+	struct tm result;
+	struct tm* st = localtime_r( &tim, &result );
+
+	if ( st ) { y = st->tm_year; }
+
+#endif
+
+	return y;
+}
+
+// curYear - GetCurrentTmYear(), taken once per listing
+static time_t GetFtpFTime( const char* p1, const char* p2, const char* p3, int curYear )
 {
 	static const char* months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec", 0};
 	int mon = 0;
@@ -1128,26 +1478,7 @@ static time_t GetFtpFTime( const char* p1, const char* p2, const char* p3 )
 
 	if ( t )
 	{
-		time_t tim = time( 0 );
-
-#if _MSC_VER > 1700
-		struct tm st;
-
-		if ( localtime_s( &st, &tim ) == 0 ) { y = st.tm_year; }
-
-#elif defined( _WIN32 )
-		struct tm* st = localtime( &tim );
-
-		if ( st ) { y = st->tm_year; }
-
-#else
-		struct tm result;
-		struct tm* st = localtime_r( &tim, &result );
-
-		if ( st ) { y = st->tm_year; }
-
-#endif
-
+		y = curYear;
 		*t = 0;
 		t++;
 		h = atoi( p3 );
@@ -1244,17 +1575,24 @@ static time_t GetFtpMSFTime( const char* p0, const char* p1 )
 
 int FSFtp::ReadDir( FSList* list, FSPath& _path, int* err, FSCInfo* info )
 {
-	clPtr<cstrhash<FSStat, char> > pSHash = new cstrhash<FSStat, char>;
+	if ( list && dirCache.GetList( _path, list ) != FSDirCache::MISS ) { return 0; }
+
+	unsigned generation = dirCache.Generation();
 
-	int r = ReadDir_int ( list,  pSHash.ptr(), _path, err, info );
+	int r = ReadDir_int ( list,  0, _path, err, info );
 
 	if ( r ) { return r; }
 
-	statCache.PutStat( _path, pSHash );
+	if ( list ) { dirCache.PutList( _path, *list, generation ); }
 
 	return r;
 }
 
+int FSFtp::ReadDirFunc( FS* fs, FSList* list, FSPath& path, int* err, FSCInfo* info )
+{
+	return ( ( FSFtp* )fs )->ReadDir_int( list, 0, path, err, info );
+}
+
 inline   long long ParzeFileSize( const char* s )
 {
 	long long size = 0;
@@ -1291,6 +1629,276 @@ inline char* ReadWord( char*& s )
 }
 
 
+/* unix
+-rw-r--r--    1 0          0                  36 Dec 24  2004 HEADER.html
+drwxrwsr-x   51 33         106              4096 Apr 25 17:14 pub
+
+-rw-r--r--   1 root     (?)      38500246 Jul  4 16:04 ftp_index.txt
+drwxr-xr-x   2 ftp      ftp           512 Jul  4 01:44 temp
+*/
+
+/* MS
+05-10-00  12:48PM               205710 index.txt
+04-30-10  10:10AM       <DIR>          MSLFILES
+09-03-99  01:03PM                 2401 README.TXT
+*/
+
+// splits a LIST line in place, false for lines without a file name (like "total ...")
+static bool ParseListLine( char* s, FSStat* st, const char** fileName, const char** owner, const char** group, int curYear )
+{
+	char* w0 = ReadWord( s );
+
+	if ( strlen( w0 ) == 8 ) // думаем что - MS NN-NN-NN
+	{
+		char* w1 = ReadWord( s );
+		char* w2 = ReadWord( s );
+
+		st->mode = 0555;
+
+		if ( !strcmp( w2, "<DIR>" ) )
+		{
+			st->mode |= S_IFDIR;
+		}
+		else
+		{
+			st->mode |= S_IFREG;
+			st->size = ParzeFileSize( w2 );
+		}
+
+		st->m_LastWriteTime = GetFtpMSFTime( w0, w1 );
+		st->m_LastAccessTime = st->m_LastWriteTime;
+		st->m_ChangeTime = st->m_LastWriteTime;
+	}
+	else
+	{
+		st->mode = StringToMode( w0 );
+
+		ReadWord( s ); //skip
+		*owner = ReadWord( s );
+		*group = ReadWord( s );
+		char* w4 = ReadWord( s );
+		char* w5 = ReadWord( s );
+		char* w6 = ReadWord( s );
+		char* w7 = ReadWord( s );
+
+		st->m_LastWriteTime = GetFtpFTime( w5, w6, w7, curYear );
+		st->m_ChangeTime = st->m_LastWriteTime;
+		st->size = ParzeFileSize( w4 );
+	}
+
+	s = SkipSpace( s );
+	{
+		int l = strlen( s );
+
+		if ( l > 0 && s[l - 1] == '\r' ) { s[l - 1] = 0; }
+	}
+
+	*fileName = s;
+
+	return *s != 0; //игнорируем пустые имена файлом (это какая-то добопнительная херня типа (total ...))
+}
+
+static bool GetDigits( const char*& s, int count, int* n )
+{
+	*n = 0;
+
+	for ( ; count > 0; count--, s++ )
+	{
+		if ( *s < '0' || *s > '9' ) { return false; }
+
+		*n = *n * 10 + ( *s - '0' );
+	}
+
+	return true;
+}
+
+// MLSx "modify" fact: YYYYMMDDHHMMSS[.sss], always UTC
+static time_t GetMlsxTime( const char* s )
+{
+	int y, mon, d, h, min, sec;
+
+	if ( !GetDigits( s, 4, &y ) || !GetDigits( s, 2, &mon ) || !GetDigits( s, 2, &d ) ||
+	     !GetDigits( s, 2, &h ) || !GetDigits( s, 2, &min ) || !GetDigits( s, 2, &sec ) ||
+	     mon < 1 || mon > 12 )
+	{
+		return 0;
+	}
+
+	// days since 1970-01-01 in the proleptic Gregorian calendar, so neither timegm() nor _mkgmtime() is needed
+	if ( mon <= 2 ) { y--; }
+
+	int era = y / 400;
+	int yoe = y - era * 400;
+	int doy = ( 153 * ( mon > 2 ? mon - 3 : mon + 9 ) + 2 ) / 5 + d - 1;
+	int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	int64_t days = int64_t( era ) * 146097 + doe - 719468;
+
+	return time_t( days * 86400 + h * 3600 + min * 60 + sec );
+}
+
+// splits a MLSD/MLST facts line in place: "type=file;size=1024;modify=20150101120000;UNIX.mode=0644; name"
+// false for the entries of the directory itself and its parent
+static bool ParseMlsxFacts( char* s, FSStat* st, const char** fileName, const char** owner, const char** group, bool allowCurrent )
+{
+	char* name = strchr( s, ' ' );
+
+	if ( !name ) { return false; }
+
+	*name++ = 0;
+
+	{
+		int l = strlen( name );
+
+		if ( l > 0 && name[l - 1] == '\r' ) { name[--l] = 0; }
+	}
+
+	const char* ownerName = 0;
+	const char* groupName = 0;
+	int perm = -1;
+
+	st->mode = S_IFREG;
+
+	while ( *s )
+	{
+		char* end = strchr( s, ';' );
+
+		if ( end ) { *end = 0; }
+
+		char* v = strchr( s, '=' );
+
+		if ( v )
+		{
+			*v++ = 0;
+
+			if ( StartsWithNoCase( s, "type" ) && !s[4] )
+			{
+				if ( StartsWithNoCase( v, "cdir" ) && !allowCurrent ) { return false; }
+
+				if ( StartsWithNoCase( v, "pdir" ) ) { return false; }
+
+				if ( StartsWithNoCase( v, "dir" ) || StartsWithNoCase( v, "cdir" ) ) { st->mode = S_IFDIR; }
+				else if ( StartsWithNoCase( v, "OS.unix=slink" ) || StartsWithNoCase( v, "OS.unix=symlink" ) ) { st->mode = S_IFLNK; }
+			}
+			else if ( StartsWithNoCase( s, "size" ) && !s[4] )
+			{
+				st->size = ParzeFileSize( v );
+			}
+			else if ( StartsWithNoCase( s, "modify" ) && !s[6] )
+			{
+				st->m_LastWriteTime = GetMlsxTime( v );
+			}
+			else if ( StartsWithNoCase( s, "UNIX.mode" ) && !s[9] )
+			{
+				perm = int( strtol( v, 0, 8 ) ) & 07777;
+			}
+			else if ( StartsWithNoCase( s, "UNIX.owner" ) )
+			{
+				if ( !s[10] ) { *owner = v; }
+				else if ( StartsWithNoCase( s + 10, "name" ) ) { ownerName = v; }
+			}
+			else if ( StartsWithNoCase( s, "UNIX.group" ) )
+			{
+				if ( !s[10] ) { *group = v; }
+				else if ( StartsWithNoCase( s + 10, "name" ) ) { groupName = v; }
+			}
+		}
+
+		if ( !end ) { break; }
+
+		s = end + 1;
+	}
+
+	if ( ownerName ) { *owner = ownerName; }
+
+	if ( groupName ) { *group = groupName; }
+
+	if ( perm < 0 ) { perm = ( st->mode == S_IFDIR ) ? 0755 : 0644; }
+
+	st->mode |= perm;
+	st->m_LastAccessTime = st->m_LastWriteTime;
+	st->m_ChangeTime = st->m_LastWriteTime;
+
+	*fileName = name;
+
+	return *name != 0;
+}
+
+struct FtpListContext
+{
+	bool mlsd;
+	int charset;
+	int curYear;
+	FSList* list;
+	cstrhash<FSStat, char>* pSHash;
+	FtpIDCollection* uids;
+	FtpIDCollection* gids;
+	// owners repeat from line to line, look them up only when they change
+	std::string lastOwner;
+	std::string lastGroup;
+	int lastUid;
+	int lastGid;
+
+	int GetId( FtpIDCollection* ids, const char* name, std::string& last, int& lastId )
+	{
+		if ( last != name )
+		{
+			last = name;
+			lastId = ids->GetId( FSString( charset, name ).GetUnicode() );
+		}
+
+		return lastId;
+	}
+};
+
+static void FtpListLine( char* line, void* param )
+{
+	FtpListContext* ctx = ( FtpListContext* )param;
+
+	FSStat st;
+	const char* fileName = "";
+	const char* owner = 0;
+	const char* group = 0;
+
+	if ( ctx->mlsd )
+	{
+		if ( !ParseMlsxFacts( line, &st, &fileName, &owner, &group, false ) ) { return; }
+	}
+	else
+	{
+		if ( !ParseListLine( line, &st, &fileName, &owner, &group, ctx->curYear ) ) { return; }
+	}
+
+	if ( owner ) { st.uid = ctx->GetId( ctx->uids, owner, ctx->lastOwner, ctx->lastUid ); }
+
+	if ( group ) { st.gid = ctx->GetId( ctx->gids, group, ctx->lastGroup, ctx->lastGid ); }
+
+	if ( ctx->pSHash )
+	{
+		ctx->pSHash->get( fileName ) = st;
+	}
+
+	if ( ctx->list )
+	{
+		clPtr<FSNode> fsNode = new FSNode();
+#if defined(__APPLE__)
+		if ( ctx->charset == CS_UTF8 )
+		{
+			std::string normname = normalize_utf8_NFC( fileName );
+			fsNode->name = FSString( ctx->charset, normname.data() );
+		}
+		else
+		{
+			fsNode->name = FSString( ctx->charset, fileName );
+		}
+#else
+		fsNode->name = FSString( ctx->charset, fileName );
+#endif
+		fsNode->st = st;
+		ctx->list->Append( fsNode );
+	}
+}
+
+
 int FSFtp::ReadDir_int ( FSList* list, cstrhash<FSStat, char>* pSHash, FSPath& _path, int* err, FSCInfo* info )
 {
 	int nodeId = GetFreeNode( err, info );
@@ -1303,126 +1911,78 @@ int FSFtp::ReadDir_int ( FSList* list, cstrhash<FSStat, char>* pSHash, FSPath& _
 	{
 		FSPath path( _path );
 
-		ccollect<std::string > ftp_list;
-
 		CStopSetter stopSetter( p->pFtpNode.ptr(), info );
 
 		p->pFtpNode->Cwd( ( char* )path.GetString( _param.charset, '/' ) );
-		p->pFtpNode->Ls( ftp_list );
 
 		if ( list ) { list->Clear(); } //!!! исправлено (забыл проверить :( )
 
-		for ( int i = 0; i < ftp_list.count(); i++ )
-		{
-			char* s = (char*)ftp_list[i].data();
-
-			if ( !s ) { continue; }
-
-
-			/* unix
-			-rw-r--r--    1 0          0                  36 Dec 24  2004 HEADER.html
-			drwxrwsr-x   51 33         106              4096 Apr 25 17:14 pub
+		FtpListContext ctx;
+		ctx.mlsd = p->pFtpNode->HasMlst();
+		ctx.charset = _param.charset;
+		ctx.curYear = GetCurrentTmYear();
+		ctx.list = list;
+		ctx.pSHash = pSHash;
+		ctx.uids = &uids;
+		ctx.gids = &gids;
+		ctx.lastUid = ctx.lastGid = 0;
+
+		p->pFtpNode->Ls( ctx.mlsd, FtpListLine, &ctx );
+	}
+	catch ( int e )
+	{
+		MutexLock lock( &mutex );
+		p->busy = false;
 
-			-rw-r--r--   1 root     (?)      38500246 Jul  4 16:04 ftp_index.txt
-			drwxr-xr-x   2 ftp      ftp           512 Jul  4 01:44 temp
-			*/
+		if ( err ) { *err = e; }
 
-			/* MS
-			05-10-00  12:48PM               205710 index.txt
-			04-30-10  10:10AM       <DIR>          MSLFILES
-			09-03-99  01:03PM                 2401 README.TXT
-			*/
-			char* w0 = ReadWord( s );
+		return ( e == -2 ) ? -2 : -1;
+	}
 
-			FSStat st;
-			const char* fileName = "";
+	MutexLock lock( &mutex );
+	p->busy = false;
 
-			if ( strlen( w0 ) == 8 ) // думаем что - MS NN-NN-NN
-			{
-				char* w1 = ReadWord( s );
-				char* w2 = ReadWord( s );
+	return 0;
+}
 
-				st.mode = 0555;
+int FSFtp::StatMlst( FSPath& path, FSStat* st, int* err, FSCInfo* info )
+{
+	int nodeId = GetFreeNode( err, info );
 
-				if ( !strcmp( w2, "<DIR>" ) )
-				{
-					st.mode |= S_IFDIR;
-				}
-				else
-				{
-					st.mode |= S_IFREG;
-					st.size = ParzeFileSize( w2 );
-				}
+	if ( nodeId < 0 ) { return nodeId; }
 
-				s = SkipSpace( s );
-				{
-					int l = strlen( s );
+	Node* p = nodes + nodeId;
 
-					if ( l > 0 && s[l - 1] == '\r' ) { s[l - 1] = 0; }
-				}
+	int ret = 1;
 
-				st.m_LastWriteTime = GetFtpMSFTime( w0, w1 );
-				st.m_LastAccessTime = st.m_LastWriteTime;
-				st.m_ChangeTime = st.m_LastWriteTime;
+	try
+	{
+		if ( p->pFtpNode->HasMlst() )
+		{
+			CStopSetter stopSetter( p->pFtpNode.ptr(), info );
 
-				fileName = s;
+			char buf[4096];
+			FSStat s;
+			const char* fileName = "";
+			const char* owner = 0;
+			const char* group = 0;
 
-			}
-			else
+			if ( p->pFtpNode->Mlst( ( char* )path.GetString( _param.charset, '/' ), buf, sizeof( buf ) ) &&
+			     ParseMlsxFacts( buf, &s, &fileName, &owner, &group, true ) )
 			{
-				st.mode = StringToMode( w0 );
-
-				ReadWord( s ); //skip
-				char* w2 = ReadWord( s );
-				char* w3 = ReadWord( s );
-				char* w4 = ReadWord( s );
-				char* w5 = ReadWord( s );
-				char* w6 = ReadWord( s );
-				char* w7 = ReadWord( s );
-
-				st.uid = uids.GetId( FSString( _param.charset, w2 ).GetUnicode() );
-				st.gid = gids.GetId( FSString( _param.charset, w3 ).GetUnicode() );
-				st.m_LastWriteTime = GetFtpFTime( w5, w6, w7 );
-				st.m_ChangeTime = st.m_LastWriteTime;
-				st.size = ParzeFileSize( w4 );
-
-				s = SkipSpace( s );
-				{
-					int l = strlen( s );
+				if ( owner ) { s.uid = uids.GetId( FSString( _param.charset, owner ).GetUnicode() ); }
 
-					if ( l > 0 && s[l - 1] == '\r' ) { s[l - 1] = 0; }
-				}
-				fileName = s;
-			}
+				if ( group ) { s.gid = gids.GetId( FSString( _param.charset, group ).GetUnicode() ); }
 
-			if ( !*fileName ) { continue; } //игнорируем пустые имена файлом (это какая-то добопнительная херня типа (total ...))
+				if ( st ) { *st = s; }
 
-			if ( pSHash )
-			{
-				pSHash->get( fileName ) = st;
+				ret = 0;
 			}
-
-			if ( list )
+			else
 			{
-				clPtr<FSNode> fsNode = new FSNode();
-#if defined(__APPLE__)
-				if ( _param.charset == CS_UTF8 )
-				{
-					std::string normname = normalize_utf8_NFC( fileName );
-					fsNode->name = FSString( _param.charset, normname.data() );
-				}
-				else
-				{
-					fsNode->name = FSString( _param.charset, fileName );
-				}
-#else
-				fsNode->name = FSString( _param.charset, fileName );
-#endif
-				fsNode->st = st;
-				list->Append( fsNode );
+				throw int( EFTP_NOTEXIST );
 			}
 		}
-
 	}
 	catch ( int e )
 	{
@@ -1437,7 +1997,7 @@ int FSFtp::ReadDir_int ( FSList* list, cstrhash<FSStat, char>* pSHash, FSPath& _
 	MutexLock lock( &mutex );
 	p->busy = false;
 
-	return 0;
+	return ret;
 }
 
 
@@ -1450,7 +2010,7 @@ int FSFtp::Stat   ( FSPath& path, FSStat* st, int* err, FSCInfo* info )
 		return -1;
 	}
 
-	int r = statCache.GetStat( path, st ); //0 - ok, 1 - not cache for it, -1 - not exist in cache
+	int r = dirCache.GetStat( path, st ); //0 - ok, 1 - not cache for it, -1 - not exist in cache
 
 	if ( !r ) { return r; }
 
@@ -1461,6 +2021,11 @@ int FSFtp::Stat   ( FSPath& path, FSStat* st, int* err, FSCInfo* info )
 		return r;
 	}
 
+	r = StatMlst( path, st, err, info );
+
+	if ( r <= 0 ) { return r; }
+
+	// no MLST, the parent directory is listed instead
 	clPtr<cstrhash<FSStat, char> > pSHash = new cstrhash<FSStat, char>;
 
 	FSPath p1 = path;
@@ -1469,7 +2034,10 @@ int FSFtp::Stat   ( FSPath& path, FSStat* st, int* err, FSCInfo* info )
 
 	p1.Pop();
 
-	r = ReadDir_int ( 0,  pSHash.ptr(), p1, err, info );
+	FSList list;
+	unsigned generation = dirCache.Generation();
+
+	r = ReadDir_int ( &list,  pSHash.ptr(), p1, err, info );
 
 	if ( r ) { return r; }
 
@@ -1477,7 +2045,7 @@ int FSFtp::Stat   ( FSPath& path, FSStat* st, int* err, FSCInfo* info )
 
 	if ( p && st ) { *st = *p; }
 
-	statCache.PutStat( p1, pSHash );
+	dirCache.PutList( p1, list, generation );
 
 	if ( !p )
 	{
@@ -1496,14 +2064,6 @@ int FSFtp::Symlink(FSPath &path, FSString &str, int *err, FSCInfo *info)
       *err = EFTP_NOTSUPPORTED;
    return -1;
 }
-
-int FSFtp::Seek(int fd, SEEK_FILE_MODE mode, seek_t pos, seek_t *pRet,  int *err, FSCInfo *info)
-{
-   if (err)
-      *err = EFTP_NOTSUPPORTED;
-
-   return -1;
-}
 */
 
 FSString FSFtp::Uri( FSPath& path )
@@ -1580,89 +2140,3 @@ FSFtp::~FSFtp()
 {
 	dbg_printf( "\n!!!FSFtp destroyed\n" );
 }
-
-
-
-////////////////////////////////////////// FtpStatCache
-
-FtpStatCache::Dir* FtpStatCache::GetParent( FSPath& path )
-{
-	if ( path.Count() <= 0 ) { return 0; }
-
-	int n = 0;
-	Dir* d = &root;
-
-	for ( ; n < path.Count() - 1; n++ )
-	{
-		clPtr<Dir>* pd = d->dirs.exist( ( char* )path.GetItem( n )->Get( *pCharset ) );
-
-		if ( !pd ) { return 0; }
-
-		d = pd->ptr();
-
-		if ( !d ) { return 0; }
-	}
-
-	return d;
-}
-
-int FtpStatCache::GetStat( FSPath path, FSStat* st )
-{
-	MutexLock lock( &mutex );
-
-	Dir* d = GetParent( path );
-
-	if ( !d ) { return 1; }
-
-	if ( d->tim + CACHE_TIMEOUT < time( 0 ) )
-	{
-		d->statHash = 0;
-		return 1;
-	}
-
-	if ( !d->statHash.ptr() ) { return 1; }
-
-	FSStat* s = d->statHash->exist( ( char* )path.GetItem( path.Count() - 1 )->Get( *pCharset ) );
-
-	if ( !s ) { return -1; }
-
-	if ( st ) { *st = *s; }
-
-	return 0;
-}
-
-void FtpStatCache::Del( FSPath path )
-{
-	MutexLock lock( &mutex );
-
-	Dir* d = GetParent( path );
-
-	if ( !d ) { return; }
-
-	char* name = ( char* )path.GetItem( path.Count() - 1 )->Get( *pCharset );
-
-	if ( d->statHash.ptr() ) { d->statHash->del( name ); }
-
-	d->dirs.del( name );
-}
-
-void FtpStatCache::PutStat( FSPath path, clPtr<cstrhash<FSStat, char> > statHash )
-{
-	MutexLock lock( &mutex );
-
-	int n = 0;
-	Dir* d = &root;
-
-	for ( ; n < path.Count(); n++ )
-	{
-		char* name = ( char* )path.GetItem( n )->Get( *pCharset );
-		clPtr<Dir>* pd = &( d->dirs[name] );
-
-		if ( !pd->ptr() ) { *pd = new Dir(); }
-
-		d = pd->ptr();
-	}
-
-	d->statHash = statHash;
-	d->tim = time( 0 );
-}
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "vfs.h"
+#include "vfs-cache.h"
 #include "tcp_sock.h"
 
 
@@ -20,32 +21,7 @@ enum FTP_ERRNO
 	EFTP_EXIST = -15
 };
 
-//++volatile надо скорректировать
-class FtpStatCache
-{
-	enum CONSTS { CACHE_TIMEOUT = 60 };
-	struct Dir: public iIntrusiveCounter
-	{
-		time_t tim;
-		cstrhash< clPtr<Dir>, char> dirs;
-		clPtr< cstrhash<FSStat, char> >  statHash;
-		Dir(): tim( 0 ) {}
-	};
-
-	Mutex mutex;
-	Dir root;
-	int* pCharset;
-	Dir* GetParent( FSPath& path );
-public:
-	FtpStatCache( int* pCs ): pCharset( pCs ) {}
-	void PutStat( FSPath path, clPtr<cstrhash<FSStat, char> > statHash );
-	int GetStat( FSPath path, FSStat* st ); //0 - ok, 1 - not cache for it, -1 - not exist in cache
-	void Del( FSPath path );
-private:
-	FtpStatCache() {};
-	FtpStatCache( const FtpStatCache& ) {};
-	void operator = ( const FtpStatCache& ) {};
-};
+typedef void ( *FtpLineFunc )( char* line, void* data );
 
 //++volatile надо скорректировать
 class FTPNode: public iIntrusiveCounter
@@ -54,8 +30,10 @@ class FTPNode: public iIntrusiveCounter
 	TCPSyncBufProto data;
 
 	bool _passive;
+	bool _mlst; // the server supports RFC 3659 MLST/MLSD
 
 	int ReadCode();
+	void Feat();
 	void Passive( unsigned& passiveIp, int& passivePort );
 	void Port( unsigned ip, int port );
 	void OpenData( const char* cmd );
@@ -64,9 +42,11 @@ public:
 
 	void Connect( unsigned ip, int port, const char* user, const char* password, bool passive );
 	void Noop();
-	void Ls( ccollect<std::string >& list );
+	bool HasMlst() const { return _mlst; }
+	void Ls( bool mlsd, FtpLineFunc f, void* param ); // LIST or MLSD of the current directory, f gets every line as it arrives
+	bool Mlst( const char* path, char* buf, int size ); // facts of a single file (RFC 3659), false if it does not exist
 	void Cwd( const char* path );
-	void OpenRead( const char* fileName );
+	void OpenRead( const char* fileName, seek_t offset = 0 ); // offset > 0 is sent as REST before RETR
 	void MkDir( const char* fileName );
 	void RmDir( const char* fileName );
 	void Rename( const char* from, const char* to );
@@ -74,6 +54,7 @@ public:
 	int ReadData( void* s, int size ) { return data.Read( ( char* )s, size ); }
 	void WriteData( void* s, int size ) { data.Write( ( char* )s, size ); }
 	void CloseData();
+	int FinishData(); // closes the data connection, returns the transfer reply unchecked (226 - complete, 426 - aborted)
 	void Delete( const char* fileName );
 
 	void SetStopFunc( CheckStopFunc f, void* d ) { ctrl.SetStopFunc( f, d ); data.SetStopFunc( f, d ); }
@@ -120,29 +101,41 @@ class FSFtp : public FS
 	mutable Mutex infoMutex;
 	FSFtpParam _infoParam;
 
-	FtpStatCache statCache; //has own mutex
+	FSDirCache dirCache;    //has own mutex
 	FtpIDCollection uids;   //has own mutex
 	FtpIDCollection gids;   //has own mutex
 
 	Mutex mutex;
 	FSFtpParam _param;
 
-	enum { NODES_COUNT = 32 };
+	enum { NODES_COUNT = 32, MAX_STREAMS = 8, MAX_RESUME = 3, SEEK_SKIP_SIZE = 64 * 1024 };
 
 	struct Node: public iIntrusiveCounter
 	{
 		volatile bool busy;
 		volatile time_t lastCall;
 		/*volatile*/ clPtr<FTPNode> pFtpNode;
+		FSPath writePath; // file being uploaded, its directory listing is dropped again on Close
 
-		Node(): busy( false ), lastCall( 0 ) {}
+		// file being downloaded: RETR is reopened with REST at readPos after Seek or a broken transfer
+		FSPath readPath;
+		seek_t readPos;
+		bool reading;
+		bool dataOpen;
+		bool readDone; // 226 received, the next Read returns 0
+
+		Node(): busy( false ), lastCall( 0 ), readPos( 0 ), reading( false ), dataOpen( false ), readDone( false ) {}
 	};
 
 	Node nodes[NODES_COUNT];
 
 	int GetFreeNode( int* err, FSCInfo* info ); //return -1 if error
+	void ConnectNode( Node* p, FSCInfo* info ); //throws int
+	Node* GetReadNode( int fd, int* err ); //0 if fd is not a file opened by OpenRead
 
 	int ReadDir_int ( FSList* list, cstrhash<FSStat, char>* pSList, FSPath& _path, int* err, FSCInfo* info );
+	int StatMlst( FSPath& path, FSStat* st, int* err, FSCInfo* info ); //1 - the server has no MLST
+	static int ReadDirFunc( FS* fs, FSList* list, FSPath& path, int* err, FSCInfo* info ); //for dirCache
 public:
 	FSFtp( FSFtpParam* param );
 
@@ -158,6 +151,8 @@ public:
 	virtual int Close ( int fd, int* err, FSCInfo* info );
 	virtual int Read  ( int fd, void* buf, int size, int* err, FSCInfo* info );
 	virtual int Write ( int fd, void* buf, int size, int* err, FSCInfo* info );
+	virtual int Seek  ( int fd, SEEK_FILE_MODE mode, seek_t pos, seek_t* pRet,  int* err, FSCInfo* info );
+	virtual int FStat ( int fd, FSStat* st, int* err, FSCInfo* info );
 	virtual int Rename   ( FSPath&  oldpath, FSPath& newpath, int* err,  FSCInfo* info );
 	virtual int MkDir ( FSPath& path, int mode, int* err,  FSCInfo* info );
 	virtual int Delete   ( FSPath& path, int* err, FSCInfo* info );
@@ -166,6 +161,9 @@ public:
 	virtual int ReadDir  ( FSList* list, FSPath& path, int* err, FSCInfo* info );
 	virtual int Stat  ( FSPath& path, FSStat* st, int* err, FSCInfo* info );
 
+	virtual void DropCache( FSPath& path ) override { dirCache.Invalidate( path ); }
+	virtual int ReadStreams() override;
+
 	virtual FSString Uri( FSPath& path );
 	virtual ~FSFtp();
 
@@ -14,33 +14,88 @@
 #include <libssh2.h>
 #include <libssh2_sftp.h>
 #include "tcp_sock.h"
+#include "vfs-cache.h"
 
 class FSSftp : public FS
 {
 	mutable Mutex infoMutex;
 	FSSftpParam _infoParam; //должно быть то же самое что и в operParam просто мьютексв разные, и который просто mutex может блокироваться надолго (на период работы функции)
 
-	Mutex mutex;
-
-	enum CONSTS { MAX_FILES = 64 };
+	Mutex mutex; // guards the session pool and the file table, never held during network i/o
+	Cond connCond;
+
+	enum CONSTS { MAX_FILES = 64, MAX_CONNS = 8 };
+
+	// Several SSH sessions to the same server. Every call checks one out for its duration,
+	// so a listing or a Stat does not wait behind a transfer running in another thread.
+	struct Conn
+	{
+		TCPSock sock;
+		LIBSSH2_SESSION* volatile ssh;
+		LIBSSH2_SFTP* volatile sftp;
+		bool busy;
+		int files; // open handles belonging to this session
+		Conn(): ssh( 0 ), sftp( 0 ), busy( false ), files( 0 ) {}
+	};
+	Conn conns[MAX_CONNS];
+
+	// the first session to log in may prompt the user, the others reuse the public key or the password entered for it
+	bool authenticated;
+	bool secondaryFailed;
+	std::string password;
+
+	struct ConnHolder
+	{
+		FSSftp* fs;
+		Conn* c;
+		ConnHolder( FSSftp* f ): fs( f ), c( 0 ) {}
+		~ConnHolder() { if ( c ) { fs->Release( c ); } }
+	};
+
+	static int PoolSize();
+	int PickConn(); // with mutex locked, -1 if the caller has to wait
+	int Acquire( ConnHolder& holder, int fd, int* err, FSCInfo* info ); // fd < 0 - any session, else the one the file is open on
+	void Release( Conn* c );
+	int AddFile( Conn* c, LIBSSH2_SFTP_HANDLE* h, int* err, FSCInfo* info );
 
-	TCPSock _sock;
 	LIBSSH2_SFTP_HANDLE* volatile fileTable[MAX_FILES];
-	LIBSSH2_SESSION* volatile sshSession;
-	LIBSSH2_SFTP* volatile sftpSession;
+	int fileConn[MAX_FILES];
+	FSPath writePath[MAX_FILES]; // files open for writing, their directory listing is dropped again on Close
+
+	FSDirCache dirCache; //has own mutex
+	int ReadDir_int( FSList* list, FSPath& path, int* err, FSCInfo* info );
+	static int ReadDirFunc( FS* fs, FSList* list, FSPath& path, int* err, FSCInfo* info ); //for dirCache
+
+	// Pipelined transfers: libssh2 keeps as many READ/WRITE requests in flight as fit into the buffer it is given,
+	// so reads are done through a window sized buffer and small writes are gathered into one before being sent.
+	struct FileBuf
+	{
+		std::vector<char> data;
+		int pos;   // read: first byte not yet returned
+		int count; // bytes in data
+		int error; // read error to be reported by the next Read() after the bytes already received
+		FileBuf(): pos( 0 ), count( 0 ), error( 0 ) {}
+		void Clear() { std::vector<char>().swap( data ); pos = count = error = 0; }
+	};
+	FileBuf fileBuf[MAX_FILES];
+
+	static int TransferWindow();
+	int WriteAll( Conn* c, LIBSSH2_SFTP_HANDLE* h, const char* s, int size, FSCInfo* info ); //throw int
+	void FlushWrite( Conn* c, int fd, FSCInfo* info ); //throw int
 
 	FSSftpParam _operParam;
+	void CloseSession( Conn* c );
 	void CloseSession();
-	int CheckSession( int* err, FSCInfo* info );
+	int CheckSession( Conn* c, int* err, FSCInfo* info );
 
-	void WaitSocket( FSCInfo* info ); //throw int(errno) or int(-2) on stop
+	void WaitSocket( Conn* c, FSCInfo* info ); //throw int(errno) or int(-2) on stop
 
-	void CheckSessionEagain(); //if err != ...EAGAIN then throw int(...
-	void CheckSFTPEagain();
-	void CheckSFTP( int err ); //cheak if not 0 then throw
+	void CheckSessionEagain( Conn* c ); //if err != ...EAGAIN then throw int(...
+	void CheckSFTPEagain( Conn* c );
+	void CheckSFTP( Conn* c, int err ); //cheak if not 0 then throw
 
 
-	void CloseHandle( LIBSSH2_SFTP_HANDLE* h, FSCInfo* info );
+	void CloseHandle( Conn* c, LIBSSH2_SFTP_HANDLE* h, FSCInfo* info );
 public:
 	FSSftp( FSSftpParam* param );
 
@@ -68,6 +123,8 @@ public:
 	virtual int Symlink  ( FSPath& path, FSString& str, int* err, FSCInfo* info );
 	virtual int StatVfs( FSPath& path, FSStatVfs* st, int* err, FSCInfo* info );
 
+	virtual void DropCache( FSPath& path ) override { dirCache.Invalidate( path ); }
+
 	virtual FSString Uri( FSPath& path );
 	virtual ~FSSftp();
 
@@ -74,7 +74,7 @@ enum INT_SSH_ERRORS
 
 
 FSSftp::FSSftp( FSSftpParam* param )
-	:  FS( SFTP ), sshSession( 0 ), sftpSession( 0 )
+	:  FS( SFTP ), authenticated( false ), secondaryFailed( false ), dirCache( this, ReadDirFunc )
 {
 	if ( param )
 	{
@@ -85,24 +85,25 @@ FSSftp::FSSftp( FSSftpParam* param )
 	for ( int i = 0; i < MAX_FILES; i++ )
 	{
 		fileTable[i] = 0;
+		fileConn[i] = 0;
 	}
 }
 
 
-void FSSftp::WaitSocket( FSCInfo* info ) //throw int(errno) or int(-2) on stop
+void FSSftp::WaitSocket( Conn* c, FSCInfo* info ) //throw int(errno) or int(-2) on stop
 {
 	while ( true )
 	{
 		if ( info && info->IsStopped() ) { throw int( -2 ); } //stopped
 
-		int dir = libssh2_session_block_directions( sshSession );
+		int dir = libssh2_session_block_directions( c->ssh );
 
 		if ( ( dir & ( LIBSSH2_SESSION_BLOCK_INBOUND | LIBSSH2_SESSION_BLOCK_OUTBOUND ) ) == 0 )
 		{
 			return ;
 		}
 
-		int n = _sock.Select2(
+		int n = c->sock.Select2(
 					( dir & LIBSSH2_SESSION_BLOCK_INBOUND ) != 0,
 					( dir & LIBSSH2_SESSION_BLOCK_OUTBOUND ) != 0,
 					3 );
@@ -116,12 +117,12 @@ void FSSftp::WaitSocket( FSCInfo* info ) //throw int(errno) or int(-2) on stop
 while (true) {\
    retvar = a;\
    if (retvar != LIBSSH2_ERROR_EAGAIN) break;\
-   WaitSocket(info);\
+   WaitSocket(c, info);\
 }
 
-void FSSftp::CheckSessionEagain()
+void FSSftp::CheckSessionEagain( Conn* c )
 {
-	int e = libssh2_session_last_errno( this->sshSession );
+	int e = libssh2_session_last_errno( c->ssh );
 
 	if ( e != LIBSSH2_ERROR_EAGAIN ) { throw int( e - 1000 ); }
 }
@@ -133,20 +134,20 @@ inline int TransSftpError( int e, LIBSSH2_SFTP* sftp )
 	return e < 0 ? e - 1000 : e;
 }
 
-void FSSftp::CheckSFTPEagain()
+void FSSftp::CheckSFTPEagain( Conn* c )
 {
-	int e = libssh2_session_last_errno( sshSession );
+	int e = libssh2_session_last_errno( c->ssh );
 
 	if ( e == LIBSSH2_ERROR_EAGAIN ) { return; }
 
-	throw TransSftpError( e, sftpSession );
+	throw TransSftpError( e, c->sftp );
 }
 
-inline void FSSftp::CheckSFTP( int err )
+inline void FSSftp::CheckSFTP( Conn* c, int err )
 {
 	if ( !err ) { return; }
 
-	throw TransSftpError( err, sftpSession );
+	throw TransSftpError( err, c->sftp );
 }
 
 
@@ -231,10 +232,14 @@ void KbIntCallback(
 	}
 }
 
-int FSSftp::CheckSession( int* err, FSCInfo* info )
+int FSSftp::CheckSession( Conn* c, int* err, FSCInfo* info )
 {
 
-	if ( sshSession ) { return 0; }
+	if ( c->ssh ) { return 0; }
+
+	// only the first session asks the user, the others log in with what is already known
+	// (as does a background reread of a cached listing, it comes without FSCInfo)
+	bool interactive = ( c == conns && info );
 
 	try
 	{
@@ -247,16 +252,16 @@ int FSSftp::CheckSession( int* err, FSCInfo* info )
 			throw int( e );
 		}
 
-		_sock.Create();
-		_sock.Connect( ntohl( ip ), _operParam.port );
+		c->sock.Create();
+		c->sock.Connect( ntohl( ip ), _operParam.port );
 
-		sshSession = libssh2_session_init();
+		c->ssh = libssh2_session_init();
 
-		if ( !sshSession ) { throw int( SSH_INTERROR_X3 ); }
+		if ( !c->ssh ) { throw int( SSH_INTERROR_X3 ); }
 
-		libssh2_session_set_blocking( sshSession, 0 );
+		libssh2_session_set_blocking( c->ssh, 0 );
 
-		WHILE_EAGAIN_( e, libssh2_session_handshake( sshSession, _sock.Id() ) );
+		WHILE_EAGAIN_( e, libssh2_session_handshake( c->ssh, c->sock.Id() ) );
 
 		if ( e ) { throw int( e - 1000 ); }
 
@@ -289,12 +294,12 @@ int FSSftp::CheckSession( int* err, FSCInfo* info )
 
 		while ( true )
 		{
-			authList = libssh2_userauth_list( sshSession, charUserName, strlen( charUserName ) );
+			authList = libssh2_userauth_list( c->ssh, charUserName, strlen( charUserName ) );
 
 			if ( authList ) { break; }
 
-			CheckSessionEagain();
-			WaitSocket( info );
+			CheckSessionEagain( c );
+			WaitSocket( c, info );
 		}
 
 		//publickey,password,keyboard-interactive
@@ -304,17 +309,18 @@ int FSSftp::CheckSession( int* err, FSCInfo* info )
 
 		static unicode_t userSymbol[] = { '@', 0 };
 
-		int ret = 0;
-#if _MSC_VER > 1700
+		int ret = interactive ? 0 : LIBSSH2_ERROR_AUTHENTICATION_FAILED;
+		// sessions of the pool authenticate concurrently, strtok() would share its position between them
 		char* next_tok = nullptr;
+#if defined( _MSC_VER )
 		for ( char* authorizationMethod = strtok_s( authList, ",", &next_tok );
 			  authorizationMethod != nullptr;
 			  authorizationMethod = strtok_s( nullptr, ",", &next_tok )
 			)
 #else
-		for ( char* authorizationMethod = strtok( authList, "," );
+		for ( char* authorizationMethod = strtok_r( authList, ",", &next_tok );
 			  authorizationMethod != nullptr;
-			  authorizationMethod = strtok( nullptr, "," ) )
+			  authorizationMethod = strtok_r( nullptr, ",", &next_tok ) )
 #endif
 		{
 			if ( !strcmp( authorizationMethod, publickey ) )
@@ -326,7 +332,7 @@ int FSSftp::CheckSession( int* err, FSCInfo* info )
 					continue;
 				}
 
-				WHILE_EAGAIN_( ret, libssh2_userauth_publickey_fromfile ( sshSession, charUserName, public_key.GetUtf8(), private_key.GetUtf8(), "" ) );
+				WHILE_EAGAIN_( ret, libssh2_userauth_publickey_fromfile ( c->ssh, charUserName, public_key.GetUtf8(), private_key.GetUtf8(), "" ) );
 
 				if ( !ret )
 				{
@@ -354,7 +360,7 @@ int FSSftp::CheckSession( int* err, FSCInfo* info )
 //
 //						char* password = ( char* )FSString( data.prompt.Data() ).Get( _operParam.charset );
 //
-//						ret = libssh2_userauth_publickey_fromfile( sshSession,
+//						ret = libssh2_userauth_publickey_fromfile( c->ssh,
 //								charUserName, public_key.GetUtf8(), private_key.GetUtf8(), password );
 //						if ( ret != LIBSSH2_ERROR_PUBLICKEY_UNVERIFIED ) break;
 //					}
@@ -365,7 +371,7 @@ int FSSftp::CheckSession( int* err, FSCInfo* info )
 					// http://www.libssh2.org/libssh2_session_last_error.html
 					// Do I get it right that when want_buf==0 I don't need to release the buffer?
 					char* buf;
-					libssh2_session_last_error( sshSession, &buf, NULL, 0 );
+					libssh2_session_last_error( c->ssh, &buf, NULL, 0 );
 					fprintf( stderr, "Authentication using key failed: %s!\n", buf );
 				}
 			}
@@ -375,25 +381,38 @@ int FSSftp::CheckSession( int* err, FSCInfo* info )
 				data.visible = false;
 				data.prompt = "Password:";
 
-				if ( !info->Prompt(
+				if ( !interactive )
+				{
+					MutexLock lock( &mutex );
+
+					if ( password.empty() ) { continue; }
+
+					data.prompt = password;
+				}
+				else if ( !info->Prompt(
 						utf8_to_unicode( "SFTP_" ).data(),
 						carray_cat<unicode_t>( userName.GetUnicode(), userSymbol, utf8str_to_unicode(_operParam.server).data() ).data(),
 						&data, 1 ) ) { throw int( SSH_INTERROR_STOPPED ); }
 
-				WHILE_EAGAIN_( ret, libssh2_userauth_password( sshSession,
+				WHILE_EAGAIN_( ret, libssh2_userauth_password( c->ssh,
 															   ( char* )FSString( _operParam.user.c_str() ).Get( _operParam.charset ),
 															   ( char* )FSString( data.prompt.c_str() ).Get( _operParam.charset ) ) );
 
-				if ( !ret ) { break; }
+				if ( !ret )
+				{
+					MutexLock lock( &mutex );
+					password = data.prompt;
+					break;
+				}
 			}
-			else if ( !strcmp( authorizationMethod, kInterId ) )
+			else if ( !strcmp( authorizationMethod, kInterId ) && interactive )
 			{
 				MutexLock lock( &kbdIntMutex );
 				kbdIntInfo = info;
 				kbdIntParam = &_operParam;
 
 				WHILE_EAGAIN_( ret,
-							   libssh2_userauth_keyboard_interactive( sshSession,
+							   libssh2_userauth_keyboard_interactive( c->ssh,
 																	  ( char* )FSString( _operParam.user.c_str() ).Get( _operParam.charset ),
 																	  KbIntCallback )
 							 );
@@ -407,20 +426,22 @@ int FSSftp::CheckSession( int* err, FSCInfo* info )
 
 		while ( true )
 		{
-			sftpSession = libssh2_sftp_init( sshSession );
+			c->sftp = libssh2_sftp_init( c->ssh );
 
-			if ( sftpSession ) { break; }
+			if ( c->sftp ) { break; }
 
-			if ( !sftpSession )
+			if ( !c->sftp )
 			{
-				int e = libssh2_session_last_errno( sshSession );
+				int e = libssh2_session_last_errno( c->ssh );
 
 				if ( e != LIBSSH2_ERROR_EAGAIN ) { throw int( e - 1000 ); }
 			}
 
-			WaitSocket( info );
+			WaitSocket( c, info );
 		}
 
+		MutexLock lock( &mutex );
+		authenticated = true;
 		return 0;
 
 	}
@@ -428,24 +449,160 @@ int FSSftp::CheckSession( int* err, FSCInfo* info )
 	{
 		if ( err ) { *err = e; }
 
-		if ( sshSession ) { libssh2_session_free( sshSession ); }
+		if ( c->ssh ) { libssh2_session_free( c->ssh ); }
 
-		sshSession = 0;
-		sftpSession = 0;
-		_sock.Close( false );
+		c->ssh = 0;
+		c->sftp = 0;
+		c->sock.Close( false );
 		return ( e == -2 ) ? -2 : -1;
 	}
 
 }
 
+void FSSftp::CloseSession( Conn* c )
+{
+	if ( c->ssh ) { libssh2_session_free( c->ssh ); }
+
+	c->ssh = 0;
+	c->sftp = 0;
+
+	if ( c->sock.IsValid() ) { c->sock.Close( false ); }
+}
+
 void FSSftp::CloseSession()
 {
-	if ( sshSession ) { libssh2_session_free( sshSession ); }
+	for ( int i = 0; i < MAX_CONNS; i++ )
+	{
+		CloseSession( &conns[i] );
+	}
+}
+
+int FSSftp::PoolSize()
+{
+	int n = g_WcmConfig.sftpSessions;
+
+	if ( n < 1 ) { n = 1; }
 
-	sshSession = 0;
-	sftpSession = 0;
+	if ( n > MAX_CONNS ) { n = MAX_CONNS; }
 
-	if ( _sock.IsValid() ) { _sock.Close( false ); }
+	return n;
+}
+
+int FSSftp::PickConn()
+{
+	int count = PoolSize();
+	int idle = -1; // connected, with the fewest open files
+	int spare = -1; // not connected yet
+
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( conns[i].busy ) { continue; }
+
+		if ( !conns[i].ssh )
+		{
+			if ( spare < 0 ) { spare = i; }
+
+			continue;
+		}
+
+		if ( idle < 0 || conns[i].files < conns[idle].files ) { idle = i; }
+	}
+
+	if ( idle >= 0 && !conns[idle].files ) { return idle; }
+
+	// the first session logs in the usual way, the others are opened only after it has succeeded
+	if ( spare == 0 || ( spare > 0 && authenticated && !secondaryFailed ) ) { return spare; }
+
+	return idle;
+}
+
+int FSSftp::Acquire( ConnHolder& holder, int fd, int* err, FSCInfo* info )
+{
+	while ( true )
+	{
+		Conn* c = 0;
+
+		{
+			MutexLock lock( &mutex );
+
+			while ( true )
+			{
+				if ( fd >= 0 )
+				{
+					if ( fd >= MAX_FILES || !fileTable[fd] )
+					{
+						if ( err ) { *err = EINVAL; }
+
+						return -1;
+					}
+
+					c = &conns[fileConn[fd]];
+
+					if ( !c->busy ) { break; }
+				}
+				else
+				{
+					int n = PickConn();
+
+					if ( n >= 0 ) { c = &conns[n]; break; }
+				}
+
+				connCond.Wait( &mutex );
+			}
+
+			c->busy = true;
+		}
+
+		holder.c = c;
+		int ret = CheckSession( c, err, info );
+
+		if ( !ret || c == conns || ret == -2 ) { return ret; }
+
+		// the server did not let an additional session in without asking the user, stay with the ones already open
+		{
+			MutexLock lock( &mutex );
+			secondaryFailed = true;
+		}
+
+		Release( c );
+		holder.c = 0;
+	}
+}
+
+void FSSftp::Release( Conn* c )
+{
+	MutexLock lock( &mutex );
+	c->busy = false;
+	connCond.Broadcast();
+}
+
+int FSSftp::AddFile( Conn* c, LIBSSH2_SFTP_HANDLE* h, int* err, FSCInfo* info )
+{
+	{
+		MutexLock lock( &mutex );
+
+		for ( int n = 0; n < MAX_FILES; n++ )
+		{
+			if ( fileTable[n] ) { continue; }
+
+			fileTable[n] = h;
+			fileConn[n] = c - conns;
+			c->files++;
+			return n;
+		}
+	}
+
+	try
+	{
+		CloseHandle( c, h, info );
+	}
+	catch ( int )
+	{
+	}
+
+	if ( err ) { *err = SSH_INTERROR_OUTOF; }
+
+	return -1;
 }
 
 
@@ -722,41 +879,28 @@ FSString FSSftp::StrError( int err )
 
 int FSSftp::OpenRead ( FSPath& path, int flags, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, -1, err, info );
 
 	if ( ret ) { return ret; }
 
-	int n = 0;
-
-	for ( ; n < MAX_FILES; n++ )
-		if ( !fileTable[n] ) { break; }
-
-	if ( n >= MAX_FILES )
-	{
-		if ( err ) { *err = SSH_INTERROR_OUTOF; }
+	Conn* c = conn.c;
 
-		return -1;
-	}
+	LIBSSH2_SFTP_HANDLE* fd = 0;
 
 	try
 	{
-		LIBSSH2_SFTP_HANDLE* fd = 0;
-
 		while ( true )
 		{
-			fd = libssh2_sftp_open( sftpSession, ( char* )path.GetString( _operParam.charset, '/' ),
+			fd = libssh2_sftp_open( c->sftp, ( char* )path.GetString( _operParam.charset, '/' ),
 									LIBSSH2_FXF_READ,
 									0 );
 
 			if ( fd ) { break; }
 
-			CheckSFTPEagain();
-			WaitSocket( info );
+			CheckSFTPEagain( c );
+			WaitSocket( c, info );
 		}
-
-		fileTable[n] = fd;
-
 	}
 	catch ( int e )
 	{
@@ -765,17 +909,19 @@ int FSSftp::OpenRead ( FSPath& path, int flags, int* err, FSCInfo* info )
 		return ( e == -2 ) ? -2 : -1;
 	}
 
-	return n;
+	return AddFile( c, fd, err, info );
 }
 
 int FSSftp::OpenCreate  ( FSPath& path, bool overwrite, int mode, int flags, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, -1, err, info );
 
 	if ( ret ) { return ret; }
 
-	int n = 0;
+	Conn* c = conn.c;
+
+	LIBSSH2_SFTP_HANDLE* fd = 0;
 
 	try
 	{
@@ -786,39 +932,23 @@ int FSSftp::OpenCreate  ( FSPath& path, bool overwrite, int mode, int flags, int
 			*/
 			LIBSSH2_SFTP_ATTRIBUTES attr;
 			int ret;
-			WHILE_EAGAIN_( ret, libssh2_sftp_lstat( sftpSession, ( char* )path.GetString( _operParam.charset, '/' ), &attr ) );
+			WHILE_EAGAIN_( ret, libssh2_sftp_lstat( c->sftp, ( char* )path.GetString( _operParam.charset, '/' ), &attr ) );
 
 			if ( !ret ) { if ( err ) { *err = EEXIST; } return -1; }
 		}
 
-		for ( n = 0; n < MAX_FILES; n++ )
-			if ( !fileTable[n] ) { break; }
-
-		if ( n >= MAX_FILES )
-		{
-			if ( err ) { *err = SSH_INTERROR_OUTOF; }
-
-			return -1;
-		}
-
-
-		LIBSSH2_SFTP_HANDLE* fd = 0;
-
 		while ( true )
 		{
-			fd = libssh2_sftp_open( sftpSession,
+			fd = libssh2_sftp_open( c->sftp,
 									( char* )path.GetString( _operParam.charset, '/' ),
 									LIBSSH2_FXF_CREAT | LIBSSH2_FXF_WRITE | ( overwrite ? LIBSSH2_FXF_TRUNC : LIBSSH2_FXF_EXCL ),
 									mode );
 
 			if ( fd ) { break; }
 
-			CheckSFTPEagain();
-			WaitSocket( info );
+			CheckSFTPEagain( c );
+			WaitSocket( c, info );
 		}
-
-		fileTable[n] = fd;
-
 	}
 	catch ( int e )
 	{
@@ -827,28 +957,86 @@ int FSSftp::OpenCreate  ( FSPath& path, bool overwrite, int mode, int flags, int
 		return ( e == -2 ) ? -2 : -1;
 	}
 
+	dirCache.Invalidate( path );
+
+	int n = AddFile( c, fd, err, info );
+
+	if ( n >= 0 ) { writePath[n] = path; }
+
 	return n;
 }
 
+int FSSftp::TransferWindow()
+{
+	int kb = g_WcmConfig.sftpTransferWindow;
+
+	if ( kb < 32 ) { kb = 32; }
+
+	if ( kb > 64 * 1024 ) { kb = 64 * 1024; }
+
+	return kb * 1024;
+}
+
+int FSSftp::WriteAll( Conn* c, LIBSSH2_SFTP_HANDLE* h, const char* s, int size, FSCInfo* info )
+{
+	int bytes = 0;
+
+	while ( size > 0 )
+	{
+		int ret;
+		WHILE_EAGAIN_( ret, libssh2_sftp_write( h, s, size ) );
+
+		if ( ret < 0 ) { CheckSFTP( c, ret ); }
+
+		if ( !ret ) { break; }
+
+		bytes += ret;
+		size -= ret;
+		s += ret;
+	}
+
+	return bytes;
+}
+
+void FSSftp::FlushWrite( Conn* c, int fd, FSCInfo* info )
+{
+	FileBuf& fb = fileBuf[fd];
+
+	if ( fb.count <= 0 ) { return; }
+
+	int count = fb.count;
+	fb.count = 0;
+
+	if ( WriteAll( c, fileTable[fd], fb.data.data(), count, info ) != count ) { throw int( EIO ); }
+}
+
 int FSSftp::Close ( int fd, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, fd, err, info );
 
 	if ( ret ) { return ret; }
 
-	if ( fd < 0 || fd >= MAX_FILES || !fileTable[fd] )
-	{
-		if ( err ) { *err = EINVAL; }
+	Conn* c = conn.c;
 
-		return -1;
+	int flushErr = 0;
+
+	try
+	{
+		FlushWrite( c, fd, info );
 	}
+	catch ( int e )
+	{
+		flushErr = e;
+	}
+
+	fileBuf[fd].Clear();
 
 	try
 	{
 		int ret;
 		WHILE_EAGAIN_( ret, libssh2_sftp_close( fileTable[fd] ) );
-		CheckSFTP( ret );
+		CheckSFTP( c, ret );
 
 	}
 	catch ( int e )
@@ -858,35 +1046,89 @@ int FSSftp::Close ( int fd, int* err, FSCInfo* info )
 		return ( e == -2 ) ? -2 : -1;
 	}
 
-	fileTable[fd] = 0;
+	if ( writePath[fd].Count() > 0 )
+	{
+		dirCache.Invalidate( writePath[fd] );
+		writePath[fd].Clear();
+	}
+
+	{
+		MutexLock lock( &mutex );
+		fileTable[fd] = 0;
+		c->files--;
+	}
+
+	if ( flushErr )
+	{
+		if ( err ) { *err = flushErr; }
+
+		return ( flushErr == -2 ) ? -2 : -1;
+	}
+
 	return 0;
 }
 
 int FSSftp::Read  ( int fd, void* buf, int size, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, fd, err, info );
 
 	if ( ret ) { return ret; }
 
-	if ( fd < 0 || fd >= MAX_FILES || !fileTable[fd] )
-	{
-		if ( err ) { *err = EINVAL; }
+	Conn* c = conn.c;
 
-		return -1;
-	}
+	FileBuf& fb = fileBuf[fd];
+	char* dst = ( char* )buf;
+	int done = 0;
 
 	try
 	{
-		int bytes;
-		WHILE_EAGAIN_( bytes, libssh2_sftp_read( fileTable[fd], ( char* )buf, size ) );
+		if ( fb.error )
+		{
+			int e = fb.error;
+			fb.error = 0;
+			throw int( e );
+		}
+
+		// fill the caller's buffer completely, so the copy engine gets large contiguous blocks
+		while ( done < size )
+		{
+			if ( fb.pos >= fb.count )
+			{
+				int window = TransferWindow();
+
+				if ( ( int )fb.data.size() != window ) { fb.data.resize( window ); }
 
-		if ( bytes < 0 ) { CheckSFTP( bytes ); }
+				int bytes;
+				WHILE_EAGAIN_( bytes, libssh2_sftp_read( fileTable[fd], fb.data.data(), fb.data.size() ) );
+
+				if ( bytes < 0 ) { CheckSFTP( c, bytes ); }
+
+				fb.pos = 0;
+				fb.count = bytes;
+
+				if ( !bytes ) { break; } //eof
+			}
+
+			int n = fb.count - fb.pos;
+
+			if ( n > size - done ) { n = size - done; }
+
+			memcpy( dst + done, fb.data.data() + fb.pos, n );
+			fb.pos += n;
+			done += n;
+		}
 
-		return bytes;
+		return done;
 	}
 	catch ( int e )
 	{
+		if ( done > 0 && e != -2 )
+		{
+			fb.error = e;
+			return done;
+		}
+
 		if ( err ) { *err = e; }
 
 		return ( e == -2 ) ? -2 : -1;
@@ -896,38 +1138,49 @@ int FSSftp::Read  ( int fd, void* buf, int size, int* err, FSCInfo* info )
 
 int FSSftp::Write ( int fd, void* buf, int size, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, fd, err, info );
 
 	if ( ret ) { return ret; }
 
-	if ( fd < 0 || fd >= MAX_FILES || !fileTable[fd] )
-	{
-		if ( err ) { *err = EINVAL; }
+	Conn* c = conn.c;
 
-		return -1;
-	}
+	FileBuf& fb = fileBuf[fd];
 
 	try
 	{
-		int bytes = 0;
-		char* s = ( char* )buf;
+		int window = TransferWindow();
 
-		while ( size > 0 )
+		// a block as large as the window goes out as is
+		if ( fb.count == 0 && size >= window )
 		{
-			int ret;
-			WHILE_EAGAIN_( ret, libssh2_sftp_write( fileTable[fd], s, size ) );
+			return WriteAll( c, fileTable[fd], ( char* )buf, size, info );
+		}
+
+		if ( ( int )fb.data.size() != window )
+		{
+			FlushWrite( c, fd, info );
+			fb.data.resize( window );
+		}
+
+		const char* s = ( const char* )buf;
+		int left = size;
+
+		while ( left > 0 )
+		{
+			int n = window - fb.count;
 
-			if ( ret < 0 ) { CheckSFTP( ret ); }
+			if ( n > left ) { n = left; }
 
-			if ( !ret ) { break; }
+			memcpy( fb.data.data() + fb.count, s, n );
+			fb.count += n;
+			s += n;
+			left -= n;
 
-			bytes += ret;
-			size -= ret;
-			s += ret;
+			if ( fb.count >= window ) { FlushWrite( c, fd, info ); }
 		}
 
-		return bytes;
+		return size;
 	}
 	catch ( int e )
 	{
@@ -939,21 +1192,30 @@ int FSSftp::Write ( int fd, void* buf, int size, int* err, FSCInfo* info )
 
 int FSSftp::Seek( int fd, SEEK_FILE_MODE mode, seek_t pos, seek_t* pRet,  int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, fd, err, info );
 
 	if ( ret ) { return ret; }
 
-	if ( fd < 0 || fd >= MAX_FILES || !fileTable[fd] )
-	{
-		if ( err ) { *err = EINVAL; }
-
-		return -1;
-	}
+	Conn* c = conn.c;
 
 	//???
 	if ( mode == FSEEK_BEGIN )
 	{
+		try
+		{
+			FlushWrite( c, fd, info );
+		}
+		catch ( int e )
+		{
+			if ( err ) { *err = e; }
+
+			return ( e == -2 ) ? -2 : -1;
+		}
+
+		// libssh2 drops its outstanding read requests on seek, the data read ahead here is stale too
+		fileBuf[fd].pos = fileBuf[fd].count = fileBuf[fd].error = 0;
+
 		libssh2_sftp_seek64( fileTable[fd],   pos );
 
 		if ( pRet ) { *pRet = pos; }
@@ -972,16 +1234,20 @@ int FSSftp::Seek( int fd, SEEK_FILE_MODE mode, seek_t pos, seek_t* pRet,  int* e
 
 int FSSftp::Rename   ( FSPath&  oldpath, FSPath& newpath, int* err,  FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, -1, err, info );
 
 	if ( ret ) { return ret; }
 
+	Conn* c = conn.c;
+
 	try
 	{
 		int ret;
-		WHILE_EAGAIN_( ret, libssh2_sftp_rename( sftpSession, ( char* ) oldpath.GetString( _operParam.charset, '/' ), ( char* ) newpath.GetString( _operParam.charset, '/' ) ) );
-		CheckSFTP( ret );
+		WHILE_EAGAIN_( ret, libssh2_sftp_rename( c->sftp, ( char* ) oldpath.GetString( _operParam.charset, '/' ), ( char* ) newpath.GetString( _operParam.charset, '/' ) ) );
+		dirCache.Invalidate( oldpath );
+		dirCache.Invalidate( newpath );
+		CheckSFTP( c, ret );
 	}
 	catch ( int e )
 	{
@@ -997,16 +1263,19 @@ int FSSftp::Rename   ( FSPath&  oldpath, FSPath& newpath, int* err,  FSCInfo* in
 
 int FSSftp::MkDir ( FSPath& path, int mode, int* err,  FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, -1, err, info );
 
 	if ( ret ) { return ret; }
 
+	Conn* c = conn.c;
+
 	try
 	{
 		int ret;
-		WHILE_EAGAIN_( ret, libssh2_sftp_mkdir( sftpSession, ( char* )path.GetString( _operParam.charset, '/' ), mode ) );
-		CheckSFTP( ret );
+		WHILE_EAGAIN_( ret, libssh2_sftp_mkdir( c->sftp, ( char* )path.GetString( _operParam.charset, '/' ), mode ) );
+		dirCache.Invalidate( path );
+		CheckSFTP( c, ret );
 	}
 	catch ( int e )
 	{
@@ -1020,16 +1289,19 @@ int FSSftp::MkDir ( FSPath& path, int mode, int* err,  FSCInfo* info )
 
 int FSSftp::Delete   ( FSPath& path, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, -1, err, info );
 
 	if ( ret ) { return ret; }
 
+	Conn* c = conn.c;
+
 	try
 	{
 		int ret;
-		WHILE_EAGAIN_( ret, libssh2_sftp_unlink( sftpSession, ( char* )path.GetString( _operParam.charset, '/' ) ) );
-		CheckSFTP( ret );
+		WHILE_EAGAIN_( ret, libssh2_sftp_unlink( c->sftp, ( char* )path.GetString( _operParam.charset, '/' ) ) );
+		dirCache.Invalidate( path );
+		CheckSFTP( c, ret );
 	}
 	catch ( int e )
 	{
@@ -1043,16 +1315,19 @@ int FSSftp::Delete   ( FSPath& path, int* err, FSCInfo* info )
 
 int FSSftp::RmDir ( FSPath& path, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, -1, err, info );
 
 	if ( ret ) { return ret; }
 
+	Conn* c = conn.c;
+
 	try
 	{
 		int ret;
-		WHILE_EAGAIN_( ret, libssh2_sftp_rmdir( sftpSession, ( char* )path.GetString( _operParam.charset, '/' ) ) );
-		CheckSFTP( ret );
+		WHILE_EAGAIN_( ret, libssh2_sftp_rmdir( c->sftp, ( char* )path.GetString( _operParam.charset, '/' ) ) );
+		dirCache.Invalidate( path );
+		CheckSFTP( c, ret );
 	}
 	catch ( int e )
 	{
@@ -1066,11 +1341,13 @@ int FSSftp::RmDir ( FSPath& path, int* err, FSCInfo* info )
 
 int FSSftp::SetFileTime ( FSPath& path, FSTime cTime, FSTime aTime, FSTime mTime, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, -1, err, info );
 
 	if ( ret ) { return ret; }
 
+	Conn* c = conn.c;
+
 	LIBSSH2_SFTP_ATTRIBUTES attr;
 	attr.flags = LIBSSH2_SFTP_ATTR_ACMODTIME;
 	attr.atime = ( unsigned long )aTime;
@@ -1079,8 +1356,9 @@ int FSSftp::SetFileTime ( FSPath& path, FSTime cTime, FSTime aTime, FSTime mTime
 	try
 	{
 		int ret;
-		WHILE_EAGAIN_( ret, libssh2_sftp_setstat( sftpSession, ( char* )path.GetString( _operParam.charset, '/' ), &attr ) );
-		CheckSFTP( ret );
+		WHILE_EAGAIN_( ret, libssh2_sftp_setstat( c->sftp, ( char* )path.GetString( _operParam.charset, '/' ), &attr ) );
+		dirCache.Invalidate( path );
+		CheckSFTP( c, ret );
 	}
 	catch ( int e )
 	{
@@ -1092,7 +1370,7 @@ int FSSftp::SetFileTime ( FSPath& path, FSTime cTime, FSTime aTime, FSTime mTime
 	return 0;
 }
 
-void FSSftp::CloseHandle( LIBSSH2_SFTP_HANDLE* h, FSCInfo* info )
+void FSSftp::CloseHandle( Conn* c, LIBSSH2_SFTP_HANDLE* h, FSCInfo* info )
 {
 	int ret;
 	WHILE_EAGAIN_( ret, libssh2_sftp_close_handle( h ) );
@@ -1115,11 +1393,33 @@ struct SftpAttr
 
 int FSSftp::ReadDir  ( FSList* list, FSPath& path, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	if ( !list ) { return 0; }
+
+	if ( dirCache.GetList( path, list ) != FSDirCache::MISS ) { return 0; }
+
+	unsigned generation = dirCache.Generation();
+
+	int ret = ReadDir_int( list, path, err, info );
+
+	if ( !ret ) { dirCache.PutList( path, *list, generation ); }
+
+	return ret;
+}
+
+int FSSftp::ReadDirFunc( FS* fs, FSList* list, FSPath& path, int* err, FSCInfo* info )
+{
+	return ( ( FSSftp* )fs )->ReadDir_int( list, path, err, info );
+}
+
+int FSSftp::ReadDir_int( FSList* list, FSPath& path, int* err, FSCInfo* info )
+{
+	ConnHolder conn( this );
+	int ret = Acquire( conn, -1, err, info );
 
 	if ( ret ) { return ret; }
 
+	Conn* c = conn.c;
+
 	if ( !list ) { return 0; }
 
 	list->Clear();
@@ -1134,12 +1434,12 @@ int FSSftp::ReadDir  ( FSList* list, FSPath& path, int* err, FSCInfo* info )
 
 			while ( true )
 			{
-				dir = libssh2_sftp_opendir( sftpSession, ( char* )path.GetString( _operParam.charset, '/' ) );
+				dir = libssh2_sftp_opendir( c->sftp, ( char* )path.GetString( _operParam.charset, '/' ) );
 
 				if ( dir ) { break; }
 
-				CheckSFTPEagain();
-				WaitSocket( info );
+				CheckSFTPEagain( c );
+				WaitSocket( c, info );
 			}
 
 			while ( true )
@@ -1151,7 +1451,7 @@ int FSSftp::ReadDir  ( FSList* list, FSPath& path, int* err, FSCInfo* info )
 
 				WHILE_EAGAIN_( len, libssh2_sftp_readdir( dir, buf, sizeof( buf ) - 1, &attr.attr ) );
 
-				if ( len < 0 ) { CheckSFTP( len ); }
+				if ( len < 0 ) { CheckSFTP( c, len ); }
 
 				if ( len == 0 ) { break; }
 
@@ -1182,14 +1482,14 @@ int FSSftp::ReadDir  ( FSList* list, FSPath& path, int* err, FSCInfo* info )
 					pt.Push( _operParam.charset, buf );
 					char* fullPath = ( char* )pt.GetString( _operParam.charset, '/' );
 
-					WHILE_EAGAIN_( len, libssh2_sftp_readlink( sftpSession, fullPath, buf, sizeof( buf ) - 1 ) );
+					WHILE_EAGAIN_( len, libssh2_sftp_readlink( c->sftp, fullPath, buf, sizeof( buf ) - 1 ) );
 
-					if ( len < 0 ) { CheckSFTP( len ); }
+					if ( len < 0 ) { CheckSFTP( c, len ); }
 
 					pNode->st.link.Set( _operParam.charset, buf );
 
 					int ret;
-					WHILE_EAGAIN_( ret, libssh2_sftp_stat( sftpSession, fullPath, &attr.attr ) );
+					WHILE_EAGAIN_( ret, libssh2_sftp_stat( c->sftp, fullPath, &attr.attr ) );
 				}
 
 				pNode->st.mode = attr.Permissions();
@@ -1207,12 +1507,12 @@ int FSSftp::ReadDir  ( FSList* list, FSPath& path, int* err, FSCInfo* info )
 		}
 		catch ( ... )
 		{
-			if ( dir ) { CloseHandle( dir, info ); }
+			if ( dir ) { CloseHandle( c, dir, info ); }
 
 			throw;
 		}
 
-		if ( dir ) { CloseHandle( dir, info ); }
+		if ( dir ) { CloseHandle( c, dir, info ); }
 
 	}
 	catch ( int e )
@@ -1228,34 +1528,47 @@ int FSSftp::ReadDir  ( FSList* list, FSPath& path, int* err, FSCInfo* info )
 
 int FSSftp::Stat  ( FSPath& path, FSStat* st, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	int r = dirCache.GetStat( path, st ); //0 - ok, 1 - not cache for it, -1 - not exist in cache
+
+	if ( !r ) { return 0; }
+
+	if ( r < 0 )
+	{
+		if ( err ) { *err = ENOENT; }
+
+		return -1;
+	}
+
+	ConnHolder conn( this );
+	int ret = Acquire( conn, -1, err, info );
 
 	if ( ret ) { return ret; }
 
+	Conn* c = conn.c;
+
 	char* fullPath = ( char* ) path.GetString( _operParam.charset, '/' );
 
 	try
 	{
 		SftpAttr attr;
 		int ret;
-		WHILE_EAGAIN_( ret, libssh2_sftp_lstat( sftpSession, fullPath, &attr.attr ) );
-		CheckSFTP( ret );
+		WHILE_EAGAIN_( ret, libssh2_sftp_lstat( c->sftp, fullPath, &attr.attr ) );
+		CheckSFTP( c, ret );
 
 		if ( attr.IsLink() )
 		{
 			char buf[4096];
 			int len;
 
-			WHILE_EAGAIN_( len,  libssh2_sftp_readlink( sftpSession, fullPath, buf, sizeof( buf ) ) );
+			WHILE_EAGAIN_( len,  libssh2_sftp_readlink( c->sftp, fullPath, buf, sizeof( buf ) ) );
 
-			if ( len < 0 ) { CheckSFTP( len ); };
+			if ( len < 0 ) { CheckSFTP( c, len ); };
 
 			st->link.Set( _operParam.charset, buf );
 
 			int ret;
 
-			WHILE_EAGAIN_( ret, libssh2_sftp_stat( sftpSession, fullPath, &attr.attr ) );
+			WHILE_EAGAIN_( ret, libssh2_sftp_stat( c->sftp, fullPath, &attr.attr ) );
 
 			if ( ret ) { attr.attr.permissions = 0; }
 		}
@@ -1283,24 +1596,21 @@ int FSSftp::Stat  ( FSPath& path, FSStat* st, int* err, FSCInfo* info )
 
 int FSSftp::FStat ( int fd, FSStat* st, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, fd, err, info );
 
 	if ( ret ) { return ret; }
 
-	if ( fd < 0 || fd >= MAX_FILES || !fileTable[fd] )
-	{
-		if ( err ) { *err = EINVAL; }
-
-		return -1;
-	}
+	Conn* c = conn.c;
 
 	try
 	{
+		FlushWrite( c, fd, info );
+
 		SftpAttr attr;
 		int ret;
 		WHILE_EAGAIN_( ret, libssh2_sftp_fstat( fileTable[fd], &attr.attr ) );
-		CheckSFTP( ret );
+		CheckSFTP( c, ret );
 
 		st->mode  = attr.Permissions();
 		st->size  = attr.Size();
@@ -1326,16 +1636,19 @@ int FSSftp::FStat ( int fd, FSStat* st, int* err, FSCInfo* info )
 
 int FSSftp::Symlink  ( FSPath& path, FSString& str, int* err, FSCInfo* info )
 {
-	MutexLock lock( &mutex );
-	int ret = CheckSession( err, info );
+	ConnHolder conn( this );
+	int ret = Acquire( conn, -1, err, info );
 
 	if ( ret ) { return ret; }
 
+	Conn* c = conn.c;
+
 	try
 	{
 		int ret;
-		WHILE_EAGAIN_( ret, libssh2_sftp_symlink( sftpSession, ( char* )str.Get( _operParam.charset ),  ( char* )path.GetString( _operParam.charset, '/' ) ) );
-		CheckSFTP( ret );
+		WHILE_EAGAIN_( ret, libssh2_sftp_symlink( c->sftp, ( char* )str.Get( _operParam.charset ),  ( char* )path.GetString( _operParam.charset, '/' ) ) );
+		dirCache.Invalidate( path );
+		CheckSFTP( c, ret );
 	}
 	catch ( int e )
 	{
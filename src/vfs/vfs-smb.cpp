@@ -185,7 +185,7 @@ static void InitSmb()
 }
 
 FSSmb::FSSmb( FSSmbParam* param )
-	:  FS( SAMBA )
+	:  FS( SAMBA ), dirCache( this, ReadDirFunc )
 {
 	InitSmb();
 
@@ -227,6 +227,13 @@ int FSSmb::OpenCreate( FSPath& path, bool overwrite, int mode, int flags, int* e
 	int n = smbc_open( pathBuffer1.SetPath( path ),
 	                   O_CREAT | O_WRONLY | O_TRUNC | OPENFLAG_LARGEFILE | ( overwrite ? 0 : O_EXCL ) , mode );
 	SetError( err, errno );
+
+	if ( n >= 0 )
+	{
+		dirCache.Invalidate( path );
+		writePaths[n] = path;
+	}
+
 	return n < 0 ? -1 : n;
 }
 
@@ -234,6 +241,14 @@ int FSSmb::Close( int fd, int* err, FSCInfo* info )
 {
 	FREPARE_SMB_OPER( lock, info, &_param );
 
+	auto w = writePaths.find( fd );
+
+	if ( w != writePaths.end() )
+	{
+		dirCache.Invalidate( w->second );
+		writePaths.erase( w );
+	}
+
 	if ( smbc_close( fd ) )
 	{
 		SetError( err, errno );
@@ -308,6 +323,8 @@ int FSSmb::Rename( FSPath&  oldpath, FSPath& newpath, int* err,  FSCInfo* info )
 	           pathBuffer2.SetPath( newpath )
 	        );
 	SetError( err, errno );
+	dirCache.Invalidate( oldpath );
+	dirCache.Invalidate( newpath );
 	return n < 0 ? -1 : n;
 }
 
@@ -317,6 +334,7 @@ int FSSmb::MkDir( FSPath& path, int mode, int* err,  FSCInfo* info )
 
 	int n = smbc_mkdir( pathBuffer1.SetPath( path ), mode );
 	SetError( err, errno );
+	dirCache.Invalidate( path );
 	return n < 0 ? -1 : n;
 }
 
@@ -326,6 +344,7 @@ int FSSmb::Delete( FSPath& path, int* err, FSCInfo* info )
 
 	int n = smbc_unlink( pathBuffer1.SetPath( path ) );
 	SetError( err, errno );
+	dirCache.Invalidate( path );
 	return n < 0 ? -1 : n;
 }
 
@@ -335,6 +354,7 @@ int FSSmb::RmDir( FSPath& path, int* err, FSCInfo* info )
 
 	int n = smbc_rmdir( pathBuffer1.SetPath( path ) );
 	SetError( err, errno );
+	dirCache.Invalidate( path );
 	return n < 0 ? -1 : n;
 }
 
@@ -350,6 +370,7 @@ int FSSmb::SetFileTime( FSPath& path, FSTime cTime, FSTime aTime, FSTime mTime,
 	tv[1].tv_usec = 0;
 	int n = smbc_utimes( pathBuffer1.SetPath( path ), tv );
 	SetError( err, errno );
+	dirCache.Invalidate( path );
 	return n < 0 ? -1 : n;
 }
 
@@ -394,6 +415,16 @@ static int InternalStat( FSPath& path, FSStat* fsStat, FSCInfo* info )
 
 int FSSmb::Stat( FSPath& path, FSStat* fsStat, int* err, FSCInfo* info )
 {
+	int r = dirCache.GetStat( path, fsStat ); //0 - ok, 1 - not cache for it, -1 - not exist in cache
+
+	if ( !r ) { return 0; }
+
+	if ( r < 0 )
+	{
+		SetError( err, ENOENT );
+		return -1;
+	}
+
 	FREPARE_SMB_OPER( lock, info, &_param );
 	ASSERT( fsStat );
 
@@ -512,7 +543,25 @@ FSString FSSmb::Uri( FSPath& path )
 	return FSString( CS_UTF8, a.c_str() );
 }
 
-int FSSmb::ReadDir( FSList* list, FSPath& _path, int* err, FSCInfo* info )
+int FSSmb::ReadDir( FSList* list, FSPath& path, int* err, FSCInfo* info )
+{
+	if ( dirCache.GetList( path, list ) != FSDirCache::MISS ) { return 0; }
+
+	unsigned generation = dirCache.Generation();
+
+	int ret = ReadDir_int( list, path, err, info );
+
+	if ( !ret ) { dirCache.PutList( path, *list, generation ); }
+
+	return ret;
+}
+
+int FSSmb::ReadDirFunc( FS* fs, FSList* list, FSPath& path, int* err, FSCInfo* info )
+{
+	return ( ( FSSmb* )fs )->ReadDir_int( list, path, err, info );
+}
+
+int FSSmb::ReadDir_int( FSList* list, FSPath& _path, int* err, FSCInfo* info )
 {
 	FREPARE_SMB_OPER( lock, info, &_param );
 
@@ -10,13 +10,21 @@
 
 #ifdef LIBSMBCLIENT_EXIST
 
+#include <unordered_map>
+
 #include "vfs.h"
+#include "vfs-cache.h"
 
 
 class FSSmb : public FS
 {
 	mutable Mutex mutex;
 	FSSmbParam _param;
+
+	FSDirCache dirCache; //has own mutex
+	std::unordered_map<int, FSPath> writePaths; // files open for writing, their directory listing is dropped again on Close
+	int ReadDir_int( FSList* list, FSPath& path, int* err, FSCInfo* info );
+	static int ReadDirFunc( FS* fs, FSList* list, FSPath& path, int* err, FSCInfo* info ); //for dirCache
 public:
 	FSSmb( FSSmbParam* param = 0 );
 
@@ -45,6 +53,8 @@ public:
 	virtual int Symlink  ( FSPath& path, FSString& str, int* err, FSCInfo* info );
 	virtual int StatVfs( FSPath& path, FSStatVfs* st, int* err, FSCInfo* info );
 
+	virtual void DropCache( FSPath& path ) override { dirCache.Invalidate( path ); }
+
 	virtual FSString Uri( FSPath& path );
 	virtual ~FSSmb();
 
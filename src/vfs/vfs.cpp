@@ -55,6 +55,12 @@ FSCInfo::~FSCInfo() {}
 bool FSCSimpleInfo::IsStopped() const { return m_Stopped; }
 FSCSimpleInfo::~FSCSimpleInfo() {}
 
+////////////////////////////////////// FSExtractSink
+FSExtractSink::~FSExtractSink() {}
+
+////////////////////////////////////// FSDeleteSink
+FSDeleteSink::~FSDeleteSink() {}
+
 //////////////////////////////////////////////////  FSSys ///////////////////////////
 
 
@@ -240,7 +246,7 @@ int FSSys::OpenCreate   ( FSPath& path, bool overwrite, int mode, int flags,  in
 {
 	DWORD diseredAccess = GENERIC_READ | GENERIC_WRITE;
 //	DWORD shareMode = 0;
-	DWORD creationDisposition = ( overwrite ) ? CREATE_ALWAYS  : CREATE_NEW;
+	DWORD creationDisposition = ( flags & UPDATE ) ? OPEN_EXISTING : ( overwrite ) ? CREATE_ALWAYS  : CREATE_NEW;
 //???
 
 	HANDLE h = CreateFileW( SysPathStr( _drive, path.GetUnicode( '\\' ) ).data(), diseredAccess, FILE_SHARE_WRITE, 0, creationDisposition, 0, 0 );
@@ -342,9 +348,11 @@ int FSSys::Seek( int fd, SEEK_FILE_MODE mode, seek_t pos, seek_t* pRet,  int* er
 
 int FSSys::Rename ( FSPath&  oldpath, FSPath& newpath, int* err,  FSCInfo* info )
 {
-	if ( MoveFileW(
+	// an existing file is replaced in one step as rename() does
+	if ( MoveFileExW(
 	        SysPathStr( _drive, oldpath.GetUnicode( '\\' ) ).data(),
-	        SysPathStr( _drive, newpath.GetUnicode( '\\' ) ).data()
+	        SysPathStr( _drive, newpath.GetUnicode( '\\' ) ).data(),
+	        MOVEFILE_REPLACE_EXISTING
 	     ) ) { return 0; }
 
 	SetError( err, GetLastError() );
@@ -1112,6 +1120,11 @@ FSWin32Net::~FSWin32Net()
 #include <dirent.h>
 #include <sys/time.h>
 
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <unordered_set>
+
 // for statfs()
 #ifdef __linux__
 #  include <sys/statfs.h>
@@ -1129,7 +1142,7 @@ FSWin32Net::~FSWin32Net()
 #  define OPENFLAG_LARGEFILE (0)
 #endif
 
-unsigned FSSys::Flags() { return HAVE_READ | HAVE_WRITE | HAVE_SYMLINK | HAVE_SEEK; }
+unsigned FSSys::Flags() { return HAVE_READ | HAVE_WRITE | HAVE_SYMLINK | HAVE_SEEK | HAVE_SPARSE; }
 bool  FSSys::IsEEXIST( int err ) { return err == EEXIST; }
 bool  FSSys::IsENOENT( int err ) { return err == ENOENT; }
 bool  FSSys::IsEXDEV( int err ) { return err == EXDEV; }
@@ -1149,6 +1162,76 @@ bool FSSys::Equal( FS* fs )
 }
 
 
+/*
+   A file opened with FS::DROP_BEHIND is copied through once, so its pages are released behind the cursor:
+   when a read or a write crosses a DROP_CHUNK boundary the chunk before is dropped, a written chunk once
+   its writeback (started when the chunk was done) has finished. Only the descriptor is remembered, so the
+   parts of a file written at several offsets at once are handled alike.
+*/
+enum { DROP_CHUNK = 8 * 1024 * 1024 };
+
+static Mutex dropBehindMutex;
+static std::unordered_map<int, bool> dropBehindFds; // descriptor, written
+static std::atomic<int> dropBehindCount( 0 );
+
+static void SetDropBehind( int fd, bool written )
+{
+	MutexLock lock( &dropBehindMutex );
+	dropBehindFds[fd] = written;
+	dropBehindCount = ( int )dropBehindFds.size();
+}
+
+/* 0 - not set, 1 - read, 2 - written; forgets the descriptor if 'remove' */
+static int GetDropBehind( int fd, bool remove = false )
+{
+	if ( !dropBehindCount ) { return 0; }
+
+	MutexLock lock( &dropBehindMutex );
+	auto it = dropBehindFds.find( fd );
+
+	if ( it == dropBehindFds.end() ) { return 0; }
+
+	int ret = it->second ? 2 : 1;
+
+	if ( remove )
+	{
+		dropBehindFds.erase( it );
+		dropBehindCount = ( int )dropBehindFds.size();
+	}
+
+	return ret;
+}
+
+static void DropBehind( int fd, int n, bool written )
+{
+#ifdef POSIX_FADV_DONTNEED
+	off_t pos = lseek( fd, 0, SEEK_CUR );
+	off_t b = pos - pos % DROP_CHUNK;
+
+	if ( pos < 0 || pos - n >= b ) { return; }
+
+	if ( !written )
+	{
+		posix_fadvise( fd, b - DROP_CHUNK, DROP_CHUNK, POSIX_FADV_DONTNEED );
+		return;
+	}
+
+#ifdef __linux__
+	// dirty pages are not dropped, so the chunk before waits for its writeback
+	sync_file_range( fd, b - DROP_CHUNK, DROP_CHUNK, SYNC_FILE_RANGE_WRITE );
+
+	if ( b >= 2 * DROP_CHUNK )
+	{
+		sync_file_range( fd, b - 2 * DROP_CHUNK, DROP_CHUNK, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER );
+	}
+
+#endif
+
+	if ( b >= 2 * DROP_CHUNK ) { posix_fadvise( fd, b - 2 * DROP_CHUNK, DROP_CHUNK, POSIX_FADV_DONTNEED ); }
+
+#endif
+}
+
 int FSSys::OpenRead  ( FSPath& path, int flags, int* err, FSCInfo* info )
 {
 	int n =  open( ( char* ) path.GetString( sys_charset_id, '/' ),
@@ -1156,6 +1239,28 @@ int FSSys::OpenRead  ( FSPath& path, int flags, int* err, FSCInfo* info )
 
 	if ( n < 0 ) { SetError( err, errno ); return -1; }
 
+	if ( flags & DROP_BEHIND )
+	{
+#ifdef POSIX_FADV_SEQUENTIAL
+		posix_fadvise( n, 0, 0, POSIX_FADV_SEQUENTIAL );
+#endif
+#ifdef F_NOCACHE
+		fcntl( n, F_NOCACHE, 1 );
+#endif
+		SetDropBehind( n, false );
+	}
+
+#ifdef POSIX_FADV_DONTNEED
+
+	// pages still dirty are not dropped, so they are written out first
+	if ( flags & NO_CACHE )
+	{
+		fdatasync( n );
+		posix_fadvise( n, 0, 0, POSIX_FADV_DONTNEED );
+	}
+
+#endif
+
 	return n;
 }
 
@@ -1163,15 +1268,40 @@ int FSSys::OpenRead  ( FSPath& path, int flags, int* err, FSCInfo* info )
 int FSSys::OpenCreate   ( FSPath& path, bool overwrite, int mode, int flags,   int* err, FSCInfo* info )
 {
 	int n =  open( ( char* ) path.GetString( sys_charset_id, '/' ),
+	               ( flags & UPDATE ) ? O_WRONLY | OPENFLAG_LARGEFILE :
 	               O_CREAT | O_WRONLY | O_TRUNC | OPENFLAG_LARGEFILE | ( overwrite ? 0 : O_EXCL ) , mode );
 
 	if ( n < 0 ) { SetError( err, errno ); return -1; }
 
+	if ( flags & DROP_BEHIND )
+	{
+#ifdef F_NOCACHE
+		fcntl( n, F_NOCACHE, 1 );
+#endif
+		SetDropBehind( n, true );
+	}
+
 	return n;
 }
 
 int FSSys::Close( int fd, int* err, FSCInfo* info )
 {
+	int drop = GetDropBehind( fd, true );
+
+#ifdef POSIX_FADV_DONTNEED
+
+	if ( drop )
+	{
+#ifdef __linux__
+
+		if ( drop == 2 ) { sync_file_range( fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER ); }
+
+#endif
+		posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+	}
+
+#endif
+
 	if ( close( fd ) )
 	{
 		SetError( err, errno );
@@ -1187,6 +1317,8 @@ int FSSys::Read( int fd, void* buf, int size, int* err, FSCInfo* info )
 
 	if ( n < 0 ) { SetError( err, errno ); return -1; }
 
+	if ( n > 0 && GetDropBehind( fd ) ) { DropBehind( fd, n, false ); }
+
 	return n;
 }
 
@@ -1202,6 +1334,67 @@ int FSSys::Seek( int fd, SEEK_FILE_MODE mode, seek_t pos, seek_t* pRet,  int* er
 	return 0;
 }
 
+int FSSys::Allocate( int fd, int64_t size, int* err, FSCInfo* info )
+{
+#if defined( __linux__ ) && defined( FALLOC_FL_KEEP_SIZE )
+
+	// the file grows as it is written, so a copy broken off does not look complete
+	if ( size > 0 && fallocate( fd, FALLOC_FL_KEEP_SIZE, 0, size ) )
+	{
+		SetError( err, errno );
+		return ( errno == EOPNOTSUPP || errno == ENOSYS ) ? 1 : -1;
+	}
+
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+int FSSys::FindData( int fd, int64_t offset, int64_t* data, int64_t* hole, int* err, FSCInfo* info )
+{
+#if defined( SEEK_DATA ) && defined( SEEK_HOLE )
+	off_t cur = lseek( fd, 0, SEEK_CUR );
+
+	if ( cur < 0 ) { SetError( err, errno ); return -1; }
+
+	int ret = 0;
+	off_t d = lseek( fd, offset, SEEK_DATA );
+	off_t h = d;
+
+	if ( d < 0 && errno == ENXIO )
+	{
+		struct stat st;
+
+		if ( fstat( fd, &st ) ) { SetError( err, errno ); return -1; }
+
+		d = h = st.st_size;
+		ret = 1;
+	}
+	else if ( d >= 0 )
+	{
+		h = lseek( fd, d, SEEK_HOLE );
+	}
+
+	if ( d < 0 || h < 0 ) { SetError( err, errno ); lseek( fd, cur, SEEK_SET ); return -1; }
+
+	if ( lseek( fd, cur, SEEK_SET ) < 0 ) { SetError( err, errno ); return -1; }
+
+	*data = d;
+	*hole = h;
+	return ret;
+#else
+	return 2;
+#endif
+}
+
+int FSSys::SetSize( int fd, int64_t size, int* err, FSCInfo* info )
+{
+	if ( ftruncate( fd, size ) ) { SetError( err, errno ); return -1; }
+
+	return 0;
+}
+
 
 int FSSys::Write( int fd, void* buf, int size, int* err, FSCInfo* info )
 {
@@ -1209,6 +1402,8 @@ int FSSys::Write( int fd, void* buf, int size, int* err, FSCInfo* info )
 
 	if ( n < 0 ) { SetError( err, errno ); return -1; }
 
+	if ( n > 0 && GetDropBehind( fd ) ) { DropBehind( fd, n, true ); }
+
 	return n;
 }
 
@@ -1588,6 +1783,358 @@ unicode_t* FSSys::GetGroupName( int group, unicode_t buf[64] )
 	return buf;
 };
 
+/*
+   FSSys::DeleteDirContent() keeps every directory being emptied open and removes its entries
+   with unlinkat() relative to it, so no path is resolved again for each file. The subdirectories
+   found are handed out to a pool of workers, the last entry of a directory to go removes it.
+   Entries that can't be removed are queued for the calling thread, which asks the sink about them.
+*/
+
+struct FSSysDelNode
+{
+	FSSysDelNode* parent;
+	std::string name; // in sys_charset_id, empty for the root
+	int fd;
+	int pending; // the walk of this directory, its subdirectories and failures not decided yet
+	bool kept; // something below was skipped
+	int err; // the directory can't be read
+	FSSysDelNode( FSSysDelNode* p, const char* s ): parent( p ), name( s ), fd( -1 ), pending( 1 ), kept( false ), err( 0 ) {}
+};
+
+struct FSSysDelFail
+{
+	FSSysDelNode* node; // the directory holding the entry
+	std::string name;
+	bool dir;
+	int err;
+};
+
+class FSSysDelTree
+{
+	Mutex mutex;
+	Cond cond;
+	FSCInfo* info;
+	FSSysDelNode* root;
+	std::vector<FSSysDelNode*> queue; // taken from the back, so the walk stays deep and few directories are open
+	std::unordered_set<FSSysDelNode*> nodes;
+	std::deque<FSSysDelFail> fails;
+	volatile bool stop;
+	volatile bool done;
+
+	void Walk( FSSysDelNode* node );
+	void Push( FSSysDelNode* node ); //with mutex locked
+	void AddFail( FSSysDelNode* node, const char* name, bool dir, int err ); //with mutex locked
+	void Release( FSSysDelNode* node ); //with mutex locked
+	void Decide( FSSysDelFail& f, int ret );
+	void Drain( MutexLock& lock );
+public:
+	FSSysDelTree( FSCInfo* i ): info( i ), root( 0 ), stop( false ), done( false ) {}
+	int Run( FSPath& dir, FSDeleteSink* sink, int* err );
+	static void* ThreadFunc( void* arg );
+	~FSSysDelTree();
+};
+
+void FSSysDelTree::Push( FSSysDelNode* node )
+{
+	nodes.insert( node );
+	queue.push_back( node );
+	cond.Signal();
+}
+
+void FSSysDelTree::AddFail( FSSysDelNode* node, const char* name, bool dir, int err )
+{
+	FSSysDelFail f;
+	f.node = node;
+	f.name = name;
+	f.dir = dir;
+	f.err = err;
+	node->pending++;
+	fails.push_back( f );
+	cond.Broadcast();
+}
+
+void FSSysDelTree::Release( FSSysDelNode* node )
+{
+	// a stopped walk leaves the nodes to the destructor
+	if ( stop ) { return; }
+
+	while ( node && --node->pending <= 0 )
+	{
+		FSSysDelNode* parent = node->parent;
+
+		if ( node->fd >= 0 ) { close( node->fd ); }
+
+		node->fd = -1;
+
+		if ( !parent )
+		{
+			done = true;
+			cond.Broadcast();
+			return;
+		}
+
+		if ( node->kept )
+		{
+			parent->kept = true;
+		}
+		else if ( node->err )
+		{
+			AddFail( parent, node->name.c_str(), true, node->err );
+		}
+		else if ( unlinkat( parent->fd, node->name.c_str(), AT_REMOVEDIR ) )
+		{
+			AddFail( parent, node->name.c_str(), true, errno );
+		}
+
+		nodes.erase( node );
+		delete node;
+		node = parent;
+	}
+}
+
+void FSSysDelTree::Walk( FSSysDelNode* node )
+{
+	if ( node->fd < 0 )
+	{
+		node->fd = openat( node->parent->fd, node->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC );
+
+		if ( node->fd < 0 ) { node->err = errno; return; }
+	}
+
+	int fd = fcntl( node->fd, F_DUPFD_CLOEXEC, 0 );
+	DIR* d = fd >= 0 ? fdopendir( fd ) : 0;
+
+	if ( !d )
+	{
+		node->err = errno;
+
+		if ( fd >= 0 ) { close( fd ); }
+
+		return;
+	}
+
+	while ( true )
+	{
+		if ( stop ) { break; }
+
+		if ( info && info->IsStopped() )
+		{
+			MutexLock lock( &mutex );
+			stop = true;
+			cond.Broadcast();
+			break;
+		}
+
+		errno = 0;
+		struct dirent* ent = readdir( d );
+
+		if ( !ent )
+		{
+			node->err = errno;
+			break;
+		}
+
+		const char* name = ent->d_name;
+
+		if ( name[0] == '.' && ( !name[1] || ( name[1] == '.' && !name[2] ) ) ) { continue; }
+
+		bool isDir = ent->d_type == DT_DIR;
+
+		if ( ent->d_type == DT_UNKNOWN )
+		{
+			struct stat st;
+			isDir = !fstatat( node->fd, name, &st, AT_SYMLINK_NOFOLLOW ) && S_ISDIR( st.st_mode );
+		}
+
+		if ( isDir )
+		{
+			MutexLock lock( &mutex );
+			node->pending++;
+			Push( new FSSysDelNode( node, name ) );
+		}
+		else if ( unlinkat( node->fd, name, 0 ) )
+		{
+			int e = errno;
+
+			if ( e == ENOENT ) { continue; }
+
+			MutexLock lock( &mutex );
+			AddFail( node, name, false, e );
+		}
+	}
+
+	closedir( d );
+}
+
+void* FSSysDelTree::ThreadFunc( void* arg )
+{
+	FSSysDelTree* t = ( FSSysDelTree* )arg;
+	MutexLock lock( &t->mutex );
+
+	while ( true )
+	{
+		while ( !t->stop && !t->done && t->queue.empty() ) { t->cond.Wait( &t->mutex ); }
+
+		if ( t->stop || t->done ) { break; }
+
+		FSSysDelNode* node = t->queue.back();
+		t->queue.pop_back();
+
+		lock.Unlock();
+		t->Walk( node );
+		lock.Lock();
+
+		t->Release( node );
+	}
+
+	return 0;
+}
+
+/* applies the answer of the sink to a failure on the calling thread */
+void FSSysDelTree::Decide( FSSysDelFail& f, int ret )
+{
+	MutexLock lock( &mutex );
+
+	if ( ret == -2 )
+	{
+		stop = true;
+		cond.Broadcast();
+		return;
+	}
+
+	if ( ret == 1 && f.dir )
+	{
+		// the directory is walked again, it takes over the count of the failure
+		Push( new FSSysDelNode( f.node, f.name.c_str() ) );
+		return;
+	}
+
+	if ( ret != 1 ) { f.node->kept = true; }
+
+	Release( f.node );
+}
+
+/* walks the queue on the calling thread when no worker could be started */
+void FSSysDelTree::Drain( MutexLock& lock )
+{
+	while ( !stop && !queue.empty() )
+	{
+		FSSysDelNode* node = queue.back();
+		queue.pop_back();
+
+		lock.Unlock();
+		Walk( node );
+		lock.Lock();
+
+		Release( node );
+	}
+}
+
+int FSSysDelTree::Run( FSPath& dir, FSDeleteSink* sink, int* err )
+{
+	root = new FSSysDelNode( 0, "" );
+	nodes.insert( root );
+	root->fd = open( ( char* ) dir.GetString( sys_charset_id, '/' ), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+	if ( root->fd < 0 ) { FS::SetError( err, errno ); return -1; }
+
+	// the root is walked here, so nothing is started for an empty or a flat directory
+	Walk( root );
+
+	if ( root->err ) { FS::SetError( err, root->err ); return -1; }
+
+	std::vector<thread_t> threads;
+	int workers = ( int )std::thread::hardware_concurrency();
+
+	if ( workers < 1 ) { workers = 1; }
+
+	if ( workers > 8 ) { workers = 8; }
+
+	{
+		MutexLock lock( &mutex );
+
+		if ( !queue.empty() )
+		{
+			for ( int i = 0; i < workers; i++ )
+			{
+				thread_t th;
+
+				if ( !thread_create( &th, ThreadFunc, this ) ) { threads.push_back( th ); }
+			}
+		}
+	}
+
+	MutexLock lock( &mutex );
+
+	if ( threads.empty() ) { Drain( lock ); }
+
+	Release( root );
+
+	while ( true )
+	{
+		while ( !stop && !done && fails.empty() ) { cond.Wait( &mutex ); }
+
+		if ( stop || fails.empty() ) { break; }
+
+		FSSysDelFail f = fails.front();
+		fails.pop_front();
+		lock.Unlock();
+
+		FSPath path = dir;
+
+		for ( FSSysDelNode* p = f.node; p->parent; p = p->parent ) { path.Push( sys_charset_id, "" ); }
+
+		int n = path.Count();
+
+		for ( FSSysDelNode* p = f.node; p->parent; p = p->parent ) { path.SetItem( --n, sys_charset_id, p->name.c_str() ); }
+
+		path.Push( sys_charset_id, f.name.c_str() );
+
+		int ret;
+
+		while ( true )
+		{
+			ret = sink->Fail( path, f.dir, f.err );
+
+			if ( ret != 1 || f.dir ) { break; }
+
+			// the directory holding it is kept open until all failures in it are decided
+			if ( !unlinkat( f.node->fd, f.name.c_str(), 0 ) || errno == ENOENT ) { break; }
+
+			f.err = errno;
+		}
+
+		Decide( f, ret );
+		lock.Lock();
+
+		if ( threads.empty() ) { Drain( lock ); }
+	}
+
+	stop = true;
+	cond.Broadcast();
+	lock.Unlock();
+
+	for ( size_t i = 0; i < threads.size(); i++ ) { thread_join( threads[i], 0 ); }
+
+	return done ? 0 : -2;
+}
+
+FSSysDelTree::~FSSysDelTree()
+{
+	for ( auto it = nodes.begin(); it != nodes.end(); ++it )
+	{
+		if ( ( *it )->fd >= 0 ) { close( ( *it )->fd ); }
+
+		delete *it;
+	}
+}
+
+int FSSys::DeleteDirContent( FSPath& dir, FSDeleteSink* sink, int* err, FSCInfo* info )
+{
+	FSSysDelTree tree( info );
+	return tree.Run( dir, sink, err );
+}
+
 #endif
 
 FSSys::~FSSys() {}
@@ -1626,6 +2173,44 @@ void FSList::Clear()
 	count = 0;
 }
 
+int FSList::MoveNodes( const std::unordered_set<FSNode*>& nodes, FSList* dst )
+{
+	if ( nodes.empty() ) { return 0; }
+
+	FSNode* prev = 0;
+	int moved = 0;
+
+	for ( FSNode* p = first; p; )
+	{
+		FSNode* next = p->next;
+
+		if ( nodes.count( p ) )
+		{
+			if ( prev ) { prev->next = next; }
+			else { first = next; }
+
+			p->next = 0;
+
+			if ( dst->last ) { dst->last->next = p; }
+			else { dst->first = p; }
+
+			dst->last = p;
+			dst->count++;
+			moved++;
+		}
+		else
+		{
+			prev = p;
+		}
+
+		p = next;
+	}
+
+	last = prev;
+	count -= moved;
+	return moved;
+}
+
 void FSList::CopyFrom( const FSList& a, bool onlySelected )
 {
 	Clear();
@@ -9,6 +9,7 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <atomic>
+#include <unordered_set>
 
 #include "wal.h"
 #include "ncdialogs.h"
@@ -384,6 +385,8 @@ public:
 
 	void Append( clPtr<FSNode> );
 	void Clear();
+	/// unlinks the nodes of this list found in 'nodes' in one pass and appends them to 'dst' without copying, returns the number of moved nodes
+	int MoveNodes( const std::unordered_set<FSNode*>& nodes, FSList* dst );
 
 	std::vector<FSNode*> GetArray();
 
@@ -621,6 +624,33 @@ public:
 	virtual bool IsStopped() const override;
 };
 
+/// Receives the files of FS::Extract() in the order they are stored in the source.
+/// Paths are relative to the directory given to Extract() and start with the name of a listed node.
+class FSExtractSink
+{
+public:
+	FSExtractSink() {}
+	virtual ~FSExtractSink();
+	/// a node begins, for a directory no data follows. 0 - take the file data, 1 - skip the file, -2 - stop
+	virtual int Begin( FSPath& path, const FSStat& st ) = 0;
+	/// next block of the file begun last. 0 - go on, 1 - skip the rest of the file, -2 - stop
+	virtual int Data( void* buf, int size ) = 0;
+	/// all data of the file begun last was passed. 0 - go on, -2 - stop
+	virtual int End() = 0;
+	/// the rest of the file begun last can't be read, 'err' is an error of the source FS. 0 - go on, -2 - stop
+	virtual int Fail( int err ) = 0;
+};
+
+/// Decides on the entries FS::DeleteDirContent() could not remove, called on the thread that called DeleteDirContent().
+class FSDeleteSink
+{
+public:
+	FSDeleteSink() {}
+	virtual ~FSDeleteSink();
+	/// 'path' (a directory if 'dir') can't be removed, 'err' is an error of the FS. 0 - skip it, 1 - try again, -2 - stop
+	virtual int Fail( FSPath& path, bool dir, int err ) = 0;
+};
+
 
 /*
    все фанкции, возвращающие int возвращают 0 при успехе  -1 при ошибке и -2 при StopEvent
@@ -634,8 +664,12 @@ class FS: public iIntrusiveCounter
 {
 public:
 	enum TYPES { SYSTEM = 0, SFTP = 1, SAMBA = 2, FTP = 3, WIN32NET = 4, TMP = 5, PLUGIN = 6 };
-	enum FLAGS { HAVE_READ = 1, HAVE_WRITE = 2, HAVE_SYMLINK = 4, HAVE_SEEK = 8 };
-	enum OPENFLAGS { SHARE_READ = 1, SHARE_WRITE = 2 };
+	// HAVE_SPARSE - what a Seek() past the end skips is left as a hole, see FindData() and SetSize()
+	enum FLAGS { HAVE_READ = 1, HAVE_WRITE = 2, HAVE_SYMLINK = 4, HAVE_SEEK = 8, HAVE_SPARSE = 16 };
+	// NO_CACHE - read from the media, not from the cache of the FS
+	// UPDATE - OpenCreate() opens an existing file to be rewritten in place, nothing is truncated (FSSys only)
+	// DROP_BEHIND - the file is read or written through once, its data need not stay in the cache of the FS
+	enum OPENFLAGS { SHARE_READ = 1, SHARE_WRITE = 2, NO_CACHE = 4, UPDATE = 8, DROP_BEHIND = 16 };
 private:
 	int _type;
 public:
@@ -673,6 +707,27 @@ public:
 	virtual int Symlink  ( FSPath& path, FSString& str, int* err, FSCInfo* info );
 	virtual int StatVfs( FSPath& path, FSStatVfs* st, int* err, FSCInfo* info );
 	virtual int64_t GetFileSystemFreeSpace( FSPath& path, int* err );
+	/// reserves space for 'size' bytes of the file 'fd' about to be written, its size is not changed. 1 - not supported
+	virtual int Allocate( int fd, int64_t size, int* err, FSCInfo* info ) { return 1; }
+	/// the first data of the file 'fd' at or after 'offset' is [*data, *hole), the position of 'fd' is kept.
+	/// 1 - only a hole after 'offset', *data and *hole are the size of the file; 2 - holes are not known, all of it is data
+	virtual int FindData( int fd, int64_t offset, int64_t* data, int64_t* hole, int* err, FSCInfo* info ) { return 2; }
+	/// cuts or extends the file 'fd' to 'size' bytes, 1 - not supported
+	virtual int SetSize( int fd, int64_t size, int* err, FSCInfo* info ) { return 1; }
+	/// forget cached listings of 'path' and below, so the next ReadDir() goes to the server
+	virtual void DropCache( FSPath& path ) {}
+	/// files, or parts of one file opened separately, worth reading at the same time when copying from this FS
+	virtual int ReadStreams() { return 1; }
+	/// reads the nodes of 'list' in 'dir' with their content in a single pass over the source, 1 - not supported, copy file by file
+	virtual int Extract( FSPath& dir, FSList* list, FSExtractSink* sink, int* err, FSCInfo* info ) { return 1; }
+	/// removes everything inside the directory 'dir' without asking, a directory with a skipped entry below is kept.
+	/// 1 - not supported, delete node by node; -1 - 'dir' itself can't be read
+	virtual int DeleteDirContent( FSPath& dir, FSDeleteSink* sink, int* err, FSCInfo* info ) { return 1; }
+	/// changes are kept by the FS until Flush() writes them out all at once (e.g. an archive being updated)
+	virtual bool IsWriteDeferred() { return false; }
+	virtual int Flush( int* err, FSCInfo* info ) { return 0; }
+	/// drops the changes made since the last Flush()
+	virtual void Rollback() {}
 
 	virtual FSString Uri( FSPath& path )                    = 0;
 
@@ -775,6 +830,12 @@ public:
 	virtual int StatVfs( FSPath& path, FSStatVfs* st, int* err, FSCInfo* info );
 	virtual FSString Uri( FSPath& path );
 	virtual int64_t GetFileSystemFreeSpace( FSPath& path, int* err );
+#ifndef _WIN32
+	virtual int Allocate( int fd, int64_t size, int* err, FSCInfo* info ) override;
+	virtual int FindData( int fd, int64_t offset, int64_t* data, int64_t* hole, int* err, FSCInfo* info ) override;
+	virtual int SetSize( int fd, int64_t size, int* err, FSCInfo* info ) override;
+	virtual int DeleteDirContent( FSPath& dir, FSDeleteSink* sink, int* err, FSCInfo* info ) override;
+#endif
 
 	virtual unicode_t* GetUserName( int user, unicode_t buf[64] );
 	virtual unicode_t* GetGroupName( int group, unicode_t buf[64] );
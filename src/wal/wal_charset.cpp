@@ -4,9 +4,45 @@
 
 #include "wal_sys_api.h"
 
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#  include <emmintrin.h>
+#  define WAL_SSE2
+#endif
+
 namespace wal
 {
 
+	/*
+	   Texts and file names are mostly 7-bit, so the bulk converters skip over ASCII runs
+	   16 (SSE2) or 8 bytes at a time and copy them without decoding.
+	   Returns the length of the 7-bit run at the start of 's'.
+	*/
+	inline int ascii_run( const char* s, int size )
+	{
+		int n = 0;
+
+#ifdef WAL_SSE2
+
+		for ( ; n + 16 <= size; n += 16 )
+		{
+			if ( _mm_movemask_epi8( _mm_loadu_si128( ( const __m128i* )( s + n ) ) ) ) { break; }
+		}
+
+#endif
+
+		for ( ; n + 8 <= size; n += 8 )
+		{
+			uint64_t w;
+			memcpy( &w, s + n, sizeof( w ) );
+
+			if ( w & 0x8080808080808080ULL ) { break; }
+		}
+
+		while ( n < size && !( s[n] & 0x80 ) ) { n++; }
+
+		return n;
+	}
+
 
 	class CP8
 	{
@@ -106,7 +142,7 @@ namespace wal
 			size = strlen( s );
 		}
 
-		for ( ; size > 0; size--, buf++, s++ ) { *buf = *s; }
+		for ( ; size > 0; size--, buf++, s++ ) { *buf = ( unsigned char ) * s; }
 
 		*buf = 0;
 
@@ -227,6 +263,8 @@ namespace wal
 		{
 			for ( ; usize > 0; buf++, usize-- )
 			{
+				if ( *buf < 0x80 ) { *( s++ ) = char( *buf ); continue; }
+
 				s = to_utf8( s, *buf );
 			}
 		}
@@ -323,10 +361,10 @@ namespace wal
 			}
 			else
 			{
-				s++;
-				cnt++;
-
-				size--;
+				int n = ascii_run( s, size );
+				s += n;
+				cnt += n;
+				size -= n;
 			}
 		}
 
@@ -395,8 +433,13 @@ namespace wal
 			}
 			else
 			{
-				*( p++ ) = *( s++ );
-				size--;
+				int n = ascii_run( s, size );
+
+				for ( int i = 0; i < n; i++ ) { p[i] = s[i]; }
+
+				p += n;
+				s += n;
+				size -= n;
 			}
 		}
 
@@ -822,6 +822,7 @@ const char* sectionEditor = "editor";
 const char* sectionViewer = "viewer";
 const char* sectionTerminal = "terminal";
 const char* sectionFonts = "fonts";
+const char* sectionNetwork = "network";
 
 static const char* CommandsHistorySection = "CommandsHistory";
 static const char* FilesAssociationsSection = "FilesAssociations";
@@ -838,6 +839,10 @@ clWcmConfig::clWcmConfig()
 	, systemShowHostName( false )
 	, systemStorePasswords( false )
 	, systemTotalProgressIndicator(false)
+	, systemVerifyCopy( false )
+	, systemCopySkipUnchanged( false )
+	, systemCopyCompareContent( false )
+	, systemCopyNoCacheSize( 256 )
 	, systemLang( "+" )
 
 	, panelShowHiddenFiles( true )
@@ -860,6 +865,17 @@ clWcmConfig::clWcmConfig()
 
 	, terminalBackspaceKey( 0 )
 
+	, sftpTransferWindow( 4096 )
+	, sftpSessions( 4 )
+	, remoteCacheTtl( 60 )
+	, remoteCacheDirs( 256 )
+	, remoteCacheStale( false )
+	, ftpConnections( 4 )
+	, tcpBufferSize( 256 )
+	, tcpReceiveBuffer( 0 )
+	, tcpNoDelay( true )
+	, tcpTimeout( 16 )
+
 	, styleShow3DUI( false )
 	, styleColorTheme( "" )
 	, styleShowToolBar( true )
@@ -883,6 +899,10 @@ clWcmConfig::clWcmConfig()
 	MapBool( sectionSystem, "show_hostname", &systemShowHostName, systemShowHostName );
 	MapBool( sectionSystem, "store_passwords", &systemStorePasswords, systemStorePasswords );
 	MapBool( sectionSystem, "total_progress_indicator", &systemTotalProgressIndicator, systemTotalProgressIndicator );
+	MapBool( sectionSystem, "verify_copy", &systemVerifyCopy, systemVerifyCopy );
+	MapBool( sectionSystem, "copy_skip_unchanged", &systemCopySkipUnchanged, systemCopySkipUnchanged );
+	MapBool( sectionSystem, "copy_compare_content", &systemCopyCompareContent, systemCopyCompareContent );
+	MapInt( sectionSystem, "copy_nocache_size", &systemCopyNoCacheSize, systemCopyNoCacheSize );
 	MapStr( sectionSystem,  "lang", &systemLang );
 
 	MapBool( sectionSystem, "show_toolbar", &styleShowToolBar, styleShowToolBar );
@@ -921,6 +941,17 @@ clWcmConfig::clWcmConfig()
 
 	MapInt( sectionTerminal, "backspace_key",  &terminalBackspaceKey, terminalBackspaceKey );
 
+	MapInt( sectionNetwork, "sftp_transfer_window", &sftpTransferWindow, sftpTransferWindow );
+	MapInt( sectionNetwork, "sftp_sessions", &sftpSessions, sftpSessions );
+	MapInt( sectionNetwork, "remote_cache_ttl", &remoteCacheTtl, remoteCacheTtl );
+	MapInt( sectionNetwork, "remote_cache_dirs", &remoteCacheDirs, remoteCacheDirs );
+	MapBool( sectionNetwork, "remote_cache_stale", &remoteCacheStale, remoteCacheStale );
+	MapInt( sectionNetwork, "ftp_connections", &ftpConnections, ftpConnections );
+	MapInt( sectionNetwork, "tcp_buffer_size", &tcpBufferSize, tcpBufferSize );
+	MapInt( sectionNetwork, "tcp_receive_buffer", &tcpReceiveBuffer, tcpReceiveBuffer );
+	MapBool( sectionNetwork, "tcp_nodelay", &tcpNoDelay, tcpNoDelay );
+	MapInt( sectionNetwork, "tcp_timeout", &tcpTimeout, tcpTimeout );
+
 	MapStr( sectionFonts, "panel_font",  &panelFontUri );
 	MapStr( sectionFonts, "viewer_font", &viewerFontUri );
 	MapStr( sectionFonts, "editor_font", &editorFontUri );
@@ -2335,6 +2366,9 @@ public:
 	SButton  m_ShowHostNameButton;
 	SButton  m_StorePasswordsButton;
 	SButton  m_TotalProgressIndicatorButton;
+	SButton  m_VerifyCopyButton;
+	SButton  m_CopySkipUnchangedButton;
+	SButton  m_CopyCompareContentButton;
 
 	StaticLabel m_LangStatic;
 	StaticLine m_LangVal;
@@ -2387,6 +2421,9 @@ SysOptDialog::SysOptDialog( NCDialogParent* parent )
 	, m_ShowHostNameButton( 0, this, utf8_to_unicode( _LT( "Show &host name" ) ).data(), 0, g_WcmConfig.systemShowHostName )
 	, m_StorePasswordsButton( 0, this, utf8_to_unicode( _LT( "Store &passwords" ) ).data(), 0, g_WcmConfig.systemStorePasswords )
 	, m_TotalProgressIndicatorButton( 0, this, utf8_to_unicode( _LT( "Enable total progress indicator" ) ).data(), 0, g_WcmConfig.systemTotalProgressIndicator )
+	, m_VerifyCopyButton( 0, this, utf8_to_unicode( _LT( "&Verify copied files" ) ).data(), 0, g_WcmConfig.systemVerifyCopy )
+	, m_CopySkipUnchangedButton( 0, this, utf8_to_unicode( _LT( "Skip &unchanged files when copying" ) ).data(), 0, g_WcmConfig.systemCopySkipUnchanged )
+	, m_CopyCompareContentButton( 0, this, utf8_to_unicode( _LT( "Compare the &content of unchanged files" ) ).data(), 0, g_WcmConfig.systemCopyCompareContent )
 	, m_LangStatic( 0, this, utf8_to_unicode( _LT( "&Language:" ) ).data( ), &m_LangButton )
 	, m_LangVal( 0, this, utf8_to_unicode( "______________________" ).data( ) )
 	, m_LangButton( 0, this, utf8_to_unicode( ">" ).data( ), 1000 )
@@ -2403,10 +2440,13 @@ SysOptDialog::SysOptDialog( NCDialogParent* parent )
 	m_iL.AddWinAndEnable( &m_ShowHostNameButton, 6, 0, 6, 2 );
 	m_iL.AddWinAndEnable( &m_StorePasswordsButton, 7, 0, 7, 2 );
 	m_iL.AddWinAndEnable( &m_TotalProgressIndicatorButton, 8, 0, 8, 2 );
+	m_iL.AddWinAndEnable( &m_VerifyCopyButton, 9, 0, 9, 2 );
+	m_iL.AddWinAndEnable( &m_CopySkipUnchangedButton, 10, 0, 10, 2 );
+	m_iL.AddWinAndEnable( &m_CopyCompareContentButton, 11, 0, 11, 2 );
 
-	m_iL.AddWinAndEnable( &m_LangStatic, 9, 0 );
-	m_iL.AddWinAndEnable( &m_LangVal, 9, 2 );
-	m_iL.AddWinAndEnable( &m_LangButton, 9, 1 );
+	m_iL.AddWinAndEnable( &m_LangStatic, 12, 0 );
+	m_iL.AddWinAndEnable( &m_LangVal, 12, 2 );
+	m_iL.AddWinAndEnable( &m_LangButton, 12, 1 );
 
 	m_iL.SetColGrowth( 2 );
 
@@ -2425,6 +2465,9 @@ SysOptDialog::SysOptDialog( NCDialogParent* parent )
 	order.append( &m_ShowHostNameButton );
 	order.append( &m_StorePasswordsButton );
 	order.append( &m_TotalProgressIndicatorButton );
+	order.append( &m_VerifyCopyButton );
+	order.append( &m_CopySkipUnchangedButton );
+	order.append( &m_CopyCompareContentButton );
 	order.append( &m_LangButton );
 
 	SetPosition();
@@ -2490,6 +2533,9 @@ bool DoSystemConfigDialog( NCDialogParent* parent )
 		g_WcmConfig.systemShowHostName = dlg.m_ShowHostNameButton.IsSet( );
 		g_WcmConfig.systemStorePasswords = dlg.m_StorePasswordsButton.IsSet( );
 		g_WcmConfig.systemTotalProgressIndicator = dlg.m_TotalProgressIndicatorButton.IsSet( );
+		g_WcmConfig.systemVerifyCopy = dlg.m_VerifyCopyButton.IsSet( );
+		g_WcmConfig.systemCopySkipUnchanged = dlg.m_CopySkipUnchangedButton.IsSet( );
+		g_WcmConfig.systemCopyCompareContent = dlg.m_CopyCompareContentButton.IsSet( );
 		const char* s = g_WcmConfig.systemLang.data();
 
 		if ( !s ) { s = "+"; }
@@ -148,6 +148,10 @@ public:
 	bool systemShowHostName;
 	bool systemStorePasswords;
 	bool systemTotalProgressIndicator;
+	bool systemVerifyCopy; // hash what is copied and compare it with a read-back of the destination
+	bool systemCopySkipUnchanged; // a copy into a directory leaves the files of the same size and time there
+	bool systemCopyCompareContent; // with systemCopySkipUnchanged, files of the same size are compared instead of the time
+	int systemCopyNoCacheSize; // MiB, files from this size on are copied without filling the page cache, 0 - never
 	std::string systemLang; //"+" - auto "-" -internal eng.
 	#pragma endregion
 
@@ -177,6 +181,19 @@ public:
 	int terminalBackspaceKey;
 	#pragma endregion
 
+	#pragma region Network settings
+	int sftpTransferWindow; // KiB of SFTP read/write requests kept in flight per open file
+	int sftpSessions; // SSH sessions opened to one SFTP server for concurrent listings and transfers
+	int remoteCacheTtl; // seconds a remote directory listing is reused without asking the server, 0 - no caching
+	int remoteCacheDirs; // listings kept per remote connection
+	bool remoteCacheStale; // show an expired listing at once and reread it in the background
+	int ftpConnections; // FTP connections a copy from one server uses at once, for several files or parts of a large one
+	int tcpBufferSize; // KiB buffered per FTP data connection, larger reads and writes bypass the buffer
+	int tcpReceiveBuffer; // KiB of SO_RCVBUF for FTP data connections, 0 - system default
+	bool tcpNoDelay; // TCP_NODELAY on FTP control connections, commands are not held back by Nagle
+	int tcpTimeout; // seconds a network read or write may wait without progress
+	#pragma endregion
+
 	#pragma region Style settings
 	bool styleShow3DUI;
 	std::string styleColorTheme;
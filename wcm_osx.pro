@@ -61,6 +61,7 @@ SOURCES += src/nc.cpp \
     src/shell.cpp \
     src/shl.cpp \
     src/path-list.cpp \
+    src/dir-watcher.cpp \
     src/folder-shortcuts.cpp \
     src/folder-history.cpp \
     src/view-history.cpp \
@@ -82,6 +83,7 @@ SOURCES += src/nc.cpp \
     src/unicode_lc.cpp \
     src/usermenu.cpp \
     src/ux_util.cpp \
+    src/vfs/vfs-cache.cpp \
     src/vfs/vfs-ftp.cpp \
     src/vfs/vfs-sftp.cpp \
     src/vfs/vfs-sftp2.cpp \
@@ -145,6 +147,7 @@ HEADERS += \
     src/shell.h \
     src/shl.h \
     src/path-list.h \
+    src/dir-watcher.h \
     src/folder-shortcuts.h \
     src/folder-history.h \
     src/view-history.h \
@@ -167,6 +170,7 @@ HEADERS += \
     src/unicode_lc.h \
     src/usermenu.cpp \
     src/ux_util.h \
+    src/vfs/vfs-cache.h \
     src/vfs/vfs-ftp.h \
     src/vfs/vfs-sftp.h \
     src/vfs/vfs-smb.h \